@@ -0,0 +1,55 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// File format: one ACCESS_LOG_HEADER, then records back to back, each an
+// ACCESS_RECORD followed by path_length bytes of request path. Fields are
+// packed and in host byte order unless noted
+#define ACCESS_LOG_MAGIC "HSAL"
+#define ACCESS_LOG_VERSION 1
+
+typedef struct __attribute__((packed))
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size; // sizeof(ACCESS_RECORD) of the writer
+} ACCESS_LOG_HEADER;
+
+// Where a request spent its time on the server
+typedef enum
+{
+    ACCESS_STAGE_PARSE,  // Request line and headers
+    ACCESS_STAGE_HANDLE, // Route handler, including a streamed body
+    ACCESS_STAGE_BUILD,  // Compression, headers and queueing the body
+    ACCESS_STAGE_COUNT
+} ACCESS_STAGE;
+
+#define ACCESS_FLAG_KEEP_ALIVE 0x01
+#define ACCESS_FLAG_COMPRESSED 0x02
+#define ACCESS_FLAG_STREAMED 0x04 // Chunked response body
+
+typedef struct __attribute__((packed))
+{
+    uint64_t timestamp_us;  // Wall clock, set by access_log_write
+    uint32_t client_addr;   // IPv4, network byte order
+    uint16_t client_port;
+    uint16_t status;        // e.g. 404
+    uint8_t method;         // HTTP_METHOD
+    uint8_t flags;          // ACCESS_FLAG_*
+    uint16_t path_length;
+    uint32_t request_bytes; // Request line, headers and buffered body
+    uint64_t response_bytes; // Status line, headers and body
+    uint32_t stage_ns[ACCESS_STAGE_COUNT]; // Saturates at UINT32_MAX
+} ACCESS_RECORD;
+
+// Records are copied into a ring of the calling thread and written to the
+// file in batches by a background thread, never with a syscall per request.
+// A full ring drops the record. Until access_log_init succeeds nothing is
+// recorded
+int access_log_init(const char *path);
+void access_log_write(const ACCESS_RECORD *record, const char *path, size_t path_length);
+void access_log_cleanup(void);
+
+#endif // ACCESS_LOG_H
@@ -0,0 +1,29 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump-pointer allocator for memory that lives exactly as long as a batch
+// of requests on one connection. Allocations are never freed one by one,
+// arena_reset drops them all at once and keeps one block for the next
+// batch; the others are given back to malloc.
+typedef struct ARENA_BLOCK
+{
+    struct ARENA_BLOCK *next;
+    size_t size;
+    char data[]; // Follows two 8-byte fields, so it keeps malloc's alignment
+} ARENA_BLOCK;
+
+typedef struct
+{
+    ARENA_BLOCK *head;  // Block being filled, newest first
+    ARENA_BLOCK *first; // Kept across resets
+    size_t used;        // Bytes taken from head
+} ARENA;
+
+void arena_init(ARENA *arena);
+void *arena_alloc(ARENA *arena, size_t size);
+void arena_reset(ARENA *arena);
+void arena_destroy(ARENA *arena);
+
+#endif // ARENA_H
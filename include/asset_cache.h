@@ -0,0 +1,14 @@
+#ifndef ASSET_CACHE_H
+#define ASSET_CACHE_H
+
+#include "request.h"
+#include "response.h"
+
+// Static files loaded once at startup, with gzip (and brotli, when built with
+// it) variants compressed ahead of time. Read-only while the loops run.
+int asset_cache_init(const char *dir);
+int asset_cache_serve(const char *path, const HTTP_REQUEST *request, HTTP_RESPONSE *response);
+void asset_cache_invalidate(const char *path);
+void asset_cache_cleanup(void);
+
+#endif // ASSET_CACHE_H
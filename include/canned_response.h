@@ -0,0 +1,21 @@
+#ifndef CANNED_RESPONSE_H
+#define CANNED_RESPONSE_H
+
+#include "response.h"
+
+typedef enum
+{
+    CANNED_FILE_NOT_FOUND,     // Static file missing
+    CANNED_FILE_ERROR,         // Static file could not be read
+    CANNED_ROUTE_NOT_FOUND,    // No route for the path
+    CANNED_METHOD_NOT_ALLOWED, // Route exists, not for this method
+    CANNED_PAYLOAD_TOO_LARGE,  // Request body over the route's limit
+    CANNED_RESPONSE_COUNT
+} CANNED_RESPONSE;
+
+// Fixed error responses. Body and Content-* headers are built once at
+// startup and shared by every response, so sending one allocates nothing
+void canned_response_init(void);
+void canned_response_set(HTTP_RESPONSE *response, CANNED_RESPONSE id);
+
+#endif // CANNED_RESPONSE_H
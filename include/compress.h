@@ -0,0 +1,26 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <zlib.h>
+
+// Content-Encoding applied to dynamic responses
+typedef enum
+{
+    COMPRESS_NONE,
+    COMPRESS_GZIP,
+    COMPRESS_DEFLATE, // zlib format, what HTTP calls "deflate"
+    COMPRESS_ENCODING_COUNT
+} COMPRESS_ENCODING;
+
+// Each thread keeps one deflate stream per encoding and resets it for the
+// next response, so compressing allocates no zlib state per request.
+// The stream belongs to the calling thread until the next call.
+bool compress_is_compressible(const char *mime_type);
+const char *compress_encoding_name(COMPRESS_ENCODING encoding);
+z_stream *compress_thread_stream(COMPRESS_ENCODING encoding);
+size_t compress_bound(COMPRESS_ENCODING encoding, size_t length);
+size_t compress_buffer(COMPRESS_ENCODING encoding, const char *data, size_t length, char *output, size_t output_size);
+
+#endif // COMPRESS_H
@@ -3,28 +3,98 @@
 
 #define DEFAULT_PORT 8080
 #define BUFFER_SIZE 1024
-#define MAX_RESPONSE_SIZE 4096
+#define MAX_RESPONSE_HEADER_SIZE 1024 // Status line and headers of one response
 #define MAX_PATH_LENGTH 256
 #define MAX_METHOD_LENGTH 16
-#define MAX_CONNECTIONS 10
+#define MAX_CONNECTIONS 1024 // listen() backlog
 
-#define MAX_REQUEST_SIZE 8192
+#define MAX_REQUEST_SIZE 8192 // Request line and headers
+#define MAX_BUFFERED_BODY_SIZE 8192 // Body limit of routes that do not set their own
+#define BODY_STREAM_BUFFER_SIZE 16384 // Read buffer room for a streamed body, at least MAX_REQUEST_SIZE
 #define MAX_HEADER_LENGTH 1024
 #define MAX_PARAM_KEY_LENGTH 64
 #define MAX_PARAM_VALUE_LENGTH 256
 
 #define MAX_URL_PARAMS 5
+#define MAX_ROUTES 32 // Distinct route patterns, each has its own metrics series
 #define MAX_QUERY_PARAMS 10
+#define MAX_HEADERS 32 // Header lines per request, more is a framing error
 
 // Database Settings
 #define DB_NAME "httpserver.db"
 #define ENABLE_WAL_MODE 1
+#define USER_JSON_MAX_LENGTH 640 // One user object in a JSON list
+#define IMPORT_MAX_BODY_SIZE (64 * 1024 * 1024) // Streamed body of a bulk user import
+#define IMPORT_MAX_OBJECT_SIZE 1024 // One user object in an import, longer ones are counted as failed
+#define IMPORT_BATCH_SIZE 256       // Users inserted per transaction
 
 #define STATIC_FILES_DIR "./public"
 #define MAX_FILE_SIZE (10 * 1024 * 1024) // 10MB max file size
+#define MAX_RANGES 16 // Byte ranges per request, with more the whole file is sent
+
+// Static asset cache, filled at startup
+#define ASSET_CACHE_MAX_FILE_SIZE (1024 * 1024) // Larger files are sent with sendfile
+#define ASSET_CACHE_MAX_SIZE (64 * 1024 * 1024) // All variants of all cached files
+#define ASSET_COMPRESS_MIN_SIZE 256             // Smaller files are not worth compressing
+
+// On-the-fly compression of dynamic responses
+#define COMPRESS_MIN_SIZE 1024 // Smaller buffered bodies go out as they are
+#define COMPRESS_LEVEL 6       // zlib level, traded against the request's CPU time
+#define COMPRESS_CHUNK_SIZE 4096 // Deflate output gathered per write into a streamed body
+
+// Open-file cache for everything else, invalidated through inotify
+#define FILE_CACHE_MAX_ENTRIES 128 // Open descriptors kept around
+#define FILE_CACHE_BUCKETS 256
+#define FILE_CACHE_MAX_WATCHES 64 // Watched directories under STATIC_FILES_DIR
 
 // Threadpool
 #define DEFAULT_THREAD_COUNT 5
 #define MAX_QUEUE_SIZE 100
 
+// Event loop
+#define MAX_EPOLL_EVENTS 256
+#define MAX_CLIENT_CONNECTIONS 10000
+#define CLIENT_TIMEOUT_SECONDS 2 // Close connections idle for this long
+#define EVENT_LOOP_TICK_MS 1000
+
+// Persistent connections
+#define KEEPALIVE_TIMEOUT_SECONDS 5 // Idle time allowed between requests
+#define KEEPALIVE_MAX_REQUESTS 100  // Requests served before the connection is closed
+#define PIPELINE_MAX_REQUESTS 32    // Pipelined requests answered per batched send
+#define WRITE_IOV_MAX 64            // Segments handed to one sendmsg call
+#define ARENA_BLOCK_SIZE 8192       // Per-connection request memory kept between batches
+#define STREAM_FLUSH_SIZE 16384     // Streamed body bytes buffered before they are sent
+#define STREAM_MAX_PENDING (4 * 1024 * 1024) // Unsent streamed bytes a slow client may leave queued
+#define DEFAULT_EVENT_LOOPS 1 // More than one enables per-core SO_REUSEPORT listeners
+#define MAX_EVENT_LOOPS 128
+
+// io_uring backend (make IO_URING=1)
+#define URING_ENTRIES 1024
+#define URING_BUFFER_COUNT 256 // Provided receive buffers, must be a power of two
+#define URING_BUFFER_SIZE 4096
+#define URING_BUFFER_GROUP 0
+#define URING_MAX_FILES 256 // Static assets registered with the ring at startup
+
+// Asynchronous logging (make DEBUG_LOG=1 compiles in debug messages)
+#define LOG_RING_SIZE 65536      // Bytes of pending messages per thread, must be a power of two
+#define LOG_LINE_MAX 1024        // Longer messages are cut
+#define LOG_BATCH_SIZE 65536     // Bytes gathered into one write by the writer thread
+#define LOG_FLUSH_INTERVAL_MS 10 // Writer sleep when every ring is empty
+
+// Binary access log, decoded with bin/access_log_decode
+#define ACCESS_LOG_PATH "access.log"
+#define ACCESS_LOG_RING_SIZE 262144      // Bytes of pending records per thread, must be a power of two
+#define ACCESS_LOG_MAX_PATH 256          // Longer request paths are cut
+#define ACCESS_LOG_BATCH_SIZE 65536      // Bytes gathered into one write
+#define ACCESS_LOG_FLUSH_INTERVAL_MS 100 // How often the writer collects records
+#define ACCESS_LOG_MAX_FILE_SIZE (64 * 1024 * 1024) // Rotated once it grows past this
+#define ACCESS_LOG_MAX_FILES 4           // Rotated files kept, access.log.1 is the newest
+
+// Request stage timing: batches slower than the threshold, from the first
+// byte received to the last byte sent, are written to the slow log
+#define SLOW_REQUEST_THRESHOLD_MS 500 // 0 turns the slow log off
+#define SLOW_LOG_PATH "slow.log"
+#define SLOW_LOG_MAX_PATH 128         // Longer request paths are cut
+#define TIMING_CALIBRATION_MS 20      // Spent measuring the time stamp counter at startup
+
 #endif // CONFIG_H
\ No newline at end of file
@@ -0,0 +1,114 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "config.h"
+#include "request.h"
+#include "file_cache.h"
+#include "arena.h"
+#include "timing.h"
+
+struct EVENT_LOOP;
+
+typedef enum
+{
+    CONN_READING,    // Waiting for a complete request (owned by the event loop)
+    CONN_PROCESSING, // Request handed to a worker thread
+    CONN_WRITING,    // Response partially sent, waiting for EPOLLOUT
+    CONN_CLOSING     // Response sent, event loop should close the socket
+} CONNECTION_STATE;
+
+// A queued piece of the response: header bytes in the write buffer, a body
+// (buffer or open file) the connection owns until it is sent, or shared bytes
+typedef struct
+{
+    const char *data; // NULL: the bytes are at offset in write_buffer
+    int owned;        // data is freed once sent
+    int fd;           // >= 0: the bytes are sent with sendfile from this file
+    FILE_CACHE_ENTRY *file; // Reference keeping fd open, released instead of closing it
+    off_t offset;  // First unsent byte
+    size_t length; // Bytes left to send
+} WRITE_SEGMENT;
+
+typedef struct CONNECTION
+{
+    int socket_fd;
+    struct sockaddr_in client_addr;
+    CONNECTION_STATE state;
+    struct EVENT_LOOP *loop;
+
+    // Read side: always NUL-terminated so the parser can treat it as a string
+    char *read_buffer;
+    size_t read_capacity;
+    size_t read_length;
+    size_t read_offset;    // Start of the next unanswered (pipelined) request
+    size_t request_length; // Size of the complete request at read_offset
+    HTTP_PARSER parser;    // Framing state of the request at read_offset
+    size_t body_chunk;     // Streamed body bytes handed out behind the request
+    int body_starved;      // The last body read found nothing left to decode
+    void *body_state;      // Kept across the handler's calls for the body, see http_request_body_state
+    void *suspended;       // handler.c request waiting for more of its streamed body, NULL if none
+    int read_closed;       // The client closed its side or the socket failed, nothing more arrives
+
+    // Write side: status lines and headers are formatted into write_buffer,
+    // bodies are queued without copying and everything goes out in one
+    // scatter-gather send
+    char *write_buffer;
+    size_t write_capacity;
+    size_t write_length;
+    WRITE_SEGMENT *segments;
+    int segment_count;
+    int segment_capacity;
+    int segment_index;                    // First segment not completely sent
+    size_t write_pending;                 // Queued bytes not sent yet
+    struct iovec write_iov[WRITE_IOV_MAX]; // Both must outlive an io_uring sendmsg
+    struct msghdr write_message;
+    int splice_pipe[2];   // Created when sendfile refuses a file
+    size_t splice_pending; // File bytes sitting in splice_pipe
+
+    // Requests, responses and their bodies of the current batch, dropped
+    // once the batch is sent
+    ARENA arena;
+
+    // Persistent connection state
+    int keep_alive;
+    int requests_served;
+
+    // Traffic counters, folded into the loop statistics on close
+    size_t bytes_read;
+    size_t bytes_written;
+
+    // Stage breakdown of the current batch of requests, for the slow log
+    REQUEST_TIMING timing;
+
+    // Owned by the event loop thread
+    time_t last_active;
+    int in_worker;
+    struct CONNECTION *prev;
+    struct CONNECTION *next;
+} CONNECTION;
+
+CONNECTION *connection_create(int socket_fd, const struct sockaddr_in *client_addr);
+int connection_read(CONNECTION *conn);
+int connection_append(CONNECTION *conn, const char *data, size_t length);
+int connection_next_request(CONNECTION *conn);
+int connection_next_body_chunk(CONNECTION *conn, HTTP_SLICE *chunk);
+int connection_finish_body(CONNECTION *conn);
+void *connection_body_state(CONNECTION *conn, size_t size);
+void connection_consume_request(CONNECTION *conn);
+int connection_write(CONNECTION *conn);
+int connection_flush(CONNECTION *conn);
+int connection_reserve_write(CONNECTION *conn, size_t size);
+int connection_queue_write(CONNECTION *conn, size_t offset, size_t length);
+int connection_queue_body(CONNECTION *conn, char *body, size_t length);
+int connection_queue_file(CONNECTION *conn, int fd, FILE_CACHE_ENTRY *entry, off_t offset, size_t length);
+int connection_queue_shared(CONNECTION *conn, const char *data, size_t length);
+int connection_prepare_write(CONNECTION *conn);
+void connection_advance_write(CONNECTION *conn, size_t bytes);
+void connection_reset_request(CONNECTION *conn);
+void connection_destroy(CONNECTION *conn);
+
+#endif // CONNECTION_H
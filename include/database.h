@@ -24,6 +24,10 @@ typedef struct {
     char search[256];
 } UserQueryParams;
 
+// Receives output as it is produced, returns -1 to stop. Its time is not
+// counted as database time
+typedef int (*DB_WRITE_FUNC)(void *context, const char *data, size_t length);
+
 extern Database app_db;
 
 int db_init(Database *db, const char *path);
@@ -31,7 +35,9 @@ int db_create_tables(Database *db);
 
 // User operations
 int db_create_user(Database *db, const char *name, const char *email, const char *password);
-int db_get_users(Database *db, char *json_output, int max_len, const UserQueryParams *params);
+int db_begin_transaction(Database *db);
+int db_commit_transaction(Database *db);
+int db_get_users(Database *db, DB_WRITE_FUNC write, void *context, const UserQueryParams *params);
 int db_get_user_by_id(Database *db, int id, char *json_output, int max_len);
 int db_update_user(Database *db, int id, const char *username, const char *email);
 int db_delete_user(Database *db, int id);
@@ -0,0 +1,15 @@
+#ifndef DATE_CACHE_H
+#define DATE_CACHE_H
+
+#include <stddef.h>
+
+#define DATE_HEADER_SIZE 48
+
+// The "Date: ...\r\n" line every response carries, formatted by a timer
+// thread at the start of each second instead of once per response. Until
+// date_cache_init runs, or if its thread cannot start, the line is empty
+int date_cache_init(void);
+const char *date_cache_header(size_t *length);
+void date_cache_cleanup(void);
+
+#endif // DATE_CACHE_H
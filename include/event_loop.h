@@ -0,0 +1,61 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <signal.h>
+#include <pthread.h>
+#include "server.h"
+#include "threadpool.h"
+#include "connection.h"
+
+// Per-loop counters, only written by the owning event loop thread
+typedef struct
+{
+    unsigned long accepted;
+    unsigned long rejected;
+    unsigned long closed;
+    unsigned long requests;
+    unsigned long bytes_read;
+    unsigned long bytes_written;
+} EVENT_LOOP_STATS;
+
+typedef enum
+{
+    EVENT_BACKEND_EPOLL,
+    EVENT_BACKEND_IO_URING
+} EVENT_BACKEND;
+
+typedef struct EVENT_LOOP
+{
+    int id;
+    EVENT_BACKEND backend;
+    int epoll_fd;
+    struct URING_BACKEND *uring;
+    TCP_SERVER *server;
+    ThreadPool *pool; // NULL: handle requests inline on the loop thread
+
+    // All open client connections, only touched by the event loop thread
+    CONNECTION *connections;
+    int connection_count;
+    EVENT_LOOP_STATS stats;
+
+    pthread_t thread;
+    int cpu;
+    time_t last_sweep;
+    volatile sig_atomic_t running;
+} EVENT_LOOP;
+
+// Event loop functions
+int event_loop_init(EVENT_LOOP *loop, TCP_SERVER *server, ThreadPool *pool);
+int event_loop_use_io_uring(EVENT_LOOP *loop);
+void event_loop_run(EVENT_LOOP *loop);
+int event_loop_start(EVENT_LOOP *loop, int cpu);
+void event_loop_join(EVENT_LOOP *loop);
+void event_loop_stop(EVENT_LOOP *loop);
+void event_loop_print_stats(const EVENT_LOOP *loop);
+void event_loop_cleanup(EVENT_LOOP *loop);
+
+// Connection list bookkeeping shared with the io_uring backend
+void event_loop_add_connection(EVENT_LOOP *loop, CONNECTION *conn);
+void event_loop_remove_connection(EVENT_LOOP *loop, CONNECTION *conn);
+
+#endif // EVENT_LOOP_H
@@ -4,6 +4,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/stat.h>
 #include "config.h"
 #include "routes.h"
 #include "utils.h"
@@ -41,9 +44,25 @@ static const mime_type mime_types[] = {
     {NULL, "application/octet-stream"} // Sentinel
 };
 
+// Reads file_stat->st_size bytes of the open file fd into a malloc'd buffer,
+// returns the size or -1
+typedef long (*FILE_READ_FUNC)(int fd, const struct stat *file_stat, char **buffer);
+
 void serve_static_file(const HTTP_REQUEST *request, HTTP_RESPONSE *response);
 void serve_404_error(HTTP_RESPONSE *response);
 void serve_500_error(HTTP_RESPONSE *response);
 const char* get_mime_type(const char* filename);
+long read_file_contents(const char *filepath, char **buffer);
+void file_set_thread_reader(FILE_READ_FUNC reader);
+
+// Cache validators
+#define FILE_ETAG_SIZE 64
+#define FILE_HTTP_DATE_SIZE 32
+void file_format_etag(char *etag, const char *data, size_t length, const char *suffix);
+void file_format_stat_etag(char *etag, const struct stat *file_stat);
+void file_format_http_date(char *date, time_t time);
+bool file_not_modified(const HTTP_REQUEST *request, const char *etag, time_t last_modified);
+int file_parse_ranges(const HTTP_REQUEST *request, const char *etag, const char *last_modified,
+                      off_t size, HTTP_RANGE *ranges, int max_ranges);
 
 #endif // FILE_H
\ No newline at end of file
@@ -0,0 +1,19 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/stat.h>
+
+// Open descriptors and stat results of static files, shared by reference.
+// An inotify thread drops entries when files under the watched directory
+// change, so redeployed files are picked up without a restart.
+typedef struct FILE_CACHE_ENTRY FILE_CACHE_ENTRY;
+
+int file_cache_init(const char *dir);
+FILE_CACHE_ENTRY *file_cache_open(const char *path, int *fd, struct stat *file_stat);
+void file_cache_retain(FILE_CACHE_ENTRY *entry);
+void file_cache_release(FILE_CACHE_ENTRY *entry);
+const char *file_cache_etag(const FILE_CACHE_ENTRY *entry);
+const char *file_cache_last_modified(const FILE_CACHE_ENTRY *entry);
+void file_cache_cleanup(void);
+
+#endif // FILE_CACHE_H
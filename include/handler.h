@@ -3,21 +3,17 @@
 
 #include "request.h"
 #include "response.h"
-
-// Route handler function pointer type
-typedef void (*ROUTE_HANDLER)(const HTTP_REQUEST *request, HTTP_RESPONSE *response);
+#include "connection.h"
+#include "router.h"
 
 // HTTP handler functions
-void handle_http_request(int client_socket);
+int handler_register_routes(void);
+int handle_http_requests(CONNECTION *conn);
+int handle_http_request(CONNECTION *conn);
 
-// Method-specific handlers
-void handle_get_request(HTTP_REQUEST *request, HTTP_RESPONSE *response);
-void handle_post_request(HTTP_REQUEST *request, HTTP_RESPONSE *response);
-void handle_put_request(HTTP_REQUEST *request, HTTP_RESPONSE *response);
-void handle_patch_request(HTTP_REQUEST *request, HTTP_RESPONSE *response);
-void handle_delete_request(HTTP_REQUEST *request, HTTP_RESPONSE *response);
 void route_get_js(const HTTP_REQUEST *request, HTTP_RESPONSE *response);
 void route_get_css(const HTTP_REQUEST *request, HTTP_RESPONSE *response);
+void route_get_media(const HTTP_REQUEST *request, HTTP_RESPONSE *response);
 
 void route_method_not_allowed(const HTTP_REQUEST *request, HTTP_RESPONSE *response);
 
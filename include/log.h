@@ -0,0 +1,42 @@
+#ifndef LOG_H
+#define LOG_H
+
+typedef enum
+{
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN, // Warnings and errors go to stderr, the rest to stdout
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_SLOW // Slow-request reports, appended to SLOW_LOG_PATH (stderr if it cannot be opened)
+} LOG_LEVEL;
+
+// Messages are formatted by the calling thread into its own ring buffer and
+// written out in batches by a background thread, so logging never takes a
+// lock or waits for the terminal. A full ring drops the message and counts
+// it. Before log_init and after log_cleanup messages are written directly.
+int log_init(void);
+void log_write(LOG_LEVEL level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void log_cleanup(void);
+
+// Debug messages exist only in builds with USE_DEBUG_LOG. Otherwise the call
+// is dead code, its arguments are still type-checked but never evaluated
+#ifdef USE_DEBUG_LOG
+#define LOG_DEBUG_ENABLED 1
+#else
+#define LOG_DEBUG_ENABLED 0
+#endif
+
+#define LOG_DEBUG(...)                                  \
+    do                                                  \
+    {                                                   \
+        if (LOG_DEBUG_ENABLED)                          \
+        {                                               \
+            log_write(LOG_LEVEL_DEBUG, __VA_ARGS__);    \
+        }                                               \
+    } while (0)
+#define LOG_INFO(...) log_write(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) log_write(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) log_write(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_SLOW(...) log_write(LOG_LEVEL_SLOW, __VA_ARGS__)
+
+#endif // LOG_H
@@ -0,0 +1,51 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "request.h"
+#include "response.h"
+
+// Every latency histogram has the same fixed bounds, so series of different
+// routes or instances can be added up: powers of two from 8us to about 34s.
+// Anything slower only counts towards +Inf
+#define METRICS_LATENCY_BUCKETS 23
+#define METRICS_FIRST_BOUND_US 8
+
+// Database calls timed by the db_* functions
+typedef enum
+{
+    METRICS_DB_BEGIN,
+    METRICS_DB_COMMIT,
+    METRICS_DB_CREATE_USER,
+    METRICS_DB_GET_USERS,
+    METRICS_DB_GET_USER,
+    METRICS_DB_UPDATE_USER,
+    METRICS_DB_DELETE_USER,
+    METRICS_DB_OP_COUNT
+} METRICS_DB_OP;
+
+// Values sampled by the caller at scrape time
+typedef struct
+{
+    int queue_depth;
+    int busy_workers;
+    int workers;
+} METRICS_GAUGES;
+
+// Receives the exposition text as it is produced, returns -1 to stop
+typedef int (*METRICS_WRITE_FUNC)(void *context, const char *data, size_t length);
+
+// Every thread counts into a cache-line aligned slot of its own, created on
+// its first sample; the slots are only added up when metrics_write runs.
+// Recording never takes a lock or writes a line another thread reads often.
+void metrics_record_request(HTTP_METHOD method, int route_id, HTTP_STATUS status, uint64_t latency_ns);
+void metrics_observe_db(METRICS_DB_OP op, uint64_t latency_ns);
+void metrics_add_bytes_in(size_t bytes);
+void metrics_add_bytes_out(size_t bytes);
+void metrics_connection_opened(void);
+void metrics_connection_closed(void);
+int metrics_write(METRICS_WRITE_FUNC write, void *context, const METRICS_GAUGES *gauges);
+void metrics_cleanup(void);
+
+#endif // METRICS_H
@@ -2,29 +2,101 @@
 #define REQUEST_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "config.h"
 
+// Header positions are stored as 16-bit offsets into the request
+#if MAX_REQUEST_SIZE > 65535
+#error "MAX_REQUEST_SIZE must fit in the 16-bit header table offsets"
+#endif
+
+// View into the connection's read buffer. Not NUL-terminated, always use
+// the length. Only valid while the request is being handled.
+typedef struct
+{
+    const char *data;
+    size_t length;
+} HTTP_SLICE;
+
+// Raw (still percent-encoded) slices, decoded when a value is used
 typedef struct
 {
-    char key[64];
-    char value[256];
+    HTTP_SLICE key;
+    HTTP_SLICE value;
 } QueryParam;
 
 typedef struct
 {
-    char key[64];
-    char value[256];
+    HTTP_SLICE key;
+    HTTP_SLICE value;
 } UrlParam;
 
+typedef enum
+{
+    HTTP_METHOD_GET,
+    HTTP_METHOD_HEAD,
+    HTTP_METHOD_POST,
+    HTTP_METHOD_PUT,
+    HTTP_METHOD_PATCH,
+    HTTP_METHOD_DELETE,
+    HTTP_METHOD_OPTIONS,
+    HTTP_METHOD_UNKNOWN,
+    HTTP_METHOD_COUNT
+} HTTP_METHOD;
+
+// Headers with a pre-resolved slot in the header table
+typedef enum
+{
+    HTTP_HEADER_HOST,
+    HTTP_HEADER_CONNECTION,
+    HTTP_HEADER_CONTENT_LENGTH,
+    HTTP_HEADER_CONTENT_TYPE,
+    HTTP_HEADER_TRANSFER_ENCODING,
+    HTTP_HEADER_ACCEPT_ENCODING,
+    HTTP_HEADER_IF_NONE_MATCH,
+    HTTP_HEADER_IF_MODIFIED_SINCE,
+    HTTP_HEADER_RANGE,
+    HTTP_HEADER_IF_RANGE,
+    HTTP_HEADER_USER_AGENT,
+    HTTP_HEADER_COOKIE,
+    HTTP_HEADER_KNOWN_COUNT
+} HTTP_HEADER_ID;
+
+// One header line, as offsets from the start of the request so it stays
+// valid when the buffer is grown or compacted while the request arrives
 typedef struct
 {
-    char method[MAX_METHOD_LENGTH];
-    char path[MAX_PATH_LENGTH];
-    char clean_path[MAX_PATH_LENGTH];
-    char query_string[512];
-    char version[16];
-    char *body;
-    int content_length;
+    uint32_t name_hash; // Case-insensitive hash of the name
+    uint16_t name_offset;
+    uint16_t name_length;
+    uint16_t value_offset; // Value without surrounding whitespace
+    uint16_t value_length;
+} HTTP_HEADER;
+
+typedef struct
+{
+    HTTP_HEADER entries[MAX_HEADERS];
+    uint8_t count;
+    uint8_t known[HTTP_HEADER_KNOWN_COUNT]; // Index + 1 of the first such header, 0 if absent
+} HTTP_HEADERS;
+
+struct CONNECTION;
+
+typedef struct
+{
+    const char *raw; // Start of the request in the read buffer
+    const HTTP_HEADERS *headers;
+    HTTP_SLICE method;
+    HTTP_METHOD method_id;
+    HTTP_SLICE path; // Request target including the query string
+    HTTP_SLICE clean_path;
+    HTTP_SLICE query_string;
+    HTTP_SLICE version;
+    const char *body; // NUL-terminated while the request is being handled
+    int content_length; // Of body; for a streamed body the announced length, -1 if chunked
+    bool keep_alive;
+    struct CONNECTION *body_stream; // Set when the route streams the body, read it with http_request_next_body_chunk
 
     // Query parameters (?key=value&key2=value2)
     QueryParam query_params[MAX_QUERY_PARAMS];
@@ -33,22 +105,118 @@ typedef struct
     // URL parameters (extracted from path like /api/users/{id})
     UrlParam url_params[MAX_URL_PARAMS];
     int url_param_count;
+    int route_id; // Pattern the path matched (see router_route_pattern), 0 if none
 } HTTP_REQUEST;
 
+typedef enum
+{
+    HTTP_PARSE_REQUEST_LINE,
+    HTTP_PARSE_HEADERS,
+    HTTP_PARSE_BODY,
+    HTTP_PARSE_DONE
+} HTTP_PARSE_STATE;
+
+// How a route takes its request body
+typedef enum
+{
+    HTTP_BODY_BUFFERED, // Received completely (and dechunked) before the handler runs
+    HTTP_BODY_STREAMED  // Handler runs after the headers and reads the body piece by piece
+} HTTP_BODY_MODE;
+
+// Picks the body mode and size limit of a request once its headers are in
+typedef void (*HTTP_BODY_POLICY)(HTTP_METHOD method, HTTP_SLICE path, HTTP_BODY_MODE *mode, size_t *limit);
+
+// Transfer-Encoding: chunked decoder state
+typedef enum
+{
+    HTTP_CHUNK_SIZE,         // Hex digits of the chunk size
+    HTTP_CHUNK_EXTENSION,    // ";name=value" after the size, ignored
+    HTTP_CHUNK_SIZE_LF,      // CR after the size line seen
+    HTTP_CHUNK_DATA,
+    HTTP_CHUNK_DATA_CR,      // Line break after the data
+    HTTP_CHUNK_DATA_LF,
+    HTTP_CHUNK_TRAILER,      // Start of a trailer line, an empty one ends the body
+    HTTP_CHUNK_TRAILER_LINE,
+    HTTP_CHUNK_TRAILER_LF,   // CR of the empty line seen
+    HTTP_CHUNK_DONE
+} HTTP_CHUNK_STATE;
+
+typedef enum
+{
+    HTTP_PARSE_ERROR = -1,
+    HTTP_PARSE_NEED_MORE = 0,
+    HTTP_PARSE_COMPLETE = 1
+} HTTP_PARSE_RESULT;
+
+// Incremental request framing. Fed the bytes of one request as they arrive,
+// it resumes where it stopped instead of scanning from the start again.
+// Positions are offsets, so the buffer may be reallocated between calls.
+typedef struct
+{
+    HTTP_PARSE_STATE state;
+    size_t offset;         // Bytes already scanned
+    size_t line_start;     // Start of the line being scanned
+    size_t request_line_start;
+    size_t request_line_length;
+    size_t header_length;  // Request line and headers, including the blank line
+    size_t content_length;
+    bool has_content_length;
+    size_t request_length; // Set once the request is complete
+    HTTP_HEADERS headers;  // Filled in while the headers are framed
+
+    // Body framing, decided when the headers are complete
+    bool chunked;
+    HTTP_BODY_MODE body_mode;
+    size_t body_limit;
+    size_t body_length;    // Decoded body bytes so far
+    size_t body_remaining; // Content-Length bytes still to come
+    size_t removed;        // Chunk framing cut out of the buffer by the last feed
+    bool too_large;        // The body is over body_limit, the request is answered with 413
+    HTTP_CHUNK_STATE chunk_state;
+    size_t chunk_size; // Size being read, then data left in the chunk
+    int chunk_digits;
+} HTTP_PARSER;
+
+// Request parser functions
+void http_parser_init(HTTP_PARSER *parser);
+void http_parser_set_body_policy(HTTP_BODY_POLICY policy);
+HTTP_PARSE_RESULT http_parser_feed(HTTP_PARSER *parser, char *buffer, size_t length);
+HTTP_PARSE_RESULT http_parser_body(HTTP_PARSER *parser, char *data, size_t length, size_t *consumed, size_t *decoded);
+bool http_parser_body_done(const HTTP_PARSER *parser);
+
 // HTTP request functions
-int http_request_parse(const char *raw_request, HTTP_REQUEST *request);
+int http_request_parse(const HTTP_PARSER *parser, const char *raw_request, HTTP_REQUEST *request);
 void http_request_init(HTTP_REQUEST *request);
 void http_request_cleanup(HTTP_REQUEST *request);
 void http_request_print(const HTTP_REQUEST *request);
+const char *http_method_name(HTTP_METHOD method);
+
+// Header lookup (empty slice when missing)
+HTTP_SLICE http_request_header(const HTTP_REQUEST *request, HTTP_HEADER_ID id);
+HTTP_SLICE http_request_find_header(const HTTP_REQUEST *request, const char *name);
+bool http_request_accepts_encoding(const HTTP_REQUEST *request, const char *coding);
+
+// Streamed bodies. The handler reads what has arrived and returns when
+// http_request_next_body_chunk says HTTP_BODY_PENDING; it is called again
+// with the same request once more is there, keeping what it needs across
+// the calls in http_request_body_state
+#define HTTP_BODY_PENDING 2
+int http_request_next_body_chunk(const HTTP_REQUEST *request, HTTP_SLICE *chunk);
+void *http_request_body_state(const HTTP_REQUEST *request, size_t size);
+
+// Slice helper functions
+bool http_slice_equals(HTTP_SLICE slice, const char *str);
+bool http_slice_starts_with(HTTP_SLICE slice, const char *prefix);
+int http_slice_to_int(HTTP_SLICE slice, int *value);
+int http_slice_decode(HTTP_SLICE slice, char *dst, size_t dst_size);
+bool http_slice_has_token(HTTP_SLICE list, const char *token);
 
-// Parameter helper functions
-const char *get_query_param(const HTTP_REQUEST *request, const char *key);
-const char *get_url_param(const HTTP_REQUEST *request, const char *key);
-int parse_query_string(const char *query_string, QueryParam *params, int max_params);
-int extract_and_store_url_params(HTTP_REQUEST *request, const char *path_pattern);
-bool match_path_pattern(const char *pattern, const char *path);
+// Parameter helper functions (empty slice when missing)
+HTTP_SLICE get_query_param(const HTTP_REQUEST *request, const char *key);
+HTTP_SLICE get_url_param(const HTTP_REQUEST *request, const char *key);
+int parse_query_string(HTTP_SLICE query_string, QueryParam *params, int max_params);
 
 // URL decoding
-int url_decode(char *dst, size_t dst_size, const char *src);
+int url_decode(char *dst, size_t dst_size, const char *src, size_t src_length);
 
 #endif // REQUEST_H
\ No newline at end of file
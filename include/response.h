@@ -1,26 +1,83 @@
 #ifndef RESPONSE_H
 #define RESPONSE_H
 
+#include <stdbool.h>
+#include <sys/types.h>
 #include "config.h"
+#include "file_cache.h"
+#include "compress.h"
+#include "arena.h"
 
 typedef enum
 {
     HTTP_200_OK,
     HTTP_201_CREATED,
+    HTTP_206_PARTIAL_CONTENT,
+    HTTP_304_NOT_MODIFIED,
     HTTP_400_BAD_REQUEST,
     HTTP_401_UNAUTHORIZED,
     HTTP_404_NOT_FOUND,
     HTTP_405_METHOD_NOT_ALLOWED,
+    HTTP_416_RANGE_NOT_SATISFIABLE,
     HTTP_500_INTERNAL_ERROR,
-    HTTP_409_CONFLICT
+    HTTP_409_CONFLICT,
+    HTTP_413_PAYLOAD_TOO_LARGE,
+    HTTP_STATUS_COUNT
 } HTTP_STATUS;
 
+typedef enum
+{
+    HTTP_STREAM_NONE,   // Body set up front and sent with Content-Length
+    HTTP_STREAM_OPEN,   // Headers queued, the handler is writing chunks
+    HTTP_STREAM_DONE,   // Last chunk queued
+    HTTP_STREAM_FAILED  // Client gone or body abandoned, the connection is closed
+} HTTP_STREAM_STATE;
+
+struct CONNECTION;
+
+// One satisfiable byte range of a representation
+typedef struct
+{
+    off_t start;
+    off_t length;
+} HTTP_RANGE;
+
 typedef struct
 {
     HTTP_STATUS status;
     char content_type[64];
     char *body;
-    int body_length;
+    size_t body_length;
+    bool body_owned;         // body was malloc'd and is freed with the response, else it is in arena
+    ARENA *arena;            // Set by the request handler, NULL: bodies are malloc'd
+    const char *shared_body; // Set instead of body for bytes that outlive the response (asset cache)
+    int file_fd;             // >= 0: body_length bytes are sent from this file instead of body
+    FILE_CACHE_ENTRY *file_entry; // Reference keeping file_fd open, released instead of closing it
+    off_t file_offset;
+    const char *header_block; // Precomputed Content-* headers, replaces content_type
+    int header_block_length;
+    char validators[128]; // ETag and Last-Modified header lines of the body
+    bool accept_ranges;
+
+    // Byte ranges of a 206, more than one makes the body multipart/byteranges
+    HTTP_RANGE ranges[MAX_RANGES];
+    int range_count;
+    off_t range_total;          // Size of the complete representation, for Content-Range
+    unsigned long range_boundary;
+
+    // Streamed body, written straight to the connection while it is produced
+    struct CONNECTION *stream; // Set by the request handler, NULL where streaming is not possible
+    bool stream_chunked;       // Client speaks HTTP/1.1, else the body ends with the connection
+    HTTP_STREAM_STATE stream_state;
+    size_t chunk_offset; // Reserved chunk-size line of the open chunk in the write buffer
+    size_t chunk_length; // Bytes in the open chunk, 0 if none is open
+
+    // On-the-fly compression of buffered and streamed bodies
+    COMPRESS_ENCODING accept_encoding;  // Best coding the client takes, set by the request handler
+    COMPRESS_ENCODING content_encoding; // Coding the body is sent with
+    bool vary_encoding;                 // The body depends on Accept-Encoding
+    z_stream *deflate_stream;           // Compressing a streamed body, owned by the thread
+    bool keep_alive;
 } HTTP_RESPONSE;
 
 // HTTP response functions
@@ -28,8 +85,24 @@ void http_response_init(HTTP_RESPONSE *response);
 void http_response_set_status(HTTP_RESPONSE *response, HTTP_STATUS status);
 void http_response_set_content_type(HTTP_RESPONSE *response, const char *content_type);
 void http_response_set_body(HTTP_RESPONSE *response, const char *body);
-int http_response_build(const HTTP_RESPONSE *response, char *buffer, int buffer_size);
+int http_response_set_body_printf(HTTP_RESPONSE *response, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+int http_response_build_headers(const HTTP_RESPONSE *response, char *buffer, int buffer_size);
+int http_response_status_code(HTTP_STATUS status);
 void http_response_set_body_with_length(HTTP_RESPONSE *response, char* body, int length);
+void http_response_set_file(HTTP_RESPONSE *response, int fd, FILE_CACHE_ENTRY *entry, off_t offset, size_t length);
+void http_response_set_validators(HTTP_RESPONSE *response, const char *etag, const char *last_modified);
+void http_response_set_accept_ranges(HTTP_RESPONSE *response);
+int http_response_set_ranges(HTTP_RESPONSE *response, const HTTP_RANGE *ranges, int count, off_t total_length);
+void http_response_set_range_not_satisfiable(HTTP_RESPONSE *response, off_t total_length);
+int http_response_format_part(const HTTP_RESPONSE *response, int index, char *buffer, size_t buffer_size);
+void http_response_set_shared_body(HTTP_RESPONSE *response, const char *body, int length,
+                                   const char *header_block, int header_block_length);
+int http_response_begin_chunked(HTTP_RESPONSE *response);
+int http_response_write_chunk(HTTP_RESPONSE *response, const char *data, size_t length);
+int http_response_end_chunked(HTTP_RESPONSE *response);
+void http_response_abort_chunked(HTTP_RESPONSE *response);
+void http_response_compress(HTTP_RESPONSE *response);
 void http_response_cleanup(HTTP_RESPONSE *response);
 
 #endif // RESPONSE_H
\ No newline at end of file
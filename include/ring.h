@@ -0,0 +1,31 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define RING_CACHE_LINE 64
+
+// Byte queue between one producer thread and one consumer thread, without
+// locks. Only the producer moves head and only the consumer moves tail;
+// both count bytes forever and are masked into data. Threads that each own
+// a ring link them into a list the consumer walks
+typedef struct BYTE_RING
+{
+    size_t head __attribute__((aligned(RING_CACHE_LINE)));
+    size_t tail __attribute__((aligned(RING_CACHE_LINE)));
+    unsigned long dropped; // Writes that did not fit, for the consumer to report
+    size_t size;           // Power of two
+    struct BYTE_RING *next;
+    char data[];
+} BYTE_RING;
+
+BYTE_RING *ring_create(size_t size);
+bool ring_write(BYTE_RING *ring, const void *data, size_t length);
+size_t ring_used(const BYTE_RING *ring);
+void ring_peek(const BYTE_RING *ring, size_t offset, void *data, size_t length);
+void ring_consume(BYTE_RING *ring, size_t length);
+void ring_list_push(BYTE_RING **list, BYTE_RING *ring);
+void ring_list_destroy(BYTE_RING **list);
+
+#endif // RING_H
@@ -0,0 +1,29 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include "request.h"
+#include "response.h"
+
+// Route handler function pointer type
+typedef void (*ROUTE_HANDLER)(const HTTP_REQUEST *request, HTTP_RESPONSE *response);
+
+typedef enum
+{
+    ROUTE_FOUND,
+    ROUTE_NOT_FOUND,
+    ROUTE_METHOD_NOT_ALLOWED // Path exists, but not for this method
+} ROUTE_STATUS;
+
+// Routes are registered once at startup, lookups are read-only and can run
+// on any thread. Patterns are '/' separated, "{name}" segments capture a
+// URL parameter, e.g. router_add(HTTP_METHOD_GET, "/api/users/{id}", handler).
+// Every distinct pattern gets a route id from 1 to router_route_count().
+int router_add(HTTP_METHOD method, const char *pattern, ROUTE_HANDLER handler);
+int router_set_body(HTTP_METHOD method, const char *pattern, HTTP_BODY_MODE mode, size_t limit);
+ROUTE_STATUS router_lookup(HTTP_REQUEST *request, ROUTE_HANDLER *handler);
+void router_body_policy(HTTP_METHOD method, HTTP_SLICE path, HTTP_BODY_MODE *mode, size_t *limit);
+int router_route_count(void);
+const char *router_route_pattern(int route_id);
+void router_cleanup(void);
+
+#endif // ROUTER_H
@@ -11,9 +11,11 @@ void route_not_found(const HTTP_REQUEST *request, HTTP_RESPONSE *response);
 void route_get_users(const HTTP_REQUEST *request, HTTP_RESPONSE *response);
 void route_get_user_by_id(const HTTP_REQUEST *request, HTTP_RESPONSE *response);
 void route_create_user(const HTTP_REQUEST *request, HTTP_RESPONSE *response);
+void route_import_users(const HTTP_REQUEST *request, HTTP_RESPONSE *response);
 void route_update_user(const HTTP_REQUEST *request, HTTP_RESPONSE *response);
 void route_partial_update_user(const HTTP_REQUEST *request, HTTP_RESPONSE *response);
 void route_delete_user(const HTTP_REQUEST *request, HTTP_RESPONSE *response);
 void route_login(const HTTP_REQUEST *request, HTTP_RESPONSE *response);
+void route_metrics(const HTTP_REQUEST *request, HTTP_RESPONSE *response);
 
 #endif // ROUTES_H
\ No newline at end of file
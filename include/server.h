@@ -13,9 +13,11 @@ typedef struct
 
 // TCP server functions
 int server_create(TCP_SERVER *server, int port);
+int server_set_reuseport(TCP_SERVER *server);
 int server_bind(TCP_SERVER *server);
 int server_listen(TCP_SERVER *server, int backlog);
 int server_accept(TCP_SERVER *server, struct sockaddr_in *client_addr);
+int server_set_nonblocking(int socket_fd);
 void server_close(TCP_SERVER *server);
 
 #endif // SERVER_H
\ No newline at end of file
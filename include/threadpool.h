@@ -20,6 +20,7 @@ typedef struct
 
     pthread_t *threads;
     int thread_count;
+    int busy_count; // Workers running a task, under queue_mutex
 
     pthread_mutex_t queue_mutex;
     pthread_cond_t queue_not_empty;
@@ -29,9 +30,13 @@ typedef struct
     bool started;
 } ThreadPool;
 
+// The server's pool, NULL when requests are handled on the event loops
+extern ThreadPool *thread_pool;
+
 // Function declarations
 ThreadPool *threadpool_create(int thread_count, int queue_capacity);
 int threadpool_add_task(ThreadPool *pool, void (*function)(void *), void *arg);
+void threadpool_stats(ThreadPool *pool, int *queued, int *busy);
 int threadpool_destroy(ThreadPool *pool);
 void *threadpool_worker(void *arg);
 
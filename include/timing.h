@@ -0,0 +1,96 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include "config.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Where a batch of requests on one connection spent its time, from the first
+// byte received to the last byte sent
+typedef enum
+{
+    TIMING_RECV,    // Receiving the requests, until they are handled or queued
+    TIMING_QUEUE,   // Waiting in the thread pool queue
+    TIMING_PARSE,
+    TIMING_ROUTE,   // Router lookup
+    TIMING_HANDLER, // Route handler, including the next two and streamed sends
+    TIMING_DB_LOCK, // Waiting for the database mutex
+    TIMING_DB,      // Inside db_* calls
+    TIMING_BUILD,   // Response headers, compression and queueing the body
+    TIMING_SEND,    // Streamed body sent by the handler, then from the responses
+                    // being queued to the last byte sent
+    TIMING_STAGE_COUNT
+} TIMING_STAGE;
+
+typedef struct
+{
+    uint64_t start; // First byte of the batch, 0 between batches
+    uint64_t mark;  // End of the last stage counted by timing_mark
+    uint64_t ticks[TIMING_STAGE_COUNT];
+    uint64_t nested; // Part of the handler stage counted towards other stages
+    int sending;    // Responses queued, timing_finish runs once they are sent
+    int requests;
+
+    // The first request of the batch, for the slow log
+    int method;
+    int status;
+    uint16_t path_length;
+    char path[SLOW_LOG_MAX_PATH];
+} REQUEST_TIMING;
+
+// Batch of the request the calling thread is handling, NULL if none
+extern __thread REQUEST_TIMING *timing_current;
+extern int timing_use_tsc;
+
+// Timestamps are time stamp counter ticks where the CPU has an invariant
+// one, reading it takes a few nanoseconds; elsewhere they are monotonic
+// clock nanoseconds. timing_init measures the tick length once at startup.
+// A batch slower than the threshold is reported to the slow log with its
+// stage breakdown, a faster one costs one comparison.
+void timing_init(unsigned int slow_threshold_ms);
+uint64_t timing_clock_ns(void);
+uint64_t timing_to_ns(uint64_t ticks);
+void timing_finish(REQUEST_TIMING *timing, const struct sockaddr_in *client_addr);
+
+static inline uint64_t timing_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (timing_use_tsc)
+    {
+        return __rdtsc();
+    }
+#endif
+    return timing_clock_ns();
+}
+
+// Bytes of a new batch arrived
+static inline void timing_begin(REQUEST_TIMING *timing)
+{
+    if (!timing->start)
+    {
+        timing->start = timing->mark = timing_now();
+    }
+}
+
+// The time since the previous mark went to stage
+static inline void timing_mark(REQUEST_TIMING *timing, TIMING_STAGE stage)
+{
+    uint64_t now = timing_now();
+    timing->ticks[stage] += now - timing->mark;
+    timing->mark = now;
+}
+
+// Count ticks the handler running on this thread spent on another stage
+static inline void timing_add(TIMING_STAGE stage, uint64_t ticks)
+{
+    if (timing_current)
+    {
+        timing_current->ticks[stage] += ticks;
+        timing_current->nested += ticks;
+    }
+}
+
+#endif // TIMING_H
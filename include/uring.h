@@ -0,0 +1,12 @@
+#ifndef URING_H
+#define URING_H
+
+#include "event_loop.h"
+
+// io_uring backend for EVENT_LOOP (build with `make IO_URING=1`).
+// Without USE_IO_URING these fail and the loop keeps using epoll.
+int uring_loop_init(EVENT_LOOP *loop);
+void uring_loop_run(EVENT_LOOP *loop);
+void uring_loop_cleanup(EVENT_LOOP *loop);
+
+#endif // URING_H
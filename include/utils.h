@@ -1,6 +1,25 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stddef.h>
+#include <stdbool.h>
+#include "config.h"
+
+// Cuts the top-level JSON objects out of a document that arrives in pieces,
+// e.g. the elements of an array or newline-delimited objects
+typedef struct
+{
+    char object[IMPORT_MAX_OBJECT_SIZE + 1]; // Object being collected, NUL-terminated when complete
+    size_t length;
+    int depth; // Open braces, 0 between objects
+    bool in_string;
+    bool escaped;
+} JSON_SPLITTER;
+
+// Called with every complete object, or with NULL for one that did not fit.
+// Returns -1 to stop
+typedef int (*JSON_OBJECT_FUNC)(void *context, const char *object, size_t length);
+
 int parse_user_json(const char *json, char *name, int name_len, char *email, int email_len,
                     char *password, int password_len);
 int parse_json_field(const char *json, const char *field, char *output, int output_len);
@@ -8,4 +27,8 @@ int is_valid_email(const char *email);
 int is_valid_name(const char *name);
 int is_valid_password(const char *password);
 
+void json_splitter_init(JSON_SPLITTER *splitter);
+int json_splitter_feed(JSON_SPLITTER *splitter, const char *data, size_t length,
+                       JSON_OBJECT_FUNC on_object, void *context);
+
 #endif // UTILS_H
\ No newline at end of file
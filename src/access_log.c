@@ -0,0 +1,284 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "../include/config.h"
+#include "../include/access_log.h"
+#include "../include/ring.h"
+#include "../include/log.h"
+
+static BYTE_RING *rings = NULL; // One per thread, added on its first record
+static __thread BYTE_RING *thread_ring = NULL;
+static int accepting = 0;
+
+// Writer state, only touched by the writer thread while it runs
+static char log_path[MAX_PATH_LENGTH];
+static int log_fd = -1;
+static off_t log_size = 0;
+static char batch[ACCESS_LOG_BATCH_SIZE];
+static size_t batch_length = 0;
+
+static pthread_t writer_thread;
+static int writer_running = 0;
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+
+static int write_all(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, data, length);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            return -1;
+        }
+        data += written;
+        length -= written;
+    }
+    return 0;
+}
+
+// Shift access.log.N up by one, dropping the oldest, and move the current
+// file to access.log.1
+static void rotate_files(void)
+{
+    char from[MAX_PATH_LENGTH + 8];
+    char to[MAX_PATH_LENGTH + 8];
+
+    for (int i = ACCESS_LOG_MAX_FILES - 1; i >= 1; i--)
+    {
+        snprintf(from, sizeof(from), "%s.%d", log_path, i);
+        snprintf(to, sizeof(to), "%s.%d", log_path, i + 1);
+        rename(from, to);
+    }
+
+    snprintf(to, sizeof(to), "%s.1", log_path);
+    rename(log_path, to);
+}
+
+// Open the log for appending. A new file gets the header, a file in
+// another format is rotated out of the way first
+static int open_log(void)
+{
+    ACCESS_LOG_HEADER header;
+    memcpy(header.magic, ACCESS_LOG_MAGIC, sizeof(header.magic));
+    header.version = ACCESS_LOG_VERSION;
+    header.record_size = sizeof(ACCESS_RECORD);
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        int fd = open(log_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        struct stat file_stat;
+        if (fd < 0 || fstat(fd, &file_stat) < 0)
+        {
+            LOG_ERROR("Cannot open access log %s: %s\n", log_path, strerror(errno));
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            return -1;
+        }
+
+        if (file_stat.st_size == 0)
+        {
+            if (write_all(fd, (const char *)&header, sizeof(header)) < 0)
+            {
+                close(fd);
+                return -1;
+            }
+            log_fd = fd;
+            log_size = sizeof(header);
+            return 0;
+        }
+
+        ACCESS_LOG_HEADER existing;
+        if (pread(fd, &existing, sizeof(existing), 0) == (ssize_t)sizeof(existing) &&
+            memcmp(&existing, &header, sizeof(header)) == 0)
+        {
+            log_fd = fd;
+            log_size = file_stat.st_size;
+            return 0;
+        }
+
+        close(fd);
+        rotate_files();
+    }
+
+    return -1;
+}
+
+static void flush_batch(void)
+{
+    if (batch_length == 0)
+    {
+        return;
+    }
+
+    if (log_fd >= 0 && write_all(log_fd, batch, batch_length) == 0)
+    {
+        log_size += batch_length;
+    }
+    batch_length = 0;
+
+    // Only between batches, so every file holds whole records
+    if (log_fd >= 0 && log_size >= ACCESS_LOG_MAX_FILE_SIZE)
+    {
+        close(log_fd);
+        log_fd = -1;
+        rotate_files();
+        open_log();
+    }
+}
+
+// Move every complete record out of the rings into the file
+static void drain_rings(void)
+{
+    for (BYTE_RING *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    {
+        size_t used = ring_used(ring);
+        size_t offset = 0;
+
+        while (offset < used)
+        {
+            ACCESS_RECORD record;
+            ring_peek(ring, offset, &record, sizeof(record));
+
+            size_t size = sizeof(record) + record.path_length;
+            if (batch_length + size > sizeof(batch))
+            {
+                flush_batch();
+            }
+            ring_peek(ring, offset, batch + batch_length, size);
+            batch_length += size;
+            offset += size;
+        }
+        ring_consume(ring, used);
+
+        unsigned long dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+        if (dropped > 0)
+        {
+            LOG_WARN("Access log: %lu records dropped\n", dropped);
+        }
+    }
+
+    flush_batch();
+}
+
+static void *writer_main(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&writer_mutex);
+    while (writer_running)
+    {
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_nsec += ACCESS_LOG_FLUSH_INTERVAL_MS * 1000000L;
+        if (wake.tv_nsec >= 1000000000L)
+        {
+            wake.tv_sec++;
+            wake.tv_nsec -= 1000000000L;
+        }
+
+        // access_log_cleanup wakes it early for the last batch
+        pthread_cond_timedwait(&writer_cond, &writer_mutex, &wake);
+        drain_rings();
+    }
+    pthread_mutex_unlock(&writer_mutex);
+
+    drain_rings();
+    return NULL;
+}
+
+int access_log_init(const char *path)
+{
+    if (snprintf(log_path, sizeof(log_path), "%s", path) >= (int)sizeof(log_path) || open_log() < 0)
+    {
+        fprintf(stderr, "Access log disabled\n");
+        return -1;
+    }
+
+    writer_running = 1;
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0)
+    {
+        perror("Failed to start access log writer");
+        writer_running = 0;
+        close(log_fd);
+        log_fd = -1;
+        return -1;
+    }
+
+    __atomic_store_n(&accepting, 1, __ATOMIC_RELEASE);
+    printf("Access log: %s\n", log_path);
+    return 0;
+}
+
+// Queue one record. path is cut to ACCESS_LOG_MAX_PATH bytes
+void access_log_write(const ACCESS_RECORD *record, const char *path, size_t path_length)
+{
+    if (!__atomic_load_n(&accepting, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+
+    BYTE_RING *ring = thread_ring;
+    if (!ring)
+    {
+        ring = ring_create(ACCESS_LOG_RING_SIZE);
+        if (!ring)
+        {
+            return;
+        }
+        ring_list_push(&rings, ring);
+        thread_ring = ring;
+    }
+
+    // Record and path are queued in one piece
+    char buffer[sizeof(ACCESS_RECORD) + ACCESS_LOG_MAX_PATH];
+    if (path_length > ACCESS_LOG_MAX_PATH)
+    {
+        path_length = ACCESS_LOG_MAX_PATH;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    ACCESS_RECORD *queued = (ACCESS_RECORD *)buffer;
+    memcpy(queued, record, sizeof(ACCESS_RECORD));
+    queued->timestamp_us = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    queued->path_length = (uint16_t)path_length;
+    memcpy(buffer + sizeof(ACCESS_RECORD), path, path_length);
+    ring_write(ring, buffer, sizeof(ACCESS_RECORD) + path_length);
+}
+
+// Call once no other thread records any more
+void access_log_cleanup(void)
+{
+    if (!writer_running)
+    {
+        return;
+    }
+
+    __atomic_store_n(&accepting, 0, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&writer_mutex);
+    writer_running = 0;
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_mutex);
+    pthread_join(writer_thread, NULL);
+
+    ring_list_destroy(&rings);
+    thread_ring = NULL;
+    close(log_fd);
+    log_fd = -1;
+}
@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include "../include/config.h"
+#include "../include/arena.h"
+
+#define ARENA_ALIGNMENT 16
+
+void arena_init(ARENA *arena)
+{
+    arena->head = NULL;
+    arena->first = NULL;
+    arena->used = 0;
+}
+
+// Take size bytes, aligned for any type. A request that does not fit the
+// current block starts a new one, at least ARENA_BLOCK_SIZE big.
+// Returns NULL if malloc fails
+void *arena_alloc(ARENA *arena, size_t size)
+{
+    if (size > SIZE_MAX - ARENA_ALIGNMENT - sizeof(ARENA_BLOCK))
+    {
+        return NULL;
+    }
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    if (!arena->head || arena->head->size - arena->used < size)
+    {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        ARENA_BLOCK *block = malloc(sizeof(ARENA_BLOCK) + block_size);
+        if (!block)
+        {
+            return NULL;
+        }
+
+        block->size = block_size;
+        block->next = arena->head;
+        arena->head = block;
+        arena->used = 0;
+        if (!arena->first && block_size == ARENA_BLOCK_SIZE)
+        {
+            arena->first = block;
+        }
+    }
+
+    void *memory = arena->head->data + arena->used;
+    arena->used += size;
+    return memory;
+}
+
+// Drop every allocation. Only the first regular-sized block is kept for reuse
+void arena_reset(ARENA *arena)
+{
+    ARENA_BLOCK *block = arena->head;
+    while (block)
+    {
+        ARENA_BLOCK *next = block->next;
+        if (block != arena->first)
+        {
+            free(block);
+        }
+        block = next;
+    }
+
+    if (arena->first)
+    {
+        arena->first->next = NULL;
+    }
+    arena->head = arena->first;
+    arena->used = 0;
+}
+
+void arena_destroy(ARENA *arena)
+{
+    arena_reset(arena);
+    free(arena->first);
+    arena_init(arena);
+}
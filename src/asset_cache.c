@@ -0,0 +1,377 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef USE_BROTLI
+#include <brotli/encode.h>
+#endif
+#include "../include/config.h"
+#include "../include/asset_cache.h"
+#include "../include/compress.h"
+#include "../include/file.h"
+
+typedef enum
+{
+    ASSET_IDENTITY,
+    ASSET_GZIP,
+    ASSET_BROTLI,
+    ASSET_ENCODING_COUNT
+} ASSET_ENCODING;
+
+typedef struct
+{
+    char *data; // NULL when the variant is missing or not worth sending
+    size_t length;
+    char etag[FILE_ETAG_SIZE];
+    char headers[256]; // Content-Type, Content-Length, Content-Encoding, Vary, validators, Accept-Ranges
+    int headers_length;
+    char not_modified_headers[160]; // Vary and validators, for a 304
+    int not_modified_length;
+} ASSET_VARIANT;
+
+typedef struct
+{
+    char *path; // As built by construct_file_path, e.g. "./public/css/style.css"
+    const char *mime_type;
+    time_t mtime;
+    char last_modified[FILE_HTTP_DATE_SIZE];
+    ASSET_VARIANT variants[ASSET_ENCODING_COUNT];
+    int stale; // Changed on disk, served from the file from now on
+} ASSET;
+
+static ASSET *assets = NULL;
+static int asset_count = 0;
+static int asset_capacity = 0;
+static size_t cached_bytes = 0;
+
+static const char *encoding_names[ASSET_ENCODING_COUNT] = {NULL, "gzip", "br"};
+
+static char *compress_gzip(const char *data, size_t length, size_t *out_length)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+
+    // windowBits 15 + 16 writes a gzip header instead of a zlib one
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return NULL;
+    }
+
+    size_t bound = deflateBound(&stream, length);
+    char *out = malloc(bound);
+    if (!out)
+    {
+        deflateEnd(&stream);
+        return NULL;
+    }
+
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = length;
+    stream.next_out = (Bytef *)out;
+    stream.avail_out = bound;
+
+    if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
+    {
+        deflateEnd(&stream);
+        free(out);
+        return NULL;
+    }
+
+    *out_length = stream.total_out;
+    deflateEnd(&stream);
+    return out;
+}
+
+static char *compress_brotli(const char *data, size_t length, size_t *out_length)
+{
+#ifdef USE_BROTLI
+    size_t bound = BrotliEncoderMaxCompressedSize(length);
+    char *out = bound ? malloc(bound) : NULL;
+    if (!out)
+    {
+        return NULL;
+    }
+
+    *out_length = bound;
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC,
+                               length, (const uint8_t *)data, out_length, (uint8_t *)out))
+    {
+        free(out);
+        return NULL;
+    }
+    return out;
+#else
+    (void)data;
+    (void)length;
+    (void)out_length;
+    return NULL;
+#endif
+}
+
+static void format_variant_headers(ASSET *asset, ASSET_ENCODING encoding, int vary)
+{
+    ASSET_VARIANT *variant = &asset->variants[encoding];
+
+    // Each encoding is a different representation and gets its own ETag. The
+    // identity one matches what the file cache computes for the same file
+    file_format_etag(variant->etag, asset->variants[ASSET_IDENTITY].data,
+                     asset->variants[ASSET_IDENTITY].length,
+                     encoding == ASSET_BROTLI ? "br" : encoding == ASSET_GZIP ? "gz" : NULL);
+
+    char validators[FILE_ETAG_SIZE + FILE_HTTP_DATE_SIZE + 32];
+    snprintf(validators, sizeof(validators),
+             "ETag: %s\r\n"
+             "Last-Modified: %s\r\n",
+             variant->etag, asset->last_modified);
+
+    variant->not_modified_length = snprintf(variant->not_modified_headers, sizeof(variant->not_modified_headers),
+                                            "%s%s", vary ? "Vary: Accept-Encoding\r\n" : "", validators);
+
+    int written = snprintf(variant->headers, sizeof(variant->headers),
+                           "Content-Type: %s\r\n"
+                           "Content-Length: %zu\r\n",
+                           asset->mime_type, variant->length);
+
+    if (encoding_names[encoding])
+    {
+        written += snprintf(variant->headers + written, sizeof(variant->headers) - written,
+                            "Content-Encoding: %s\r\n", encoding_names[encoding]);
+    }
+
+    // Caches must keep the variants apart, the identity one included
+    if (vary)
+    {
+        written += snprintf(variant->headers + written, sizeof(variant->headers) - written,
+                            "Vary: Accept-Encoding\r\n");
+    }
+
+    written += snprintf(variant->headers + written, sizeof(variant->headers) - written,
+                        "%s"
+                        "Accept-Ranges: bytes\r\n",
+                        validators);
+
+    variant->headers_length = written;
+}
+
+static void asset_cache_load(const char *path, size_t size, time_t mtime)
+{
+    if (cached_bytes + size > ASSET_CACHE_MAX_SIZE)
+    {
+        return;
+    }
+
+    char *data = NULL;
+    long length = read_file_contents(path, &data);
+    if (length < 0 || !data)
+    {
+        return;
+    }
+
+    if (asset_count == asset_capacity)
+    {
+        int new_capacity = asset_capacity ? asset_capacity * 2 : 16;
+        ASSET *grown = realloc(assets, new_capacity * sizeof(ASSET));
+        if (!grown)
+        {
+            free(data);
+            return;
+        }
+        assets = grown;
+        asset_capacity = new_capacity;
+    }
+
+    ASSET *asset = &assets[asset_count];
+    memset(asset, 0, sizeof(ASSET));
+    asset->path = strdup(path);
+    if (!asset->path)
+    {
+        free(data);
+        return;
+    }
+    asset->mime_type = get_mime_type(path);
+    asset->mtime = mtime;
+    file_format_http_date(asset->last_modified, mtime);
+    asset->variants[ASSET_IDENTITY].data = data;
+    asset->variants[ASSET_IDENTITY].length = length;
+    cached_bytes += length;
+
+    int vary = 0;
+    if (length >= ASSET_COMPRESS_MIN_SIZE && compress_is_compressible(asset->mime_type))
+    {
+        for (int encoding = ASSET_GZIP; encoding < ASSET_ENCODING_COUNT; encoding++)
+        {
+            size_t compressed_length = 0;
+            char *compressed = (encoding == ASSET_GZIP)
+                                   ? compress_gzip(data, length, &compressed_length)
+                                   : compress_brotli(data, length, &compressed_length);
+
+            // Keep a variant only if it saves at least a tenth
+            if (compressed && compressed_length < (size_t)length - length / 10)
+            {
+                asset->variants[encoding].data = compressed;
+                asset->variants[encoding].length = compressed_length;
+                cached_bytes += compressed_length;
+                vary = 1;
+            }
+            else
+            {
+                free(compressed);
+            }
+        }
+    }
+
+    for (int encoding = ASSET_IDENTITY; encoding < ASSET_ENCODING_COUNT; encoding++)
+    {
+        if (asset->variants[encoding].data)
+        {
+            format_variant_headers(asset, encoding, vary);
+        }
+    }
+
+    asset_count++;
+}
+
+static void asset_cache_collect(const char *dir)
+{
+    DIR *handle = opendir(dir);
+    if (!handle)
+    {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(handle)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+
+        char path[MAX_PATH_LENGTH];
+        if (snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name) >= (int)sizeof(path))
+        {
+            continue;
+        }
+
+        struct stat file_stat;
+        if (stat(path, &file_stat) != 0)
+        {
+            continue;
+        }
+
+        if (S_ISDIR(file_stat.st_mode))
+        {
+            asset_cache_collect(path);
+        }
+        else if (S_ISREG(file_stat.st_mode) && file_stat.st_size <= ASSET_CACHE_MAX_FILE_SIZE)
+        {
+            // Bigger files are left to sendfile
+            asset_cache_load(path, file_stat.st_size, file_stat.st_mtime);
+        }
+    }
+
+    closedir(handle);
+}
+
+static int compare_assets(const void *a, const void *b)
+{
+    return strcmp(((const ASSET *)a)->path, ((const ASSET *)b)->path);
+}
+
+// Load every small file under dir. Returns the number of cached files
+int asset_cache_init(const char *dir)
+{
+    asset_cache_collect(dir);
+    qsort(assets, asset_count, sizeof(ASSET), compare_assets);
+
+    int compressed = 0;
+    for (int i = 0; i < asset_count; i++)
+    {
+        compressed += assets[i].variants[ASSET_GZIP].data || assets[i].variants[ASSET_BROTLI].data;
+    }
+
+    printf("Asset cache: %d files (%d with compressed variants), %zu bytes\n",
+           asset_count, compressed, cached_bytes);
+    return asset_count;
+}
+
+// Answer from the cache with the smallest variant the client accepts.
+// Returns 0 if the response was set, -1 if the path is not cached
+int asset_cache_serve(const char *path, const HTTP_REQUEST *request, HTTP_RESPONSE *response)
+{
+    if (asset_count == 0)
+    {
+        return -1;
+    }
+
+    ASSET key;
+    key.path = (char *)path;
+    const ASSET *asset = bsearch(&key, assets, asset_count, sizeof(ASSET), compare_assets);
+    if (!asset || __atomic_load_n(&asset->stale, __ATOMIC_RELAXED))
+    {
+        return -1;
+    }
+
+    // Byte ranges are cut from the file, of its identity encoding
+    if (http_request_header(request, HTTP_HEADER_RANGE).data)
+    {
+        return -1;
+    }
+
+    const ASSET_VARIANT *variant = &asset->variants[ASSET_IDENTITY];
+    if (asset->variants[ASSET_BROTLI].data && http_request_accepts_encoding(request, "br"))
+    {
+        variant = &asset->variants[ASSET_BROTLI];
+    }
+    else if (asset->variants[ASSET_GZIP].data && http_request_accepts_encoding(request, "gzip"))
+    {
+        variant = &asset->variants[ASSET_GZIP];
+    }
+
+    if (file_not_modified(request, variant->etag, asset->mtime))
+    {
+        http_response_set_status(response, HTTP_304_NOT_MODIFIED);
+        http_response_set_shared_body(response, NULL, 0,
+                                      variant->not_modified_headers, variant->not_modified_length);
+        return 0;
+    }
+
+    http_response_set_status(response, HTTP_200_OK);
+    http_response_set_shared_body(response, variant->data, (int)variant->length,
+                                  variant->headers, variant->headers_length);
+    return 0;
+}
+
+// The file changed on disk. The cache stays read-only, the entry is just
+// skipped so the new contents are sent from the file
+void asset_cache_invalidate(const char *path)
+{
+    ASSET key;
+    key.path = (char *)path;
+    ASSET *asset = asset_count ? bsearch(&key, assets, asset_count, sizeof(ASSET), compare_assets) : NULL;
+    if (asset)
+    {
+        __atomic_store_n(&asset->stale, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void asset_cache_cleanup(void)
+{
+    for (int i = 0; i < asset_count; i++)
+    {
+        for (int encoding = ASSET_IDENTITY; encoding < ASSET_ENCODING_COUNT; encoding++)
+        {
+            free(assets[i].variants[encoding].data);
+        }
+        free(assets[i].path);
+    }
+
+    free(assets);
+    assets = NULL;
+    asset_count = 0;
+    asset_capacity = 0;
+    cached_bytes = 0;
+}
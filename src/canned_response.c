@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <string.h>
+#include "../include/canned_response.h"
+
+static const char file_not_found_html[] =
+    "<!DOCTYPE html>\n"
+    "<html>\n"
+    "<head>\n"
+    "    <title>404 - File Not Found</title>\n"
+    "    <style>\n"
+    "        body { font-family: Arial, sans-serif; text-align: center; margin-top: 100px; }\n"
+    "        .error { color: #e74c3c; }\n"
+    "        .back-link { margin-top: 20px; }\n"
+    "        .back-link a { color: #3498db; text-decoration: none; }\n"
+    "    </style>\n"
+    "</head>\n"
+    "<body>\n"
+    "    <div class=\"error\">\n"
+    "        <h1>404 - File Not Found</h1>\n"
+    "        <p>The requested file could not be found on this server.</p>\n"
+    "    </div>\n"
+    "    <div class=\"back-link\">\n"
+    "        <a href=\"/\">← Back to Home</a>\n"
+    "    </div>\n"
+    "</body>\n"
+    "</html>\n";
+
+static const char file_error_html[] =
+    "<!DOCTYPE html>\n"
+    "<html>\n"
+    "<head>\n"
+    "    <title>500 - Internal Server Error</title>\n"
+    "    <style>\n"
+    "        body { font-family: Arial, sans-serif; text-align: center; margin-top: 100px; }\n"
+    "        .error { color: #e74c3c; }\n"
+    "        .back-link { margin-top: 20px; }\n"
+    "        .back-link a { color: #3498db; text-decoration: none; }\n"
+    "    </style>\n"
+    "</head>\n"
+    "<body>\n"
+    "    <div class=\"error\">\n"
+    "        <h1>500 - Internal Server Error</h1>\n"
+    "        <p>An error occurred while processing your request.</p>\n"
+    "    </div>\n"
+    "    <div class=\"back-link\">\n"
+    "        <a href=\"/\">← Back to Home</a>\n"
+    "    </div>\n"
+    "</body>\n"
+    "</html>\n";
+
+static const char route_not_found_html[] =
+    "<!DOCTYPE html>\n"
+    "<html>\n"
+    "<head><title>404 Not Found</title></head>\n"
+    "<body>\n"
+    "<h1>404 - Page Not Found</h1>\n"
+    "<p>The requested resource was not found on this server.</p>\n"
+    "<p><a href=\"/\">Go back to home</a></p>\n"
+    "</body>\n"
+    "</html>\n";
+
+static const char method_not_allowed_json[] =
+    "{\n"
+    "  \"error\": \"Method Not Allowed\",\n"
+    "  \"message\": \"The HTTP method is not supported for this endpoint\"\n"
+    "}";
+
+static const char payload_too_large_json[] =
+    "{\n"
+    "  \"error\": \"Payload Too Large\",\n"
+    "  \"message\": \"The request body exceeds the limit of this endpoint\"\n"
+    "}";
+
+typedef struct
+{
+    HTTP_STATUS status;
+    const char *content_type;
+    const char *body;
+    int body_length;
+    char headers[96]; // Content-Type and Content-Length, empty until canned_response_init
+    int headers_length;
+} CANNED_ENTRY;
+
+#define CANNED(status, type, body) {status, type, body, sizeof(body) - 1, "", 0}
+
+static CANNED_ENTRY canned[CANNED_RESPONSE_COUNT] = {
+    [CANNED_FILE_NOT_FOUND] = CANNED(HTTP_404_NOT_FOUND, "text/html", file_not_found_html),
+    [CANNED_FILE_ERROR] = CANNED(HTTP_500_INTERNAL_ERROR, "text/html", file_error_html),
+    [CANNED_ROUTE_NOT_FOUND] = CANNED(HTTP_404_NOT_FOUND, "text/html", route_not_found_html),
+    [CANNED_METHOD_NOT_ALLOWED] = CANNED(HTTP_405_METHOD_NOT_ALLOWED, "application/json", method_not_allowed_json),
+    [CANNED_PAYLOAD_TOO_LARGE] = CANNED(HTTP_413_PAYLOAD_TOO_LARGE, "application/json", payload_too_large_json)};
+
+// Call before the event loops start, the entries are read-only afterwards
+void canned_response_init(void)
+{
+    for (int i = 0; i < CANNED_RESPONSE_COUNT; i++)
+    {
+        CANNED_ENTRY *entry = &canned[i];
+        entry->headers_length = snprintf(entry->headers, sizeof(entry->headers),
+                                         "Content-Type: %s\r\n"
+                                         "Content-Length: %d\r\n",
+                                         entry->content_type, entry->body_length);
+    }
+}
+
+void canned_response_set(HTTP_RESPONSE *response, CANNED_RESPONSE id)
+{
+    const CANNED_ENTRY *entry = &canned[id];
+
+    http_response_set_status(response, entry->status);
+    if (entry->headers_length > 0)
+    {
+        http_response_set_shared_body(response, entry->body, entry->body_length,
+                                      entry->headers, entry->headers_length);
+    }
+    else
+    {
+        http_response_set_content_type(response, entry->content_type);
+        http_response_set_shared_body(response, entry->body, entry->body_length, NULL, 0);
+    }
+}
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include "../include/config.h"
+#include "../include/compress.h"
+
+static const char *encoding_names[COMPRESS_ENCODING_COUNT] = {NULL, "gzip", "deflate"};
+
+// Streams of the calling thread, created on first use. The key only exists
+// to free them when the thread exits
+static __thread z_stream *thread_streams[COMPRESS_ENCODING_COUNT];
+static pthread_key_t streams_key;
+static pthread_once_t streams_key_once = PTHREAD_ONCE_INIT;
+
+static void free_thread_streams(void *unused)
+{
+    (void)unused;
+
+    for (int i = 0; i < COMPRESS_ENCODING_COUNT; i++)
+    {
+        if (thread_streams[i])
+        {
+            deflateEnd(thread_streams[i]);
+            free(thread_streams[i]);
+            thread_streams[i] = NULL;
+        }
+    }
+}
+
+static void create_streams_key(void)
+{
+    pthread_key_create(&streams_key, free_thread_streams);
+}
+
+// Formats that are already compressed gain nothing from another pass.
+// Parameters such as "; charset=utf-8" are ignored
+bool compress_is_compressible(const char *mime_type)
+{
+    static const char *types[] = {
+        "application/javascript", "application/json", "application/xml",
+        "image/svg+xml", "image/x-icon", "font/ttf", "font/otf"};
+
+    size_t length = strcspn(mime_type, "; ");
+    if (length >= 5 && strncmp(mime_type, "text/", 5) == 0)
+    {
+        return true;
+    }
+
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+    {
+        if (strlen(types[i]) == length && strncmp(mime_type, types[i], length) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Content-Encoding token of an encoding, NULL for none
+const char *compress_encoding_name(COMPRESS_ENCODING encoding)
+{
+    return (encoding > COMPRESS_NONE && encoding < COMPRESS_ENCODING_COUNT) ? encoding_names[encoding] : NULL;
+}
+
+// This thread's deflate stream for encoding, reset for a new body. NULL if
+// it cannot be set up
+z_stream *compress_thread_stream(COMPRESS_ENCODING encoding)
+{
+    if (encoding <= COMPRESS_NONE || encoding >= COMPRESS_ENCODING_COUNT)
+    {
+        return NULL;
+    }
+
+    z_stream *stream = thread_streams[encoding];
+    if (stream)
+    {
+        return deflateReset(stream) == Z_OK ? stream : NULL;
+    }
+
+    stream = calloc(1, sizeof(z_stream));
+    if (!stream)
+    {
+        return NULL;
+    }
+
+    // windowBits 15 + 16 writes a gzip header instead of a zlib one
+    int window_bits = (encoding == COMPRESS_GZIP) ? 15 + 16 : 15;
+    if (deflateInit2(stream, COMPRESS_LEVEL, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        free(stream);
+        return NULL;
+    }
+
+    pthread_once(&streams_key_once, create_streams_key);
+    pthread_setspecific(streams_key, thread_streams);
+    thread_streams[encoding] = stream;
+    return stream;
+}
+
+// Output space compress_buffer needs for length bytes, 0 if the encoding
+// cannot be used
+size_t compress_bound(COMPRESS_ENCODING encoding, size_t length)
+{
+    z_stream *stream = compress_thread_stream(encoding);
+    if (!stream || length > UINT_MAX)
+    {
+        return 0;
+    }
+    return deflateBound(stream, length);
+}
+
+// Compress a whole body in one pass into output (compress_bound bytes).
+// Returns the compressed size, 0 if that fails or it would not be smaller
+size_t compress_buffer(COMPRESS_ENCODING encoding, const char *data, size_t length, char *output, size_t output_size)
+{
+    z_stream *stream = compress_thread_stream(encoding);
+    if (!stream || length > UINT_MAX || output_size > UINT_MAX)
+    {
+        return 0;
+    }
+
+    stream->next_in = (Bytef *)data;
+    stream->avail_in = (uInt)length;
+    stream->next_out = (Bytef *)output;
+    stream->avail_out = (uInt)output_size;
+
+    if (deflate(stream, Z_FINISH) != Z_STREAM_END || stream->total_out >= length)
+    {
+        return 0;
+    }
+    return stream->total_out;
+}
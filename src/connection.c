@@ -0,0 +1,774 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include "../include/config.h"
+#include "../include/connection.h"
+#include "../include/log.h"
+#include "../include/metrics.h"
+
+CONNECTION *connection_create(int socket_fd, const struct sockaddr_in *client_addr)
+{
+    CONNECTION *conn = malloc(sizeof(CONNECTION));
+    if (!conn)
+    {
+        return NULL;
+    }
+
+    memset(conn, 0, sizeof(CONNECTION));
+    conn->socket_fd = socket_fd;
+    conn->client_addr = *client_addr;
+    conn->state = CONN_READING;
+    conn->splice_pipe[0] = -1;
+    conn->splice_pipe[1] = -1;
+    http_parser_init(&conn->parser);
+    arena_init(&conn->arena);
+
+    conn->read_buffer = malloc(BUFFER_SIZE);
+    if (!conn->read_buffer)
+    {
+        free(conn);
+        return NULL;
+    }
+
+    conn->read_capacity = BUFFER_SIZE;
+    conn->read_buffer[0] = '\0';
+
+    metrics_connection_opened();
+    return conn;
+}
+
+// How far the read buffer may fill for the request being parsed: its
+// headers, plus a buffered body with room for the framing not decoded yet.
+// A streamed body only gets the room reserved behind its headers, the
+// buffer must not move while its handler waits for more
+static size_t connection_read_limit(const CONNECTION *conn)
+{
+    const HTTP_PARSER *parser = &conn->parser;
+    if (conn->suspended)
+    {
+        return conn->read_offset + conn->request_length + BODY_STREAM_BUFFER_SIZE;
+    }
+    if (parser->state == HTTP_PARSE_BODY && parser->body_mode == HTTP_BODY_BUFFERED)
+    {
+        return conn->read_offset + parser->header_length + parser->body_limit + MAX_REQUEST_SIZE;
+    }
+    return conn->read_offset + MAX_REQUEST_SIZE;
+}
+
+// Grow the read buffer to hold size bytes and the NUL terminator
+static int connection_grow_read_buffer(CONNECTION *conn, size_t size)
+{
+    if (size < conn->read_capacity)
+    {
+        return 0;
+    }
+
+    size_t new_capacity = conn->read_capacity * 2;
+    if (new_capacity < size + 1)
+    {
+        new_capacity = size + 1;
+    }
+
+    char *new_buffer = realloc(conn->read_buffer, new_capacity);
+    if (!new_buffer)
+    {
+        return -1;
+    }
+
+    conn->read_buffer = new_buffer;
+    conn->read_capacity = new_capacity;
+    return 0;
+}
+
+// Drain the socket into the read buffer, up to the limit of the request
+// being parsed. Returns 1 when data was read and the socket would block,
+// 2 when the limit stopped reading (parse, then read again), 0 on EOF,
+// -1 on error
+int connection_read(CONNECTION *conn)
+{
+    size_t limit = connection_read_limit(conn);
+
+    while (1)
+    {
+        if (conn->read_length >= limit)
+        {
+            return 2;
+        }
+
+        if (conn->read_length + 1 >= conn->read_capacity)
+        {
+            size_t size = conn->read_capacity * 2 - 1;
+            if (connection_grow_read_buffer(conn, size < limit ? size : limit) < 0)
+            {
+                return -1;
+            }
+        }
+
+        size_t space = conn->read_capacity - conn->read_length - 1;
+        if (space > limit - conn->read_length)
+        {
+            space = limit - conn->read_length;
+        }
+        ssize_t bytes = recv(conn->socket_fd, conn->read_buffer + conn->read_length, space, 0);
+
+        if (bytes > 0)
+        {
+            timing_begin(&conn->timing);
+            conn->read_length += bytes;
+            conn->bytes_read += bytes;
+            metrics_add_bytes_in(bytes);
+            conn->read_buffer[conn->read_length] = '\0';
+            continue;
+        }
+
+        if (bytes == 0)
+        {
+            conn->read_closed = 1;
+            return 0;
+        }
+
+        if (errno == EINTR)
+        {
+            continue;
+        }
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            return 1;
+        }
+
+        conn->read_closed = 1;
+        return -1;
+    }
+}
+
+// Append bytes that were received elsewhere (e.g. an io_uring buffer).
+// Returns 0 on success, -1 if the request grows beyond its limit
+int connection_append(CONNECTION *conn, const char *data, size_t length)
+{
+    if (conn->read_length + length > connection_read_limit(conn))
+    {
+        LOG_INFO("Request too large from client\n");
+        conn->parser.too_large = conn->parser.state == HTTP_PARSE_BODY;
+        return -1;
+    }
+
+    if (connection_grow_read_buffer(conn, conn->read_length + length) < 0)
+    {
+        return -1;
+    }
+
+    timing_begin(&conn->timing);
+    memcpy(conn->read_buffer + conn->read_length, data, length);
+    conn->read_length += length;
+    conn->bytes_read += length;
+    metrics_add_bytes_in(length);
+    conn->read_buffer[conn->read_length] = '\0';
+    return 0;
+}
+
+// Feed newly received bytes to the parser and remember the request size once
+// it is complete. Returns the request size, 0 if more data is needed, -1 if
+// the request is malformed or too large. A body over its limit leaves
+// parser.too_large set, the request is answered with 413 before closing.
+// A request whose handler waits for its streamed body stays the current
+// one, the new bytes are for the handler
+int connection_next_request(CONNECTION *conn)
+{
+    if (conn->parser.too_large)
+    {
+        return -1;
+    }
+
+    if (conn->suspended)
+    {
+        return (int)conn->request_length;
+    }
+
+    HTTP_PARSE_RESULT result = http_parser_feed(&conn->parser,
+                                                conn->read_buffer + conn->read_offset,
+                                                conn->read_length - conn->read_offset);
+
+    // Chunk framing the parser cut out of a buffered body
+    conn->read_length -= conn->parser.removed;
+    conn->read_buffer[conn->read_length] = '\0';
+
+    if (result == HTTP_PARSE_NEED_MORE && conn->read_length >= connection_read_limit(conn))
+    {
+        LOG_INFO("Request too large from client\n");
+        conn->parser.too_large = conn->parser.state == HTTP_PARSE_BODY;
+        return -1;
+    }
+
+    if (result != HTTP_PARSE_COMPLETE)
+    {
+        return result;
+    }
+
+    // A streamed body is read into the space behind the headers. Make room
+    // now, the request points into the buffer once it is handled
+    if (conn->parser.body_mode == HTTP_BODY_STREAMED &&
+        connection_grow_read_buffer(conn, conn->read_offset + conn->parser.header_length +
+                                              BODY_STREAM_BUFFER_SIZE) < 0)
+    {
+        return -1;
+    }
+
+    conn->request_length = conn->parser.request_length;
+    conn->body_chunk = 0;
+    return (int)conn->request_length;
+}
+
+// Drop the body chunk handed out last, pulling up what was read behind it
+static void connection_drop_body_chunk(CONNECTION *conn)
+{
+    if (conn->body_chunk == 0)
+    {
+        return;
+    }
+
+    size_t start = conn->read_offset + conn->request_length;
+    memmove(conn->read_buffer + start, conn->read_buffer + start + conn->body_chunk,
+            conn->read_length - start - conn->body_chunk);
+    conn->read_length -= conn->body_chunk;
+    conn->read_buffer[conn->read_length] = '\0';
+    conn->body_chunk = 0;
+}
+
+// Next piece of a streamed request body, decoded in the read buffer right
+// behind the headers and valid until the next call. Nothing waits for the
+// client: once the bytes received so far are used up the handler returns,
+// and is called again when the event loop has read more. Returns 1 with a
+// chunk, 0 at the end of the body, HTTP_BODY_PENDING if the rest has not
+// arrived yet, -1 if it is malformed or too large
+int connection_next_body_chunk(CONNECTION *conn, HTTP_SLICE *chunk)
+{
+    size_t start = conn->read_offset + conn->request_length;
+
+    connection_drop_body_chunk(conn);
+    chunk->data = conn->read_buffer + start;
+    chunk->length = 0;
+    conn->body_starved = 0;
+
+    while (!http_parser_body_done(&conn->parser))
+    {
+        if (conn->read_length > start)
+        {
+            size_t consumed;
+            size_t decoded;
+            if (http_parser_body(&conn->parser, conn->read_buffer + start, conn->read_length - start,
+                                 &consumed, &decoded) == HTTP_PARSE_ERROR)
+            {
+                return -1;
+            }
+
+            // Close the gap the framing leaves behind the decoded bytes
+            memmove(conn->read_buffer + start + decoded, conn->read_buffer + start + consumed,
+                    conn->read_length - start - consumed);
+            conn->read_length -= consumed - decoded;
+            conn->read_buffer[conn->read_length] = '\0';
+
+            if (decoded > 0)
+            {
+                chunk->length = decoded;
+                conn->body_chunk = decoded;
+                return 1;
+            }
+            continue;
+        }
+
+        // Everything received so far is decoded
+        conn->body_starved = 1;
+        return HTTP_BODY_PENDING;
+    }
+
+    return 0;
+}
+
+// Zeroed memory of size bytes that lives as long as the batch, the same
+// block on every call until the request is answered. NULL if it cannot be
+// allocated
+void *connection_body_state(CONNECTION *conn, size_t size)
+{
+    if (!conn->body_state)
+    {
+        conn->body_state = arena_alloc(&conn->arena, size);
+        if (conn->body_state)
+        {
+            memset(conn->body_state, 0, size);
+        }
+    }
+    return conn->body_state;
+}
+
+// Release the last body chunk once the handler is done. Returns 0 if the
+// whole body was read, -1 if the rest of it is still in the way of the
+// next request
+int connection_finish_body(CONNECTION *conn)
+{
+    connection_drop_body_chunk(conn);
+    return http_parser_body_done(&conn->parser) ? 0 : -1;
+}
+
+// Step past the request that was just answered and start parsing the next one
+void connection_consume_request(CONNECTION *conn)
+{
+    conn->read_offset += conn->request_length;
+    conn->request_length = 0;
+    http_parser_init(&conn->parser);
+}
+
+// Move file bytes to the socket with splice(2) through a pipe, for files
+// sendfile refuses. Returns the bytes that reached the socket, like send
+static ssize_t connection_splice_file(CONNECTION *conn, WRITE_SEGMENT *segment)
+{
+    if (conn->splice_pipe[0] < 0 && pipe2(conn->splice_pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+        return -1;
+    }
+
+    // Refill the pipe only once the previous chunk is out, the segment
+    // offset counts bytes that reached the socket
+    if (conn->splice_pending == 0)
+    {
+        loff_t offset = segment->offset;
+        ssize_t filled = splice(segment->fd, &offset, conn->splice_pipe[1], NULL,
+                                segment->length, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (filled <= 0)
+        {
+            return -1;
+        }
+        conn->splice_pending = filled;
+    }
+
+    ssize_t bytes = splice(conn->splice_pipe[0], NULL, conn->socket_fd, NULL,
+                           conn->splice_pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (bytes > 0)
+    {
+        conn->splice_pending -= bytes;
+    }
+    return bytes;
+}
+
+// Send a file segment from the page cache, the contents never pass through
+// userspace
+static ssize_t connection_send_file(CONNECTION *conn, WRITE_SEGMENT *segment)
+{
+    if (conn->splice_pending == 0)
+    {
+        off_t offset = segment->offset;
+        ssize_t bytes = sendfile(conn->socket_fd, segment->fd, &offset, segment->length);
+        if (bytes >= 0 || (errno != EINVAL && errno != ENOSYS))
+        {
+            return bytes;
+        }
+    }
+
+    return connection_splice_file(conn, segment);
+}
+
+// Send as much of the queued responses as the socket accepts.
+// Returns 1 when everything was sent, 0 when the socket would block, -1 on error
+int connection_write(CONNECTION *conn)
+{
+    while (conn->write_pending > 0)
+    {
+        ssize_t bytes;
+        WRITE_SEGMENT *segment = &conn->segments[conn->segment_index];
+
+        if (segment->fd >= 0)
+        {
+            bytes = connection_send_file(conn, segment);
+        }
+        else
+        {
+            // sendmsg rather than writev, a closed peer must not raise SIGPIPE.
+            // MSG_MORE lets headers share a packet with the file that follows
+            int count = connection_prepare_write(conn);
+            int flags = MSG_NOSIGNAL;
+            if (conn->segment_index + count < conn->segment_count)
+            {
+                flags |= MSG_MORE;
+            }
+            bytes = sendmsg(conn->socket_fd, &conn->write_message, flags);
+        }
+
+        if (bytes > 0)
+        {
+            connection_advance_write(conn, bytes);
+            continue;
+        }
+
+        if (bytes < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return 0;
+        }
+
+        return -1;
+    }
+
+    return 1;
+}
+
+static WRITE_SEGMENT *connection_add_segment(CONNECTION *conn)
+{
+    if (conn->segment_count == conn->segment_capacity)
+    {
+        int new_capacity = conn->segment_capacity ? conn->segment_capacity * 2 : 2 * PIPELINE_MAX_REQUESTS;
+        WRITE_SEGMENT *segments = realloc(conn->segments, new_capacity * sizeof(WRITE_SEGMENT));
+        if (!segments)
+        {
+            return NULL;
+        }
+
+        conn->segments = segments;
+        conn->segment_capacity = new_capacity;
+    }
+
+    WRITE_SEGMENT *segment = &conn->segments[conn->segment_count++];
+    segment->data = NULL;
+    segment->owned = 0;
+    segment->fd = -1;
+    segment->file = NULL;
+    return segment;
+}
+
+// Queue length bytes already formatted at offset in the write buffer.
+// Consecutive header blocks are merged into one segment
+int connection_queue_write(CONNECTION *conn, size_t offset, size_t length)
+{
+    if (length == 0)
+    {
+        return 0;
+    }
+
+    if (conn->segment_count > conn->segment_index)
+    {
+        WRITE_SEGMENT *last = &conn->segments[conn->segment_count - 1];
+        if (!last->data && last->fd < 0 && (size_t)last->offset + last->length == offset)
+        {
+            last->length += length;
+            conn->write_pending += length;
+            return 0;
+        }
+    }
+
+    WRITE_SEGMENT *segment = connection_add_segment(conn);
+    if (!segment)
+    {
+        return -1;
+    }
+
+    segment->offset = offset;
+    segment->length = length;
+    conn->write_pending += length;
+    return 0;
+}
+
+// Queue a malloc'd body without copying it. The connection frees it once
+// it is sent, or right away if it cannot be queued
+int connection_queue_body(CONNECTION *conn, char *body, size_t length)
+{
+    if (length == 0)
+    {
+        free(body);
+        return 0;
+    }
+
+    WRITE_SEGMENT *segment = connection_add_segment(conn);
+    if (!segment)
+    {
+        free(body);
+        return -1;
+    }
+
+    segment->data = body;
+    segment->owned = 1;
+    segment->offset = 0;
+    segment->length = length;
+    conn->write_pending += length;
+    return 0;
+}
+
+// Queue bytes that stay valid until the batch is sent (the asset cache, the
+// connection arena), sent in place
+int connection_queue_shared(CONNECTION *conn, const char *data, size_t length)
+{
+    if (length == 0)
+    {
+        return 0;
+    }
+
+    WRITE_SEGMENT *segment = connection_add_segment(conn);
+    if (!segment)
+    {
+        return -1;
+    }
+
+    segment->data = data;
+    segment->offset = 0;
+    segment->length = length;
+    conn->write_pending += length;
+    return 0;
+}
+
+// Release what a segment holds: a malloc'd body, an open file or a file
+// cache reference
+static void connection_release_segment(WRITE_SEGMENT *segment)
+{
+    if (segment->owned)
+    {
+        free((char *)segment->data);
+    }
+    segment->data = NULL;
+    segment->owned = 0;
+
+    if (segment->file)
+    {
+        file_cache_release(segment->file);
+    }
+    else if (segment->fd >= 0)
+    {
+        close(segment->fd);
+    }
+    segment->file = NULL;
+    segment->fd = -1;
+}
+
+// Queue length bytes of an open file, sent with sendfile. With a file cache
+// entry the fd stays open and the reference is released once it is sent;
+// otherwise the connection closes the fd. Either happens right away if the
+// file cannot be queued
+int connection_queue_file(CONNECTION *conn, int fd, FILE_CACHE_ENTRY *entry, off_t offset, size_t length)
+{
+    WRITE_SEGMENT *segment = (length > 0) ? connection_add_segment(conn) : NULL;
+    if (!segment)
+    {
+        WRITE_SEGMENT unsent = {NULL, 0, fd, entry, 0, 0};
+        connection_release_segment(&unsent);
+        return (length > 0) ? -1 : 0;
+    }
+
+    segment->fd = fd;
+    segment->file = entry;
+    segment->offset = offset;
+    segment->length = length;
+    conn->write_pending += length;
+    return 0;
+}
+
+// Point write_message at the unsent in-memory segments up to the next file,
+// returns the number of iovecs. The pointers stay valid until the next call
+// that queues or advances
+int connection_prepare_write(CONNECTION *conn)
+{
+    int count = 0;
+
+    for (int i = conn->segment_index; i < conn->segment_count && count < WRITE_IOV_MAX; i++)
+    {
+        WRITE_SEGMENT *segment = &conn->segments[i];
+        if (segment->fd >= 0)
+        {
+            break;
+        }
+
+        const char *base = segment->data ? segment->data : conn->write_buffer;
+
+        conn->write_iov[count].iov_base = (char *)base + segment->offset;
+        conn->write_iov[count].iov_len = segment->length;
+        count++;
+    }
+
+    memset(&conn->write_message, 0, sizeof(conn->write_message));
+    conn->write_message.msg_iov = conn->write_iov;
+    conn->write_message.msg_iovlen = count;
+    return count;
+}
+
+// Account for bytes the socket accepted, releasing the bodies that went out
+void connection_advance_write(CONNECTION *conn, size_t bytes)
+{
+    conn->bytes_written += bytes;
+    conn->write_pending -= bytes;
+    metrics_add_bytes_out(bytes);
+
+    while (bytes > 0 && conn->segment_index < conn->segment_count)
+    {
+        WRITE_SEGMENT *segment = &conn->segments[conn->segment_index];
+        size_t sent = (bytes < segment->length) ? bytes : segment->length;
+
+        segment->offset += sent;
+        segment->length -= sent;
+        bytes -= sent;
+
+        if (segment->length > 0)
+        {
+            // Partial write, resume inside this segment
+            break;
+        }
+
+        connection_release_segment(segment);
+        conn->segment_index++;
+    }
+
+    if (conn->write_pending == 0 && conn->timing.sending)
+    {
+        timing_finish(&conn->timing, &conn->client_addr);
+    }
+}
+
+static void connection_release_segments(CONNECTION *conn)
+{
+    for (int i = conn->segment_index; i < conn->segment_count; i++)
+    {
+        connection_release_segment(&conn->segments[i]);
+    }
+
+    conn->segment_count = 0;
+    conn->segment_index = 0;
+    conn->write_pending = 0;
+}
+
+// Move the unsent part of the write buffer to its start, the bytes in front
+// of the first pending segment that points into it went out already
+static void connection_compact_write(CONNECTION *conn)
+{
+    int first = -1;
+    for (int i = conn->segment_index; i < conn->segment_count; i++)
+    {
+        const WRITE_SEGMENT *segment = &conn->segments[i];
+        if (!segment->data && segment->fd < 0)
+        {
+            first = i;
+            break;
+        }
+    }
+
+    size_t start = (first >= 0) ? (size_t)conn->segments[first].offset : conn->write_length;
+    if (start == 0)
+    {
+        return;
+    }
+
+    memmove(conn->write_buffer, conn->write_buffer + start, conn->write_length - start);
+    conn->write_length -= start;
+    for (int i = (first >= 0) ? first : conn->segment_count; i < conn->segment_count; i++)
+    {
+        WRITE_SEGMENT *segment = &conn->segments[i];
+        if (!segment->data && segment->fd < 0)
+        {
+            segment->offset -= start;
+        }
+    }
+}
+
+// Send what the socket takes right now without waiting for it (streamed
+// responses, on whatever thread runs the handler). The rest stays queued
+// for the event loop to send, moved to the front of the write buffer so it
+// does not grow with the bytes already sent. Returns -1 on error or once
+// more than STREAM_MAX_PENDING bytes wait for a client that is not reading
+int connection_flush(CONNECTION *conn)
+{
+    int result = connection_write(conn);
+    if (result < 0)
+    {
+        return -1;
+    }
+
+    if (result > 0)
+    {
+        conn->write_length = 0;
+        connection_release_segments(conn);
+        return 0;
+    }
+
+    connection_compact_write(conn);
+    return (conn->write_pending > STREAM_MAX_PENDING) ? -1 : 0;
+}
+
+// Make sure the write buffer can hold at least size bytes
+int connection_reserve_write(CONNECTION *conn, size_t size)
+{
+    if (conn->write_buffer && size <= conn->write_capacity)
+    {
+        return 0;
+    }
+
+    // Grow geometrically, pipelined responses are appended one by one
+    size_t new_capacity = conn->write_capacity * 2;
+    if (new_capacity < size)
+    {
+        new_capacity = size;
+    }
+    if (new_capacity < MAX_RESPONSE_HEADER_SIZE)
+    {
+        new_capacity = MAX_RESPONSE_HEADER_SIZE;
+    }
+    char *buffer = realloc(conn->write_buffer, new_capacity);
+    if (!buffer)
+    {
+        return -1;
+    }
+
+    conn->write_buffer = buffer;
+    conn->write_capacity = new_capacity;
+    return 0;
+}
+
+// Drop the requests that were just answered, keeping any bytes the client
+// already sent for the next ones
+void connection_reset_request(CONNECTION *conn)
+{
+    size_t leftover = conn->read_length - conn->read_offset;
+    if (leftover > 0 && conn->read_offset > 0)
+    {
+        memmove(conn->read_buffer, conn->read_buffer + conn->read_offset, leftover);
+    }
+
+    conn->read_length = leftover;
+    conn->read_buffer[leftover] = '\0';
+    conn->read_offset = 0;
+    conn->request_length = 0;
+    conn->write_length = 0;
+    connection_release_segments(conn);
+    arena_reset(&conn->arena);
+    conn->state = CONN_READING;
+}
+
+void connection_destroy(CONNECTION *conn)
+{
+    if (!conn)
+    {
+        return;
+    }
+
+    metrics_connection_closed();
+    if (conn->socket_fd >= 0)
+    {
+        close(conn->socket_fd);
+        conn->socket_fd = -1;
+    }
+
+    connection_release_segments(conn);
+    free(conn->segments);
+    if (conn->splice_pipe[0] >= 0)
+    {
+        close(conn->splice_pipe[0]);
+        close(conn->splice_pipe[1]);
+    }
+    arena_destroy(&conn->arena);
+    free(conn->read_buffer);
+    free(conn->write_buffer);
+    free(conn);
+}
@@ -2,6 +2,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include "../include/database.h"
+#include "../include/log.h"
+#include "../include/metrics.h"
+#include "../include/timing.h"
 
 int db_init(Database *db, const char *path)
 {
@@ -57,7 +60,50 @@ int db_create_tables(Database *db)
     return 0;
 }
 
-int db_create_user(Database *db, const char *name, const char *email, const char *password)
+// A db_* call that began at start is over: its time goes to the request
+// being handled and to the metrics
+static void observe_call(METRICS_DB_OP op, uint64_t start)
+{
+    uint64_t elapsed = timing_now() - start;
+    timing_add(TIMING_DB, elapsed);
+    metrics_observe_db(op, timing_to_ns(elapsed));
+}
+
+static int db_exec(Database *db, const char *sql)
+{
+    if (!db || !db->db)
+        return -1;
+
+    char *err_msg = 0;
+    int rc = sqlite3_exec(db->db, sql, 0, 0, &err_msg);
+
+    if (rc != SQLITE_OK)
+    {
+        LOG_ERROR("SQL error: %s\n", err_msg);
+        sqlite3_free(err_msg);
+        return -1;
+    }
+    return 0;
+}
+
+// Group many writes into one commit (bulk imports)
+int db_begin_transaction(Database *db)
+{
+    uint64_t start = timing_now();
+    int result = db_exec(db, "BEGIN;");
+    observe_call(METRICS_DB_BEGIN, start);
+    return result;
+}
+
+int db_commit_transaction(Database *db)
+{
+    uint64_t start = timing_now();
+    int result = db_exec(db, "COMMIT;");
+    observe_call(METRICS_DB_COMMIT, start);
+    return result;
+}
+
+static int insert_user(Database *db, const char *name, const char *email, const char *password)
 {
     if (!db || !db->db || !name || !email || !password)
         return -1;
@@ -68,7 +114,7 @@ int db_create_user(Database *db, const char *name, const char *email, const char
     int rc = sqlite3_prepare_v2(db->db, sql, -1, &stmt, NULL);
     if (rc != SQLITE_OK)
     {
-        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db->db));
+        LOG_ERROR("Failed to prepare statement: %s\n", sqlite3_errmsg(db->db));
         return -1;
     }
 
@@ -81,7 +127,7 @@ int db_create_user(Database *db, const char *name, const char *email, const char
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_DONE)
     {
-        fprintf(stderr, "Failed to insert user: %s\n", sqlite3_errmsg(db->db));
+        LOG_ERROR("Failed to insert user: %s\n", sqlite3_errmsg(db->db));
         sqlite3_finalize(stmt);
         return -1;
     }
@@ -90,7 +136,7 @@ int db_create_user(Database *db, const char *name, const char *email, const char
     int user_id = (int)sqlite3_last_insert_rowid(db->db);
 
     sqlite3_finalize(stmt);
-    printf("User created with ID: %d\n", user_id);
+    LOG_DEBUG("User created with ID: %d\n", user_id);
     return user_id;
 }
 
@@ -105,9 +151,12 @@ void init_user_query_params(UserQueryParams *params)
     params->filter_count = 0;
 }
 
-int db_get_users(Database *db, char *json_output, int max_len, const UserQueryParams *params)
+// Stream the matching users as one JSON object through write, a row at a
+// time while the cursor advances. Nothing is written if the queries fail.
+// Returns the number of users, -1 on error or if write gave up
+static int query_users(Database *db, DB_WRITE_FUNC write, void *context, const UserQueryParams *params)
 {
-    if (!db || !db->db || !json_output || max_len <= 0 || !params)
+    if (!db || !db->db || !write || !params)
     {
         return -1;
     }
@@ -171,7 +220,7 @@ int db_get_users(Database *db, char *json_output, int max_len, const UserQueryPa
 
         if (where_remaining <= 0)
         {
-            fprintf(stderr, "WHERE clause too long\n");
+            LOG_WARN("WHERE clause too long\n");
             return -1;
         }
     }
@@ -211,7 +260,7 @@ int db_get_users(Database *db, char *json_output, int max_len, const UserQueryPa
     int rc = sqlite3_prepare_v2(db->db, count_sql, -1, &count_stmt, NULL);
     if (rc != SQLITE_OK)
     {
-        fprintf(stderr, "Failed to prepare count statement: %s\n", sqlite3_errmsg(db->db));
+        LOG_ERROR("Failed to prepare count statement: %s\n", sqlite3_errmsg(db->db));
         return -1;
     }
 
@@ -269,7 +318,7 @@ int db_get_users(Database *db, char *json_output, int max_len, const UserQueryPa
     rc = sqlite3_prepare_v2(db->db, sql, -1, &stmt, NULL);
     if (rc != SQLITE_OK)
     {
-        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db->db));
+        LOG_ERROR("Failed to prepare statement: %s\n", sqlite3_errmsg(db->db));
         return -1;
     }
 
@@ -319,57 +368,70 @@ int db_get_users(Database *db, char *json_output, int max_len, const UserQueryPa
     sqlite3_bind_int(stmt, param_index++, params->limit);
     sqlite3_bind_int(stmt, param_index++, params->offset);
 
-    // Build JSON response
-    int written = snprintf(json_output, max_len, "{\"users\":[");
-    if (written >= max_len)
+    // Write the JSON as rows come in, one user object at a time
+    char json[USER_JSON_MAX_LENGTH + 1];
+    int user_count = 0;
+
+    rc = sqlite3_step(stmt);
+    if ((rc != SQLITE_ROW && rc != SQLITE_DONE) || write(context, "{\"users\":[", 10) < 0)
     {
         sqlite3_finalize(stmt);
         return -1;
     }
 
-    int first = 1;
-    int user_count = 0;
-
-    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    for (; rc == SQLITE_ROW; rc = sqlite3_step(stmt))
     {
         int id = sqlite3_column_int(stmt, 0);
         const char *name = (const char *)sqlite3_column_text(stmt, 1);
         const char *email = (const char *)sqlite3_column_text(stmt, 2);
         const char *created_at = (const char *)sqlite3_column_text(stmt, 3);
 
-        if (!first)
+        const char *format = "%s{\"id\":%d,\"name\":\"%s\",\"email\":\"%s\",\"created_at\":\"%s\"}";
+        const char *separator = user_count ? "," : "";
+        name = name ? name : "";
+        email = email ? email : "";
+        created_at = created_at ? created_at : "";
+
+        int written = snprintf(json, sizeof(json), format, separator, id, name, email, created_at);
+        char *row = json;
+
+        // Unusually long values get a buffer of their own
+        if (written >= (int)sizeof(json))
         {
-            written += snprintf(json_output + written, max_len - written, ",");
-            if (written >= max_len)
-                break;
+            row = malloc(written + 1);
+            if (row)
+            {
+                snprintf(row, written + 1, format, separator, id, name, email, created_at);
+            }
         }
 
-        int user_written = snprintf(json_output + written, max_len - written,
-                                    "{\"id\":%d,\"name\":\"%s\",\"email\":\"%s\",\"created_at\":\"%s\"}",
-                                    id, name ? name : "", email ? email : "", created_at ? created_at : "");
-
-        written += user_written;
-        if (written >= max_len)
-            break;
+        int result = row ? write(context, row, written) : -1;
+        if (row != json)
+        {
+            free(row);
+        }
 
-        first = 0;
+        if (result < 0)
+        {
+            sqlite3_finalize(stmt);
+            return -1;
+        }
         user_count++;
     }
 
-    if (rc != SQLITE_DONE && rc != SQLITE_ROW)
+    if (rc != SQLITE_DONE)
     {
-        fprintf(stderr, "Error reading users: %s\n", sqlite3_errmsg(db->db));
+        LOG_ERROR("Error reading users: %s\n", sqlite3_errmsg(db->db));
         sqlite3_finalize(stmt);
         return -1;
     }
 
-    written += snprintf(json_output + written, max_len - written,
-                        "],\"count\":%d,\"total\":%d,\"limit\":%d,\"offset\":%d}",
-                        user_count, total_count, params->limit, params->offset);
-
     sqlite3_finalize(stmt);
 
-    if (written >= max_len)
+    int written = snprintf(json, sizeof(json),
+                           "],\"count\":%d,\"total\":%d,\"limit\":%d,\"offset\":%d}",
+                           user_count, total_count, params->limit, params->offset);
+    if (write(context, json, written) < 0)
     {
         return -1;
     }
@@ -377,7 +439,7 @@ int db_get_users(Database *db, char *json_output, int max_len, const UserQueryPa
     return user_count;
 }
 
-int db_get_user_by_id(Database *db, int id, char *json_output, int max_len)
+static int query_user_by_id(Database *db, int id, char *json_output, int max_len)
 {
     if (!db || !db->db || !json_output || max_len <= 0 || id <= 0)
     {
@@ -390,7 +452,7 @@ int db_get_user_by_id(Database *db, int id, char *json_output, int max_len)
     int rc = sqlite3_prepare_v2(db->db, sql, -1, &stmt, NULL);
     if (rc != SQLITE_OK)
     {
-        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db->db));
+        LOG_ERROR("Failed to prepare statement: %s\n", sqlite3_errmsg(db->db));
         return -1;
     }
 
@@ -427,13 +489,13 @@ int db_get_user_by_id(Database *db, int id, char *json_output, int max_len)
     else
     {
         // Error
-        fprintf(stderr, "Error querying user: %s\n", sqlite3_errmsg(db->db));
+        LOG_ERROR("Error querying user: %s\n", sqlite3_errmsg(db->db));
         sqlite3_finalize(stmt);
         return -1;
     }
 }
 
-int db_update_user(Database *db, int id, const char *name, const char *email)
+static int update_user(Database *db, int id, const char *name, const char *email)
 {
     if (!db || !db->db || id <= 0 || !name || !email)
     {
@@ -446,7 +508,7 @@ int db_update_user(Database *db, int id, const char *name, const char *email)
     int rc = sqlite3_prepare_v2(db->db, sql, -1, &stmt, NULL);
     if (rc != SQLITE_OK)
     {
-        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db->db));
+        LOG_ERROR("Failed to prepare statement: %s\n", sqlite3_errmsg(db->db));
         return -1;
     }
 
@@ -459,7 +521,7 @@ int db_update_user(Database *db, int id, const char *name, const char *email)
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_DONE)
     {
-        fprintf(stderr, "Failed to update user: %s\n", sqlite3_errmsg(db->db));
+        LOG_ERROR("Failed to update user: %s\n", sqlite3_errmsg(db->db));
         sqlite3_finalize(stmt);
         return -1;
     }
@@ -470,17 +532,17 @@ int db_update_user(Database *db, int id, const char *name, const char *email)
 
     if (rows_affected > 0)
     {
-        printf("User %d updated successfully\n", id);
+        LOG_DEBUG("User %d updated successfully\n", id);
         return 1; // Success
     }
     else
     {
-        printf("User %d not found for update\n", id);
+        LOG_DEBUG("User %d not found for update\n", id);
         return 0; // User not found
     }
 }
 
-int db_delete_user(Database *db, int id)
+static int delete_user(Database *db, int id)
 {
     if (!db || !db->db || id <= 0)
     {
@@ -493,7 +555,7 @@ int db_delete_user(Database *db, int id)
     int rc = sqlite3_prepare_v2(db->db, sql, -1, &stmt, NULL);
     if (rc != SQLITE_OK)
     {
-        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db->db));
+        LOG_ERROR("Failed to prepare statement: %s\n", sqlite3_errmsg(db->db));
         return -1;
     }
 
@@ -502,7 +564,7 @@ int db_delete_user(Database *db, int id)
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_DONE)
     {
-        fprintf(stderr, "Failed to delete user: %s\n", sqlite3_errmsg(db->db));
+        LOG_ERROR("Failed to delete user: %s\n", sqlite3_errmsg(db->db));
         sqlite3_finalize(stmt);
         return -1;
     }
@@ -512,16 +574,78 @@ int db_delete_user(Database *db, int id)
 
     if (rows_affected > 0)
     {
-        printf("User %d deleted successfully\n", id);
+        LOG_DEBUG("User %d deleted successfully\n", id);
         return 1; // Success
     }
     else
     {
-        printf("User %d not found for deletion\n", id);
+        LOG_DEBUG("User %d not found for deletion\n", id);
         return 0; // User not found
     }
 }
 
+// The user operations proper, each call timed for db_call_duration_seconds.
+// A users query is timed until the last row has been written out
+int db_create_user(Database *db, const char *name, const char *email, const char *password)
+{
+    uint64_t start = timing_now();
+    int result = insert_user(db, name, email, password);
+    observe_call(METRICS_DB_CREATE_USER, start);
+    return result;
+}
+
+// The caller's write function, timed so its time can be left out of the query's
+typedef struct
+{
+    DB_WRITE_FUNC write;
+    void *context;
+    uint64_t ticks;
+} TIMED_WRITE;
+
+static int timed_write(void *context, const char *data, size_t length)
+{
+    TIMED_WRITE *timed = context;
+    uint64_t start = timing_now();
+    int result = timed->write(timed->context, data, length);
+    timed->ticks += timing_now() - start;
+    return result;
+}
+
+int db_get_users(Database *db, DB_WRITE_FUNC write, void *context, const UserQueryParams *params)
+{
+    TIMED_WRITE timed = {write, context, 0};
+    uint64_t start = timing_now();
+    int result = query_users(db, write ? timed_write : NULL, &timed, params);
+
+    // Whatever write does with the rows (send them, even) is not the query
+    observe_call(METRICS_DB_GET_USERS, start + timed.ticks);
+    return result;
+}
+
+int db_get_user_by_id(Database *db, int id, char *json_output, int max_len)
+{
+    uint64_t start = timing_now();
+    int result = query_user_by_id(db, id, json_output, max_len);
+    observe_call(METRICS_DB_GET_USER, start);
+    return result;
+}
+
+int db_update_user(Database *db, int id, const char *name, const char *email)
+{
+    uint64_t start = timing_now();
+    int result = update_user(db, id, name, email);
+    observe_call(METRICS_DB_UPDATE_USER, start);
+    return result;
+}
+
+int db_delete_user(Database *db, int id)
+{
+    uint64_t start = timing_now();
+    int result = delete_user(db, id);
+    observe_call(METRICS_DB_DELETE_USER, start);
+    return result;
+}
+
 void db_close(Database *db)
 {
     if (!db)
@@ -0,0 +1,89 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include "../include/date_cache.h"
+
+// Two copies: the timer formats the one readers are not using and then
+// flips current. A reader copies its line long before the timer comes back
+// to that copy a second later
+static char headers[2][DATE_HEADER_SIZE];
+static size_t header_lengths[2];
+static int current = 0;
+
+static pthread_t timer_thread;
+static int timer_running = 0;
+static pthread_mutex_t timer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_cond = PTHREAD_COND_INITIALIZER;
+
+static void format_header(time_t now)
+{
+    int next = !__atomic_load_n(&current, __ATOMIC_RELAXED);
+
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    header_lengths[next] = strftime(headers[next], DATE_HEADER_SIZE, "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+
+    __atomic_store_n(&current, next, __ATOMIC_RELEASE);
+}
+
+static void *timer_main(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&timer_mutex);
+    while (timer_running)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        format_header(now.tv_sec);
+
+        // Sleep until the next second starts, date_cache_cleanup wakes it early
+        struct timespec next_second = {now.tv_sec + 1, 0};
+        pthread_cond_timedwait(&timer_cond, &timer_mutex, &next_second);
+    }
+    pthread_mutex_unlock(&timer_mutex);
+
+    return NULL;
+}
+
+int date_cache_init(void)
+{
+    format_header(time(NULL));
+
+    timer_running = 1;
+    if (pthread_create(&timer_thread, NULL, timer_main, NULL) != 0)
+    {
+        perror("Failed to start date timer");
+        timer_running = 0;
+
+        // A date that stops moving is worse than none
+        header_lengths[__atomic_load_n(&current, __ATOMIC_RELAXED)] = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Current Date header line and its length, shared by every thread
+const char *date_cache_header(size_t *length)
+{
+    int index = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+    *length = header_lengths[index];
+    return headers[index];
+}
+
+void date_cache_cleanup(void)
+{
+    if (!timer_running)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&timer_mutex);
+    timer_running = 0;
+    pthread_cond_signal(&timer_cond);
+    pthread_mutex_unlock(&timer_mutex);
+
+    pthread_join(timer_thread, NULL);
+}
@@ -0,0 +1,534 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include "../include/config.h"
+#include "../include/event_loop.h"
+#include "../include/handler.h"
+#include "../include/request.h"
+#include "../include/uring.h"
+#include "../include/log.h"
+
+static time_t monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+// Re-enable events for a connection. Every registration is one-shot, so
+// exactly one thread (event loop or worker) owns a connection at a time.
+static int event_loop_arm(CONNECTION *conn, uint32_t events)
+{
+    struct epoll_event event;
+    event.events = events | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+    event.data.ptr = conn;
+
+    return epoll_ctl(conn->loop->epoll_fd, EPOLL_CTL_MOD, conn->socket_fd, &event);
+}
+
+// Events of a connection waiting for request bytes. Responses queued ahead
+// of a handler that waits for its body are still sent meanwhile
+static uint32_t event_loop_read_events(const CONNECTION *conn)
+{
+    return conn->write_pending > 0 ? EPOLLIN | EPOLLOUT : EPOLLIN;
+}
+
+void event_loop_add_connection(EVENT_LOOP *loop, CONNECTION *conn)
+{
+    conn->loop = loop;
+    conn->last_active = monotonic_seconds();
+
+    conn->prev = NULL;
+    conn->next = loop->connections;
+    if (loop->connections)
+    {
+        loop->connections->prev = conn;
+    }
+    loop->connections = conn;
+    loop->connection_count++;
+    loop->stats.accepted++;
+}
+
+void event_loop_remove_connection(EVENT_LOOP *loop, CONNECTION *conn)
+{
+    // Unlink from the connection list
+    if (conn->prev)
+    {
+        conn->prev->next = conn->next;
+    }
+    else
+    {
+        loop->connections = conn->next;
+    }
+
+    if (conn->next)
+    {
+        conn->next->prev = conn->prev;
+    }
+
+    loop->connection_count--;
+    loop->stats.closed++;
+    loop->stats.requests += conn->requests_served;
+    loop->stats.bytes_read += conn->bytes_read;
+    loop->stats.bytes_written += conn->bytes_written;
+}
+
+static void event_loop_close_connection(EVENT_LOOP *loop, CONNECTION *conn)
+{
+    event_loop_remove_connection(loop, conn);
+
+    // Closing the socket also removes it from the epoll set
+    connection_destroy(conn);
+}
+
+// Handle the buffered (possibly pipelined) requests and start sending the responses
+static void event_loop_execute_requests(CONNECTION *conn)
+{
+    LOG_DEBUG("[Thread %lu] Handling client request from %s:%d\n",
+              pthread_self(),
+              inet_ntoa(conn->client_addr.sin_addr),
+              ntohs(conn->client_addr.sin_port));
+
+    if (handle_http_requests(conn) < 0)
+    {
+        conn->state = CONN_CLOSING;
+    }
+    else
+    {
+        int result = connection_write(conn);
+        if (conn->suspended)
+        {
+            // A handler waits for more of its body, which will never come
+            // from a client that is gone
+            conn->state = (result < 0 || conn->read_closed) ? CONN_CLOSING : CONN_READING;
+        }
+        else if (result == 0)
+        {
+            conn->state = CONN_WRITING;
+        }
+        else if (result > 0 && conn->keep_alive)
+        {
+            LOG_DEBUG("Response sent\n\n");
+            connection_reset_request(conn);
+        }
+        else
+        {
+            conn->state = CONN_CLOSING;
+        }
+    }
+
+    LOG_DEBUG("[Thread %lu] Request handling completed\n", pthread_self());
+}
+
+// Worker thread task
+static void event_loop_process_request(void *arg)
+{
+    CONNECTION *conn = (CONNECTION *)arg;
+
+    timing_mark(&conn->timing, TIMING_QUEUE);
+    event_loop_execute_requests(conn);
+
+    // Hand the connection back to the event loop. EPOLLOUT fires immediately,
+    // which lets the loop close the connection or wait for the next request.
+    // A handler waiting for its body is dispatched again once more arrives.
+    // Requests left over from a batch cut at PIPELINE_MAX_REQUESTS are in the
+    // buffer already, no new bytes would wake the loop for them
+    uint32_t events = EPOLLOUT;
+    if (conn->state == CONN_READING && (conn->suspended || connection_next_request(conn) == 0))
+    {
+        events = event_loop_read_events(conn);
+    }
+    if (event_loop_arm(conn, events) < 0)
+    {
+        LOG_ERROR("epoll_ctl rearm failed: %s\n", strerror(errno));
+    }
+}
+
+static void event_loop_dispatch(EVENT_LOOP *loop, CONNECTION *conn)
+{
+    conn->state = CONN_PROCESSING;
+    conn->in_worker = 1;
+    timing_begin(&conn->timing); // Pipelined requests may be left from the last batch
+    timing_mark(&conn->timing, TIMING_RECV);
+
+    if (threadpool_add_task(loop->pool, event_loop_process_request, conn) < 0)
+    {
+        LOG_ERROR("Failed to add task to thread pool\n");
+        event_loop_close_connection(loop, conn);
+    }
+}
+
+static void event_loop_accept(EVENT_LOOP *loop)
+{
+    while (1)
+    {
+        struct sockaddr_in client_addr;
+        int client_socket = server_accept(loop->server, &client_addr);
+
+        if (client_socket < 0)
+        {
+            // EAGAIN means the accept queue is drained
+            return;
+        }
+
+        if (loop->connection_count >= MAX_CLIENT_CONNECTIONS)
+        {
+            LOG_WARN("Connection limit reached, rejecting client\n");
+            close(client_socket);
+            loop->stats.rejected++;
+            continue;
+        }
+
+        CONNECTION *conn = connection_create(client_socket, &client_addr);
+        if (!conn)
+        {
+            LOG_ERROR("Failed to allocate memory for connection\n");
+            close(client_socket);
+            continue;
+        }
+
+        conn->loop = loop;
+
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+        event.data.ptr = conn;
+
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, client_socket, &event) < 0)
+        {
+            LOG_ERROR("epoll_ctl add failed: %s\n", strerror(errno));
+            connection_destroy(conn);
+            continue;
+        }
+
+        event_loop_add_connection(loop, conn);
+
+        LOG_DEBUG("New connection from %s:%d\n",
+                  inet_ntoa(client_addr.sin_addr),
+                  ntohs(client_addr.sin_port));
+    }
+}
+
+static void event_loop_handle_readable(EVENT_LOOP *loop, CONNECTION *conn, uint32_t events)
+{
+    while (1)
+    {
+        int result = connection_read(conn);
+
+        // A body over its limit is still answered, with 413
+        int length = connection_next_request(conn);
+        if (length < 0 && !conn->parser.too_large)
+        {
+            LOG_INFO("Invalid request framing, closing connection\n");
+            event_loop_close_connection(loop, conn);
+            return;
+        }
+
+        if (length == 0)
+        {
+            // The read stopped at the buffer limit before the socket was drained
+            if (result == 2)
+            {
+                continue;
+            }
+
+            // Need more data, unless the peer went away
+            if (result <= 0 || (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+            {
+                event_loop_close_connection(loop, conn);
+                return;
+            }
+            break;
+        }
+
+        if (loop->pool)
+        {
+            event_loop_dispatch(loop, conn);
+            return;
+        }
+
+        // Shared-nothing mode: the loop thread runs the handler itself
+        conn->state = CONN_PROCESSING;
+        event_loop_execute_requests(conn);
+
+        if (conn->state == CONN_WRITING && event_loop_arm(conn, EPOLLOUT) == 0)
+        {
+            return;
+        }
+
+        if (conn->state != CONN_READING)
+        {
+            event_loop_close_connection(loop, conn);
+            return;
+        }
+
+        if (conn->suspended)
+        {
+            // The handler used up the body bytes read so far
+            break;
+        }
+
+        // Keep-alive and everything was sent: look for the next requests
+    }
+
+    if (event_loop_arm(conn, event_loop_read_events(conn)) < 0)
+    {
+        LOG_ERROR("epoll_ctl rearm failed: %s\n", strerror(errno));
+        event_loop_close_connection(loop, conn);
+    }
+}
+
+static void event_loop_handle_writable(EVENT_LOOP *loop, CONNECTION *conn)
+{
+    if (conn->state == CONN_WRITING)
+    {
+        int result = connection_write(conn);
+        if (result == 0)
+        {
+            if (event_loop_arm(conn, EPOLLOUT) < 0)
+            {
+                LOG_ERROR("epoll_ctl rearm failed: %s\n", strerror(errno));
+                event_loop_close_connection(loop, conn);
+            }
+            return;
+        }
+
+        if (result > 0 && conn->keep_alive)
+        {
+            connection_reset_request(conn);
+            event_loop_handle_readable(loop, conn, 0);
+            return;
+        }
+    }
+
+    // Response fully sent (or failed), close the connection
+    event_loop_close_connection(loop, conn);
+}
+
+static void event_loop_handle_event(EVENT_LOOP *loop, CONNECTION *conn, uint32_t events)
+{
+    // Any event on a dispatched connection means the worker handed it back
+    conn->in_worker = 0;
+    conn->last_active = monotonic_seconds();
+
+    switch (conn->state)
+    {
+    case CONN_READING:
+        if (events & EPOLLERR)
+        {
+            event_loop_close_connection(loop, conn);
+            return;
+        }
+        event_loop_handle_readable(loop, conn, events);
+        break;
+    case CONN_WRITING:
+    case CONN_CLOSING:
+        event_loop_handle_writable(loop, conn);
+        break;
+    case CONN_PROCESSING:
+        // Cannot happen with one-shot registration
+        break;
+    }
+}
+
+// Close connections that have been idle for too long (slow or silent
+// clients, and keep-alive connections nobody reused)
+static void event_loop_sweep_idle(EVENT_LOOP *loop)
+{
+    time_t now = monotonic_seconds();
+    if (now == loop->last_sweep)
+    {
+        return;
+    }
+    loop->last_sweep = now;
+
+    CONNECTION *conn = loop->connections;
+    while (conn)
+    {
+        CONNECTION *next = conn->next;
+
+        // Idle keep-alive connections get longer than clients stuck mid-request
+        int timeout = (conn->read_length == 0 && conn->requests_served > 0)
+                          ? KEEPALIVE_TIMEOUT_SECONDS
+                          : CLIENT_TIMEOUT_SECONDS;
+
+        if (!conn->in_worker && now - conn->last_active >= timeout)
+        {
+            event_loop_close_connection(loop, conn);
+        }
+
+        conn = next;
+    }
+}
+
+int event_loop_init(EVENT_LOOP *loop, TCP_SERVER *server, ThreadPool *pool)
+{
+    memset(loop, 0, sizeof(EVENT_LOOP));
+    loop->server = server;
+    loop->pool = pool;
+    loop->cpu = -1;
+    loop->running = 1;
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0)
+    {
+        perror("epoll_create1 failed");
+        return -1;
+    }
+
+    if (server_set_nonblocking(server->socket_fd) < 0)
+    {
+        close(loop->epoll_fd);
+        return -1;
+    }
+
+    // The listening socket stays level-triggered with data.ptr == NULL
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, server->socket_fd, &event) < 0)
+    {
+        perror("epoll_ctl add listener failed");
+        close(loop->epoll_fd);
+        return -1;
+    }
+
+    loop->last_sweep = monotonic_seconds();
+    return 0;
+}
+
+void event_loop_run(EVENT_LOOP *loop)
+{
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+
+    if (loop->backend == EVENT_BACKEND_IO_URING)
+    {
+        uring_loop_run(loop);
+        return;
+    }
+
+    while (loop->running)
+    {
+        int count = epoll_wait(loop->epoll_fd, events, MAX_EPOLL_EVENTS, EVENT_LOOP_TICK_MS);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            LOG_ERROR("epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            if (events[i].data.ptr == NULL)
+            {
+                event_loop_accept(loop);
+            }
+            else
+            {
+                event_loop_handle_event(loop, events[i].data.ptr, events[i].events);
+            }
+        }
+
+        event_loop_sweep_idle(loop);
+    }
+}
+
+static void *event_loop_thread(void *arg)
+{
+    EVENT_LOOP *loop = (EVENT_LOOP *)arg;
+
+    if (loop->cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(loop->cpu, &cpus);
+
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+        {
+            fprintf(stderr, "Failed to pin event loop %d to CPU %d\n", loop->id, loop->cpu);
+        }
+    }
+
+    event_loop_run(loop);
+    return NULL;
+}
+
+// Run the loop on its own thread, pinned to cpu (or unpinned when cpu < 0)
+int event_loop_start(EVENT_LOOP *loop, int cpu)
+{
+    loop->cpu = cpu;
+
+    if (pthread_create(&loop->thread, NULL, event_loop_thread, loop) != 0)
+    {
+        fprintf(stderr, "Failed to create event loop thread %d\n", loop->id);
+        return -1;
+    }
+
+    return 0;
+}
+
+void event_loop_join(EVENT_LOOP *loop)
+{
+    if (pthread_join(loop->thread, NULL) != 0)
+    {
+        fprintf(stderr, "Warning: Failed to join event loop thread %d\n", loop->id);
+    }
+}
+
+void event_loop_stop(EVENT_LOOP *loop)
+{
+    loop->running = 0;
+}
+
+void event_loop_print_stats(const EVENT_LOOP *loop)
+{
+    printf("Event loop %d: %lu accepted, %lu rejected, %lu requests, %lu bytes in, %lu bytes out\n",
+           loop->id,
+           loop->stats.accepted,
+           loop->stats.rejected,
+           loop->stats.requests,
+           loop->stats.bytes_read,
+           loop->stats.bytes_written);
+}
+
+// Must be called after the thread pool is destroyed so no worker owns a connection
+void event_loop_cleanup(EVENT_LOOP *loop)
+{
+    if (loop->backend == EVENT_BACKEND_IO_URING)
+    {
+        uring_loop_cleanup(loop);
+    }
+
+    while (loop->connections)
+    {
+        event_loop_close_connection(loop, loop->connections);
+    }
+
+    if (loop->epoll_fd >= 0)
+    {
+        close(loop->epoll_fd);
+        loop->epoll_fd = -1;
+    }
+}
+
+// Switch the loop to the io_uring backend. Returns -1 (and keeps epoll)
+// when the server was built without it or the kernel refuses.
+int event_loop_use_io_uring(EVENT_LOOP *loop)
+{
+    if (uring_loop_init(loop) < 0)
+    {
+        return -1;
+    }
+
+    loop->backend = EVENT_BACKEND_IO_URING;
+    return 0;
+}
@@ -1,17 +1,275 @@
+#define _GNU_SOURCE
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <zlib.h>
 #include "../include/file.h"
+#include "../include/asset_cache.h"
+#include "../include/file_cache.h"
+#include "../include/canned_response.h"
+#include "../include/log.h"
+
+// Optional per-thread file reader (used by io_uring loops). Without one files
+// are sent with sendfile instead of being read into memory
+static __thread FILE_READ_FUNC thread_file_reader = NULL;
+
+void file_set_thread_reader(FILE_READ_FUNC reader)
+{
+    thread_file_reader = reader;
+}
+
+// Strong ETag from the content: its length and CRC-32, plus a suffix that
+// tells encoded variants apart, e.g. "5f7-1a2b3c4d-br"
+void file_format_etag(char *etag, const char *data, size_t length, const char *suffix)
+{
+    unsigned long crc = crc32(0L, Z_NULL, 0);
+
+    // crc32 takes a uInt length, feed large inputs in pieces
+    for (size_t done = 0; done < length;)
+    {
+        uInt chunk = (length - done > (1u << 30)) ? (1u << 30) : (uInt)(length - done);
+        crc = crc32(crc, (const Bytef *)data + done, chunk);
+        done += chunk;
+    }
+
+    snprintf(etag, FILE_ETAG_SIZE, "\"%zx-%08lx%s%s\"", length, crc, suffix ? "-" : "", suffix ? suffix : "");
+}
+
+// ETag of a file on disk from its inode, size and modification time (to the
+// nanosecond), so it costs nothing beyond the stat
+void file_format_stat_etag(char *etag, const struct stat *file_stat)
+{
+    snprintf(etag, FILE_ETAG_SIZE, "\"%lx-%lx-%lx.%lx\"",
+             (unsigned long)file_stat->st_ino, (unsigned long)file_stat->st_size,
+             (unsigned long)file_stat->st_mtim.tv_sec, (unsigned long)file_stat->st_mtim.tv_nsec);
+}
+
+// IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+void file_format_http_date(char *date, time_t time)
+{
+    struct tm tm;
+    gmtime_r(&time, &tm);
+    strftime(date, FILE_HTTP_DATE_SIZE, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+// Does If-None-Match list the ETag? Weak comparison, as RFC 7232 asks for
+static bool etag_list_matches(HTTP_SLICE list, const char *etag)
+{
+    size_t etag_len = strlen(etag);
+    const char *pos = list.data;
+    const char *end = list.data + list.length;
+
+    while (pos < end)
+    {
+        while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == ','))
+        {
+            pos++;
+        }
+
+        const char *item = pos;
+        while (pos < end && *pos != ',')
+        {
+            pos++;
+        }
+
+        const char *item_end = pos;
+        while (item_end > item && (item_end[-1] == ' ' || item_end[-1] == '\t'))
+        {
+            item_end--;
+        }
+
+        if (item_end - item >= 2 && item[0] == 'W' && item[1] == '/')
+        {
+            item += 2;
+        }
+
+        if ((item_end - item == 1 && *item == '*') ||
+            ((size_t)(item_end - item) == etag_len && memcmp(item, etag, etag_len) == 0))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Evaluate If-None-Match, or If-Modified-Since when there is none.
+// True if the client's copy is current and a 304 should be sent
+bool file_not_modified(const HTTP_REQUEST *request, const char *etag, time_t last_modified)
+{
+    HTTP_SLICE if_none_match = http_request_header(request, HTTP_HEADER_IF_NONE_MATCH);
+    if (if_none_match.data)
+    {
+        return etag_list_matches(if_none_match, etag);
+    }
+
+    HTTP_SLICE if_modified_since = http_request_header(request, HTTP_HEADER_IF_MODIFIED_SINCE);
+    char date[FILE_HTTP_DATE_SIZE + 1];
+    if (!if_modified_since.data || if_modified_since.length >= sizeof(date))
+    {
+        return false;
+    }
+    memcpy(date, if_modified_since.data, if_modified_since.length);
+    date[if_modified_since.length] = '\0';
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *parsed = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!parsed || *parsed != '\0')
+    {
+        // Not an IMF-fixdate, ignore the header
+        return false;
+    }
+
+    return last_modified <= timegm(&tm);
+}
+
+// Parse a non-negative decimal number, false on overflow or no digits
+static bool parse_offset(const char **pos, const char *end, off_t *value)
+{
+    const char *start = *pos;
+    off_t result = 0;
+
+    while (*pos < end && **pos >= '0' && **pos <= '9')
+    {
+        int digit = **pos - '0';
+        if (result > (LLONG_MAX - digit) / 10)
+        {
+            return false;
+        }
+        result = result * 10 + digit;
+        (*pos)++;
+    }
+
+    *value = result;
+    return *pos > start;
+}
+
+// If-Range names the representation the client has a part of. A range is
+// only sent if it still is the current one: strong ETag match or the exact
+// Last-Modified date
+static bool if_range_matches(const HTTP_REQUEST *request, const char *etag, const char *last_modified)
+{
+    HTTP_SLICE if_range = http_request_header(request, HTTP_HEADER_IF_RANGE);
+    if (!if_range.data)
+    {
+        return true;
+    }
+
+    const char *validator = (if_range.data[0] == '"') ? etag : last_modified;
+    return if_range.length == strlen(validator) && memcmp(if_range.data, validator, if_range.length) == 0;
+}
+
+// Resolve the Range header against a representation of size bytes
+// (RFC 7233). Fills ranges in request order and returns their number, 0 to
+// ignore the header and send the whole body, -1 if no range is satisfiable
+int file_parse_ranges(const HTTP_REQUEST *request, const char *etag, const char *last_modified,
+                      off_t size, HTTP_RANGE *ranges, int max_ranges)
+{
+    HTTP_SLICE range = http_request_header(request, HTTP_HEADER_RANGE);
+    if (!range.data || range.length < 6 || strncasecmp(range.data, "bytes=", 6) != 0 ||
+        !if_range_matches(request, etag, last_modified))
+    {
+        return 0;
+    }
+
+    const char *pos = range.data + 6;
+    const char *end = range.data + range.length;
+    int count = 0;
+    int specs = 0;
+    off_t total = 0;
+
+    while (pos < end)
+    {
+        while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == ','))
+        {
+            pos++;
+        }
+        if (pos == end)
+        {
+            break;
+        }
+
+        off_t first = -1;
+        off_t last = -1;
+        if (*pos != '-' && !parse_offset(&pos, end, &first))
+        {
+            return 0;
+        }
+        if (pos == end || *pos != '-')
+        {
+            return 0;
+        }
+        pos++;
+        if (pos < end && *pos >= '0' && *pos <= '9' && !parse_offset(&pos, end, &last))
+        {
+            return 0;
+        }
+
+        while (pos < end && (*pos == ' ' || *pos == '\t'))
+        {
+            pos++;
+        }
+        if ((pos < end && *pos != ',') || (first < 0 && last < 0) || (last >= 0 && first > last))
+        {
+            // Malformed, the header is ignored as a whole
+            return 0;
+        }
+        specs++;
+
+        off_t start;
+        off_t length;
+        if (first < 0)
+        {
+            // Suffix range: the last `last` bytes
+            if (last == 0 || size == 0)
+            {
+                continue;
+            }
+            start = (last < size) ? size - last : 0;
+            length = size - start;
+        }
+        else
+        {
+            if (first >= size)
+            {
+                continue;
+            }
+            start = first;
+            length = ((last < 0 || last >= size) ? size - 1 : last) - first + 1;
+        }
+
+        // Many or overlapping ranges cost more than the whole body
+        total += length;
+        if (count == max_ranges || total > size)
+        {
+            return 0;
+        }
+
+        ranges[count].start = start;
+        ranges[count].length = length;
+        count++;
+    }
+
+    if (count == 0)
+    {
+        return specs > 0 ? -1 : 0;
+    }
+    return count;
+}
 
 const char *get_mime_type(const char *filename)
 {
     const char *ext = strrchr(filename, '.');
     if (!ext)
     {
-        printf("No extension found for file: %s, using default MIME type\n", filename);
+        LOG_DEBUG("No extension found for file: %s, using default MIME type\n", filename);
         return "application/octet-stream"; // Default for unknown types
     }
 
@@ -58,25 +316,33 @@ int is_safe_path(const char *path)
 
 int construct_file_path(const char *requested_path, char *full_path, size_t max_len)
 {
-    // Remove leading slash if present
-    const char *clean_path = (requested_path[0] == '/') ? requested_path + 1 : requested_path;
-
-    // Handle empty path (serve index.html)
-    if (strlen(clean_path) == 0 || strcmp(clean_path, "/") == 0)
+    // Drop the leading slash and empty segments. The router ignores those,
+    // "/about/" and "/css//style.css" name the same files as without them
+    char path[MAX_PATH_LENGTH];
+    size_t length = 0;
+    for (const char *p = requested_path; *p && length < sizeof(path) - 1; p++)
     {
-        clean_path = "index.html";
+        if (*p != '/' || (length > 0 && path[length - 1] != '/'))
+        {
+            path[length++] = *p;
+        }
     }
-    else if (strlen(clean_path) == 5 || strcmp(clean_path, "/about") == 0)
+    if (length > 0 && path[length - 1] == '/')
     {
-        clean_path = "about.html";
+        length--;
     }
-    else if (strlen(clean_path) == 13 || strcmp(clean_path, "/css/style.css") == 0)
+    path[length] = '\0';
+    const char *clean_path = path;
+
+    // Handle empty path (serve index.html). Only exact names are aliased,
+    // anything else (e.g. /media/{file}) is served under its own name
+    if (clean_path[0] == '\0')
     {
-        clean_path = "css/style.css";
+        clean_path = "index.html";
     }
-    else if (strlen(clean_path) == 9 || strcmp(clean_path, "/js/app.js") == 0)
+    else if (strcmp(clean_path, "about") == 0)
     {
-        clean_path = "js/app.js";
+        clean_path = "about.html";
     }
 
     // Check path safety
@@ -152,112 +418,133 @@ void serve_static_file(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
     char *file_contents = NULL;
     long file_size;
 
-    printf("Serving static file for path: %s\n", request->path);
+    // The request path is a slice into the read buffer, the file helpers want a string
+    char requested_path[MAX_PATH_LENGTH];
+    if (request->clean_path.length >= sizeof(requested_path))
+    {
+        serve_404_error(response);
+        return;
+    }
+    memcpy(requested_path, request->clean_path.data, request->clean_path.length);
+    requested_path[request->clean_path.length] = '\0';
+
+    LOG_DEBUG("Serving static file for path: %s\n", requested_path);
 
     // Construct file path
-    if (construct_file_path(request->path, full_path, sizeof(full_path)) < 0)
+    if (construct_file_path(requested_path, full_path, sizeof(full_path)) < 0)
     {
-        printf("Invalid or unsafe path: %s\n", request->path);
+        LOG_INFO("Invalid or unsafe path: %s\n", requested_path);
         serve_404_error(response);
         return;
     }
 
-    printf("Full file path: %s\n", full_path);
+    LOG_DEBUG("Full file path: %s\n", full_path);
 
-    // Check if file exists and is readable
+    // Small assets are answered from memory, no stat/open/read
+    if (asset_cache_serve(full_path, request, response) == 0)
+    {
+        LOG_DEBUG("Served from asset cache: %s\n", full_path);
+        return;
+    }
+
+    // Open regular file and its stat from the file cache, no syscalls on a hit
+    int fd;
     struct stat file_stat;
-    if (stat(full_path, &file_stat) != 0)
+    FILE_CACHE_ENTRY *entry = file_cache_open(full_path, &fd, &file_stat);
+    if (!entry)
     {
-        printf("File not found: %s\n", full_path);
+        LOG_DEBUG("File not found: %s\n", full_path);
         serve_404_error(response);
         return;
     }
 
-    // Check if it's a regular file
-    if (!S_ISREG(file_stat.st_mode))
+    // The client's copy is current: validators only, no body
+    if (file_not_modified(request, file_cache_etag(entry), file_stat.st_mtime))
     {
-        printf("Not a regular file: %s\n", full_path);
-        serve_404_error(response);
+        http_response_set_status(response, HTTP_304_NOT_MODIFIED);
+        http_response_set_validators(response, file_cache_etag(entry), file_cache_last_modified(entry));
+        file_cache_release(entry);
+        LOG_DEBUG("Not modified: %s\n", full_path);
         return;
     }
 
-    // Read file contents
-    file_size = read_file_contents(full_path, &file_contents);
-    if (file_size < 0 || !file_contents)
+    HTTP_RANGE ranges[MAX_RANGES];
+    int range_count = file_parse_ranges(request, file_cache_etag(entry), file_cache_last_modified(entry),
+                                        file_stat.st_size, ranges, MAX_RANGES);
+    if (range_count < 0)
     {
-        printf("Failed to read file: %s\n", full_path);
-        serve_500_error(response);
+        file_cache_release(entry);
+        http_response_set_range_not_satisfiable(response, file_stat.st_size);
+        LOG_DEBUG("Range not satisfiable: %s\n", full_path);
         return;
     }
 
     // Get MIME type
     const char *mime_type = get_mime_type(full_path);
 
+    // Hand the open file to the connection, it is sent with sendfile(2)
+    // after the headers. Loops with their own file reader (io_uring) read it
+    // unless it is too large to hold in memory
+    if (!thread_file_reader || file_stat.st_size > MAX_FILE_SIZE)
+    {
+        http_response_set_status(response, HTTP_200_OK);
+        http_response_set_content_type(response, mime_type);
+        http_response_set_file(response, fd, entry, 0, (size_t)file_stat.st_size);
+        http_response_set_validators(response, file_cache_etag(entry), file_cache_last_modified(entry));
+        http_response_set_accept_ranges(response);
+
+        // Only the requested parts of the file are sent, from their offsets
+        if (range_count > 0 && http_response_set_ranges(response, ranges, range_count, file_stat.st_size) < 0)
+        {
+            serve_500_error(response);
+            return;
+        }
+
+        LOG_DEBUG("Sending file: %s (size: %ld bytes, type: %s)\n",
+                  full_path, (long)file_stat.st_size, mime_type);
+        return;
+    }
+
+    // Read the file the cache opened, its contents go with its validators
+    char etag[FILE_ETAG_SIZE];
+    char last_modified[FILE_HTTP_DATE_SIZE];
+    strcpy(etag, file_cache_etag(entry));
+    strcpy(last_modified, file_cache_last_modified(entry));
+
+    file_size = thread_file_reader(fd, &file_stat, &file_contents);
+    file_cache_release(entry);
+    if (file_size < 0 || !file_contents)
+    {
+        LOG_ERROR("Failed to read file: %s\n", full_path);
+        serve_500_error(response);
+        return;
+    }
+
     // Set response
     http_response_set_status(response, HTTP_200_OK);
     http_response_set_content_type(response, mime_type);
     http_response_set_body_with_length(response, file_contents, file_size);
+    http_response_set_validators(response, etag, last_modified);
+    http_response_set_accept_ranges(response);
+
+    // The file changed size since it was opened, the ranges may not fit
+    if (range_count > 0 && http_response_set_ranges(response, ranges, range_count, file_stat.st_size) < 0)
+    {
+        LOG_WARN("Ranges do not fit file: %s\n", full_path);
+        serve_500_error(response);
+        return;
+    }
 
-    printf("Successfully served file: %s (size: %ld bytes, type: %s)\n",
-           full_path, file_size, mime_type);
+    LOG_DEBUG("Successfully served file: %s (size: %ld bytes, type: %s)\n",
+              full_path, file_size, mime_type);
 }
 
 void serve_404_error(HTTP_RESPONSE *response)
 {
-    const char *error_html =
-        "<!DOCTYPE html>\n"
-        "<html>\n"
-        "<head>\n"
-        "    <title>404 - File Not Found</title>\n"
-        "    <style>\n"
-        "        body { font-family: Arial, sans-serif; text-align: center; margin-top: 100px; }\n"
-        "        .error { color: #e74c3c; }\n"
-        "        .back-link { margin-top: 20px; }\n"
-        "        .back-link a { color: #3498db; text-decoration: none; }\n"
-        "    </style>\n"
-        "</head>\n"
-        "<body>\n"
-        "    <div class=\"error\">\n"
-        "        <h1>404 - File Not Found</h1>\n"
-        "        <p>The requested file could not be found on this server.</p>\n"
-        "    </div>\n"
-        "    <div class=\"back-link\">\n"
-        "        <a href=\"/\">← Back to Home</a>\n"
-        "    </div>\n"
-        "</body>\n"
-        "</html>\n";
-
-    http_response_set_status(response, HTTP_404_NOT_FOUND);
-    http_response_set_content_type(response, "text/html");
-    http_response_set_body(response, error_html);
+    canned_response_set(response, CANNED_FILE_NOT_FOUND);
 }
 
 void serve_500_error(HTTP_RESPONSE *response)
 {
-    const char *error_html =
-        "<!DOCTYPE html>\n"
-        "<html>\n"
-        "<head>\n"
-        "    <title>500 - Internal Server Error</title>\n"
-        "    <style>\n"
-        "        body { font-family: Arial, sans-serif; text-align: center; margin-top: 100px; }\n"
-        "        .error { color: #e74c3c; }\n"
-        "        .back-link { margin-top: 20px; }\n"
-        "        .back-link a { color: #3498db; text-decoration: none; }\n"
-        "    </style>\n"
-        "</head>\n"
-        "<body>\n"
-        "    <div class=\"error\">\n"
-        "        <h1>500 - Internal Server Error</h1>\n"
-        "        <p>An error occurred while processing your request.</p>\n"
-        "    </div>\n"
-        "    <div class=\"back-link\">\n"
-        "        <a href=\"/\">← Back to Home</a>\n"
-        "    </div>\n"
-        "</body>\n"
-        "</html>\n";
-
-    http_response_set_status(response, HTTP_500_INTERNAL_ERROR);
-    http_response_set_content_type(response, "text/html");
-    http_response_set_body(response, error_html);
+    canned_response_set(response, CANNED_FILE_ERROR);
 }
\ No newline at end of file
@@ -0,0 +1,598 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include "../include/config.h"
+#include "../include/file_cache.h"
+#include "../include/asset_cache.h"
+#include "../include/file.h"
+#include "../include/log.h"
+
+struct FILE_CACHE_ENTRY
+{
+    char path[MAX_PATH_LENGTH];
+    uint32_t hash;
+    int fd;
+    struct stat file_stat;
+    char etag[FILE_ETAG_SIZE];
+    char last_modified[FILE_HTTP_DATE_SIZE];
+    int refs;   // The table holds one while the entry is cached
+    int cached; // Still reachable from the table
+    unsigned long last_used;
+    struct FILE_CACHE_ENTRY *next;
+};
+
+typedef struct
+{
+    int wd;
+    char path[MAX_PATH_LENGTH];   // As events report it, and the asset cache knows it
+    char normal[MAX_PATH_LENGTH]; // normalize_path of it
+} FILE_WATCH;
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE_CACHE_ENTRY *buckets[FILE_CACHE_BUCKETS];
+static int entry_count = 0;
+static unsigned long use_clock = 0;
+
+// Bumped by every invalidation of a path in the bucket, and by every flush,
+// so a miss can tell whether its file changed while it was being opened.
+// Sharing a counter per bucket only costs a colliding path its insert
+static unsigned long generations[FILE_CACHE_BUCKETS];
+static unsigned long flush_generation = 0;
+
+// Watcher thread state. The thread changes the watch table under
+// cache_mutex, file_cache_open reads it there
+static int inotify_fd = -1;
+static FILE_WATCH watches[FILE_CACHE_MAX_WATCHES];
+static int watch_count = 0;
+static int watch_limit_logged = 0;
+static pthread_t watcher_thread;
+static volatile int watcher_running = 0;
+
+static uint32_t path_hash(const char *path)
+{
+    uint32_t hash = 2166136261u;
+    while (*path)
+    {
+        hash = (hash ^ (unsigned char)*path++) * 16777619u;
+    }
+    return hash;
+}
+
+// The one spelling of path entries are kept under: no empty or "." segments,
+// so "./public/css//style.css" is the entry the watcher's
+// "./public/css/style.css" invalidates. Returns -1 if it does not fit
+static int normalize_path(const char *path, char *normal, size_t size)
+{
+    size_t length = 0;
+    if (*path == '/')
+    {
+        normal[length++] = '/';
+    }
+
+    while (*path)
+    {
+        while (*path == '/')
+        {
+            path++;
+        }
+
+        const char *segment = path;
+        while (*path && *path != '/')
+        {
+            path++;
+        }
+
+        size_t segment_length = path - segment;
+        if (segment_length == 0 || (segment_length == 1 && segment[0] == '.'))
+        {
+            continue;
+        }
+
+        int separator = length > 0 && normal[length - 1] != '/';
+        if (length + separator + segment_length >= size)
+        {
+            return -1;
+        }
+
+        if (separator)
+        {
+            normal[length++] = '/';
+        }
+        memcpy(normal + length, segment, segment_length);
+        length += segment_length;
+    }
+
+    normal[length] = '\0';
+    return 0;
+}
+
+// Is the directory holding the file at normal path watched? Files anywhere
+// else would never be invalidated. Caller holds the lock
+static int directory_watched(const char *normal)
+{
+    const char *slash = strrchr(normal, '/');
+    size_t length = slash ? (size_t)(slash - normal) : 0;
+
+    for (int i = 0; i < watch_count; i++)
+    {
+        if (strlen(watches[i].normal) == length && strncmp(watches[i].normal, normal, length) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Validators are computed once per entry from its stat, an entry never
+// outlives its file contents because changes invalidate it. Nothing is read,
+// so a miss costs the same for any file size
+static void compute_validators(FILE_CACHE_ENTRY *entry)
+{
+    file_format_stat_etag(entry->etag, &entry->file_stat);
+    file_format_http_date(entry->last_modified, entry->file_stat.st_mtime);
+}
+
+const char *file_cache_etag(const FILE_CACHE_ENTRY *entry)
+{
+    return entry->etag;
+}
+
+const char *file_cache_last_modified(const FILE_CACHE_ENTRY *entry)
+{
+    return entry->last_modified;
+}
+
+// Drop a reference, the fd is closed with the last one. Caller holds the lock
+static void entry_unref(FILE_CACHE_ENTRY *entry)
+{
+    if (--entry->refs == 0)
+    {
+        close(entry->fd);
+        free(entry);
+    }
+}
+
+// Take an entry out of the table. Connections still sending from it keep
+// their references. Caller holds the lock
+static void entry_remove(FILE_CACHE_ENTRY *entry)
+{
+    FILE_CACHE_ENTRY **link = &buckets[entry->hash % FILE_CACHE_BUCKETS];
+    while (*link && *link != entry)
+    {
+        link = &(*link)->next;
+    }
+
+    if (*link)
+    {
+        *link = entry->next;
+        entry->cached = 0;
+        entry_count--;
+        entry_unref(entry);
+    }
+}
+
+static void evict_least_recently_used(void)
+{
+    FILE_CACHE_ENTRY *oldest = NULL;
+
+    for (int i = 0; i < FILE_CACHE_BUCKETS; i++)
+    {
+        for (FILE_CACHE_ENTRY *entry = buckets[i]; entry; entry = entry->next)
+        {
+            if (!oldest || entry->last_used < oldest->last_used)
+            {
+                oldest = entry;
+            }
+        }
+    }
+
+    if (oldest)
+    {
+        entry_remove(oldest);
+    }
+}
+
+// Caller holds the lock
+static unsigned long generation(uint32_t hash)
+{
+    return generations[hash % FILE_CACHE_BUCKETS] + flush_generation;
+}
+
+static FILE_CACHE_ENTRY *lookup(const char *path, uint32_t hash)
+{
+    for (FILE_CACHE_ENTRY *entry = buckets[hash % FILE_CACHE_BUCKETS]; entry; entry = entry->next)
+    {
+        if (entry->hash == hash && strcmp(entry->path, path) == 0)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Open a regular file through the cache. On success fills fd and file_stat
+// and returns a reference that must be given back with file_cache_release.
+// Returns NULL if the file does not exist, is not regular or cannot be opened
+FILE_CACHE_ENTRY *file_cache_open(const char *requested_path, int *fd, struct stat *file_stat)
+{
+    char path[MAX_PATH_LENGTH];
+    if (normalize_path(requested_path, path, sizeof(path)) < 0)
+    {
+        return NULL;
+    }
+
+    uint32_t hash = path_hash(path);
+
+    pthread_mutex_lock(&cache_mutex);
+    FILE_CACHE_ENTRY *entry = watcher_running ? lookup(path, hash) : NULL;
+    if (entry)
+    {
+        entry->refs++;
+        entry->last_used = ++use_clock;
+        pthread_mutex_unlock(&cache_mutex);
+
+        *fd = entry->fd;
+        *file_stat = entry->file_stat;
+        return entry;
+    }
+    unsigned long opened_generation = generation(hash);
+    pthread_mutex_unlock(&cache_mutex);
+
+    // Miss: open and stat outside the lock
+    entry = malloc(sizeof(FILE_CACHE_ENTRY));
+    if (!entry)
+    {
+        return NULL;
+    }
+
+    entry->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (entry->fd < 0 || fstat(entry->fd, &entry->file_stat) != 0 || !S_ISREG(entry->file_stat.st_mode))
+    {
+        if (entry->fd >= 0)
+        {
+            close(entry->fd);
+        }
+        free(entry);
+        return NULL;
+    }
+
+    strcpy(entry->path, path);
+    entry->hash = hash;
+    compute_validators(entry);
+
+    // Nothing would tell us about changes, so the entry is private to the caller
+    if (!watcher_running)
+    {
+        entry->refs = 1;
+        entry->cached = 0;
+        *fd = entry->fd;
+        *file_stat = entry->file_stat;
+        return entry;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    if (generation(hash) != opened_generation || !directory_watched(path))
+    {
+        // The file changed while it was opened, the stat and validators may
+        // already be stale; or nothing watches its directory and would tell
+        // when they are. Serve them once without caching them
+        pthread_mutex_unlock(&cache_mutex);
+        entry->refs = 1;
+        entry->cached = 0;
+        *fd = entry->fd;
+        *file_stat = entry->file_stat;
+        return entry;
+    }
+
+    FILE_CACHE_ENTRY *existing = lookup(path, hash);
+    if (existing)
+    {
+        // Another thread cached it meanwhile, use that one
+        close(entry->fd);
+        free(entry);
+        entry = existing;
+    }
+    else
+    {
+        if (entry_count >= FILE_CACHE_MAX_ENTRIES)
+        {
+            evict_least_recently_used();
+        }
+
+        entry->refs = 1;
+        entry->cached = 1;
+        entry->next = buckets[hash % FILE_CACHE_BUCKETS];
+        buckets[hash % FILE_CACHE_BUCKETS] = entry;
+        entry_count++;
+    }
+
+    entry->refs++;
+    entry->last_used = ++use_clock;
+    *fd = entry->fd;
+    *file_stat = entry->file_stat;
+    pthread_mutex_unlock(&cache_mutex);
+
+    return entry;
+}
+
+// Take another reference on an entry the caller already holds
+void file_cache_retain(FILE_CACHE_ENTRY *entry)
+{
+    pthread_mutex_lock(&cache_mutex);
+    entry->refs++;
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+void file_cache_release(FILE_CACHE_ENTRY *entry)
+{
+    if (!entry)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    entry_unref(entry);
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+static void file_cache_invalidate(const char *path)
+{
+    char normal[MAX_PATH_LENGTH];
+    if (normalize_path(path, normal, sizeof(normal)) < 0)
+    {
+        return;
+    }
+    uint32_t hash = path_hash(normal);
+
+    pthread_mutex_lock(&cache_mutex);
+    generations[hash % FILE_CACHE_BUCKETS]++;
+    FILE_CACHE_ENTRY *entry = lookup(normal, hash);
+    if (entry)
+    {
+        entry_remove(entry);
+    }
+    pthread_mutex_unlock(&cache_mutex);
+
+    asset_cache_invalidate(path);
+}
+
+static void file_cache_flush(void)
+{
+    pthread_mutex_lock(&cache_mutex);
+    flush_generation++;
+    for (int i = 0; i < FILE_CACHE_BUCKETS; i++)
+    {
+        while (buckets[i])
+        {
+            entry_remove(buckets[i]);
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+// Watch dir and its subdirectories. Files in directories left unwatched
+// (past FILE_CACHE_MAX_WATCHES, or when inotify refuses) are not cached
+static void watch_directory(const char *dir)
+{
+    char normal[MAX_PATH_LENGTH];
+    if (normalize_path(dir, normal, sizeof(normal)) < 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    int full = watch_count >= FILE_CACHE_MAX_WATCHES;
+    pthread_mutex_unlock(&cache_mutex);
+
+    if (full)
+    {
+        if (!watch_limit_logged)
+        {
+            LOG_WARN("File cache: more than %d directories to watch, files under %s and any further ones are not cached\n",
+                     FILE_CACHE_MAX_WATCHES, dir);
+            watch_limit_logged = 1;
+        }
+        return;
+    }
+
+    int wd = inotify_add_watch(inotify_fd, dir,
+                               IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE |
+                                   IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+    if (wd < 0)
+    {
+        LOG_WARN("File cache: cannot watch %s, its files are not cached: %s\n", dir, strerror(errno));
+        return;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    int slot = watch_count;
+    for (int i = 0; i < watch_count; i++)
+    {
+        // The same directory again (moved back in): inotify gave its old watch
+        if (watches[i].wd == wd)
+        {
+            slot = i;
+            break;
+        }
+    }
+    watches[slot].wd = wd;
+    snprintf(watches[slot].path, sizeof(watches[0].path), "%s", dir);
+    strcpy(watches[slot].normal, normal);
+    if (slot == watch_count)
+    {
+        watch_count++;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+
+    DIR *handle = opendir(dir);
+    if (!handle)
+    {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(handle)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+
+        char path[MAX_PATH_LENGTH];
+        struct stat file_stat;
+        if (snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name) < (int)sizeof(path) &&
+            stat(path, &file_stat) == 0 && S_ISDIR(file_stat.st_mode))
+        {
+            watch_directory(path);
+        }
+    }
+
+    closedir(handle);
+}
+
+static const char *watch_path(int wd)
+{
+    for (int i = 0; i < watch_count; i++)
+    {
+        if (watches[i].wd == wd)
+        {
+            return watches[i].path;
+        }
+    }
+    return NULL;
+}
+
+// The directory of wd went away, its slot is free for another one
+static void unwatch(int wd)
+{
+    pthread_mutex_lock(&cache_mutex);
+    for (int i = 0; i < watch_count; i++)
+    {
+        if (watches[i].wd == wd)
+        {
+            watches[i] = watches[--watch_count];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+static void handle_watch_event(const struct inotify_event *event)
+{
+    if (event->mask & IN_IGNORED)
+    {
+        unwatch(event->wd);
+        file_cache_flush();
+        return;
+    }
+
+    const char *dir = watch_path(event->wd);
+
+    if (event->mask & IN_Q_OVERFLOW || !dir || event->len == 0)
+    {
+        // Events were lost or concern a directory itself
+        file_cache_flush();
+        return;
+    }
+
+    char path[MAX_PATH_LENGTH];
+    if (snprintf(path, sizeof(path), "%s/%s", dir, event->name) >= (int)sizeof(path))
+    {
+        return;
+    }
+
+    if (event->mask & IN_ISDIR)
+    {
+        // A directory appeared or moved, everything below it may have changed
+        if (event->mask & (IN_CREATE | IN_MOVED_TO))
+        {
+            watch_directory(path);
+        }
+        file_cache_flush();
+        return;
+    }
+
+    LOG_INFO("Static file changed: %s\n", path);
+    file_cache_invalidate(path);
+}
+
+static void *watcher_main(void *arg)
+{
+    (void)arg;
+
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd = {inotify_fd, POLLIN, 0};
+
+    while (watcher_running)
+    {
+        // Wake up every tick to notice shutdown
+        if (poll(&pfd, 1, EVENT_LOOP_TICK_MS) <= 0)
+        {
+            continue;
+        }
+
+        ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+        for (char *pos = buffer; length > 0 && pos < buffer + length;)
+        {
+            const struct inotify_event *event = (const struct inotify_event *)pos;
+            handle_watch_event(event);
+            pos += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    return NULL;
+}
+
+// Start watching dir. Without inotify nothing is cached and every
+// file_cache_open opens the file
+int file_cache_init(const char *dir)
+{
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0)
+    {
+        perror("inotify_init1 failed");
+        return -1;
+    }
+
+    watch_directory(dir);
+
+    watcher_running = 1;
+    if (pthread_create(&watcher_thread, NULL, watcher_main, NULL) != 0)
+    {
+        perror("Failed to start file watcher");
+        watcher_running = 0;
+        close(inotify_fd);
+        inotify_fd = -1;
+        return -1;
+    }
+
+    printf("File cache: watching %d directories under %s\n", watch_count, dir);
+    return 0;
+}
+
+void file_cache_cleanup(void)
+{
+    if (watcher_running)
+    {
+        watcher_running = 0;
+        pthread_join(watcher_thread, NULL);
+    }
+
+    if (inotify_fd >= 0)
+    {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+    watch_count = 0;
+
+    file_cache_flush();
+}
@@ -1,193 +1,526 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
-#include <sys/socket.h>
-#include <sys/time.h>
+#include <strings.h>
+#include <stdint.h>
 #include "../include/config.h"
 #include "../include/handler.h"
 #include "../include/routes.h"
 #include "../include/file.h"
+#include "../include/canned_response.h"
+#include "../include/log.h"
+#include "../include/access_log.h"
+#include "../include/metrics.h"
+#include "../include/timing.h"
 
-void handle_http_request(int client_socket)
+typedef struct
 {
-    char buffer[BUFFER_SIZE];
-    HTTP_REQUEST request;
-    HTTP_RESPONSE response;
-    char response_buffer[MAX_RESPONSE_SIZE];
+    HTTP_METHOD method;
+    const char *pattern;
+    ROUTE_HANDLER handler;
+} ROUTE;
+
+// Routes that take their body differently from the default, buffered up to
+// MAX_BUFFERED_BODY_SIZE
+typedef struct
+{
+    HTTP_METHOD method;
+    const char *pattern;
+    HTTP_BODY_MODE mode;
+    size_t limit;
+} ROUTE_BODY;
 
-    struct timeval timeout = {2, 0}; // 2 seconds
-    setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+static const ROUTE routes[] = {
+    {HTTP_METHOD_GET, "/", route_home},
+    {HTTP_METHOD_GET, "/index.html", route_home},
+    {HTTP_METHOD_GET, "/css/style.css", route_get_css},
+    {HTTP_METHOD_GET, "/js/app.js", route_get_js},
+    {HTTP_METHOD_GET, "/media/{file}", route_get_media},
+    {HTTP_METHOD_GET, "/about", route_about},
+    {HTTP_METHOD_GET, "/about.html", route_about},
+    {HTTP_METHOD_GET, "/api/users", route_get_users},
+    {HTTP_METHOD_GET, "/api/users/{id}", route_get_user_by_id},
+    {HTTP_METHOD_POST, "/api/users", route_create_user},
+    {HTTP_METHOD_POST, "/api/users/import", route_import_users},
+    {HTTP_METHOD_POST, "/api/login", route_login},
+    {HTTP_METHOD_PUT, "/api/users/{id}", route_update_user},
+    {HTTP_METHOD_PATCH, "/api/users/{id}", route_partial_update_user},
+    {HTTP_METHOD_DELETE, "/api/users/{id}", route_delete_user},
+    {HTTP_METHOD_GET, "/metrics", route_metrics},
+};
 
-    // Read the request
-    int bytes_received = recv(client_socket, buffer, BUFFER_SIZE - 1, 0);
-    if (bytes_received <= 0)
+static const ROUTE_BODY route_bodies[] = {
+    {HTTP_METHOD_POST, "/api/users/import", HTTP_BODY_STREAMED, IMPORT_MAX_BODY_SIZE},
+};
+
+// Build the routing tree, once before the event loops start
+int handler_register_routes(void)
+{
+    for (size_t i = 0; i < sizeof(routes) / sizeof(routes[0]); i++)
     {
-        // perror("recv failed");
-        close(client_socket);  // Doing this to ignore empty connections from client (browser)
-        return;
+        if (router_add(routes[i].method, routes[i].pattern, routes[i].handler) < 0)
+        {
+            printf("Failed to register route %s\n", routes[i].pattern);
+            router_cleanup();
+            return -1;
+        }
     }
 
-    buffer[bytes_received] = '\0';
-    printf("Raw request (%d bytes): '%s'\n", bytes_received, buffer);
-
-    // Parse the request
-    if (http_request_parse(buffer, &request) < 0)
+    for (size_t i = 0; i < sizeof(route_bodies) / sizeof(route_bodies[0]); i++)
     {
-        printf("Failed to parse HTTP request\n");
-        return;
+        if (router_set_body(route_bodies[i].method, route_bodies[i].pattern,
+                            route_bodies[i].mode, route_bodies[i].limit) < 0)
+        {
+            router_cleanup();
+            return -1;
+        }
     }
 
-    http_request_print(&request);
+    // The parser asks the router how to take each request body
+    http_parser_set_body_policy(router_body_policy);
+    return 0;
+}
 
-    // Initialize response
-    http_response_init(&response);
+static int queue_payload_too_large(CONNECTION *conn);
+struct HANDLED_REQUEST;
+static int run_handler(CONNECTION *conn, struct HANDLED_REQUEST *handled);
 
-    // Route based on method and path
-    if (strcmp(request.method, "GET") == 0)
-    {
-        handle_get_request(&request, &response);
-    }
-    else if (strcmp(request.method, "POST") == 0)
-    {
-        handle_post_request(&request, &response);
-    }
-    else if (strcmp(request.method, "PUT") == 0)
+// Answer every complete request buffered on the connection (HTTP/1.1
+// pipelining). Responses are appended to the write buffer in request order
+// so the whole batch goes out in one send. A handler waiting for more of a
+// streamed body stops the batch, conn->suspended is set until it is resumed
+// by a later call.
+// Returns the number of requests answered (0 if the first one waits for its
+// body), -1 if the first one failed
+int handle_http_requests(CONNECTION *conn)
+{
+    int handled = 0;
+    int length = 0;
+
+    // Database time of the handlers is counted towards this batch
+    timing_begin(&conn->timing);
+    timing_mark(&conn->timing, TIMING_RECV);
+    timing_current = &conn->timing;
+
+    while (handled < PIPELINE_MAX_REQUESTS && (length = connection_next_request(conn)) > 0)
     {
-        handle_put_request(&request, &response);
+        int result = conn->suspended ? run_handler(conn, conn->suspended) : handle_http_request(conn);
+        if (result > 0)
+        {
+            // The event loop calls again once more of the body is read
+            break;
+        }
+
+        if (result < 0)
+        {
+            // Send the responses built so far, then close
+            conn->keep_alive = 0;
+            break;
+        }
+
+        connection_consume_request(conn);
+        handled++;
+
+        if (!conn->keep_alive)
+        {
+            // The client asked to close, ignore anything it sent afterwards
+            break;
+        }
     }
-    else if (strcmp(request.method, "PATCH") == 0)
+
+    if (length < 0 && conn->parser.too_large && queue_payload_too_large(conn) == 0)
     {
-        handle_patch_request(&request, &response);
+        handled++;
     }
-    else if (strcmp(request.method, "DELETE") == 0)
+
+    if (conn->suspended)
     {
-        handle_delete_request(&request, &response);
+        // Whatever is queued goes out while the body arrives, the batch is
+        // not complete yet
+        timing_current = NULL;
+        return handled;
     }
-    else
+
+    // Sending starts now, the batch is finished once the last byte is out
+    timing_current = NULL;
+    conn->timing.mark = timing_now();
+    conn->timing.sending = 1;
+    if (conn->write_pending == 0)
     {
-        // Method not allowed
-        route_method_not_allowed(&request, &response);
+        timing_finish(&conn->timing, &conn->client_addr);
     }
 
-    // Build and send response
-    if (http_response_build(&response, response_buffer, sizeof(response_buffer)) > 0)
+    return (handled > 0) ? handled : -1;
+}
+
+// Queue a multipart/byteranges file body: each part's delimiter and headers
+// from the write buffer, its bytes with sendfile. Every file segment holds
+// its own reference, the response keeps the one it had
+static int queue_byteranges(CONNECTION *conn, const HTTP_RESPONSE *response)
+{
+    if (!response->file_entry)
     {
-        send(client_socket, response_buffer, strlen(response_buffer), 0);
-        printf("Response sent\n\n");
+        return -1;
     }
-    else
+
+    for (int i = 0; i <= response->range_count; i++)
     {
-        printf("Failed to build response\n");
+        if (connection_reserve_write(conn, conn->write_length + MAX_RESPONSE_HEADER_SIZE) != 0)
+        {
+            return -1;
+        }
+
+        int written = http_response_format_part(response, i, conn->write_buffer + conn->write_length,
+                                                conn->write_capacity - conn->write_length);
+        if (written <= 0 || connection_queue_write(conn, conn->write_length, written) != 0)
+        {
+            return -1;
+        }
+        conn->write_length += written;
+
+        if (i < response->range_count)
+        {
+            const HTTP_RANGE *range = &response->ranges[i];
+            file_cache_retain(response->file_entry);
+            if (connection_queue_file(conn, response->file_fd, response->file_entry,
+                                      range->start, range->length) != 0)
+            {
+                return -1;
+            }
+        }
     }
 
-    // Cleanup
-    http_request_cleanup(&request);
-    http_response_cleanup(&response);
+    return 0;
 }
 
-void handle_get_request(HTTP_REQUEST *request, HTTP_RESPONSE *response)
+// Format the headers into the write buffer and queue the body behind them,
+// both go out in the batch's scatter-gather send
+static int queue_response(CONNECTION *conn, HTTP_RESPONSE *response)
 {
-    // Check for exact matches first
-    if (strcmp(request->clean_path, "/") == 0 || strcmp(request->clean_path, "/index.html") == 0)
+    if (connection_reserve_write(conn, conn->write_length + MAX_RESPONSE_HEADER_SIZE) != 0)
     {
-        route_home(request, response);
+        return -1;
     }
-    else if (strcmp(request->clean_path, "/css/style.css") == 0)
+
+    int written = http_response_build_headers(response, conn->write_buffer + conn->write_length,
+                                              (int)(conn->write_capacity - conn->write_length));
+    if (written <= 0 || connection_queue_write(conn, conn->write_length, written) != 0)
     {
-        route_get_css(request, response);
+        LOG_ERROR("Failed to build response\n");
+        return -1;
     }
-    else if (strcmp(request->clean_path, "/js/app.js") == 0)
+    conn->write_length += written;
+
+    // The connection owns the body from here on
+    int result;
+    if (response->file_fd >= 0 && response->range_count > 1)
     {
-        route_get_js(request, response);
+        result = queue_byteranges(conn, response);
     }
-    else if (strcmp(request->clean_path, "/about") == 0 || strcmp(request->clean_path, "/about.html") == 0)
+    else if (response->file_fd >= 0)
     {
-        route_about(request, response);
+        result = connection_queue_file(conn, response->file_fd, response->file_entry,
+                                       response->file_offset, response->body_length);
+        response->file_fd = -1;
+        response->file_entry = NULL;
     }
-    else if (strcmp(request->clean_path, "/api/users") == 0)
+    else if (response->shared_body)
     {
-        route_get_users(request, response);
+        result = connection_queue_shared(conn, response->shared_body, response->body_length);
     }
-    // Check for parameterized routes
-    else if (match_path_pattern("/api/users/{id}", request->clean_path))
+    else if (response->body_owned)
     {
-        extract_and_store_url_params(request, "/api/users/{id}");
-        http_request_print(request);
-        route_get_user_by_id(request, response);
+        result = connection_queue_body(conn, response->body, response->body_length);
+        response->body = NULL;
+        response->body_owned = false;
     }
     else
     {
-        route_not_found(request, response);
+        result = connection_queue_shared(conn, response->body, response->body_length);
+    }
+    response->body_length = 0;
+    return result;
+}
+
+// Answer a request whose body is over its limit. Nothing after it can be
+// framed, so the connection closes once the response is sent
+static int queue_payload_too_large(CONNECTION *conn)
+{
+    HTTP_RESPONSE *response = arena_alloc(&conn->arena, sizeof(HTTP_RESPONSE));
+    if (!response)
+    {
+        return -1;
     }
+
+    http_response_init(response);
+    response->arena = &conn->arena;
+    canned_response_set(response, CANNED_PAYLOAD_TOO_LARGE);
+    conn->keep_alive = 0;
+
+    int result = queue_response(conn, response);
+    http_response_cleanup(response);
+    return result;
+}
+
+// Bytes ever queued on the connection, sent or not
+static uint64_t queued_bytes(const CONNECTION *conn)
+{
+    return (uint64_t)conn->bytes_written + conn->write_pending;
 }
 
-void handle_post_request(HTTP_REQUEST *request, HTTP_RESPONSE *response)
+// The access-log stage: one record per answered request. stage_start holds
+// the timestamps (timing_now) of every stage's start and of the last one's end
+static void record_access(const CONNECTION *conn, const HTTP_REQUEST *request, const HTTP_RESPONSE *response,
+                          const uint64_t *stage_start, uint64_t response_bytes)
 {
-    if (strcmp(request->path, "/api/users") == 0)
+    ACCESS_RECORD record;
+    memset(&record, 0, sizeof(record));
+    record.client_addr = conn->client_addr.sin_addr.s_addr;
+    record.client_port = ntohs(conn->client_addr.sin_port);
+    record.status = (uint16_t)http_response_status_code(response->status);
+    record.method = (uint8_t)request->method_id;
+    record.request_bytes = (uint32_t)conn->request_length;
+    record.response_bytes = response_bytes;
+
+    if (response->keep_alive)
     {
-        route_create_user(request, response);
+        record.flags |= ACCESS_FLAG_KEEP_ALIVE;
     }
-    else if (strcmp(request->path, "/api/login") == 0)
+    if (response->content_encoding != COMPRESS_NONE)
     {
-        route_login(request, response);
+        record.flags |= ACCESS_FLAG_COMPRESSED;
     }
-    else
+    if (response->stream_state != HTTP_STREAM_NONE)
     {
-        route_not_found(request, response);
+        record.flags |= ACCESS_FLAG_STREAMED;
     }
-}
 
-void handle_put_request(HTTP_REQUEST *request, HTTP_RESPONSE *response)
-{
-    if (match_path_pattern("/api/users/{id}", request->clean_path))
+    for (int i = 0; i < ACCESS_STAGE_COUNT; i++)
     {
-        extract_and_store_url_params(request, "/api/users/{id}");
-        route_update_user(request, response);
+        uint64_t elapsed = timing_to_ns(stage_start[i + 1] - stage_start[i]);
+        record.stage_ns[i] = (elapsed > UINT32_MAX) ? UINT32_MAX : (uint32_t)elapsed;
     }
-    else
+
+    access_log_write(&record, request->path.data, request->path.length);
+}
+
+// Add a request's stages to the batch breakdown. The first request of the
+// batch is the one the slow log names
+static void record_timing(CONNECTION *conn, const HTTP_REQUEST *request, const HTTP_RESPONSE *response,
+                          const uint64_t *stage_start, uint64_t route_ticks)
+{
+    REQUEST_TIMING *timing = &conn->timing;
+    timing->ticks[TIMING_PARSE] += stage_start[ACCESS_STAGE_HANDLE] - stage_start[ACCESS_STAGE_PARSE];
+    timing->ticks[TIMING_ROUTE] += route_ticks;
+    timing->ticks[TIMING_HANDLER] += stage_start[ACCESS_STAGE_BUILD] - stage_start[ACCESS_STAGE_HANDLE] - route_ticks;
+    timing->ticks[TIMING_BUILD] += stage_start[ACCESS_STAGE_COUNT] - stage_start[ACCESS_STAGE_BUILD];
+
+    if (timing->requests++ == 0)
     {
-        route_not_found(request, response);
+        size_t length = request->path.length < SLOW_LOG_MAX_PATH ? request->path.length : SLOW_LOG_MAX_PATH;
+        memcpy(timing->path, request->path.data, length);
+        timing->path_length = (uint16_t)length;
+        timing->method = request->method_id;
+        timing->status = http_response_status_code(response->status);
     }
 }
 
-void handle_patch_request(HTTP_REQUEST *request, HTTP_RESPONSE *response)
+// A request from its parse to its response. It stays in the connection
+// arena, with the response body, until the batch is sent; while its handler
+// waits for more of a streamed body the connection keeps it in suspended
+typedef struct HANDLED_REQUEST
 {
-    if (match_path_pattern("/api/users/{id}", request->clean_path))
+    HTTP_REQUEST request;
+    HTTP_RESPONSE response;
+    ROUTE_HANDLER route;
+    uint64_t stage_start[ACCESS_STAGE_COUNT + 1];
+    uint64_t route_ticks;
+    uint64_t queued_before;
+    bool streamed;
+    char next; // Byte behind the request, replaced by its terminator
+} HANDLED_REQUEST;
+
+// Queue the response of a request whose handler is done, then record it
+static int finish_http_request(CONNECTION *conn, HANDLED_REQUEST *handled)
+{
+    HTTP_REQUEST *request = &handled->request;
+    HTTP_RESPONSE *response = &handled->response;
+    uint64_t *stage_start = handled->stage_start;
+
+    // Whatever the handler left of a streamed body is still on the wire in
+    // front of the next request, the connection cannot be reused
+    if (handled->streamed && connection_finish_body(conn) < 0)
+    {
+        response->keep_alive = false;
+    }
+    conn->body_state = NULL;
+
+    conn->keep_alive = response->keep_alive;
+    stage_start[ACCESS_STAGE_BUILD] = timing_now();
+
+    // Format the headers into the write buffer and queue the body behind
+    // them, both go out in the batch's scatter-gather send. A streamed body
+    // is queued already, only its end may be missing
+    int result = -1;
+    if (response->stream_state == HTTP_STREAM_NONE)
     {
-        extract_and_store_url_params(request, "/api/users/{id}");
-        route_partial_update_user(request, response);
+        http_response_compress(response);
+    }
+
+    if (response->stream_state != HTTP_STREAM_NONE)
+    {
+        if (response->stream_state == HTTP_STREAM_DONE || http_response_end_chunked(response) == 0)
+        {
+            result = 0;
+        }
     }
     else
     {
-        route_not_found(request, response);
+        result = queue_response(conn, response);
+    }
+
+    if (result == 0)
+    {
+        stage_start[ACCESS_STAGE_COUNT] = timing_now();
+        record_access(conn, request, response, stage_start, queued_bytes(conn) - handled->queued_before);
+        metrics_record_request(request->method_id, request->route_id, response->status,
+                               timing_to_ns(stage_start[ACCESS_STAGE_COUNT] - stage_start[ACCESS_STAGE_PARSE]));
+        record_timing(conn, request, response, stage_start, handled->route_ticks);
+    }
+
+    // Cleanup
+    http_request_cleanup(request);
+    http_response_cleanup(response);
+    if (!handled->streamed)
+    {
+        conn->read_buffer[conn->read_offset + conn->request_length] = handled->next;
     }
+    return result;
 }
 
-void handle_delete_request(HTTP_REQUEST *request, HTTP_RESPONSE *response)
+// Call the handler, the first time or again with more of its body.
+// Returns 1 if it waits for the rest of the body, else what
+// finish_http_request returns
+static int run_handler(CONNECTION *conn, HANDLED_REQUEST *handled)
 {
-    if (match_path_pattern("/api/users/{id}", request->clean_path))
+    conn->body_starved = 0;
+    handled->route(&handled->request, &handled->response);
+
+    if (handled->streamed && conn->body_starved)
     {
-        extract_and_store_url_params(request, "/api/users/{id}");
-        route_delete_user(request, response);
+        conn->suspended = handled;
+        return 1;
     }
-    else
+
+    conn->suspended = NULL;
+    return finish_http_request(conn, handled);
+}
+
+// Answer the complete request at the start of the read buffer. Returns 0
+// once its response is queued, 1 if the handler waits for more of a streamed
+// body (handle_http_requests resumes it), -1 on failure
+int handle_http_request(CONNECTION *conn)
+{
+    HANDLED_REQUEST *handled = arena_alloc(&conn->arena, sizeof(HANDLED_REQUEST));
+    if (!handled)
+    {
+        return -1;
+    }
+    HTTP_REQUEST *request = &handled->request;
+    HTTP_RESPONSE *response = &handled->response;
+
+    handled->stage_start[ACCESS_STAGE_PARSE] = timing_now();
+    handled->queued_before = queued_bytes(conn);
+
+    char *raw_request = conn->read_buffer + conn->read_offset;
+    LOG_DEBUG("Raw request (%zu bytes): '%.*s'\n", conn->request_length, (int)conn->request_length, raw_request);
+
+    // The request points into the read buffer. Terminate it so the body is
+    // a string and nothing runs into the next pipelined request, until the
+    // response is built. A streamed body is read into the bytes behind it
+    handled->streamed = conn->parser.body_mode == HTTP_BODY_STREAMED;
+    handled->next = raw_request[conn->request_length];
+    if (!handled->streamed)
     {
-        route_not_found(request, response);
+        raw_request[conn->request_length] = '\0';
     }
+
+    if (http_request_parse(&conn->parser, raw_request, request) < 0)
+    {
+        LOG_INFO("Failed to parse HTTP request\n");
+        raw_request[conn->request_length] = handled->next;
+        return -1;
+    }
+
+    if (handled->streamed)
+    {
+        request->body_stream = conn;
+
+        // The client may hold the body back until it is told to send it. It
+        // goes out behind the earlier pipelined responses as soon as the
+        // handler waits for the body
+        HTTP_SLICE expect = http_request_find_header(request, "Expect");
+        if (expect.length == 12 && strncasecmp(expect.data, "100-continue", 12) == 0 &&
+            http_slice_equals(request->version, "HTTP/1.1"))
+        {
+            static const char continue_response[] = "HTTP/1.1 100 Continue\r\n\r\n";
+            if (connection_queue_shared(conn, continue_response, sizeof(continue_response) - 1) != 0)
+            {
+                return -1;
+            }
+        }
+    }
+
+    if (LOG_DEBUG_ENABLED)
+    {
+        http_request_print(request);
+    }
+
+    // Initialize response
+    handled->stage_start[ACCESS_STAGE_HANDLE] = timing_now();
+    http_response_init(response);
+    response->arena = &conn->arena;
+
+    // Keep the connection open if the client wants it and it has requests left
+    conn->requests_served++;
+    response->keep_alive = request->keep_alive && conn->requests_served < KEEPALIVE_MAX_REQUESTS;
+
+    // Handlers may stream the body to the connection instead of setting it
+    response->stream = conn;
+    response->stream_chunked = http_slice_equals(request->version, "HTTP/1.1");
+
+    // Dynamic bodies are compressed for clients that take it
+    if (http_request_accepts_encoding(request, "gzip"))
+    {
+        response->accept_encoding = COMPRESS_GZIP;
+    }
+    else if (http_request_accepts_encoding(request, "deflate"))
+    {
+        response->accept_encoding = COMPRESS_DEFLATE;
+    }
+
+    // Route based on method and path
+    uint64_t route_start = timing_now();
+    ROUTE_STATUS route_status = router_lookup(request, &handled->route);
+    handled->route_ticks = timing_now() - route_start;
+
+    switch (route_status)
+    {
+    case ROUTE_FOUND:
+        break;
+    case ROUTE_METHOD_NOT_ALLOWED:
+        handled->route = route_method_not_allowed;
+        break;
+    default:
+        handled->route = route_not_found;
+        break;
+    }
+
+    return run_handler(conn, handled);
 }
 
 void route_method_not_allowed(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
 {
     (void)request;
-
-    const char *body =
-        "{\n"
-        "  \"error\": \"Method Not Allowed\",\n"
-        "  \"message\": \"The HTTP method is not supported for this endpoint\"\n"
-        "}";
-
-    http_response_set_status(response, HTTP_405_METHOD_NOT_ALLOWED);
-    http_response_set_content_type(response, "application/json");
-    http_response_set_body(response, body);
+    canned_response_set(response, CANNED_METHOD_NOT_ALLOWED);
 }
\ No newline at end of file
@@ -0,0 +1,242 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "../include/config.h"
+#include "../include/log.h"
+#include "../include/ring.h"
+
+// Every message in a ring starts with one of these
+typedef struct
+{
+    uint32_t length;
+    uint32_t level;
+} LOG_RECORD;
+
+// Output gathered by the writer for one file descriptor
+typedef struct
+{
+    int fd;
+    size_t length;
+    char data[LOG_BATCH_SIZE];
+} LOG_BATCH;
+
+static BYTE_RING *rings = NULL; // One per thread, added on its first message and freed by log_cleanup
+static __thread BYTE_RING *thread_ring = NULL;
+static int accepting = 0;     // Messages go through the rings
+static int writer_running = 0;
+static pthread_t writer_thread;
+
+static LOG_BATCH out_batch = {STDOUT_FILENO, 0, {0}};
+static LOG_BATCH err_batch = {STDERR_FILENO, 0, {0}};
+static LOG_BATCH slow_batch = {-1, 0, {0}}; // The file is opened with the first report
+
+static void batch_flush(LOG_BATCH *batch)
+{
+    // Startup and shutdown messages still go through stdio, keep them in order
+    if (batch->fd == STDOUT_FILENO)
+    {
+        fflush(stdout);
+    }
+
+    size_t written = 0;
+    while (written < batch->length)
+    {
+        ssize_t result = write(batch->fd, batch->data + written, batch->length - written);
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result <= 0)
+        {
+            break; // Nowhere to log to, the messages are lost
+        }
+        written += result;
+    }
+    batch->length = 0;
+}
+
+// Batch a record of level goes to
+static LOG_BATCH *level_batch(uint32_t level)
+{
+    if (level == LOG_LEVEL_SLOW)
+    {
+        if (slow_batch.fd < 0)
+        {
+            slow_batch.fd = open(SLOW_LOG_PATH, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        }
+        if (slow_batch.fd >= 0)
+        {
+            return &slow_batch;
+        }
+    }
+    return (level >= LOG_LEVEL_WARN) ? &err_batch : &out_batch;
+}
+
+static void batch_append(LOG_BATCH *batch, const char *data, size_t length)
+{
+    if (batch->length + length > sizeof(batch->data))
+    {
+        batch_flush(batch);
+    }
+    memcpy(batch->data + batch->length, data, length);
+    batch->length += length;
+}
+
+static BYTE_RING *register_thread(void)
+{
+    BYTE_RING *ring = ring_create(LOG_RING_SIZE);
+    if (ring)
+    {
+        ring_list_push(&rings, ring);
+        thread_ring = ring;
+    }
+    return ring;
+}
+
+// Move everything queued so far into the batches and write them out.
+// Returns the number of bytes taken from the rings
+static size_t drain_rings(void)
+{
+    size_t drained = 0;
+
+    for (BYTE_RING *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    {
+        size_t used = ring_used(ring);
+        size_t offset = 0;
+
+        while (offset < used)
+        {
+            LOG_RECORD record;
+            ring_peek(ring, offset, &record, sizeof(record));
+
+            LOG_BATCH *batch = level_batch(record.level);
+            if (batch->length + record.length > sizeof(batch->data))
+            {
+                batch_flush(batch);
+            }
+            ring_peek(ring, offset + sizeof(record), batch->data + batch->length, record.length);
+            batch->length += record.length;
+            offset += sizeof(record) + record.length;
+        }
+
+        ring_consume(ring, used);
+        drained += used;
+
+        unsigned long dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+        if (dropped > 0)
+        {
+            char line[64];
+            int length = snprintf(line, sizeof(line), "Log: %lu messages dropped\n", dropped);
+            batch_append(&err_batch, line, length);
+        }
+    }
+
+    batch_flush(&out_batch);
+    batch_flush(&err_batch);
+    if (slow_batch.fd >= 0)
+    {
+        batch_flush(&slow_batch);
+    }
+    return drained;
+}
+
+static void *writer_main(void *arg)
+{
+    (void)arg;
+
+    struct timespec interval = {0, LOG_FLUSH_INTERVAL_MS * 1000000L};
+    while (__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE))
+    {
+        if (drain_rings() == 0)
+        {
+            nanosleep(&interval, NULL);
+        }
+    }
+
+    // Whatever was logged before log_cleanup stopped the writer
+    drain_rings();
+    return NULL;
+}
+
+int log_init(void)
+{
+    writer_running = 1;
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0)
+    {
+        perror("Failed to start log writer");
+        writer_running = 0;
+        return -1;
+    }
+
+    __atomic_store_n(&accepting, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void log_write(LOG_LEVEL level, const char *format, ...)
+{
+    // The record header goes in front of the text so it is queued in one piece
+    char buffer[sizeof(LOG_RECORD) + LOG_LINE_MAX];
+    char *line = buffer + sizeof(LOG_RECORD);
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, LOG_LINE_MAX, format, args);
+    va_end(args);
+
+    if (length < 0)
+    {
+        return;
+    }
+    if (length >= LOG_LINE_MAX)
+    {
+        // Cut, but keep the line break
+        length = LOG_LINE_MAX - 1;
+        line[length - 1] = '\n';
+    }
+
+    BYTE_RING *ring = NULL;
+    if (__atomic_load_n(&accepting, __ATOMIC_ACQUIRE))
+    {
+        ring = thread_ring ? thread_ring : register_thread();
+    }
+    if (!ring)
+    {
+        fwrite(line, 1, length, (level >= LOG_LEVEL_WARN) ? stderr : stdout);
+        return;
+    }
+
+    LOG_RECORD record = {(uint32_t)length, (uint32_t)level};
+    memcpy(buffer, &record, sizeof(record));
+    ring_write(ring, buffer, sizeof(record) + length);
+}
+
+// Call once every other thread has stopped logging: the rings are written
+// out and freed, later messages are written directly
+void log_cleanup(void)
+{
+    if (!writer_running)
+    {
+        return;
+    }
+
+    __atomic_store_n(&accepting, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&writer_running, 0, __ATOMIC_RELEASE);
+    pthread_join(writer_thread, NULL);
+
+    ring_list_destroy(&rings);
+    thread_ring = NULL;
+
+    if (slow_batch.fd >= 0)
+    {
+        close(slow_batch.fd);
+        slow_batch.fd = -1;
+    }
+}
@@ -1,69 +1,69 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
-#include <arpa/inet.h>
+#include <string.h>
 #include <unistd.h>
 #include "../include/config.h"
 #include "../include/server.h"
-#include "../include/handler.h"
 #include "../include/database.h"
 #include "../include/threadpool.h"
-
-static TCP_SERVER server;
+#include "../include/event_loop.h"
+#include "../include/handler.h"
+#include "../include/asset_cache.h"
+#include "../include/file_cache.h"
+#include "../include/canned_response.h"
+#include "../include/date_cache.h"
+#include "../include/log.h"
+#include "../include/access_log.h"
+#include "../include/metrics.h"
+#include "../include/timing.h"
+
+static TCP_SERVER servers[MAX_EVENT_LOOPS];
+static EVENT_LOOP event_loops[MAX_EVENT_LOOPS];
+static int event_loop_count = 0;
 Database app_db;
 ThreadPool *thread_pool = NULL;
 
-// Structure to hold client request data
-typedef struct
-{
-    int client_socket;
-    struct sockaddr_in client_addr;
-} ClientRequest;
-
 void signal_handler(int sig)
 {
     (void)sig;
 
-    printf("\nShutting down server...\n");
-
-    // Destroy thread pool first
-    if (thread_pool)
+    // The event loops notice within one tick and main() performs the cleanup
+    for (int i = 0; i < event_loop_count; i++)
     {
-        printf("Destroying thread pool...\n");
-        threadpool_destroy(thread_pool);
-        thread_pool = NULL;
+        event_loop_stop(&event_loops[i]);
     }
-
-    // Close server socket
-    server_close(&server);
-
-    // Close database
-    db_close(&app_db);
-
-    printf("Server shutdown complete\n");
-    exit(0);
 }
 
-// Thread function to handle client request
-void handle_client_request(void *arg)
+static int open_listener(TCP_SERVER *server, int port, int reuse_port)
 {
-    ClientRequest *client_req = (ClientRequest *)arg;
-    int client_socket = client_req->client_socket;
-
-    printf("[Thread %lu] Handling client request from %s:%d\n",
-           pthread_self(),
-           inet_ntoa(client_req->client_addr.sin_addr),
-           ntohs(client_req->client_addr.sin_port));
+    if (server_create(server, port) < 0)
+    {
+        return -1;
+    }
 
-    handle_http_request(client_socket);
+    if (reuse_port && server_set_reuseport(server) < 0)
+    {
+        server_close(server);
+        return -1;
+    }
 
-    // Close client socket
-    close(client_socket);
+    if (server_bind(server) < 0 || server_listen(server, MAX_CONNECTIONS) < 0)
+    {
+        server_close(server);
+        return -1;
+    }
 
-    // Free the client request structure
-    free(client_req);
+    return 0;
+}
 
-    printf("[Thread %lu] Request handling completed\n", pthread_self());
+static void close_listeners(int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        server_close(&servers[i]);
+    }
 }
 
 int main(int argc, char *argv[])
@@ -71,6 +71,8 @@ int main(int argc, char *argv[])
     int port = DEFAULT_PORT;
     int thread_count = DEFAULT_THREAD_COUNT;
     int queue_size = MAX_QUEUE_SIZE;
+    int loop_count = DEFAULT_EVENT_LOOPS;
+    int use_io_uring = 0;
 
     // Parse command line arguments
     if (argc > 1)
@@ -103,46 +105,83 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (argc > 4)
+    {
+        // 0 means one event loop per online CPU
+        loop_count = atoi(argv[4]);
+        if (loop_count == 0)
+        {
+            loop_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        }
+        if (loop_count <= 0 || loop_count > MAX_EVENT_LOOPS)
+        {
+            printf("Invalid event loop count. Using default %d\n", DEFAULT_EVENT_LOOPS);
+            loop_count = DEFAULT_EVENT_LOOPS;
+        }
+    }
+
+    if (argc > 5)
+    {
+        if (strcmp(argv[5], "io_uring") == 0)
+        {
+            use_io_uring = 1;
+        }
+        else if (strcmp(argv[5], "epoll") != 0)
+        {
+            printf("Unknown I/O backend '%s'. Using epoll\n", argv[5]);
+        }
+    }
+
+    // With several loops each one gets its own SO_REUSEPORT listener and
+    // runs handlers inline, so no connection ever crosses threads
+    int per_core = loop_count > 1;
+
+    // Request-path messages are written by a background thread from here on
+    log_init();
+    timing_init(SLOW_REQUEST_THRESHOLD_MS);
+
     // Set up signal handler for graceful shutdown
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
 
-    printf("Starting HTTP server on port %d with %d threads...\n", port, thread_count);
+    // sendfile and splice have no MSG_NOSIGNAL, a client closing in the
+    // middle of a file must fail the write, not end the process
+    signal(SIGPIPE, SIG_IGN);
 
-    // Create thread pool
-    thread_pool = threadpool_create(thread_count, queue_size);
-    if (!thread_pool)
+    if (per_core || use_io_uring)
     {
-        fprintf(stderr, "Failed to create thread pool\n");
-        exit(1);
+        printf("Starting HTTP server on port %d with %d %s event loop(s)...\n",
+               port, loop_count, use_io_uring ? "io_uring" : "per-core");
     }
-
-    // Create and configure server
-    if (server_create(&server, port) < 0)
+    else
     {
-        threadpool_destroy(thread_pool);
-        exit(1);
-    }
+        printf("Starting HTTP server on port %d with %d threads...\n", port, thread_count);
 
-    if (server_bind(&server) < 0)
-    {
-        server_close(&server);
-        threadpool_destroy(thread_pool);
-        exit(1);
+        // Create thread pool
+        thread_pool = threadpool_create(thread_count, queue_size);
+        if (!thread_pool)
+        {
+            fprintf(stderr, "Failed to create thread pool\n");
+            exit(1);
+        }
     }
 
-    if (server_listen(&server, MAX_CONNECTIONS) < 0)
+    // Create and configure one listening socket per event loop
+    for (int i = 0; i < loop_count; i++)
     {
-        server_close(&server);
-        threadpool_destroy(thread_pool);
-        exit(1);
+        if (open_listener(&servers[i], port, per_core) < 0)
+        {
+            close_listeners(i);
+            threadpool_destroy(thread_pool);
+            exit(1);
+        }
     }
 
     // Initialize database
     if (db_init(&app_db, "httpserver.db") < 0)
     {
         fprintf(stderr, "Failed to initialize database\n");
-        server_close(&server);
+        close_listeners(loop_count);
         threadpool_destroy(thread_pool);
         exit(1);
     }
@@ -151,55 +190,142 @@ int main(int argc, char *argv[])
     {
         fprintf(stderr, "Failed to create tables\n");
         db_close(&app_db);
-        server_close(&server);
+        close_listeners(loop_count);
         threadpool_destroy(thread_pool);
         exit(1);
     }
 
-    printf("Server listening on http://localhost:%d\n", port);
-    printf("Thread pool: %d worker threads with queue size %d\n", thread_count, queue_size);
-    printf("Press Ctrl+C to stop the server\n\n");
-
-    // Main server loop
-    while (1)
+    if (handler_register_routes() < 0)
     {
-        struct sockaddr_in client_addr;
-        int client_socket = server_accept(&server, &client_addr);
+        fprintf(stderr, "Failed to register routes\n");
+        db_close(&app_db);
+        close_listeners(loop_count);
+        threadpool_destroy(thread_pool);
+        exit(1);
+    }
+
+    // Files missing from the caches are still served from disk
+    asset_cache_init(STATIC_FILES_DIR);
+    file_cache_init(STATIC_FILES_DIR);
+    canned_response_init();
+    date_cache_init();
+    access_log_init(ACCESS_LOG_PATH);
 
-        if (client_socket < 0)
+    for (int i = 0; i < loop_count; i++)
+    {
+        if (event_loop_init(&event_loops[i], &servers[i], thread_pool) < 0)
         {
-            // Accept failed, but continue running
-            continue;
+            fprintf(stderr, "Failed to initialize event loop %d\n", i);
+            for (int j = 0; j < i; j++)
+            {
+                event_loop_cleanup(&event_loops[j]);
+            }
+            access_log_cleanup();
+            date_cache_cleanup();
+            file_cache_cleanup();
+            asset_cache_cleanup();
+            router_cleanup();
+            db_close(&app_db);
+            close_listeners(loop_count);
+            threadpool_destroy(thread_pool);
+            exit(1);
         }
+        event_loops[i].id = i;
 
-        printf("New connection from %s:%d\n",
-               inet_ntoa(client_addr.sin_addr),
-               ntohs(client_addr.sin_port));
+        if (use_io_uring && event_loop_use_io_uring(&event_loops[i]) < 0)
+        {
+            printf("Event loop %d: io_uring unavailable, falling back to epoll\n", i);
+        }
+    }
+    event_loop_count = loop_count;
 
-        // Create client request structure
-        ClientRequest *client_req = malloc(sizeof(ClientRequest));
-        if (!client_req)
+    // io_uring loops run handlers inline; a fallback single loop still needs workers
+    if (!per_core && !thread_pool && event_loops[0].backend == EVENT_BACKEND_EPOLL)
+    {
+        thread_pool = threadpool_create(thread_count, queue_size);
+        if (!thread_pool)
         {
-            fprintf(stderr, "Failed to allocate memory for client request\n");
-            close(client_socket);
-            continue;
+            fprintf(stderr, "Failed to create thread pool\n");
+            event_loop_cleanup(&event_loops[0]);
+            access_log_cleanup();
+            date_cache_cleanup();
+            file_cache_cleanup();
+            asset_cache_cleanup();
+            router_cleanup();
+            db_close(&app_db);
+            close_listeners(loop_count);
+            exit(1);
         }
+        event_loops[0].pool = thread_pool;
+    }
+
+    printf("Server listening on http://localhost:%d\n", port);
+    if (use_io_uring && event_loops[0].backend == EVENT_BACKEND_IO_URING)
+    {
+        printf("I/O backend: io_uring (multishot accept, provided buffers, linked send/close)\n");
+    }
+    else if (per_core)
+    {
+        printf("Event loops: %d, each with its own SO_REUSEPORT listener\n", loop_count);
+    }
+    else
+    {
+        printf("Thread pool: %d worker threads with queue size %d\n", thread_count, queue_size);
+    }
+    printf("Press Ctrl+C to stop the server\n\n");
 
-        client_req->client_socket = client_socket;
-        client_req->client_addr = client_addr;
+    if (per_core)
+    {
+        // One pinned thread per loop; main just waits for them to stop
+        long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+        int started = 0;
 
-        // Add task to the thread pool
-        if (threadpool_add_task(thread_pool, handle_client_request, client_req) < 0)
+        for (int i = 0; i < loop_count; i++)
         {
-            fprintf(stderr, "Failed to add task to thread pool\n");
-            close(client_socket);
-            free(client_req);
-            continue;
+            if (event_loop_start(&event_loops[i], (int)(i % cpu_count)) < 0)
+            {
+                signal_handler(SIGTERM);
+                break;
+            }
+            started++;
         }
+
+        for (int i = 0; i < started; i++)
+        {
+            event_loop_join(&event_loops[i]);
+        }
+    }
+    else
+    {
+        // Main server loop: accept, read and write on this thread, handle requests on workers
+        event_loop_run(&event_loops[0]);
     }
 
-    threadpool_destroy(thread_pool);
-    server_close(&server);
+    printf("\nShutting down server...\n");
+
+    // Destroy thread pool first so no worker still owns a connection
+    if (thread_pool)
+    {
+        printf("Destroying thread pool...\n");
+        threadpool_destroy(thread_pool);
+        thread_pool = NULL;
+    }
+
+    for (int i = 0; i < loop_count; i++)
+    {
+        event_loop_print_stats(&event_loops[i]);
+        event_loop_cleanup(&event_loops[i]);
+    }
+    close_listeners(loop_count);
+    access_log_cleanup();
+    date_cache_cleanup();
+    file_cache_cleanup();
+    asset_cache_cleanup();
+    router_cleanup();
     db_close(&app_db);
+    metrics_cleanup();
+    log_cleanup();
+
+    printf("Server shutdown complete\n");
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,357 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "../include/config.h"
+#include "../include/metrics.h"
+#include "../include/router.h"
+
+#define METRICS_CACHE_LINE 64
+#define METRICS_LINE_MAX 512
+
+typedef struct
+{
+    uint64_t buckets[METRICS_LATENCY_BUCKETS];
+    uint64_t count;
+    uint64_t sum_ns;
+} METRICS_HISTOGRAM;
+
+// Counters of one thread. Only the owner writes them, with plain relaxed
+// stores; the scraper reads them with relaxed loads and may see a slot a
+// few samples behind, never a torn value
+typedef struct METRICS_SLOT
+{
+    uint64_t requests[HTTP_METHOD_COUNT][MAX_ROUTES + 1][HTTP_STATUS_COUNT];
+    METRICS_HISTOGRAM request_latency[MAX_ROUTES + 1]; // By route id, 0: unmatched
+    METRICS_HISTOGRAM db_latency[METRICS_DB_OP_COUNT];
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t connections_opened;
+    uint64_t connections_closed;
+    struct METRICS_SLOT *next;
+} __attribute__((aligned(METRICS_CACHE_LINE))) METRICS_SLOT;
+
+typedef struct
+{
+    METRICS_WRITE_FUNC write;
+    void *context;
+    int failed;
+} METRICS_OUTPUT;
+
+static const char *db_op_names[METRICS_DB_OP_COUNT] = {
+    "begin", "commit", "create_user", "get_users", "get_user", "update_user", "delete_user"};
+
+static METRICS_SLOT *slots = NULL; // One per thread, added on its first sample
+static __thread METRICS_SLOT *thread_slot = NULL;
+
+// The calling thread's slot, NULL if it cannot be allocated (the sample is lost)
+static METRICS_SLOT *get_slot(void)
+{
+    if (thread_slot)
+    {
+        return thread_slot;
+    }
+
+    void *memory;
+    if (posix_memalign(&memory, METRICS_CACHE_LINE, sizeof(METRICS_SLOT)) != 0)
+    {
+        return NULL;
+    }
+    memset(memory, 0, sizeof(METRICS_SLOT));
+
+    METRICS_SLOT *slot = memory;
+    slot->next = __atomic_load_n(&slots, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&slots, &slot->next, slot, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    {
+    }
+
+    thread_slot = slot;
+    return slot;
+}
+
+static inline void counter_add(uint64_t *counter, uint64_t value)
+{
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t counter_read(const uint64_t *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+// Bucket of a latency: the first whose bound is not below it, -1 past the
+// last bucket
+static int bucket_index(uint64_t latency_ns)
+{
+    uint64_t multiple = (latency_ns > 0) ? (latency_ns - 1) / (METRICS_FIRST_BOUND_US * 1000) : 0;
+    int index = (multiple == 0) ? 0 : 64 - __builtin_clzll(multiple);
+    return (index < METRICS_LATENCY_BUCKETS) ? index : -1;
+}
+
+// Inclusive upper bound (le) of a bucket in microseconds
+static uint64_t bucket_bound_us(int index)
+{
+    return (uint64_t)METRICS_FIRST_BOUND_US << index;
+}
+
+static void histogram_add(METRICS_HISTOGRAM *histogram, uint64_t latency_ns)
+{
+    int index = bucket_index(latency_ns);
+    if (index >= 0)
+    {
+        counter_add(&histogram->buckets[index], 1);
+    }
+    counter_add(&histogram->count, 1);
+    counter_add(&histogram->sum_ns, latency_ns);
+}
+
+// Count an answered request. route_id is the request's, 0 if unmatched
+void metrics_record_request(HTTP_METHOD method, int route_id, HTTP_STATUS status, uint64_t latency_ns)
+{
+    METRICS_SLOT *slot = get_slot();
+    if (!slot || method < 0 || method >= HTTP_METHOD_COUNT || status < 0 || status >= HTTP_STATUS_COUNT)
+    {
+        return;
+    }
+    if (route_id < 0 || route_id > MAX_ROUTES)
+    {
+        route_id = 0;
+    }
+
+    counter_add(&slot->requests[method][route_id][status], 1);
+    histogram_add(&slot->request_latency[route_id], latency_ns);
+}
+
+// Count a database call
+void metrics_observe_db(METRICS_DB_OP op, uint64_t latency_ns)
+{
+    METRICS_SLOT *slot = get_slot();
+    if (slot && op >= 0 && op < METRICS_DB_OP_COUNT)
+    {
+        histogram_add(&slot->db_latency[op], latency_ns);
+    }
+}
+
+void metrics_add_bytes_in(size_t bytes)
+{
+    METRICS_SLOT *slot = get_slot();
+    if (slot)
+    {
+        counter_add(&slot->bytes_in, bytes);
+    }
+}
+
+void metrics_add_bytes_out(size_t bytes)
+{
+    METRICS_SLOT *slot = get_slot();
+    if (slot)
+    {
+        counter_add(&slot->bytes_out, bytes);
+    }
+}
+
+void metrics_connection_opened(void)
+{
+    METRICS_SLOT *slot = get_slot();
+    if (slot)
+    {
+        counter_add(&slot->connections_opened, 1);
+    }
+}
+
+void metrics_connection_closed(void)
+{
+    METRICS_SLOT *slot = get_slot();
+    if (slot)
+    {
+        counter_add(&slot->connections_closed, 1);
+    }
+}
+
+static void sum_histogram(METRICS_HISTOGRAM *total, const METRICS_HISTOGRAM *histogram)
+{
+    for (int i = 0; i < METRICS_LATENCY_BUCKETS; i++)
+    {
+        total->buckets[i] += counter_read(&histogram->buckets[i]);
+    }
+    total->count += counter_read(&histogram->count);
+    total->sum_ns += counter_read(&histogram->sum_ns);
+}
+
+// Add up every thread's slot into total
+static void sum_slots(METRICS_SLOT *total)
+{
+    for (METRICS_SLOT *slot = __atomic_load_n(&slots, __ATOMIC_ACQUIRE); slot; slot = slot->next)
+    {
+        const uint64_t *counts = &slot->requests[0][0][0];
+        uint64_t *total_counts = &total->requests[0][0][0];
+        for (size_t i = 0; i < sizeof(slot->requests) / sizeof(uint64_t); i++)
+        {
+            total_counts[i] += counter_read(&counts[i]);
+        }
+
+        for (int i = 0; i <= MAX_ROUTES; i++)
+        {
+            sum_histogram(&total->request_latency[i], &slot->request_latency[i]);
+        }
+        for (int i = 0; i < METRICS_DB_OP_COUNT; i++)
+        {
+            sum_histogram(&total->db_latency[i], &slot->db_latency[i]);
+        }
+
+        total->bytes_in += counter_read(&slot->bytes_in);
+        total->bytes_out += counter_read(&slot->bytes_out);
+        total->connections_opened += counter_read(&slot->connections_opened);
+        total->connections_closed += counter_read(&slot->connections_closed);
+    }
+}
+
+static void emit(METRICS_OUTPUT *output, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+// One line of exposition text, nothing more once a write failed
+static void emit(METRICS_OUTPUT *output, const char *format, ...)
+{
+    if (output->failed)
+    {
+        return;
+    }
+
+    char line[METRICS_LINE_MAX];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if (length < 0 || (size_t)length >= sizeof(line) || output->write(output->context, line, length) < 0)
+    {
+        output->failed = 1;
+    }
+}
+
+static void emit_header(METRICS_OUTPUT *output, const char *name, const char *type, const char *help)
+{
+    emit(output, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// Every bucket is written, empty ones too, so all series share the bounds
+static void emit_histogram(METRICS_OUTPUT *output, const char *name, const char *label, const char *value,
+                           const METRICS_HISTOGRAM *histogram)
+{
+    uint64_t cumulative = 0;
+    for (int i = 0; i < METRICS_LATENCY_BUCKETS; i++)
+    {
+        cumulative += histogram->buckets[i];
+        uint64_t bound = bucket_bound_us(i);
+        emit(output, "%s_bucket{%s=\"%s\",le=\"%llu.%06llu\"} %llu\n", name, label, value,
+             (unsigned long long)(bound / 1000000), (unsigned long long)(bound % 1000000),
+             (unsigned long long)cumulative);
+    }
+
+    emit(output, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %llu\n", name, label, value,
+         (unsigned long long)histogram->count);
+    emit(output, "%s_sum{%s=\"%s\"} %llu.%09llu\n", name, label, value,
+         (unsigned long long)(histogram->sum_ns / 1000000000ULL),
+         (unsigned long long)(histogram->sum_ns % 1000000000ULL));
+    emit(output, "%s_count{%s=\"%s\"} %llu\n", name, label, value, (unsigned long long)histogram->count);
+}
+
+static const char *route_label(int route_id)
+{
+    const char *pattern = router_route_pattern(route_id);
+    return pattern ? pattern : "unmatched";
+}
+
+// Write every metric in the Prometheus text format (version 0.0.4).
+// Series that were never counted are left out.
+// Returns 0, -1 if write gave up or memory ran out
+int metrics_write(METRICS_WRITE_FUNC write, void *context, const METRICS_GAUGES *gauges)
+{
+    // Too big for a worker's stack
+    METRICS_SLOT *total = calloc(1, sizeof(METRICS_SLOT));
+    if (!total)
+    {
+        return -1;
+    }
+    sum_slots(total);
+
+    METRICS_OUTPUT output = {write, context, 0};
+
+    emit_header(&output, "http_requests_total", "counter", "Requests answered, by method, route and status.");
+    for (int method = 0; method < HTTP_METHOD_COUNT; method++)
+    {
+        for (int route = 0; route <= MAX_ROUTES; route++)
+        {
+            for (int status = 0; status < HTTP_STATUS_COUNT; status++)
+            {
+                uint64_t count = total->requests[method][route][status];
+                if (count > 0)
+                {
+                    emit(&output, "http_requests_total{method=\"%s\",route=\"%s\",status=\"%d\"} %llu\n",
+                         http_method_name((HTTP_METHOD)method), route_label(route),
+                         http_response_status_code((HTTP_STATUS)status), (unsigned long long)count);
+                }
+            }
+        }
+    }
+
+    emit_header(&output, "http_request_duration_seconds", "histogram",
+                "Time from parsing a request to its response being queued, by route.");
+    for (int route = 0; route <= MAX_ROUTES; route++)
+    {
+        if (total->request_latency[route].count > 0)
+        {
+            emit_histogram(&output, "http_request_duration_seconds", "route", route_label(route),
+                           &total->request_latency[route]);
+        }
+    }
+
+    emit_header(&output, "http_received_bytes_total", "counter", "Bytes read from clients.");
+    emit(&output, "http_received_bytes_total %llu\n", (unsigned long long)total->bytes_in);
+    emit_header(&output, "http_sent_bytes_total", "counter", "Bytes sent to clients.");
+    emit(&output, "http_sent_bytes_total %llu\n", (unsigned long long)total->bytes_out);
+
+    // Opens and closes of one connection may be counted by different
+    // threads, the difference must not go negative in between
+    uint64_t open = (total->connections_opened > total->connections_closed)
+                        ? total->connections_opened - total->connections_closed
+                        : 0;
+    emit_header(&output, "http_connections_total", "counter", "Client connections accepted.");
+    emit(&output, "http_connections_total %llu\n", (unsigned long long)total->connections_opened);
+    emit_header(&output, "http_connections_open", "gauge", "Client connections currently open.");
+    emit(&output, "http_connections_open %llu\n", (unsigned long long)open);
+
+    emit_header(&output, "threadpool_workers", "gauge", "Worker threads in the pool.");
+    emit(&output, "threadpool_workers %d\n", gauges->workers);
+    emit_header(&output, "threadpool_queue_depth", "gauge", "Tasks waiting for a worker.");
+    emit(&output, "threadpool_queue_depth %d\n", gauges->queue_depth);
+    emit_header(&output, "threadpool_busy_workers", "gauge", "Workers running a task.");
+    emit(&output, "threadpool_busy_workers %d\n", gauges->busy_workers);
+
+    emit_header(&output, "db_call_duration_seconds", "histogram", "Latency of database calls, by operation.");
+    for (int op = 0; op < METRICS_DB_OP_COUNT; op++)
+    {
+        if (total->db_latency[op].count > 0)
+        {
+            emit_histogram(&output, "db_call_duration_seconds", "operation", db_op_names[op],
+                           &total->db_latency[op]);
+        }
+    }
+
+    free(total);
+    return output.failed ? -1 : 0;
+}
+
+// Call once no other thread records any more
+void metrics_cleanup(void)
+{
+    METRICS_SLOT *slot = slots;
+    while (slot)
+    {
+        METRICS_SLOT *next = slot->next;
+        free(slot);
+        slot = next;
+    }
+    slots = NULL;
+    thread_slot = NULL;
+}
@@ -3,30 +3,101 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <strings.h>
+#include <limits.h>
 #include "../include/request.h"
+#include "../include/connection.h"
+#include "../include/scan.h"
+#include "../include/log.h"
 
-static void safe_strncpy(char *dest, const char *src, size_t dest_size)
+// Slice helpers
+static HTTP_SLICE make_slice(const char *data, size_t length)
 {
-    if (dest_size == 0)
-        return;
-    strncpy(dest, src, dest_size - 1);
-    dest[dest_size - 1] = '\0';
+    HTTP_SLICE slice = {data, length};
+    return slice;
+}
+
+static bool slice_contains(HTTP_SLICE slice, const char *needle)
+{
+    size_t needle_len = strlen(needle);
+    for (size_t i = 0; i + needle_len <= slice.length; i++)
+    {
+        if (memcmp(slice.data + i, needle, needle_len) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool http_slice_equals(HTTP_SLICE slice, const char *str)
+{
+    return str && strlen(str) == slice.length && memcmp(slice.data, str, slice.length) == 0;
+}
+
+bool http_slice_starts_with(HTTP_SLICE slice, const char *prefix)
+{
+    size_t prefix_len = strlen(prefix);
+    return prefix_len <= slice.length && memcmp(slice.data, prefix, prefix_len) == 0;
 }
 
-static bool is_safe_path(const char *path)
+// Parse a whole slice as a decimal integer. Returns 0 on success, -1 (with
+// value untouched) if the slice is empty, has trailing characters or overflows
+int http_slice_to_int(HTTP_SLICE slice, int *value)
 {
-    if (!path)
+    size_t i = 0;
+    bool negative = false;
+    long result = 0;
+
+    if (slice.length > 0 && slice.data[0] == '-')
+    {
+        negative = true;
+        i++;
+    }
+
+    if (i == slice.length)
+    {
+        return -1;
+    }
+
+    for (; i < slice.length; i++)
+    {
+        if (!isdigit((unsigned char)slice.data[i]))
+        {
+            return -1;
+        }
+
+        result = result * 10 + (slice.data[i] - '0');
+        if (result > INT_MAX)
+        {
+            return -1;
+        }
+    }
+
+    *value = negative ? (int)-result : (int)result;
+    return 0;
+}
+
+// URL decode a slice into dst (NUL-terminated)
+int http_slice_decode(HTTP_SLICE slice, char *dst, size_t dst_size)
+{
+    return url_decode(dst, dst_size, slice.data, slice.length);
+}
+
+static bool is_safe_path(HTTP_SLICE path)
+{
+    if (!path.data)
         return false;
 
     // Check for directory traversal patterns
-    if (strstr(path, "../") || strstr(path, "..\\") ||
-        strstr(path, "/..") || strstr(path, "\\.."))
+    if (slice_contains(path, "../") || slice_contains(path, "..\\") ||
+        slice_contains(path, "/..") || slice_contains(path, "\\.."))
     {
         return false;
     }
 
     // Check for null bytes
-    if (strlen(path) != strcspn(path, "\0"))
+    if (memchr(path.data, '\0', path.length))
     {
         return false;
     }
@@ -34,432 +105,1047 @@ static bool is_safe_path(const char *path)
     return true;
 }
 
+// Check a comma separated header value for a token, e.g. "keep-alive"
+bool http_slice_has_token(HTTP_SLICE list, const char *token)
+{
+    size_t token_len = strlen(token);
+    const char *pos = list.data;
+    const char *end = list.data + list.length;
+
+    while (pos < end)
+    {
+        while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == ','))
+        {
+            pos++;
+        }
+
+        const char *item = pos;
+        while (pos < end && *pos != ',')
+        {
+            pos++;
+        }
+
+        // Trim the item, parameters after ';' are ignored
+        const char *item_end = item;
+        while (item_end < pos && *item_end != ';' && *item_end != ' ' && *item_end != '\t')
+        {
+            item_end++;
+        }
+
+        if ((size_t)(item_end - item) == token_len && strncasecmp(item, token, token_len) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// True unless a list item's parameters carry a q=0 weight
+static bool item_accepted(const char *params, const char *end)
+{
+    while (params < end)
+    {
+        while (params < end && (*params == ';' || *params == ' ' || *params == '\t'))
+        {
+            params++;
+        }
+
+        if (end - params >= 2 && (params[0] == 'q' || params[0] == 'Q') && params[1] == '=')
+        {
+            // q=0, q=0.0, q=0.000 reject the coding, any other digit accepts it
+            for (params += 2; params < end && *params != ';'; params++)
+            {
+                if (*params >= '1' && *params <= '9')
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        while (params < end && *params != ';')
+        {
+            params++;
+        }
+    }
+
+    return true;
+}
+
+// Content negotiation for a response coding like "gzip" or "br". An explicit
+// entry wins over "*", and a q=0 weight rules the coding out
+bool http_request_accepts_encoding(const HTTP_REQUEST *request, const char *coding)
+{
+    HTTP_SLICE list = http_request_header(request, HTTP_HEADER_ACCEPT_ENCODING);
+    size_t coding_len = strlen(coding);
+    const char *pos = list.data;
+    const char *end = list.data + list.length;
+    int wildcard = -1;
+
+    while (pos < end)
+    {
+        while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == ','))
+        {
+            pos++;
+        }
+
+        const char *item = pos;
+        while (pos < end && *pos != ',')
+        {
+            pos++;
+        }
+
+        const char *item_end = item;
+        while (item_end < pos && *item_end != ';' && *item_end != ' ' && *item_end != '\t')
+        {
+            item_end++;
+        }
+
+        if ((size_t)(item_end - item) == coding_len && strncasecmp(item, coding, coding_len) == 0)
+        {
+            return item_accepted(item_end, pos);
+        }
+
+        if (item_end - item == 1 && *item == '*')
+        {
+            wildcard = item_accepted(item_end, pos);
+        }
+    }
+
+    return wildcard == 1;
+}
+
 void http_request_init(HTTP_REQUEST *request)
 {
     if (!request)
         return;
 
-    memset(request->method, 0, sizeof(request->method));
-    memset(request->path, 0, sizeof(request->path));
-    memset(request->clean_path, 0, sizeof(request->clean_path));
-    memset(request->query_string, 0, sizeof(request->query_string));
-    memset(request->version, 0, sizeof(request->version));
+    // Parameter arrays are only read up to their counts, no need to clear them
+    request->raw = NULL;
+    request->headers = NULL;
+    request->method = make_slice(NULL, 0);
+    request->method_id = HTTP_METHOD_UNKNOWN;
+    request->path = make_slice(NULL, 0);
+    request->clean_path = make_slice(NULL, 0);
+    request->query_string = make_slice(NULL, 0);
+    request->version = make_slice(NULL, 0);
     request->body = NULL;
     request->content_length = 0;
+    request->keep_alive = false;
+    request->body_stream = NULL;
     request->query_param_count = 0;
     request->url_param_count = 0;
-
-    // Initialize parameter arrays
-    for (int i = 0; i < MAX_QUERY_PARAMS; i++)
-    {
-        memset(request->query_params[i].key, 0, sizeof(request->query_params[i].key));
-        memset(request->query_params[i].value, 0, sizeof(request->query_params[i].value));
-    }
-
-    for (int i = 0; i < MAX_URL_PARAMS; i++)
-    {
-        memset(request->url_params[i].key, 0, sizeof(request->url_params[i].key));
-        memset(request->url_params[i].value, 0, sizeof(request->url_params[i].value));
-    }
 }
 
-int url_decode(char *dst, size_t dst_size, const char *src)
+int url_decode(char *dst, size_t dst_size, const char *src, size_t src_length)
 {
-    if (!dst || !src || dst_size == 0)
+    if (!dst || (!src && src_length > 0) || dst_size == 0)
         return -1;
 
     size_t dst_idx = 0;
-    const char *src_ptr = src;
+    size_t src_idx = 0;
 
-    while (*src_ptr && dst_idx < dst_size - 1)
+    while (src_idx < src_length && dst_idx < dst_size - 1)
     {
-        if (*src_ptr == '%' && src_ptr[1] && src_ptr[2] &&
-            isxdigit(src_ptr[1]) && isxdigit(src_ptr[2]))
+        if (src[src_idx] == '%' && src_idx + 2 < src_length &&
+            isxdigit((unsigned char)src[src_idx + 1]) && isxdigit((unsigned char)src[src_idx + 2]))
         {
-
-            char hex_str[3] = {src_ptr[1], src_ptr[2], '\0'};
-            char *endptr;
-            long val = strtol(hex_str, &endptr, 16);
-
-            if (*endptr == '\0' && val >= 0 && val <= 255)
-            {
-                dst[dst_idx++] = (char)val;
-                src_ptr += 3;
-            }
-            else
-            {
-                dst[dst_idx++] = *src_ptr++;
-            }
+            char hex_str[3] = {src[src_idx + 1], src[src_idx + 2], '\0'};
+            dst[dst_idx++] = (char)strtol(hex_str, NULL, 16);
+            src_idx += 3;
         }
-        else if (*src_ptr == '+')
+        else if (src[src_idx] == '+')
         {
             dst[dst_idx++] = ' ';
-            src_ptr++;
+            src_idx++;
         }
         else
         {
-            dst[dst_idx++] = *src_ptr++;
+            dst[dst_idx++] = src[src_idx++];
         }
     }
 
     dst[dst_idx] = '\0';
-    return (*src_ptr == '\0') ? 0 : -1; // Return -1 if source wasn't fully processed
+    return (src_idx == src_length) ? 0 : -1; // Return -1 if source wasn't fully processed
 }
 
-// Parse query string into key-value pairs
-int parse_query_string(const char *query_string, QueryParam *params, int max_params)
+// Split the query string into raw key/value slices, nothing is copied
+int parse_query_string(HTTP_SLICE query_string, QueryParam *params, int max_params)
 {
-    if (!query_string || !params || max_params <= 0)
+    if (!query_string.data || !params || max_params <= 0)
     {
         return 0;
     }
 
-    size_t query_len = strlen(query_string);
-    if (query_len == 0 || query_len > MAX_HEADER_LENGTH)
+    if (query_string.length == 0 || query_string.length > MAX_HEADER_LENGTH)
     {
         return 0;
     }
 
-    char *query_copy = malloc(query_len + 1);
-    if (!query_copy)
-    {
-        return 0;
-    }
-
-    safe_strncpy(query_copy, query_string, query_len + 1);
-
-    char *saveptr;
-    char *token = strtok_r(query_copy, "&", &saveptr);
+    const char *pos = query_string.data;
+    const char *end = query_string.data + query_string.length;
     int count = 0;
 
-    while (token && count < max_params)
+    while (pos < end && count < max_params)
     {
-        char *equals = strchr(token, '=');
-        if (equals && equals != token)
-        { // Ensure key is not empty
-            *equals = '\0';
-            char *key = token;
-            char *value = equals + 1;
+        const char *token_end = memchr(pos, '&', end - pos);
+        if (!token_end)
+        {
+            token_end = end;
+        }
 
-            // Validate lengths before decoding
-            if (strlen(key) < MAX_PARAM_KEY_LENGTH &&
-                strlen(value) < MAX_PARAM_VALUE_LENGTH)
-            {
+        const char *equals = memchr(pos, '=', token_end - pos);
+        const char *key_end = equals ? equals : token_end;
+        size_t key_len = key_end - pos;
+        size_t value_len = equals ? (size_t)(token_end - equals - 1) : 0;
 
-                // URL decode key and value with bounds checking
-                if (url_decode(params[count].key, sizeof(params[count].key), key) == 0 &&
-                    url_decode(params[count].value, sizeof(params[count].value), value) == 0)
-                {
-                    count++;
-                }
-            }
-        }
-        else if (!equals && strlen(token) < MAX_PARAM_KEY_LENGTH)
+        // Ensure key is not empty and both fit once decoded
+        if (key_len > 0 && key_len < MAX_PARAM_KEY_LENGTH && value_len < MAX_PARAM_VALUE_LENGTH)
         {
-            // Handle keys without values
-            if (url_decode(params[count].key, sizeof(params[count].key), token) == 0)
-            {
-                params[count].value[0] = '\0';
-                count++;
-            }
+            params[count].key = make_slice(pos, key_len);
+            params[count].value = make_slice(equals ? equals + 1 : token_end, value_len);
+            count++;
         }
-        token = strtok_r(NULL, "&", &saveptr);
+
+        pos = token_end + 1;
     }
 
-    free(query_copy);
     return count;
 }
 
-int http_request_parse(const char *raw_request, HTTP_REQUEST *request)
+void http_parser_init(HTTP_PARSER *parser)
 {
-    if (!raw_request || !request)
-    {
-        return -1;
-    }
+    if (!parser)
+        return;
 
-    // Check request size limit
-    size_t request_len = strlen(raw_request);
-    if (request_len > MAX_REQUEST_SIZE)
-    {
-        printf("Request too large: %zu bytes\n", request_len);
-        return -1;
-    }
+    // Header entries are only read up to the count, leave them alone
+    parser->state = HTTP_PARSE_REQUEST_LINE;
+    parser->offset = 0;
+    parser->line_start = 0;
+    parser->request_line_start = 0;
+    parser->request_line_length = 0;
+    parser->header_length = 0;
+    parser->content_length = 0;
+    parser->has_content_length = false;
+    parser->request_length = 0;
+    parser->headers.count = 0;
+    memset(parser->headers.known, 0, sizeof(parser->headers.known));
+    parser->chunked = false;
+    parser->body_mode = HTTP_BODY_BUFFERED;
+    parser->body_limit = MAX_BUFFERED_BODY_SIZE;
+    parser->body_length = 0;
+    parser->body_remaining = 0;
+    parser->removed = 0;
+    parser->too_large = false;
+    parser->chunk_state = HTTP_CHUNK_SIZE;
+    parser->chunk_size = 0;
+    parser->chunk_digits = 0;
+}
 
-    http_request_init(request);
+// Decides per request how the body is taken, set once at startup
+static HTTP_BODY_POLICY body_policy;
 
-    char method[16] = {0};
-    char path[MAX_PATH_LENGTH] = {0};
-    char version[16] = {0};
+void http_parser_set_body_policy(HTTP_BODY_POLICY policy)
+{
+    body_policy = policy;
+}
 
-    // Parse the request line with bounds checking
-    int parsed = sscanf(raw_request, "%15s %255s %15s", method, path, version);
+// Names of the headers with a slot in the table, indexed by HTTP_HEADER_ID
+static const char *known_headers[HTTP_HEADER_KNOWN_COUNT] = {
+    "Host",
+    "Connection",
+    "Content-Length",
+    "Content-Type",
+    "Transfer-Encoding",
+    "Accept-Encoding",
+    "If-None-Match",
+    "If-Modified-Since",
+    "Range",
+    "If-Range",
+    "User-Agent",
+    "Cookie",
+};
+
+// FNV-1a over the lowercased name
+static uint32_t header_name_hash(const char *name, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (uint32_t)tolower((unsigned char)name[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
-    if (parsed < 2)
+// The only known header a name can be follows from its length, and from the
+// first letter for the two lengths shared by two names. One compare decides
+static int header_known_id(const char *name, size_t length)
+{
+    int id;
+    switch (length)
     {
-        printf("Failed to parse HTTP request line\n");
+    case 4:
+        id = HTTP_HEADER_HOST;
+        break;
+    case 5:
+        id = HTTP_HEADER_RANGE;
+        break;
+    case 6:
+        id = HTTP_HEADER_COOKIE;
+        break;
+    case 8:
+        id = HTTP_HEADER_IF_RANGE;
+        break;
+    case 10:
+        id = (tolower((unsigned char)name[0]) == 'c') ? HTTP_HEADER_CONNECTION : HTTP_HEADER_USER_AGENT;
+        break;
+    case 12:
+        id = HTTP_HEADER_CONTENT_TYPE;
+        break;
+    case 13:
+        id = HTTP_HEADER_IF_NONE_MATCH;
+        break;
+    case 14:
+        id = HTTP_HEADER_CONTENT_LENGTH;
+        break;
+    case 15:
+        id = HTTP_HEADER_ACCEPT_ENCODING;
+        break;
+    case 17:
+        id = (tolower((unsigned char)name[0]) == 't') ? HTTP_HEADER_TRANSFER_ENCODING : HTTP_HEADER_IF_MODIFIED_SINCE;
+        break;
+    default:
         return -1;
     }
 
-    // Validate and copy parsed values
-    safe_strncpy(request->method, method, sizeof(request->method));
-    safe_strncpy(request->path, path, sizeof(request->path));
+    return strncasecmp(known_headers[id], name, length) == 0 ? id : -1;
+}
 
-    if (parsed == 2)
+// Request line must look like "METHOD target [version]"
+static bool parser_check_request_line(const char *line, size_t length)
+{
+    size_t method_length = scan_token(line, length);
+    if (method_length == 0 || method_length >= MAX_METHOD_LENGTH)
     {
-        safe_strncpy(request->version, "HTTP/1.1", sizeof(request->version));
+        return false;
     }
-    else
+
+    return method_length + 1 < length && line[method_length] == ' ' &&
+           line[method_length + 1] != ' ';
+}
+
+static const char *method_names[HTTP_METHOD_UNKNOWN] = {
+    "GET", "HEAD", "POST", "PUT", "PATCH", "DELETE", "OPTIONS"};
+
+static HTTP_METHOD parse_method(HTTP_SLICE method)
+{
+    for (int i = 0; i < HTTP_METHOD_UNKNOWN; i++)
     {
-        safe_strncpy(request->version, version, sizeof(request->version));
+        if (http_slice_equals(method, method_names[i]))
+        {
+            return (HTTP_METHOD)i;
+        }
     }
+    return HTTP_METHOD_UNKNOWN;
+}
 
-    if (!is_safe_path(request->path))
+// Parse a Content-Length value, a second one has to agree with the first
+static int parser_content_length(HTTP_PARSER *parser, const char *value, size_t length)
+{
+    size_t content_length = 0;
+
+    if (length == 0)
     {
-        printf("Unsafe path detected: %s\n", request->path);
         return -1;
     }
 
-    // Split path and query string
-    char *question_mark = strchr(request->path, '?');
-    if (question_mark)
+    for (size_t i = 0; i < length; i++)
     {
-        // Validate query string length
-        size_t query_len = strlen(question_mark + 1);
-        if (query_len >= sizeof(request->query_string))
+        if (!isdigit((unsigned char)value[i]))
         {
-            printf("Query string too long\n");
             return -1;
         }
 
-        safe_strncpy(request->query_string, question_mark + 1, sizeof(request->query_string));
-
-        size_t path_len = question_mark - request->path;
-        if (path_len >= sizeof(request->clean_path))
+        if (content_length > (SIZE_MAX - 9) / 10)
         {
-            printf("Path too long\n");
             return -1;
         }
+        content_length = content_length * 10 + (value[i] - '0');
+    }
 
-        strncpy(request->clean_path, request->path, path_len);
-        request->clean_path[path_len] = '\0';
+    if (parser->has_content_length && parser->content_length != content_length)
+    {
+        return -1;
+    }
 
-        // Parse query parameters
-        request->query_param_count = parse_query_string(request->query_string,
-                                                        request->query_params,
-                                                        MAX_QUERY_PARAMS);
+    parser->content_length = content_length;
+    parser->has_content_length = true;
+    return 0;
+}
+
+// Validate one header line at line_start and add it to the header table
+static int parser_add_header(HTTP_PARSER *parser, const char *buffer, size_t line_start, size_t length)
+{
+    const char *line = buffer + line_start;
+
+    // Field name is a token directly followed by the colon
+    size_t name_length = scan_token(line, length);
+    if (name_length == 0 || name_length == length || line[name_length] != ':')
+    {
+        return -1;
     }
-    else
+
+    if (parser->headers.count >= MAX_HEADERS)
     {
-        // No query string, clean path is same as original path
-        safe_strncpy(request->clean_path, request->path, sizeof(request->clean_path));
-        request->query_string[0] = '\0';
-        request->query_param_count = 0;
+        return -1;
     }
 
-    // Look for Content-Length header
-    const char *content_length_header = strstr(raw_request, "Content-Length:");
-    if (content_length_header)
+    // Strip optional whitespace around the value
+    size_t value_start = name_length + 1;
+    size_t value_end = length;
+    while (value_start < value_end && (line[value_start] == ' ' || line[value_start] == '\t'))
     {
-        char *endptr;
-        long content_length = strtol(content_length_header + 15, &endptr, 10);
+        value_start++;
+    }
+    while (value_end > value_start && (line[value_end - 1] == ' ' || line[value_end - 1] == '\t'))
+    {
+        value_end--;
+    }
 
-        // Validate content length
-        if (content_length >= 0 && content_length <= MAX_REQUEST_SIZE &&
-            (*endptr == '\r' || *endptr == '\n' || isspace(*endptr)))
-        {
-            request->content_length = (int)content_length;
-        }
-        else
-        {
-            printf("Invalid Content-Length header\n");
-            return -1;
-        }
+    HTTP_HEADER *header = &parser->headers.entries[parser->headers.count++];
+    header->name_hash = header_name_hash(line, name_length);
+    header->name_offset = (uint16_t)line_start;
+    header->name_length = (uint16_t)name_length;
+    header->value_offset = (uint16_t)(line_start + value_start);
+    header->value_length = (uint16_t)(value_end - value_start);
+
+    int id = header_known_id(line, name_length);
+    if (id < 0)
+    {
+        return 0;
+    }
+
+    if (!parser->headers.known[id])
+    {
+        parser->headers.known[id] = parser->headers.count;
     }
 
-    // Find and process body if present
-    const char *body_start = strstr(raw_request, "\r\n\r\n");
-    if (body_start && request->content_length > 0)
+    if (id == HTTP_HEADER_CONTENT_LENGTH)
     {
-        body_start += 4; // Skip \r\n\r\n
+        return parser_content_length(parser, line + value_start, value_end - value_start);
+    }
 
-        size_t remaining = request_len - (body_start - raw_request);
-        if (remaining < (size_t)request->content_length)
+    return 0;
+}
+
+// Decide how the body is framed and taken once the headers are complete
+static int parser_begin_body(HTTP_PARSER *parser, const char *buffer)
+{
+    int te = parser->headers.known[HTTP_HEADER_TRANSFER_ENCODING];
+    if (te)
+    {
+        // Only plain chunked is understood, and it must not be combined with
+        // a Content-Length (request smuggling)
+        const HTTP_HEADER *header = &parser->headers.entries[te - 1];
+        if (parser->has_content_length || header->value_length != 7 ||
+            strncasecmp(buffer + header->value_offset, "chunked", 7) != 0)
         {
-            printf("Incomplete request body\n");
             return -1;
         }
+        parser->chunked = true;
+    }
 
-        request->body = malloc(request->content_length + 1);
-        if (!request->body)
+    // Ask the router what the target wants, the request line was checked
+    if (body_policy && (parser->chunked || parser->content_length > 0))
+    {
+        const char *line = buffer + parser->request_line_start;
+        const char *line_end = line + parser->request_line_length;
+        const char *method_end = memchr(line, ' ', line_end - line);
+        const char *path = method_end + 1;
+        const char *path_end = path;
+        while (path_end < line_end && *path_end != ' ' && *path_end != '?')
         {
-            printf("Failed to allocate memory for request body\n");
-            return -1;
+            path_end++;
         }
 
-        memcpy(request->body, body_start, request->content_length);
-        request->body[request->content_length] = '\0';
+        body_policy(parse_method(make_slice(line, method_end - line)),
+                    make_slice(path, path_end - path), &parser->body_mode, &parser->body_limit);
+    }
+
+    if (!parser->chunked && parser->content_length == 0)
+    {
+        parser->body_mode = HTTP_BODY_BUFFERED;
     }
 
+    if (parser->content_length > parser->body_limit)
+    {
+        parser->too_large = true;
+        return -1;
+    }
+
+    parser->body_remaining = parser->content_length;
     return 0;
 }
 
-// Get query parameter value by key
-const char *get_query_param(const HTTP_REQUEST *request, const char *key)
+static int hex_value(char c)
 {
-    if (!request || !key || strlen(key) == 0)
-    {
-        return NULL;
-    }
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
 
-    for (int i = 0; i < request->query_param_count; i++)
+// Chunked decoder, resumable at any byte. Reads length bytes at in and
+// writes the chunk data to out, which may be in itself as long as it does
+// not lie behind it. Everything given is consumed unless the body ends
+static HTTP_PARSE_RESULT parser_decode_chunked(HTTP_PARSER *parser, char *out, const char *in, size_t length,
+                                               size_t *consumed, size_t *decoded)
+{
+    size_t i = 0;
+    size_t produced = 0;
+
+    while (i < length && parser->chunk_state != HTTP_CHUNK_DONE)
     {
-        if (strcmp(request->query_params[i].key, key) == 0)
+        char c = in[i];
+
+        switch (parser->chunk_state)
         {
-            return request->query_params[i].value;
+        case HTTP_CHUNK_SIZE:
+            if (hex_value(c) >= 0)
+            {
+                if (++parser->chunk_digits > 15)
+                {
+                    return HTTP_PARSE_ERROR;
+                }
+                parser->chunk_size = parser->chunk_size * 16 + hex_value(c);
+                i++;
+                continue;
+            }
+            if (parser->chunk_digits == 0 || (c != ';' && c != ' ' && c != '\t' && c != '\r' && c != '\n'))
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            // The extension state also ends the line
+            parser->chunk_state = HTTP_CHUNK_EXTENSION;
+            continue;
+
+        case HTTP_CHUNK_EXTENSION:
+            if (c == '\r')
+            {
+                parser->chunk_state = HTTP_CHUNK_SIZE_LF;
+                i++;
+                continue;
+            }
+            if (c != '\n')
+            {
+                if ((unsigned char)c < 0x20 && c != '\t')
+                {
+                    return HTTP_PARSE_ERROR;
+                }
+                i++;
+                continue;
+            }
+            // fall through
+        case HTTP_CHUNK_SIZE_LF:
+            if (c != '\n')
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            i++;
+
+            if (parser->chunk_size == 0)
+            {
+                parser->chunk_state = HTTP_CHUNK_TRAILER;
+            }
+            else if (parser->chunk_size > parser->body_limit - parser->body_length)
+            {
+                parser->too_large = true;
+                return HTTP_PARSE_ERROR;
+            }
+            else
+            {
+                parser->chunk_state = HTTP_CHUNK_DATA;
+            }
+            continue;
+
+        case HTTP_CHUNK_DATA:
+        {
+            size_t available = length - i;
+            size_t n = parser->chunk_size < available ? parser->chunk_size : available;
+            memmove(out + produced, in + i, n);
+            produced += n;
+            i += n;
+            parser->chunk_size -= n;
+            parser->body_length += n;
+            if (parser->chunk_size == 0)
+            {
+                parser->chunk_state = HTTP_CHUNK_DATA_CR;
+            }
+            continue;
+        }
+
+        case HTTP_CHUNK_DATA_CR:
+            if (c == '\r')
+            {
+                parser->chunk_state = HTTP_CHUNK_DATA_LF;
+                i++;
+                continue;
+            }
+            // fall through
+        case HTTP_CHUNK_DATA_LF:
+            if (c != '\n')
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            i++;
+            parser->chunk_state = HTTP_CHUNK_SIZE;
+            parser->chunk_digits = 0;
+            continue;
+
+        case HTTP_CHUNK_TRAILER:
+            // Trailer fields are skipped, chunk_size counts their bytes
+            if (c == '\r')
+            {
+                parser->chunk_state = HTTP_CHUNK_TRAILER_LF;
+            }
+            else if (c == '\n')
+            {
+                parser->chunk_state = HTTP_CHUNK_DONE;
+            }
+            else
+            {
+                parser->chunk_state = HTTP_CHUNK_TRAILER_LINE;
+            }
+            break;
+
+        case HTTP_CHUNK_TRAILER_LINE:
+            if (c == '\n')
+            {
+                parser->chunk_state = HTTP_CHUNK_TRAILER;
+            }
+            break;
+
+        case HTTP_CHUNK_TRAILER_LF:
+            if (c != '\n')
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            parser->chunk_state = HTTP_CHUNK_DONE;
+            break;
+
+        case HTTP_CHUNK_DONE:
+            break;
+        }
+
+        // Trailer bytes
+        i++;
+        if (++parser->chunk_size > MAX_REQUEST_SIZE)
+        {
+            return HTTP_PARSE_ERROR;
         }
     }
-    return NULL;
+
+    *consumed = i;
+    *decoded = produced;
+    return parser->chunk_state == HTTP_CHUNK_DONE ? HTTP_PARSE_COMPLETE : HTTP_PARSE_NEED_MORE;
 }
 
-// Get URL parameter value by key
-const char *get_url_param(const HTTP_REQUEST *request, const char *key)
+// Decode the next piece of a streamed body in place: the body bytes among
+// the length bytes at data end up at its start. consumed tells how many of
+// the input bytes belonged to the body (the rest is the next request),
+// decoded how many body bytes came out of them
+HTTP_PARSE_RESULT http_parser_body(HTTP_PARSER *parser, char *data, size_t length, size_t *consumed, size_t *decoded)
 {
-    if (!request || !key || strlen(key) == 0)
+    *consumed = 0;
+    *decoded = 0;
+
+    if (!parser || !data || parser->state != HTTP_PARSE_DONE)
     {
-        return NULL;
+        return HTTP_PARSE_ERROR;
     }
 
-    for (int i = 0; i < request->url_param_count; i++)
+    if (parser->chunked)
     {
-        if (strcmp(request->url_params[i].key, key) == 0)
-        {
-            return request->url_params[i].value;
-        }
+        return parser_decode_chunked(parser, data, data, length, consumed, decoded);
     }
-    return NULL;
+
+    size_t n = parser->body_remaining < length ? parser->body_remaining : length;
+    parser->body_remaining -= n;
+    parser->body_length += n;
+    *consumed = n;
+    *decoded = n;
+    return parser->body_remaining == 0 ? HTTP_PARSE_COMPLETE : HTTP_PARSE_NEED_MORE;
+}
+
+bool http_parser_body_done(const HTTP_PARSER *parser)
+{
+    return parser->chunked ? parser->chunk_state == HTTP_CHUNK_DONE : parser->body_remaining == 0;
 }
 
-bool match_path_pattern(const char *pattern, const char *path)
+// Feed the parser the bytes of a request received so far (buffer holds
+// length bytes starting at the request line). Bytes scanned by an earlier
+// call are not looked at again. A buffered chunked body is decoded in place
+// behind the headers; the framing cut out of the buffer is left in
+// parser->removed, the caller's buffer is that much shorter afterwards.
+// A streamed body is not waited for, the request is complete with its headers
+HTTP_PARSE_RESULT http_parser_feed(HTTP_PARSER *parser, char *buffer, size_t length)
 {
-    if (!pattern || !path)
+    if (!parser || !buffer)
     {
-        return false;
+        return HTTP_PARSE_ERROR;
     }
 
-    size_t pattern_len = strlen(pattern);
-    size_t path_len = strlen(path);
+    parser->removed = 0;
 
-    if (pattern_len >= 512 || path_len >= 512)
+    while (parser->state == HTTP_PARSE_REQUEST_LINE || parser->state == HTTP_PARSE_HEADERS)
     {
-        return false; // Reject overly long paths
-    }
+        // Find the end of the line, rejecting control characters on the way
+        size_t end = parser->offset + scan_line(buffer + parser->offset, length - parser->offset);
+        size_t next = end + 1;
+
+        if (end < length && buffer[end] == '\r')
+        {
+            // CR must be followed by LF
+            if (next < length && buffer[next] != '\n')
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            next++;
+        }
+        else if (end < length && buffer[end] != '\n')
+        {
+            return HTTP_PARSE_ERROR;
+        }
 
-    char pattern_copy[512], path_copy[512];
-    safe_strncpy(pattern_copy, pattern, sizeof(pattern_copy));
-    safe_strncpy(path_copy, path, sizeof(path_copy));
+        if (next > length)
+        {
+            // Line not complete yet, resume at its unscanned tail
+            parser->offset = end;
+            return (length > MAX_REQUEST_SIZE) ? HTTP_PARSE_ERROR : HTTP_PARSE_NEED_MORE;
+        }
 
-    char *pattern_saveptr, *path_saveptr;
-    char *pattern_token = strtok_r(pattern_copy, "/", &pattern_saveptr);
-    char *path_token = strtok_r(path_copy, "/", &path_saveptr);
+        size_t line_start = parser->line_start;
+        size_t line_length = end - line_start;
 
-    while (pattern_token && path_token)
-    {
-        size_t token_len = strlen(pattern_token);
+        parser->offset = next;
+        parser->line_start = parser->offset;
 
-        // Check if it's a parameter (enclosed in braces)
-        if (token_len >= 3 && pattern_token[0] == '{' &&
-            pattern_token[token_len - 1] == '}')
+        if (parser->offset > MAX_REQUEST_SIZE)
         {
-            // Parameter matches any non-empty token
-            if (strlen(path_token) == 0)
+            return HTTP_PARSE_ERROR;
+        }
+
+        if (parser->state == HTTP_PARSE_REQUEST_LINE)
+        {
+            // Ignore empty lines before the request line
+            if (line_length == 0)
             {
-                return false;
+                continue;
             }
+
+            if (!parser_check_request_line(buffer + line_start, line_length))
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            parser->request_line_start = line_start;
+            parser->request_line_length = line_length;
+            parser->state = HTTP_PARSE_HEADERS;
         }
-        else
+        else if (line_length == 0)
         {
-            // Exact match required
-            if (strcmp(pattern_token, path_token) != 0)
+            // Blank line ends the headers
+            parser->header_length = parser->offset;
+            parser->state = HTTP_PARSE_BODY;
+            if (parser_begin_body(parser, buffer) < 0)
             {
-                return false;
+                return HTTP_PARSE_ERROR;
             }
         }
+        else if (parser_add_header(parser, buffer, line_start, line_length) < 0)
+        {
+            return HTTP_PARSE_ERROR;
+        }
+    }
 
-        pattern_token = strtok_r(NULL, "/", &pattern_saveptr);
-        path_token = strtok_r(NULL, "/", &path_saveptr);
+    if (parser->state == HTTP_PARSE_BODY && parser->body_mode == HTTP_BODY_STREAMED)
+    {
+        parser->request_length = parser->header_length;
+        parser->state = HTTP_PARSE_DONE;
     }
+    else if (parser->state == HTTP_PARSE_BODY && parser->chunked)
+    {
+        // Decoded bytes go right behind the ones decoded by earlier calls,
+        // which all raw bytes up to offset have been turned into
+        size_t end = parser->header_length + parser->body_length;
+        size_t consumed;
+        size_t decoded;
+        HTTP_PARSE_RESULT result = parser_decode_chunked(parser, buffer + end, buffer + parser->offset,
+                                                         length - parser->offset, &consumed, &decoded);
+        if (result == HTTP_PARSE_ERROR)
+        {
+            return HTTP_PARSE_ERROR;
+        }
 
-    return pattern_token == NULL && path_token == NULL;
+        size_t next = parser->offset + consumed;
+        end += decoded;
+
+        // Close the gap the framing leaves, pulling up a pipelined request
+        memmove(buffer + end, buffer + next, length - next);
+        parser->removed = next - end;
+        parser->offset = end;
+
+        if (result == HTTP_PARSE_NEED_MORE)
+        {
+            return HTTP_PARSE_NEED_MORE;
+        }
+
+        parser->request_length = end;
+        parser->state = HTTP_PARSE_DONE;
+    }
+    else if (parser->state == HTTP_PARSE_BODY)
+    {
+        size_t total = parser->header_length + parser->content_length;
+        if (length < total)
+        {
+            parser->offset = length;
+            return HTTP_PARSE_NEED_MORE;
+        }
+
+        parser->request_length = total;
+        parser->state = HTTP_PARSE_DONE;
+    }
+
+    return HTTP_PARSE_COMPLETE;
 }
 
-int extract_and_store_url_params(HTTP_REQUEST *request, const char *path_pattern)
+// Build the request from a completely framed one. raw_request points at
+// the parser's request, which must stay untouched (and NUL-terminated after
+// its last byte) while the request is handled, since the request points into it
+int http_request_parse(const HTTP_PARSER *parser, const char *raw_request, HTTP_REQUEST *request)
 {
-    if (!request || !path_pattern)
+    if (!parser || !raw_request || !request || parser->state != HTTP_PARSE_DONE)
     {
         return -1;
     }
 
-    size_t pattern_len = strlen(path_pattern);
-    size_t path_len = strlen(request->clean_path);
+    http_request_init(request);
+    request->raw = raw_request;
+    request->headers = &parser->headers;
+
+    // Request line: METHOD SP target [SP version], already validated by the parser
+    const char *pos = raw_request + parser->request_line_start;
+    const char *line_end = pos + parser->request_line_length;
 
-    if (pattern_len >= 512 || path_len >= 512)
+    const char *method_end = memchr(pos, ' ', line_end - pos);
+    if (!method_end)
     {
+        LOG_DEBUG("Failed to parse HTTP request line\n");
         return -1;
     }
 
-    char pattern_copy[512], path_copy[512];
-    safe_strncpy(pattern_copy, path_pattern, sizeof(pattern_copy));
-    safe_strncpy(path_copy, request->clean_path, sizeof(path_copy));
+    request->method = make_slice(pos, method_end - pos);
+    request->method_id = parse_method(request->method);
+    pos = method_end + 1;
 
-    char *pattern_saveptr, *path_saveptr;
-    char *pattern_token = strtok_r(pattern_copy, "/", &pattern_saveptr);
-    char *path_token = strtok_r(path_copy, "/", &path_saveptr);
+    const char *target_end = memchr(pos, ' ', line_end - pos);
+    if (!target_end)
+    {
+        target_end = line_end;
+    }
 
-    request->url_param_count = 0;
+    if (target_end - pos >= MAX_PATH_LENGTH)
+    {
+        LOG_DEBUG("Path too long\n");
+        return -1;
+    }
 
-    while (pattern_token && path_token &&
-           request->url_param_count < MAX_URL_PARAMS)
+    request->path = make_slice(pos, target_end - pos);
+
+    if (target_end < line_end)
+    {
+        request->version = make_slice(target_end + 1, line_end - target_end - 1);
+    }
+    else
+    {
+        request->version = make_slice("HTTP/1.1", 8);
+    }
+
+    // HTTP/1.1 connections are persistent unless the client says otherwise,
+    // HTTP/1.0 ones only when the client asks for it
+    HTTP_SLICE connection_header = http_request_header(request, HTTP_HEADER_CONNECTION);
+    if (http_slice_equals(request->version, "HTTP/1.1"))
+    {
+        request->keep_alive = !http_slice_has_token(connection_header, "close");
+    }
+    else
+    {
+        request->keep_alive = http_slice_has_token(connection_header, "keep-alive");
+    }
+
+    if (!is_safe_path(request->path))
     {
+        LOG_INFO("Unsafe path detected: %.*s\n", (int)request->path.length, request->path.data);
+        return -1;
+    }
 
-        size_t token_len = strlen(pattern_token);
+    // Split path and query string
+    const char *question_mark = memchr(request->path.data, '?', request->path.length);
+    if (question_mark)
+    {
+        request->clean_path = make_slice(request->path.data, question_mark - request->path.data);
+        request->query_string = make_slice(question_mark + 1, target_end - question_mark - 1);
 
-        // Check if pattern token is a parameter
-        if (token_len >= 3 && pattern_token[0] == '{' &&
-            pattern_token[token_len - 1] == '}')
+        // Parse query parameters
+        request->query_param_count = parse_query_string(request->query_string,
+                                                        request->query_params,
+                                                        MAX_QUERY_PARAMS);
+    }
+    else
+    {
+        // No query string, clean path is same as original path
+        request->clean_path = request->path;
+        request->query_string = make_slice(target_end, 0);
+        request->query_param_count = 0;
+    }
+
+    // A buffered body is whatever follows the headers (dechunked by the
+    // parser), a streamed one is read through http_request_next_body_chunk
+    if (parser->body_mode == HTTP_BODY_STREAMED)
+    {
+        request->content_length = parser->chunked ? -1 : (int)parser->content_length;
+    }
+    else
+    {
+        request->content_length = (int)(parser->request_length - parser->header_length);
+        if (request->content_length > 0)
         {
+            request->body = raw_request + parser->header_length;
+        }
+    }
 
-            // Extract parameter name (between curly braces)
-            if (token_len - 2 >= sizeof(request->url_params[0].key))
-            {
-                printf("Parameter name too long\n");
-                return -1;
-            }
+    return 0;
+}
 
-            char param_name[MAX_PARAM_KEY_LENGTH];
-            strncpy(param_name, pattern_token + 1, token_len - 2);
-            param_name[token_len - 2] = '\0';
+// Read the next piece of a streamed body (see connection_next_body_chunk).
+// A request without a body is never streamed and simply ends at once.
+// Returns 1 with a chunk, 0 once the body is complete, HTTP_BODY_PENDING if
+// the handler has to return and wait for the rest, -1 on error
+int http_request_next_body_chunk(const HTTP_REQUEST *request, HTTP_SLICE *chunk)
+{
+    if (!request || !chunk)
+    {
+        return -1;
+    }
 
-            // Validate parameter value length
-            if (strlen(path_token) >= sizeof(request->url_params[0].value))
-            {
-                printf("Parameter value too long\n");
-                return -1;
-            }
+    if (!request->body_stream)
+    {
+        *chunk = make_slice(NULL, 0);
+        return request->content_length > 0 ? -1 : 0;
+    }
+    return connection_next_body_chunk(request->body_stream, chunk);
+}
 
-            // Store parameter
-            safe_strncpy(request->url_params[request->url_param_count].key,
-                         param_name, sizeof(request->url_params[0].key));
-            safe_strncpy(request->url_params[request->url_param_count].value,
-                         path_token, sizeof(request->url_params[0].value));
+// Memory of size bytes, zeroed on the first call, that a streaming handler
+// gets back on every call for the same body. It lives in the connection
+// arena, so it is released with the request even when the client goes away
+// halfway: it must not hold anything that needs freeing. NULL if there is
+// no streamed body or no memory
+void *http_request_body_state(const HTTP_REQUEST *request, size_t size)
+{
+    if (!request || !request->body_stream)
+    {
+        return NULL;
+    }
+    return connection_body_state(request->body_stream, size);
+}
 
-            request->url_param_count++;
+static HTTP_SLICE header_value(const HTTP_REQUEST *request, const HTTP_HEADER *header)
+{
+    return make_slice(request->raw + header->value_offset, header->value_length);
+}
+
+// Value of a header with a pre-resolved slot (the first one if repeated)
+HTTP_SLICE http_request_header(const HTTP_REQUEST *request, HTTP_HEADER_ID id)
+{
+    if (!request || !request->headers || id < 0 || id >= HTTP_HEADER_KNOWN_COUNT)
+    {
+        return make_slice(NULL, 0);
+    }
+
+    uint8_t index = request->headers->known[id];
+    if (index == 0)
+    {
+        return make_slice(NULL, 0);
+    }
+
+    return header_value(request, &request->headers->entries[index - 1]);
+}
+
+// Value of any header by name (case-insensitive, the first one if repeated)
+HTTP_SLICE http_request_find_header(const HTTP_REQUEST *request, const char *name)
+{
+    if (!request || !request->headers || !name)
+    {
+        return make_slice(NULL, 0);
+    }
+
+    size_t name_length = strlen(name);
+    uint32_t hash = header_name_hash(name, name_length);
+
+    for (int i = 0; i < request->headers->count; i++)
+    {
+        const HTTP_HEADER *header = &request->headers->entries[i];
+        if (header->name_hash == hash && header->name_length == name_length &&
+            strncasecmp(request->raw + header->name_offset, name, name_length) == 0)
+        {
+            return header_value(request, header);
         }
+    }
+
+    return make_slice(NULL, 0);
+}
 
-        pattern_token = strtok_r(NULL, "/", &pattern_saveptr);
-        path_token = strtok_r(NULL, "/", &path_saveptr);
+// Get query parameter value by key (keys are compared decoded)
+HTTP_SLICE get_query_param(const HTTP_REQUEST *request, const char *key)
+{
+    if (!request || !key || strlen(key) == 0)
+    {
+        return make_slice(NULL, 0);
     }
 
-    return 0;
+    for (int i = 0; i < request->query_param_count; i++)
+    {
+        char decoded_key[MAX_PARAM_KEY_LENGTH];
+        if (http_slice_decode(request->query_params[i].key, decoded_key, sizeof(decoded_key)) == 0 &&
+            strcmp(decoded_key, key) == 0)
+        {
+            return request->query_params[i].value;
+        }
+    }
+    return make_slice(NULL, 0);
+}
+
+// Get URL parameter value by key
+HTTP_SLICE get_url_param(const HTTP_REQUEST *request, const char *key)
+{
+    if (!request || !key || strlen(key) == 0)
+    {
+        return make_slice(NULL, 0);
+    }
+
+    for (int i = 0; i < request->url_param_count; i++)
+    {
+        if (http_slice_equals(request->url_params[i].key, key))
+        {
+            return request->url_params[i].value;
+        }
+    }
+    return make_slice(NULL, 0);
 }
 
 void http_request_cleanup(HTTP_REQUEST *request)
@@ -467,48 +1153,61 @@ void http_request_cleanup(HTTP_REQUEST *request)
     if (!request)
         return;
 
-    if (request->body)
-    {
-        free(request->body);
-        request->body = NULL;
-    }
+    // Everything points into the connection buffer, nothing to free
+    http_request_init(request);
+}
 
-    memset(request, 0, sizeof(HTTP_REQUEST));
+// Token of a parsed method, "OTHER" for anything unrecognised
+const char *http_method_name(HTTP_METHOD method)
+{
+    return (method >= 0 && method < HTTP_METHOD_UNKNOWN) ? method_names[method] : "OTHER";
 }
 
 void http_request_print(const HTTP_REQUEST *request)
 {
     if (!request)
     {
-        printf("Invalid request pointer\n");
+        LOG_DEBUG("Invalid request pointer\n");
         return;
     }
 
-    printf("Method: %.15s\n", request->method);
-    printf("Original Path: %.255s\n", request->path);
-    printf("Clean Path: %.255s\n", request->clean_path);
-    printf("Query String: %.255s\n", request->query_string);
-    printf("Version: %.15s\n", request->version);
-    printf("Content-Length: %d\n", request->content_length);
-    printf("Query Parameters (%d):\n", request->query_param_count);
+    LOG_DEBUG("Method: %.*s\n", (int)request->method.length, request->method.data);
+    LOG_DEBUG("Original Path: %.*s\n", (int)request->path.length, request->path.data);
+    LOG_DEBUG("Clean Path: %.*s\n", (int)request->clean_path.length, request->clean_path.data);
+    LOG_DEBUG("Query String: %.*s\n", (int)request->query_string.length, request->query_string.data);
+    LOG_DEBUG("Version: %.*s\n", (int)request->version.length, request->version.data);
+    LOG_DEBUG("Content-Length: %d\n", request->content_length);
+    LOG_DEBUG("Keep-Alive: %s\n", request->keep_alive ? "yes" : "no");
+
+    int header_count = request->headers ? request->headers->count : 0;
+    LOG_DEBUG("Headers (%d):\n", header_count);
+    for (int i = 0; i < header_count; i++)
+    {
+        const HTTP_HEADER *header = &request->headers->entries[i];
+        LOG_DEBUG("  %.*s: %.*s\n",
+                  header->name_length, request->raw + header->name_offset,
+                  header->value_length, request->raw + header->value_offset);
+    }
+
+    LOG_DEBUG("Query Parameters (%d):\n", request->query_param_count);
 
     for (int i = 0; i < request->query_param_count && i < MAX_QUERY_PARAMS; i++)
     {
-        printf("  %.63s = %.255s\n",
-               request->query_params[i].key,
-               request->query_params[i].value);
+        LOG_DEBUG("  %.*s = %.*s\n",
+                  (int)request->query_params[i].key.length, request->query_params[i].key.data,
+                  (int)request->query_params[i].value.length, request->query_params[i].value.data);
     }
 
-    printf("URL Parameters (%d):\n", request->url_param_count);
+    LOG_DEBUG("URL Parameters (%d):\n", request->url_param_count);
     for (int i = 0; i < request->url_param_count && i < MAX_URL_PARAMS; i++)
     {
-        printf("  %.63s = %.255s\n",
-               request->url_params[i].key,
-               request->url_params[i].value);
+        LOG_DEBUG("  %.*s = %.*s\n",
+                  (int)request->url_params[i].key.length, request->url_params[i].key.data,
+                  (int)request->url_params[i].value.length, request->url_params[i].value.data);
     }
 
     if (request->body && request->content_length > 0)
     {
-        printf("Body: %.*s\n", request->content_length, request->body);
+        LOG_DEBUG("Body: %.*s\n", request->content_length, request->body);
     }
-}
\ No newline at end of file
+}
@@ -1,31 +1,119 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
+#include <limits.h>
+#include <unistd.h>
 #include "../include/response.h"
+#include "../include/connection.h"
+#include "../include/date_cache.h"
+#include "../include/timing.h"
 
-static const char *get_status_text(HTTP_STATUS status)
+#define CHUNK_SIZE_LINE 10 // "%08zx\r\n", patched in when the chunk is closed
+
+// Makes multipart/byteranges boundaries unique per response
+static unsigned long boundary_counter = 0;
+
+// Status lines and fixed header lines, serialized once instead of being
+// formatted for every response
+typedef struct
+{
+    const char *text;
+    size_t length;
+} HEADER_FRAGMENT;
+
+#define FRAGMENT(text) {text, sizeof(text) - 1}
+#define STATUS_LINE(code, reason) {code, FRAGMENT("HTTP/1.1 " #code " " reason "\r\n")}
+#define STRINGIFY(value) #value
+#define TO_STRING(value) STRINGIFY(value)
+
+typedef struct
+{
+    int code;
+    HEADER_FRAGMENT line;
+} STATUS_ENTRY;
+
+static const STATUS_ENTRY statuses[] = {
+    [HTTP_200_OK] = STATUS_LINE(200, "OK"),
+    [HTTP_201_CREATED] = STATUS_LINE(201, "Created"),
+    [HTTP_206_PARTIAL_CONTENT] = STATUS_LINE(206, "Partial Content"),
+    [HTTP_304_NOT_MODIFIED] = STATUS_LINE(304, "Not Modified"),
+    [HTTP_400_BAD_REQUEST] = STATUS_LINE(400, "Bad Request"),
+    [HTTP_401_UNAUTHORIZED] = STATUS_LINE(401, "Unauthorized"),
+    [HTTP_404_NOT_FOUND] = STATUS_LINE(404, "Not Found"),
+    [HTTP_405_METHOD_NOT_ALLOWED] = STATUS_LINE(405, "Method Not Allowed"),
+    [HTTP_416_RANGE_NOT_SATISFIABLE] = STATUS_LINE(416, "Range Not Satisfiable"),
+    [HTTP_500_INTERNAL_ERROR] = STATUS_LINE(500, "Internal Server Error"),
+    [HTTP_409_CONFLICT] = STATUS_LINE(409, "Conflict"),
+    [HTTP_413_PAYLOAD_TOO_LARGE] = STATUS_LINE(413, "Payload Too Large")};
+
+static const HEADER_FRAGMENT keep_alive_header = FRAGMENT(
+    "Connection: keep-alive\r\n"
+    "Keep-Alive: timeout=" TO_STRING(KEEPALIVE_TIMEOUT_SECONDS) ", max=" TO_STRING(KEEPALIVE_MAX_REQUESTS) "\r\n");
+static const HEADER_FRAGMENT close_header = FRAGMENT("Connection: close\r\n");
+static const HEADER_FRAGMENT chunked_header = FRAGMENT("Transfer-Encoding: chunked\r\n");
+static const HEADER_FRAGMENT vary_header = FRAGMENT("Vary: Accept-Encoding\r\n");
+static const HEADER_FRAGMENT accept_ranges_header = FRAGMENT("Accept-Ranges: bytes\r\n");
+
+// Headers are copied into the caller's buffer piece by piece. length keeps
+// counting past size so the caller can tell the headers did not fit
+typedef struct
 {
-    switch (status)
+    char *buffer;
+    size_t size;
+    size_t length;
+} HEADER_WRITER;
+
+#define HEADER_APPEND_LITERAL(writer, text) header_append(writer, text, sizeof(text) - 1)
+
+static void header_append(HEADER_WRITER *writer, const char *data, size_t length)
+{
+    if (writer->length + length <= writer->size)
     {
-    case HTTP_200_OK:
-        return "200 OK";
-    case HTTP_201_CREATED:
-        return "201 Created";
-    case HTTP_400_BAD_REQUEST:
-        return "400 Bad Request";
-    case HTTP_401_UNAUTHORIZED:
-        return "401 Unauthorized";
-    case HTTP_404_NOT_FOUND:
-        return "404 Not Found";
-    case HTTP_405_METHOD_NOT_ALLOWED:
-        return "405 Method Not Allowed";
-    case HTTP_500_INTERNAL_ERROR:
-        return "500 Internal Server Error";
-    case HTTP_409_CONFLICT:
-        return "409 Conflict";
-    default:
-        return "200 OK";
+        memcpy(writer->buffer + writer->length, data, length);
     }
+    writer->length += length;
+}
+
+static void header_append_fragment(HEADER_WRITER *writer, const HEADER_FRAGMENT *fragment)
+{
+    header_append(writer, fragment->text, fragment->length);
+}
+
+static void header_append_string(HEADER_WRITER *writer, const char *text)
+{
+    header_append(writer, text, strlen(text));
+}
+
+static void header_append_number(HEADER_WRITER *writer, long long value)
+{
+    char digits[24];
+    char *start = digits + sizeof(digits);
+    unsigned long long magnitude = (value < 0) ? -(unsigned long long)value : (unsigned long long)value;
+
+    do
+    {
+        *--start = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+
+    if (value < 0)
+    {
+        *--start = '-';
+    }
+    header_append(writer, start, digits + sizeof(digits) - start);
+}
+
+// Fixed width, like "%016lx"
+static void header_append_hex(HEADER_WRITER *writer, unsigned long value)
+{
+    char digits[2 * sizeof(unsigned long)];
+    for (int i = (int)sizeof(digits) - 1; i >= 0; i--)
+    {
+        digits[i] = "0123456789abcdef"[value & 0xf];
+        value >>= 4;
+    }
+    header_append(writer, digits, sizeof(digits));
 }
 
 void http_response_init(HTTP_RESPONSE *response)
@@ -34,6 +122,29 @@ void http_response_init(HTTP_RESPONSE *response)
     strcpy(response->content_type, "text/html");
     response->body = NULL;
     response->body_length = 0;
+    response->body_owned = false;
+    response->arena = NULL;
+    response->shared_body = NULL;
+    response->file_fd = -1;
+    response->file_entry = NULL;
+    response->file_offset = 0;
+    response->header_block = NULL;
+    response->header_block_length = 0;
+    response->validators[0] = '\0';
+    response->accept_ranges = false;
+    response->range_count = 0;
+    response->range_total = 0;
+    response->range_boundary = 0;
+    response->stream = NULL;
+    response->stream_chunked = false;
+    response->stream_state = HTTP_STREAM_NONE;
+    response->chunk_offset = 0;
+    response->chunk_length = 0;
+    response->accept_encoding = COMPRESS_NONE;
+    response->content_encoding = COMPRESS_NONE;
+    response->vary_encoding = false;
+    response->deflate_stream = NULL;
+    response->keep_alive = false;
 }
 
 void http_response_set_status(HTTP_RESPONSE *response, HTTP_STATUS status)
@@ -47,64 +158,616 @@ void http_response_set_content_type(HTTP_RESPONSE *response, const char *content
     response->content_type[sizeof(response->content_type) - 1] = '\0';
 }
 
-void http_response_set_body(HTTP_RESPONSE *response, const char *body)
+// Memory for a body, from the arena when the response has one
+static char *body_alloc(HTTP_RESPONSE *response, size_t size)
+{
+    return response->arena ? arena_alloc(response->arena, size) : malloc(size);
+}
+
+// Drop the current body, whether it is a buffer or a file. Arena bodies
+// stay where they are until the batch is sent
+static void release_body(HTTP_RESPONSE *response)
 {
-    if (response->body)
+    if (response->body_owned)
     {
         free(response->body);
     }
+    response->body = NULL;
+    response->body_owned = false;
+    response->body_length = 0;
+    response->shared_body = NULL;
+    response->header_block = NULL;
+    response->header_block_length = 0;
+    response->validators[0] = '\0'; // They described the old body
+    response->accept_ranges = false;
+    response->range_count = 0;
+    response->content_encoding = COMPRESS_NONE;
+    response->vary_encoding = false;
 
+    if (response->file_entry)
+    {
+        file_cache_release(response->file_entry);
+    }
+    else if (response->file_fd >= 0)
+    {
+        close(response->file_fd);
+    }
+    response->file_fd = -1;
+    response->file_entry = NULL;
+}
+
+// Make body the new body, taking over a malloc'd one
+static void replace_body(HTTP_RESPONSE *response, char *body, size_t length, bool owned)
+{
+    release_body(response);
+    response->body = body;
+    response->body_length = body ? length : 0;
+    response->body_owned = body && owned;
+}
+
+void http_response_set_body(HTTP_RESPONSE *response, const char *body)
+{
+    if (!body)
+    {
+        release_body(response);
+        return;
+    }
+
+    size_t length = strlen(body);
+    char *copy = body_alloc(response, length + 1);
+    if (copy)
+    {
+        memcpy(copy, body, length + 1);
+    }
+    replace_body(response, copy, length, !response->arena);
+}
+
+// Format the body in place instead of into a stack buffer that is copied.
+// Returns the body length, -1 if it could not be allocated
+int http_response_set_body_printf(HTTP_RESPONSE *response, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    char *body = (length >= 0) ? body_alloc(response, (size_t)length + 1) : NULL;
     if (body)
     {
-        response->body_length = strlen(body);
-        response->body = malloc(response->body_length + 1);
-        if (response->body)
+        va_start(args, format);
+        vsnprintf(body, (size_t)length + 1, format, args);
+        va_end(args);
+    }
+
+    replace_body(response, body, length, !response->arena);
+    return body ? length : -1;
+}
+
+// Unknown statuses are sent as 200
+static const STATUS_ENTRY *status_entry(HTTP_STATUS status)
+{
+    if ((size_t)status >= sizeof(statuses) / sizeof(statuses[0]) || statuses[status].code == 0)
+    {
+        status = HTTP_200_OK;
+    }
+    return &statuses[status];
+}
+
+// Numeric code of status as sent in the status line
+int http_response_status_code(HTTP_STATUS status)
+{
+    return status_entry(status)->code;
+}
+
+// Content-* and range headers of a response with a body
+static void append_content_headers(HEADER_WRITER *writer, const HTTP_RESPONSE *response)
+{
+    // Several ranges go out as multipart/byteranges, with the real type in
+    // each part; one range or a 416 says which bytes in Content-Range
+    HEADER_APPEND_LITERAL(writer, "Content-Type: ");
+    if (response->range_count > 1)
+    {
+        HEADER_APPEND_LITERAL(writer, "multipart/byteranges; boundary=");
+        header_append_hex(writer, response->range_boundary);
+    }
+    else
+    {
+        header_append_string(writer, response->content_type);
+    }
+    HEADER_APPEND_LITERAL(writer, "\r\n");
+
+    if (response->content_encoding != COMPRESS_NONE)
+    {
+        HEADER_APPEND_LITERAL(writer, "Content-Encoding: ");
+        header_append_string(writer, compress_encoding_name(response->content_encoding));
+        HEADER_APPEND_LITERAL(writer, "\r\n");
+    }
+    if (response->vary_encoding)
+    {
+        header_append_fragment(writer, &vary_header);
+    }
+
+    // A streamed body is framed by chunks, or by closing the connection
+    if (response->stream_state == HTTP_STREAM_NONE)
+    {
+        HEADER_APPEND_LITERAL(writer, "Content-Length: ");
+        header_append_number(writer, (long long)response->body_length);
+        HEADER_APPEND_LITERAL(writer, "\r\n");
+    }
+    else if (response->stream_chunked)
+    {
+        header_append_fragment(writer, &chunked_header);
+    }
+
+    if (response->range_count == 1)
+    {
+        const HTTP_RANGE *range = &response->ranges[0];
+        HEADER_APPEND_LITERAL(writer, "Content-Range: bytes ");
+        header_append_number(writer, (long long)range->start);
+        HEADER_APPEND_LITERAL(writer, "-");
+        header_append_number(writer, (long long)(range->start + range->length - 1));
+        HEADER_APPEND_LITERAL(writer, "/");
+        header_append_number(writer, (long long)response->range_total);
+        HEADER_APPEND_LITERAL(writer, "\r\n");
+    }
+    else if (response->range_count == 0 && response->status == HTTP_416_RANGE_NOT_SATISFIABLE)
+    {
+        HEADER_APPEND_LITERAL(writer, "Content-Range: bytes */");
+        header_append_number(writer, (long long)response->range_total);
+        HEADER_APPEND_LITERAL(writer, "\r\n");
+    }
+
+    if (response->accept_ranges)
+    {
+        header_append_fragment(writer, &accept_ranges_header);
+    }
+    header_append_string(writer, response->validators);
+}
+
+// Copy the status line and headers into buffer. The body is sent from its
+// own buffer. Returns the header length, -1 if it does not fit
+int http_response_build_headers(const HTTP_RESPONSE *response, char *buffer, int buffer_size)
+{
+    HEADER_WRITER writer = {buffer, (buffer_size > 0) ? (size_t)buffer_size : 0, 0};
+
+    header_append_fragment(&writer, &status_entry(response->status)->line);
+
+    if (response->header_block)
+    {
+        header_append(&writer, response->header_block, response->header_block_length);
+    }
+    else if (response->status == HTTP_304_NOT_MODIFIED)
+    {
+        // A 304 has no body, and no Content-* headers describing one
+        header_append_string(&writer, response->validators);
+    }
+    else
+    {
+        append_content_headers(&writer, response);
+    }
+
+    size_t date_length;
+    const char *date = date_cache_header(&date_length);
+    header_append(&writer, date, date_length);
+
+    header_append_fragment(&writer, response->keep_alive ? &keep_alive_header : &close_header);
+    HEADER_APPEND_LITERAL(&writer, "\r\n");
+
+    return (writer.length < writer.size) ? (int)writer.length : -1;
+}
+
+// Send the body as the handler produces it, with Transfer-Encoding: chunked
+// (HTTP/1.0 clients get it unframed and the connection closes after it).
+// Set status and content type first. The headers are queued right away and
+// the body goes out every STREAM_FLUSH_SIZE bytes, as fast as the client
+// reads it. A compressible body is deflated on the way when the client
+// accepts it. Returns -1 if the response cannot be streamed
+int http_response_begin_chunked(HTTP_RESPONSE *response)
+{
+    CONNECTION *conn = response->stream;
+    if (!conn || response->stream_state != HTTP_STREAM_NONE)
+    {
+        return -1;
+    }
+
+    release_body(response);
+    response->stream_state = HTTP_STREAM_OPEN;
+    response->chunk_length = 0;
+    if (!response->stream_chunked)
+    {
+        response->keep_alive = false;
+    }
+
+    if (compress_is_compressible(response->content_type))
+    {
+        response->vary_encoding = true;
+        response->deflate_stream = compress_thread_stream(response->accept_encoding);
+        if (response->deflate_stream)
         {
-            strcpy(response->body, body);
+            response->content_encoding = response->accept_encoding;
         }
     }
-    else
+
+    if (connection_reserve_write(conn, conn->write_length + MAX_RESPONSE_HEADER_SIZE) == 0)
+    {
+        int written = http_response_build_headers(response, conn->write_buffer + conn->write_length,
+                                                  (int)(conn->write_capacity - conn->write_length));
+        if (written > 0 && connection_queue_write(conn, conn->write_length, written) == 0)
+        {
+            conn->write_length += written;
+            return 0;
+        }
+    }
+
+    response->stream_state = HTTP_STREAM_FAILED;
+    return -1;
+}
+
+// Append bytes to the write buffer and queue them behind what is there
+static int stream_append(CONNECTION *conn, const char *data, size_t length)
+{
+    if (connection_reserve_write(conn, conn->write_length + length) < 0 ||
+        connection_queue_write(conn, conn->write_length, length) < 0)
+    {
+        return -1;
+    }
+
+    memcpy(conn->write_buffer + conn->write_length, data, length);
+    conn->write_length += length;
+    return 0;
+}
+
+// Fill in the size line of the open chunk and terminate it
+static int close_chunk(HTTP_RESPONSE *response)
+{
+    if (response->chunk_length == 0 || !response->stream_chunked)
     {
-        response->body = NULL;
-        response->body_length = 0;
+        response->chunk_length = 0;
+        return 0;
     }
+
+    // Leading zeros keep the size line at its reserved width
+    char size_line[CHUNK_SIZE_LINE + 1];
+    snprintf(size_line, sizeof(size_line), "%08zx\r\n", response->chunk_length);
+    memcpy(response->stream->write_buffer + response->chunk_offset, size_line, CHUNK_SIZE_LINE);
+
+    response->chunk_length = 0;
+    return stream_append(response->stream, "\r\n", 2);
 }
 
-int http_response_build(const HTTP_RESPONSE *response, char *buffer, int buffer_size)
+// Queue bytes of the body as sent on the wire. Small writes are gathered
+// into one chunk, which is sent once STREAM_FLUSH_SIZE bytes are waiting.
+// Nothing waits for the client: what the socket does not take stays queued
+// for the event loop, up to STREAM_MAX_PENDING bytes
+static int stream_emit(HTTP_RESPONSE *response, const char *data, size_t length)
 {
-    const char *status_text = get_status_text(response->status);
+    CONNECTION *conn = response->stream;
+    if (response->stream_chunked && response->chunk_length == 0)
+    {
+        response->chunk_offset = conn->write_length;
+        if (stream_append(conn, "00000000\r\n", CHUNK_SIZE_LINE) < 0)
+        {
+            response->stream_state = HTTP_STREAM_FAILED;
+            return -1;
+        }
+    }
 
-    int written = snprintf(buffer, buffer_size,
-                           "HTTP/1.1 %s\r\n"
-                           "Content-Type: %s\r\n"
-                           "Content-Length: %d\r\n"
-                           "Connection: close\r\n"
-                           "\r\n"
-                           "%s",
-                           status_text,
-                           response->content_type,
-                           response->body_length,
-                           response->body ? response->body : "");
+    if (length > 0xffffffffu - response->chunk_length || stream_append(conn, data, length) < 0)
+    {
+        response->stream_state = HTTP_STREAM_FAILED;
+        return -1;
+    }
+    response->chunk_length += length;
+
+    if (conn->write_pending >= STREAM_FLUSH_SIZE)
+    {
+        // Sending, not the handler's own work
+        uint64_t start = timing_now();
+        int result = (close_chunk(response) < 0) ? -1 : connection_flush(conn);
+        timing_add(TIMING_SEND, timing_now() - start);
+        if (result < 0)
+        {
+            response->stream_state = HTTP_STREAM_FAILED;
+            return -1;
+        }
+    }
 
-    return (written < buffer_size) ? written : -1;
+    return 0;
 }
 
-void http_response_cleanup(HTTP_RESPONSE *response)
+// Run body bytes through the deflate stream and emit what comes out. zlib
+// holds back input until it has a block worth writing; Z_FINISH drains it
+static int stream_deflate(HTTP_RESPONSE *response, const char *data, size_t length, int flush)
+{
+    z_stream *stream = response->deflate_stream;
+    char output[COMPRESS_CHUNK_SIZE];
+
+    stream->next_in = (Bytef *)data;
+    stream->avail_in = (uInt)length;
+
+    do
+    {
+        stream->next_out = (Bytef *)output;
+        stream->avail_out = sizeof(output);
+
+        int result = deflate(stream, flush);
+        if (result == Z_STREAM_ERROR)
+        {
+            response->stream_state = HTTP_STREAM_FAILED;
+            return -1;
+        }
+
+        size_t produced = sizeof(output) - stream->avail_out;
+        if (produced > 0 && stream_emit(response, output, produced) < 0)
+        {
+            return -1;
+        }
+    } while (stream->avail_out == 0 || stream->avail_in > 0);
+
+    return 0;
+}
+
+// Queue body bytes, see stream_emit. Returns -1 once the client is gone,
+// the handler should stop producing
+int http_response_write_chunk(HTTP_RESPONSE *response, const char *data, size_t length)
+{
+    if (response->stream_state != HTTP_STREAM_OPEN)
+    {
+        return -1;
+    }
+    if (length == 0)
+    {
+        // An empty chunk would end the body
+        return 0;
+    }
+
+    if (length > UINT_MAX)
+    {
+        response->stream_state = HTTP_STREAM_FAILED;
+        return -1;
+    }
+
+    return response->deflate_stream ? stream_deflate(response, data, length, Z_NO_FLUSH)
+                                    : stream_emit(response, data, length);
+}
+
+// Queue the rest of the body and the last chunk, sent with the batch
+int http_response_end_chunked(HTTP_RESPONSE *response)
+{
+    if (response->stream_state != HTTP_STREAM_OPEN)
+    {
+        return -1;
+    }
+
+    if ((response->deflate_stream && stream_deflate(response, NULL, 0, Z_FINISH) < 0) ||
+        close_chunk(response) < 0 ||
+        (response->stream_chunked && stream_append(response->stream, "0\r\n\r\n", 5) < 0))
+    {
+        response->stream_state = HTTP_STREAM_FAILED;
+        return -1;
+    }
+
+    response->stream_state = HTTP_STREAM_DONE;
+    return 0;
+}
+
+// Give up on a started body, e.g. after a database error. The status is
+// already on the wire; closing without the last chunk tells the client the
+// body is incomplete
+void http_response_abort_chunked(HTTP_RESPONSE *response)
 {
-    if (response && response->body)
+    if (response->stream_state == HTTP_STREAM_OPEN)
+    {
+        response->stream_state = HTTP_STREAM_FAILED;
+    }
+}
+
+// Compress a buffered body for the coding the client accepts, when its type
+// and size make that worthwhile. File-backed bodies (validators, ranges) are
+// left alone, the asset cache has compressed variants of those
+void http_response_compress(HTTP_RESPONSE *response)
+{
+    if (!response->body || response->body_length < COMPRESS_MIN_SIZE || response->range_count > 0 ||
+        response->validators[0] || response->accept_ranges || response->content_encoding != COMPRESS_NONE ||
+        !compress_is_compressible(response->content_type))
+    {
+        return;
+    }
+
+    response->vary_encoding = true;
+    if (response->accept_encoding == COMPRESS_NONE)
+    {
+        return;
+    }
+
+    size_t bound = compress_bound(response->accept_encoding, response->body_length);
+    char *compressed = bound ? body_alloc(response, bound) : NULL;
+    if (!compressed)
+    {
+        return;
+    }
+
+    size_t length = compress_buffer(response->accept_encoding, response->body, response->body_length,
+                                    compressed, bound);
+    if (length == 0)
+    {
+        if (!response->arena)
+        {
+            free(compressed);
+        }
+        return;
+    }
+
+    if (response->body_owned)
     {
         free(response->body);
-        response->body = NULL;
-        response->body_length = 0;
     }
+    response->body = compressed;
+    response->body_length = length;
+    response->body_owned = !response->arena;
+    response->content_encoding = response->accept_encoding;
 }
 
+void http_response_cleanup(HTTP_RESPONSE *response)
+{
+    if (response)
+    {
+        release_body(response);
+    }
+}
+
+// Take over a malloc'd body
 void http_response_set_body_with_length(HTTP_RESPONSE *response, char *body, int length)
 {
-    if (response->body)
+    replace_body(response, body, length, true);
+}
+
+// Send length bytes of an open file as the body. The response owns the fd,
+// or the file cache reference keeping it open, until the connection takes
+// it over
+void http_response_set_file(HTTP_RESPONSE *response, int fd, FILE_CACHE_ENTRY *entry, off_t offset, size_t length)
+{
+    release_body(response);
+    response->file_fd = fd;
+    response->file_entry = entry;
+    response->file_offset = offset;
+    response->body_length = length;
+}
+
+// Cache validators of the body, sent with it or with a 304. Set them after
+// the body, replacing the body drops them
+void http_response_set_validators(HTTP_RESPONSE *response, const char *etag, const char *last_modified)
+{
+    snprintf(response->validators, sizeof(response->validators),
+             "ETag: %s\r\n"
+             "Last-Modified: %s\r\n",
+             etag, last_modified);
+}
+
+// Advertise Accept-Ranges: bytes for the body
+void http_response_set_accept_ranges(HTTP_RESPONSE *response)
+{
+    response->accept_ranges = true;
+}
+
+// Delimiter and headers of part index of a multipart/byteranges body, or the
+// closing delimiter for index == range_count. Returns the length like
+// snprintf does, so a NULL buffer measures it
+int http_response_format_part(const HTTP_RESPONSE *response, int index, char *buffer, size_t buffer_size)
+{
+    if (index == response->range_count)
+    {
+        return snprintf(buffer, buffer_size, "\r\n--%016lx--\r\n", response->range_boundary);
+    }
+
+    const HTTP_RANGE *range = &response->ranges[index];
+    return snprintf(buffer, buffer_size,
+                    "\r\n--%016lx\r\n"
+                    "Content-Type: %s\r\n"
+                    "Content-Range: bytes %lld-%lld/%lld\r\n"
+                    "\r\n",
+                    response->range_boundary,
+                    response->content_type,
+                    (long long)range->start, (long long)(range->start + range->length - 1),
+                    (long long)response->range_total);
+}
+
+// Narrow the complete body to byte ranges of it and make it a 206. A file
+// body keeps being sent from the file, the connection queues one segment per
+// range; a buffer is cut down in place or rebuilt as multipart/byteranges.
+// Returns -1 if the ranges do not fit the body
+int http_response_set_ranges(HTTP_RESPONSE *response, const HTTP_RANGE *ranges, int count, off_t total_length)
+{
+    if (count < 1 || count > MAX_RANGES || response->shared_body ||
+        total_length != (off_t)response->body_length)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (ranges[i].start < 0 || ranges[i].length <= 0 || ranges[i].start + ranges[i].length > total_length)
+        {
+            return -1;
+        }
+    }
+
+    memcpy(response->ranges, ranges, count * sizeof(HTTP_RANGE));
+    response->range_count = count;
+    response->range_total = total_length;
+    response->range_boundary = __atomic_add_fetch(&boundary_counter, 1, __ATOMIC_RELAXED);
+    response->status = HTTP_206_PARTIAL_CONTENT;
+
+    // The ranges lie within the body and add up to no more than it, the
+    // parts' headers come on top
+    size_t length = ranges[0].length;
+    if (count > 1)
+    {
+        length = http_response_format_part(response, count, NULL, 0);
+        for (int i = 0; i < count; i++)
+        {
+            length += http_response_format_part(response, i, NULL, 0) + ranges[i].length;
+        }
+    }
+
+    if (response->file_fd >= 0)
+    {
+        response->file_offset = ranges[0].start;
+        response->body_length = length;
+        return 0;
+    }
+
+    if (count == 1)
+    {
+        memmove(response->body, response->body + ranges[0].start, ranges[0].length);
+        response->body_length = length;
+        return 0;
+    }
+
+    char *multipart = body_alloc(response, length + 1);
+    if (!multipart)
+    {
+        return -1;
+    }
+
+    size_t written = 0;
+    for (int i = 0; i <= count; i++)
+    {
+        written += http_response_format_part(response, i, multipart + written, length + 1 - written);
+        if (i < count)
+        {
+            memcpy(multipart + written, response->body + ranges[i].start, ranges[i].length);
+            written += ranges[i].length;
+        }
+    }
+
+    if (response->body_owned)
     {
         free(response->body);
     }
-    response->body = body;
+    response->body = multipart;
     response->body_length = length;
-}
\ No newline at end of file
+    response->body_owned = !response->arena;
+    return 0;
+}
+
+// None of the requested ranges exist in a representation of total_length bytes
+void http_response_set_range_not_satisfiable(HTTP_RESPONSE *response, off_t total_length)
+{
+    http_response_set_status(response, HTTP_416_RANGE_NOT_SATISFIABLE);
+    http_response_set_content_type(response, "text/plain");
+    http_response_set_body(response, "Range Not Satisfiable\n");
+    response->range_total = total_length;
+}
+
+// Send bytes owned by someone else, with their precomputed Content-* header
+// block. Both must stay valid until the response is sent
+void http_response_set_shared_body(HTTP_RESPONSE *response, const char *body, int length,
+                                   const char *header_block, int header_block_length)
+{
+    release_body(response);
+    response->shared_body = body;
+    response->body_length = length;
+    response->header_block = header_block;
+    response->header_block_length = header_block_length;
+}
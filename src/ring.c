@@ -0,0 +1,86 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include "../include/ring.h"
+
+// size must be a power of two. Returns NULL if it cannot be allocated
+BYTE_RING *ring_create(size_t size)
+{
+    void *memory;
+    if (posix_memalign(&memory, RING_CACHE_LINE, sizeof(BYTE_RING) + size) != 0)
+    {
+        return NULL;
+    }
+
+    BYTE_RING *ring = memory;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dropped = 0;
+    ring->size = size;
+    ring->next = NULL;
+    return ring;
+}
+
+// Producer side: queue all of data or, if the consumer is behind, none of
+// it and count the drop
+bool ring_write(BYTE_RING *ring, const void *data, size_t length)
+{
+    size_t head = ring->head;
+    if (ring->size - (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) < length)
+    {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    size_t offset = head & (ring->size - 1);
+    size_t first = (length < ring->size - offset) ? length : ring->size - offset;
+    memcpy(ring->data + offset, data, first);
+    memcpy(ring->data, (const char *)data + first, length - first);
+
+    __atomic_store_n(&ring->head, head + length, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Consumer side: bytes written and not consumed yet
+size_t ring_used(const BYTE_RING *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - ring->tail;
+}
+
+// Consumer side: copy length bytes starting offset bytes into the used ones
+void ring_peek(const BYTE_RING *ring, size_t offset, void *data, size_t length)
+{
+    size_t position = (ring->tail + offset) & (ring->size - 1);
+    size_t first = (length < ring->size - position) ? length : ring->size - position;
+    memcpy(data, ring->data + position, first);
+    memcpy((char *)data + first, ring->data, length - first);
+}
+
+// Consumer side: hand length bytes back to the producer
+void ring_consume(BYTE_RING *ring, size_t length)
+{
+    __atomic_store_n(&ring->tail, ring->tail + length, __ATOMIC_RELEASE);
+}
+
+// Link ring into list. Producers only ever add, so a compare-and-swap on
+// the head is all the locking needed
+void ring_list_push(BYTE_RING **list, BYTE_RING *ring)
+{
+    ring->next = __atomic_load_n(list, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(list, &ring->next, ring, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+// Free every ring of list, once no thread uses them any more
+void ring_list_destroy(BYTE_RING **list)
+{
+    BYTE_RING *ring = *list;
+    while (ring)
+    {
+        BYTE_RING *next = ring->next;
+        free(ring);
+        ring = next;
+    }
+    *list = NULL;
+}
@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/config.h"
+#include "../include/router.h"
+
+// Prefix tree over path segments. Static children are kept sorted so a
+// lookup is one binary search per segment; a node has at most one
+// parameter child, which is only tried when no static child matches.
+typedef struct ROUTER_NODE
+{
+    char *segment; // Static segment, or the parameter name for a param child
+    size_t segment_length;
+    struct ROUTER_NODE **children;
+    int child_count;
+    struct ROUTER_NODE *param_child;
+    ROUTE_HANDLER handlers[HTTP_METHOD_COUNT];
+    int handler_count;
+    HTTP_BODY_MODE body_modes[HTTP_METHOD_COUNT];
+    size_t body_limits[HTTP_METHOD_COUNT]; // 0: MAX_BUFFERED_BODY_SIZE
+    int route_id; // Set once a handler is registered
+} ROUTER_NODE;
+
+static ROUTER_NODE router_root;
+static char *route_patterns[MAX_ROUTES + 1]; // By route id, 0 is unused
+static int route_count = 0;
+
+// Next '/' separated segment in [*pos, end), skipping empty ones like strtok
+static int next_segment(const char **pos, const char *end, HTTP_SLICE *segment)
+{
+    const char *p = *pos;
+    while (p < end && *p == '/')
+    {
+        p++;
+    }
+
+    if (p == end)
+    {
+        *pos = p;
+        return 0;
+    }
+
+    const char *start = p;
+    while (p < end && *p != '/')
+    {
+        p++;
+    }
+
+    segment->data = start;
+    segment->length = p - start;
+    *pos = p;
+    return 1;
+}
+
+static int compare_segment(const ROUTER_NODE *node, HTTP_SLICE segment)
+{
+    size_t length = node->segment_length < segment.length ? node->segment_length : segment.length;
+    int result = memcmp(node->segment, segment.data, length);
+    if (result != 0)
+    {
+        return result;
+    }
+    return (node->segment_length > segment.length) - (node->segment_length < segment.length);
+}
+
+// Binary search the sorted static children. Returns the index of the match,
+// or -(insert position + 1)
+static int find_child(const ROUTER_NODE *node, HTTP_SLICE segment)
+{
+    int low = 0;
+    int high = node->child_count - 1;
+
+    while (low <= high)
+    {
+        int mid = (low + high) / 2;
+        int result = compare_segment(node->children[mid], segment);
+        if (result == 0)
+        {
+            return mid;
+        }
+        if (result < 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid - 1;
+        }
+    }
+    return -(low + 1);
+}
+
+static ROUTER_NODE *create_node(HTTP_SLICE segment)
+{
+    ROUTER_NODE *node = calloc(1, sizeof(ROUTER_NODE));
+    if (!node)
+    {
+        return NULL;
+    }
+
+    node->segment = malloc(segment.length + 1);
+    if (!node->segment)
+    {
+        free(node);
+        return NULL;
+    }
+    memcpy(node->segment, segment.data, segment.length);
+    node->segment[segment.length] = '\0';
+    node->segment_length = segment.length;
+    return node;
+}
+
+static ROUTER_NODE *add_static_child(ROUTER_NODE *node, HTTP_SLICE segment)
+{
+    int index = find_child(node, segment);
+    if (index >= 0)
+    {
+        return node->children[index];
+    }
+    index = -index - 1;
+
+    ROUTER_NODE **children = realloc(node->children, (node->child_count + 1) * sizeof(ROUTER_NODE *));
+    if (!children)
+    {
+        return NULL;
+    }
+    node->children = children;
+
+    ROUTER_NODE *child = create_node(segment);
+    if (!child)
+    {
+        return NULL;
+    }
+
+    memmove(&children[index + 1], &children[index], (node->child_count - index) * sizeof(ROUTER_NODE *));
+    children[index] = child;
+    node->child_count++;
+    return child;
+}
+
+static ROUTER_NODE *add_param_child(ROUTER_NODE *node, HTTP_SLICE name)
+{
+    if (node->param_child)
+    {
+        // One parameter name per position, "/users/{id}" and "/users/{name}" would be ambiguous
+        if (node->param_child->segment_length != name.length ||
+            memcmp(node->param_child->segment, name.data, name.length) != 0)
+        {
+            printf("Conflicting route parameter '{%.*s}' and '{%s}'\n",
+                   (int)name.length, name.data, node->param_child->segment);
+            return NULL;
+        }
+        return node->param_child;
+    }
+
+    node->param_child = create_node(name);
+    return node->param_child;
+}
+
+// Find or create the node of a pattern
+static ROUTER_NODE *add_pattern(const char *pattern)
+{
+    const char *pos = pattern;
+    const char *end = pattern + strlen(pattern);
+    ROUTER_NODE *node = &router_root;
+    HTTP_SLICE segment;
+    int param_count = 0;
+
+    while (next_segment(&pos, end, &segment))
+    {
+        // Pattern segments like "{id}" are parameters
+        if (segment.length >= 3 && segment.data[0] == '{' && segment.data[segment.length - 1] == '}')
+        {
+            HTTP_SLICE name = {segment.data + 1, segment.length - 2};
+            if (name.length >= MAX_PARAM_KEY_LENGTH || ++param_count > MAX_URL_PARAMS)
+            {
+                printf("Invalid route parameter in '%s'\n", pattern);
+                return NULL;
+            }
+            node = add_param_child(node, name);
+        }
+        else
+        {
+            node = add_static_child(node, segment);
+        }
+
+        if (!node)
+        {
+            return NULL;
+        }
+    }
+
+    return node;
+}
+
+int router_add(HTTP_METHOD method, const char *pattern, ROUTE_HANDLER handler)
+{
+    if (!pattern || !handler || method < 0 || method >= HTTP_METHOD_UNKNOWN)
+    {
+        return -1;
+    }
+
+    ROUTER_NODE *node = add_pattern(pattern);
+    if (!node)
+    {
+        return -1;
+    }
+
+    if (node->handlers[method])
+    {
+        printf("Route '%s' registered twice\n", pattern);
+        return -1;
+    }
+
+    if (!node->route_id)
+    {
+        if (route_count == MAX_ROUTES)
+        {
+            printf("Too many routes, '%s' is over MAX_ROUTES\n", pattern);
+            return -1;
+        }
+
+        size_t length = strlen(pattern);
+        char *copy = malloc(length + 1);
+        if (!copy)
+        {
+            return -1;
+        }
+        memcpy(copy, pattern, length + 1);
+        route_patterns[++route_count] = copy;
+        node->route_id = route_count;
+    }
+
+    node->handlers[method] = handler;
+    node->handler_count++;
+    return 0;
+}
+
+// Walk the rest of the path from node. Static segments win over parameters;
+// if the static branch dead-ends the parameter branch is tried instead.
+static ROUTER_NODE *match_node(ROUTER_NODE *node, const char *pos, const char *end, HTTP_REQUEST *request)
+{
+    HTTP_SLICE segment;
+    if (!next_segment(&pos, end, &segment))
+    {
+        return node->handler_count > 0 ? node : NULL;
+    }
+
+    int index = find_child(node, segment);
+    if (index >= 0)
+    {
+        ROUTER_NODE *match = match_node(node->children[index], pos, end, request);
+        if (match)
+        {
+            return match;
+        }
+    }
+
+    ROUTER_NODE *param = node->param_child;
+    if (param && segment.length < MAX_PARAM_VALUE_LENGTH && request->url_param_count < MAX_URL_PARAMS)
+    {
+        UrlParam *url_param = &request->url_params[request->url_param_count++];
+        url_param->key.data = param->segment;
+        url_param->key.length = param->segment_length;
+        url_param->value = segment;
+
+        ROUTER_NODE *match = match_node(param, pos, end, request);
+        if (match)
+        {
+            return match;
+        }
+        request->url_param_count--;
+    }
+
+    return NULL;
+}
+
+ROUTE_STATUS router_lookup(HTTP_REQUEST *request, ROUTE_HANDLER *handler)
+{
+    *handler = NULL;
+    request->url_param_count = 0;
+    request->route_id = 0;
+
+    if (!request->clean_path.data)
+    {
+        return ROUTE_NOT_FOUND;
+    }
+
+    ROUTER_NODE *node = match_node(&router_root, request->clean_path.data,
+                                   request->clean_path.data + request->clean_path.length, request);
+    if (!node)
+    {
+        return ROUTE_NOT_FOUND;
+    }
+
+    request->route_id = node->route_id;
+    *handler = node->handlers[request->method_id];
+    return *handler ? ROUTE_FOUND : ROUTE_METHOD_NOT_ALLOWED;
+}
+
+// How a registered route takes its request body, by default it is buffered
+// up to MAX_BUFFERED_BODY_SIZE bytes
+int router_set_body(HTTP_METHOD method, const char *pattern, HTTP_BODY_MODE mode, size_t limit)
+{
+    if (!pattern || method < 0 || method >= HTTP_METHOD_UNKNOWN)
+    {
+        return -1;
+    }
+
+    ROUTER_NODE *node = add_pattern(pattern);
+    if (!node || !node->handlers[method])
+    {
+        printf("Route '%s' must be registered before its body settings\n", pattern);
+        return -1;
+    }
+
+    node->body_modes[method] = mode;
+    node->body_limits[method] = limit;
+    return 0;
+}
+
+// HTTP_BODY_POLICY for the parser: the settings of the route a request's
+// headers point at, the defaults for anything else
+void router_body_policy(HTTP_METHOD method, HTTP_SLICE path, HTTP_BODY_MODE *mode, size_t *limit)
+{
+    HTTP_REQUEST scratch; // Takes the URL parameters, only the count is initialized
+    scratch.url_param_count = 0;
+
+    ROUTER_NODE *node = match_node(&router_root, path.data, path.data + path.length, &scratch);
+    if (!node || method < 0 || method >= HTTP_METHOD_UNKNOWN || !node->handlers[method] ||
+        node->body_limits[method] == 0)
+    {
+        return;
+    }
+
+    *mode = node->body_modes[method];
+    *limit = node->body_limits[method];
+}
+
+static void free_children(ROUTER_NODE *node)
+{
+    for (int i = 0; i < node->child_count; i++)
+    {
+        free_children(node->children[i]);
+        free(node->children[i]->segment);
+        free(node->children[i]);
+    }
+    free(node->children);
+
+    if (node->param_child)
+    {
+        free_children(node->param_child);
+        free(node->param_child->segment);
+        free(node->param_child);
+    }
+}
+
+// Number of registered patterns, the highest route id
+int router_route_count(void)
+{
+    return route_count;
+}
+
+// Pattern a route id stands for, NULL for 0 or an unknown id
+const char *router_route_pattern(int route_id)
+{
+    return (route_id > 0 && route_id <= route_count) ? route_patterns[route_id] : NULL;
+}
+
+void router_cleanup(void)
+{
+    free_children(&router_root);
+    memset(&router_root, 0, sizeof(router_root));
+
+    for (int i = 1; i <= route_count; i++)
+    {
+        free(route_patterns[i]);
+        route_patterns[i] = NULL;
+    }
+    route_count = 0;
+}
@@ -7,76 +7,76 @@
 #include "../include/database.h"
 #include "../include/utils.h"
 #include "../include/file.h"
+#include "../include/canned_response.h"
+#include "../include/log.h"
+#include "../include/metrics.h"
+#include "../include/threadpool.h"
+#include "../include/timing.h"
 
 static pthread_mutex_t db_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-void route_get_css(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
+// Take db_mutex, counting the wait towards the request being handled
+static void lock_db(void)
 {
-    (void)request;
+    uint64_t start = timing_now();
+    pthread_mutex_lock(&db_mutex);
+    timing_add(TIMING_DB_LOCK, timing_now() - start);
+}
 
-    if (strcmp(request->clean_path, "/css/style.css") == 0)
-    {
-        serve_static_file(request, response);
-        return;
-    }
+void route_get_css(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
+{
+    serve_static_file(request, response);
 }
 
 void route_get_js(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
 {
-    (void)request;
+    serve_static_file(request, response);
+}
 
-    if (strcmp(request->clean_path, "/js/app.js") == 0)
-    {
-        serve_static_file(request, response);
-        return;
-    }
+// Audio and video under public/media, sent with Range support for seeking
+void route_get_media(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
+{
+    serve_static_file(request, response);
 }
 
 void route_home(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
 {
     // For root path
-    if (strcmp(request->clean_path, "/") == 0)
+    if (http_slice_equals(request->clean_path, "/"))
     {
         serve_static_file(request, response);
         return;
     }
 
     // If it's not an API route
-    if (strncmp(request->clean_path, "/api/", 5) != 0)
+    if (!http_slice_starts_with(request->clean_path, "/api/"))
     {
         serve_static_file(request, response);
         return;
     }
 
     // Fallback to original hardcoded HTML
-    char body[2048];
-    snprintf(body, sizeof(body),
-             "<!DOCTYPE html>\n"
-             "<html>\n"
-             "<head><title>My C HTTP Server</title></head>\n"
-             "<body>\n"
-             "<h1>Hello from C HTTP Server!</h1>\n"
-             "<p>This server is running on port %d</p>\n"
-             "<p>Requested path: %s</p>\n"
-             "<p><a href=\"/about\">About this server</a></p>\n"
-             "</body>\n"
-             "</html>\n",
-             DEFAULT_PORT, request->path);
+    http_response_set_body_printf(response,
+                                  "<!DOCTYPE html>\n"
+                                  "<html>\n"
+                                  "<head><title>My C HTTP Server</title></head>\n"
+                                  "<body>\n"
+                                  "<h1>Hello from C HTTP Server!</h1>\n"
+                                  "<p>This server is running on port %d</p>\n"
+                                  "<p>Requested path: %.*s</p>\n"
+                                  "<p><a href=\"/about\">About this server</a></p>\n"
+                                  "</body>\n"
+                                  "</html>\n",
+                                  DEFAULT_PORT, (int)request->path.length, request->path.data);
 
     http_response_set_status(response, HTTP_200_OK);
     http_response_set_content_type(response, "text/html");
-    http_response_set_body(response, body);
 }
 
+// Registered for /about and /about.html, both are public/about.html
 void route_about(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
 {
-    (void)request;
-
-    if (strcmp(request->clean_path, "/about") == 0)
-    {
-        serve_static_file(request, response);
-        return;
-    }
+    serve_static_file(request, response);
 
     // If static file not found, serve hardcoded HTML instead
     if (response->status == HTTP_404_NOT_FOUND)
@@ -106,6 +106,34 @@ void route_about(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
     }
 }
 
+typedef struct
+{
+    HTTP_RESPONSE *response;
+    const char *content_type;
+    bool started;
+} BODY_STREAM;
+
+// METRICS_WRITE_FUNC for route_metrics, DB_WRITE_FUNC for route_get_users.
+// The 200 goes out with the first bytes, so a producer that fails before
+// writing any can still answer with a 500
+static int write_body_stream(void *context, const char *data, size_t length)
+{
+    BODY_STREAM *stream = context;
+
+    if (!stream->started)
+    {
+        http_response_set_status(stream->response, HTTP_200_OK);
+        http_response_set_content_type(stream->response, stream->content_type);
+        if (http_response_begin_chunked(stream->response) < 0)
+        {
+            return -1;
+        }
+        stream->started = true;
+    }
+
+    return http_response_write_chunk(stream->response, data, length);
+}
+
 // API Routes
 void route_get_users(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
 {
@@ -114,86 +142,82 @@ void route_get_users(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
         return;
     }
 
-    char json_buffer[4096];
     UserQueryParams params;
 
     // Initialize parameters
     init_user_query_params(&params);
 
     // Parse HTTP request into database parameters
-    const char *limit_str = get_query_param(request, "limit");
-    const char *offset_str = get_query_param(request, "offset");
-    const char *search_str = get_query_param(request, "search");
+    HTTP_SLICE limit_str = get_query_param(request, "limit");
+    HTTP_SLICE offset_str = get_query_param(request, "offset");
+    HTTP_SLICE search_str = get_query_param(request, "search");
 
     // Set pagination parameters
-    if (limit_str)
+    int limit;
+    if (http_slice_to_int(limit_str, &limit) == 0 && limit > 0 && limit <= 100) // Add reasonable upper limit
     {
-        int limit = atoi(limit_str);
-        if (limit > 0 && limit <= 100) // Add reasonable upper limit
-        {
-            params.limit = limit;
-        }
+        params.limit = limit;
     }
 
-    if (offset_str)
+    int offset;
+    if (http_slice_to_int(offset_str, &offset) == 0 && offset >= 0)
     {
-        int offset = atoi(offset_str);
-        if (offset >= 0)
-        {
-            params.offset = offset;
-        }
+        params.offset = offset;
     }
 
-    // Set search parameter
-    if (search_str && strlen(search_str) > 0)
+    // Set search parameter (truncated if it does not fit)
+    if (search_str.length > 0)
     {
-        strncpy(params.search, search_str, sizeof(params.search) - 1);
-        params.search[sizeof(params.search) - 1] = '\0';
+        http_slice_decode(search_str, params.search, sizeof(params.search));
     }
 
     // Convert query parameters to filters
     for (int i = 0; i < request->query_param_count && params.filter_count < 10; i++)
     {
-        const char *key = request->query_params[i].key;
-        const char *value = request->query_params[i].value;
+        char *key = params.filters[params.filter_count].key;
+        char *value = params.filters[params.filter_count].value;
+
+        // Decode straight into the filter, skipping reserved parameters
+        if (http_slice_decode(request->query_params[i].key, key, sizeof(params.filters[0].key)) < 0 ||
+            http_slice_decode(request->query_params[i].value, value, sizeof(params.filters[0].value)) < 0)
+        {
+            continue;
+        }
 
-        // Skip reserved parameters
         if (strcmp(key, "limit") == 0 || strcmp(key, "offset") == 0 ||
             strcmp(key, "search") == 0 || strlen(value) == 0)
         {
             continue;
         }
 
-        // Add to filters
-        strncpy(params.filters[params.filter_count].key, key,
-                sizeof(params.filters[params.filter_count].key) - 1);
-        params.filters[params.filter_count].key[sizeof(params.filters[params.filter_count].key) - 1] = '\0';
-
-        strncpy(params.filters[params.filter_count].value, value,
-                sizeof(params.filters[params.filter_count].value) - 1);
-        params.filters[params.filter_count].value[sizeof(params.filters[params.filter_count].value) - 1] = '\0';
-
         params.filter_count++;
     }
 
-    printf("Getting users with limit=%d, offset=%d, filters=%d\n",
-           params.limit, params.offset, params.filter_count);
+    LOG_DEBUG("Getting users with limit=%d, offset=%d, filters=%d\n",
+              params.limit, params.offset, params.filter_count);
 
     for (int i = 0; i < params.filter_count; i++)
     {
-        printf("  Filter: %s = %s\n", params.filters[i].key, params.filters[i].value);
+        LOG_DEBUG("  Filter: %s = %s\n", params.filters[i].key, params.filters[i].value);
     }
 
-    // Call database function
-    pthread_mutex_lock(&db_mutex);
-    int result = db_get_users(&app_db, json_buffer, sizeof(json_buffer), &params);
+    // Rows are streamed to the client as the cursor produces them. Sending
+    // never waits for the client, so a slow one does not hold db_mutex; one
+    // that stops reading fails the stream once STREAM_MAX_PENDING is queued
+    BODY_STREAM stream = {response, "application/json", false};
+
+    lock_db();
+    int result = db_get_users(&app_db, write_body_stream, &stream, &params);
     pthread_mutex_unlock(&db_mutex);
 
     if (result >= 0)
     {
-        http_response_set_status(response, HTTP_200_OK);
-        http_response_set_content_type(response, "application/json");
-        http_response_set_body(response, json_buffer);
+        http_response_end_chunked(response);
+    }
+    else if (stream.started)
+    {
+        // Too late for an error status
+        http_response_abort_chunked(response);
     }
     else
     {
@@ -211,41 +235,37 @@ void route_get_user_by_id(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
         return;
     }
 
-    char body[1024];
     char user_json[512];
 
     // Extract user ID from URL path "/api/users/123"
     // Get URL parameter safely
-    const char *user_id_str = get_url_param(request, "id");
-    if (!user_id_str || strlen(user_id_str) == 0)
-    {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Bad Request\",\n"
-                 "  \"message\": \"User ID is missing\"\n"
-                 "}");
+    HTTP_SLICE user_id_str = get_url_param(request, "id");
+    if (user_id_str.length == 0)
+    {
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Bad Request\",\n"
+                                      "  \"message\": \"User ID is missing\"\n"
+                                      "}");
         http_response_set_status(response, HTTP_400_BAD_REQUEST);
         http_response_set_content_type(response, "application/json");
-        http_response_set_body(response, body);
         return;
     }
 
-    char *endptr;
-    int user_id = strtol(user_id_str, &endptr, 10);
-    if (*endptr != '\0' || user_id <= 0)
+    int user_id;
+    if (http_slice_to_int(user_id_str, &user_id) < 0 || user_id <= 0)
     {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Bad Request\",\n"
-                 "  \"message\": \"Invalid user ID\"\n"
-                 "}");
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Bad Request\",\n"
+                                      "  \"message\": \"Invalid user ID\"\n"
+                                      "}");
         http_response_set_status(response, HTTP_400_BAD_REQUEST);
         http_response_set_content_type(response, "application/json");
-        http_response_set_body(response, body);
         return;
     }
 
-    pthread_mutex_lock(&db_mutex);
+    lock_db();
     int result = db_get_user_by_id(&app_db, user_id, user_json, sizeof(user_json));
     pthread_mutex_unlock(&db_mutex);
 
@@ -257,32 +277,29 @@ void route_get_user_by_id(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
     }
     else if (result == 0)
     {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Not Found\",\n"
-                 "  \"message\": \"User with ID %d not found\"\n"
-                 "}",
-                 user_id);
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Not Found\",\n"
+                                      "  \"message\": \"User with ID %d not found\"\n"
+                                      "}",
+                                      user_id);
         http_response_set_status(response, HTTP_404_NOT_FOUND);
         http_response_set_content_type(response, "application/json");
-        http_response_set_body(response, body);
     }
     else
     {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Internal Server Error\",\n"
-                 "  \"message\": \"Database error occurred while retrieving user\"\n"
-                 "}");
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Internal Server Error\",\n"
+                                      "  \"message\": \"Database error occurred while retrieving user\"\n"
+                                      "}");
         http_response_set_status(response, HTTP_500_INTERNAL_ERROR);
         http_response_set_content_type(response, "application/json");
-        http_response_set_body(response, body);
     }
 }
 
 void route_create_user(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
 {
-    char body[1024];
     char name[256];
     char email[256];
     char password[256];
@@ -290,282 +307,411 @@ void route_create_user(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
     // Check if request body exists
     if (request->body && request->content_length <= 0)
     {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Bad Request\",\n"
-                 "  \"message\": \"Request body is required for user creation\"\n"
-                 "}");
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Bad Request\",\n"
+                                      "  \"message\": \"Request body is required for user creation\"\n"
+                                      "}");
 
         http_response_set_status(response, HTTP_400_BAD_REQUEST);
         http_response_set_content_type(response, "application/json");
-        http_response_set_body(response, body);
         return;
     }
 
-    printf("Creating user with data: %s\n", request->body);
+    LOG_DEBUG("Creating user with data: %s\n", request->body);
 
     // Parse JSON data
     if (parse_user_json(request->body, name, sizeof(name), email, sizeof(email), password, sizeof(password)) < 0)
     {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Bad Request\",\n"
-                 "  \"message\": \"Invalid JSON format. Expected {\\\"name\\\":\\\"...\\\", \\\"email\\\":\\\"...\\\"}\"\n"
-                 "}");
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Bad Request\",\n"
+                                      "  \"message\": \"Invalid JSON format. Expected {\\\"name\\\":\\\"...\\\", \\\"email\\\":\\\"...\\\"}\"\n"
+                                      "}");
 
         http_response_set_status(response, HTTP_400_BAD_REQUEST);
         http_response_set_content_type(response, "application/json");
-        http_response_set_body(response, body);
         return;
     }
 
     // Validate username
     if (!is_valid_name(name) || !is_valid_email(email) || !is_valid_password(password))
     {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Bad Request\",\n"
-                 "  \"message\": \"Name, email and password must be 3-50 characters long and contain only letters, numbers, and underscores\"\n"
-                 "}");
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Bad Request\",\n"
+                                      "  \"message\": \"Name, email and password must be 3-50 characters long and contain only letters, numbers, and underscores\"\n"
+                                      "}");
 
         http_response_set_status(response, HTTP_400_BAD_REQUEST);
         http_response_set_content_type(response, "application/json");
-        http_response_set_body(response, body);
         return;
     }
 
     // Create user in database
-    pthread_mutex_lock(&db_mutex);
+    lock_db();
     int user_id = db_create_user(&app_db, name, email, password);
     pthread_mutex_unlock(&db_mutex);
 
     if (user_id > 0)
     {
         // Success - user created
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"message\": \"User created successfully\",\n"
-                 "  \"id\": %d,\n"
-                 "  \"name\": \"%s\",\n"
-                 "  \"email\": \"%s\"\n"
-                 "}",
-                 user_id, name, email);
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"message\": \"User created successfully\",\n"
+                                      "  \"id\": %d,\n"
+                                      "  \"name\": \"%s\",\n"
+                                      "  \"email\": \"%s\"\n"
+                                      "}",
+                                      user_id, name, email);
 
         http_response_set_status(response, HTTP_201_CREATED);
-        printf("User created successfully with ID: %d\n", user_id);
+        LOG_INFO("User created successfully with ID: %d\n", user_id);
     }
     else
     {
         // Database error or constraint violation (duplicate username/email)
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Conflict\",\n"
-                 "  \"message\": \"Username or email already exists, or database error occurred\"\n"
-                 "}");
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Conflict\",\n"
+                                      "  \"message\": \"Username or email already exists, or database error occurred\"\n"
+                                      "}");
 
         http_response_set_status(response, HTTP_409_CONFLICT);
-        printf("Failed to create user - possibly duplicate username/email\n");
+        LOG_WARN("Failed to create user - possibly duplicate username/email\n");
+    }
+
+    http_response_set_content_type(response, "application/json");
+}
+
+typedef struct
+{
+    char name[256];
+    char email[256];
+    char password[256];
+} IMPORT_USER;
+
+// Kept across the handler's calls for one body (http_request_body_state)
+typedef struct
+{
+    IMPORT_USER batch[IMPORT_BATCH_SIZE];
+    int count;
+    int imported;
+    int failed;
+    JSON_SPLITTER splitter;
+    bool started;
+} USER_IMPORT;
+
+// Insert the batched users in one transaction
+static void import_flush(USER_IMPORT *import)
+{
+    if (import->count == 0)
+    {
+        return;
+    }
+
+    lock_db();
+    int began = db_begin_transaction(&app_db);
+    for (int i = 0; i < import->count; i++)
+    {
+        IMPORT_USER *user = &import->batch[i];
+        if (db_create_user(&app_db, user->name, user->email, user->password) > 0)
+        {
+            import->imported++;
+        }
+        else
+        {
+            import->failed++;
+        }
+    }
+    if (began == 0 && db_commit_transaction(&app_db) < 0)
+    {
+        // Rolled back, nothing of the batch is in
+        import->failed += import->imported;
+        import->imported = 0;
+    }
+    pthread_mutex_unlock(&db_mutex);
+
+    import->count = 0;
+}
+
+// JSON_OBJECT_FUNC for route_import_users
+static int import_user_object(void *context, const char *object, size_t length)
+{
+    USER_IMPORT *import = context;
+    IMPORT_USER *user = &import->batch[import->count];
+    (void)length;
+
+    if (!object ||
+        parse_user_json(object, user->name, sizeof(user->name), user->email, sizeof(user->email),
+                        user->password, sizeof(user->password)) < 0 ||
+        !is_valid_name(user->name) || !is_valid_email(user->email) || !is_valid_password(user->password))
+    {
+        import->failed++;
+        return 0;
+    }
+
+    if (++import->count == IMPORT_BATCH_SIZE)
+    {
+        import_flush(import);
+    }
+    return 0;
+}
+
+// Bulk import: a JSON array (or newline-delimited objects) of users in the
+// create format, read as a stream and inserted in batches. Called again
+// each time more of the body has arrived
+void route_import_users(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
+{
+    USER_IMPORT *import = http_request_body_state(request, sizeof(USER_IMPORT));
+    HTTP_SLICE chunk;
+    int result;
+
+    if (!import)
+    {
+        http_response_set_status(response, HTTP_500_INTERNAL_ERROR);
+        http_response_set_content_type(response, "application/json");
+        http_response_set_body(response, "{\"error\": \"Internal Server Error\"}");
+        return;
+    }
+
+    if (!import->started)
+    {
+        json_splitter_init(&import->splitter);
+        import->started = true;
+    }
+
+    while ((result = http_request_next_body_chunk(request, &chunk)) == 1)
+    {
+        json_splitter_feed(&import->splitter, chunk.data, chunk.length, import_user_object, import);
+    }
+
+    if (result == HTTP_BODY_PENDING)
+    {
+        return;
+    }
+
+    import_flush(import);
+
+    // An object cut off by the end of the body
+    if (import->splitter.depth > 0)
+    {
+        import->failed++;
+    }
+
+    LOG_INFO("Imported %d users, %d failed\n", import->imported, import->failed);
+
+    if (result < 0)
+    {
+        // Batches read before the error stay imported
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Bad Request\",\n"
+                                      "  \"message\": \"Request body could not be read completely\",\n"
+                                      "  \"imported\": %d,\n"
+                                      "  \"failed\": %d\n"
+                                      "}",
+                                      import->imported, import->failed);
+        http_response_set_status(response, HTTP_400_BAD_REQUEST);
+    }
+    else
+    {
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"imported\": %d,\n"
+                                      "  \"failed\": %d\n"
+                                      "}",
+                                      import->imported, import->failed);
+        http_response_set_status(response, HTTP_200_OK);
     }
 
     http_response_set_content_type(response, "application/json");
-    http_response_set_body(response, body);
 }
 
 void route_update_user(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
 {
-    char body[1024];
     char name[256];
     char email[256];
     char password[256];
 
     // Extract user ID from URL path "/api/users/123"
-    const char *user_id_str = get_url_param(request, "id");
-    int user_id = atoi(user_id_str);
+    int user_id = 0;
+    http_slice_to_int(get_url_param(request, "id"), &user_id);
 
     if (user_id <= 0)
     {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Bad Request\",\n"
-                 "  \"message\": \"Invalid user ID\"\n"
-                 "}");
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Bad Request\",\n"
+                                      "  \"message\": \"Invalid user ID\"\n"
+                                      "}");
 
         http_response_set_status(response, HTTP_400_BAD_REQUEST);
         http_response_set_content_type(response, "application/json");
-        http_response_set_body(response, body);
         return;
     }
 
     // Check if request body exists
     if (!request->body || request->content_length <= 0)
     {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Bad Request\",\n"
-                 "  \"message\": \"Request body is required for user update\"\n"
-                 "}");
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Bad Request\",\n"
+                                      "  \"message\": \"Request body is required for user update\"\n"
+                                      "}");
 
         http_response_set_status(response, HTTP_400_BAD_REQUEST);
         http_response_set_content_type(response, "application/json");
-        http_response_set_body(response, body);
         return;
     }
 
-    printf("Updating user %d with data: %s\n", user_id, request->body);
+    LOG_DEBUG("Updating user %d with data: %s\n", user_id, request->body);
 
     // Parse JSON data
     if (parse_user_json(request->body, name, sizeof(name), email, sizeof(email), password, sizeof(password)) < 0)
     {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Bad Request\",\n"
-                 "  \"message\": \"Invalid JSON format. Expected {\\\"name\\\":\\\"...\\\", \\\"email\\\":\\\"...\\\", \\\"password\\\":\\\"...\\\"}\"\n"
-                 "}");
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Bad Request\",\n"
+                                      "  \"message\": \"Invalid JSON format. Expected {\\\"name\\\":\\\"...\\\", \\\"email\\\":\\\"...\\\", \\\"password\\\":\\\"...\\\"}\"\n"
+                                      "}");
 
         http_response_set_status(response, HTTP_400_BAD_REQUEST);
         http_response_set_content_type(response, "application/json");
-        http_response_set_body(response, body);
         return;
     }
 
     // Validate input
     if (!is_valid_name(name) || !is_valid_email(email) || !is_valid_password(password))
     {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Bad Request\",\n"
-                 "  \"message\": \"Name, email and password must be 3-50 characters long and contain only letters, numbers, and underscores\"\n"
-                 "}");
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Bad Request\",\n"
+                                      "  \"message\": \"Name, email and password must be 3-50 characters long and contain only letters, numbers, and underscores\"\n"
+                                      "}");
 
         http_response_set_status(response, HTTP_400_BAD_REQUEST);
         http_response_set_content_type(response, "application/json");
-        http_response_set_body(response, body);
         return;
     }
 
     // Update user in database
-    pthread_mutex_lock(&db_mutex);
+    lock_db();
     int result = db_update_user(&app_db, user_id, name, email);
     pthread_mutex_unlock(&db_mutex);
 
     if (result > 0)
     {
         // Success - user updated
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"message\": \"User updated successfully\",\n"
-                 "  \"id\": %d,\n"
-                 "  \"name\": \"%s\",\n"
-                 "  \"email\": \"%s\"\n"
-                 "}",
-                 user_id, name, email);
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"message\": \"User updated successfully\",\n"
+                                      "  \"id\": %d,\n"
+                                      "  \"name\": \"%s\",\n"
+                                      "  \"email\": \"%s\"\n"
+                                      "}",
+                                      user_id, name, email);
 
         http_response_set_status(response, HTTP_200_OK);
-        printf("User %d updated successfully\n", user_id);
+        LOG_INFO("User %d updated successfully\n", user_id);
     }
     else if (result == 0)
     {
         // User not found
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Not Found\",\n"
-                 "  \"message\": \"User with ID %d not found\"\n"
-                 "}",
-                 user_id);
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Not Found\",\n"
+                                      "  \"message\": \"User with ID %d not found\"\n"
+                                      "}",
+                                      user_id);
 
         http_response_set_status(response, HTTP_404_NOT_FOUND);
-        printf("User %d not found for update\n", user_id);
+        LOG_INFO("User %d not found for update\n", user_id);
     }
     else
     {
         // Database error
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Internal Server Error\",\n"
-                 "  \"message\": \"Database error occurred while updating user\"\n"
-                 "}");
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Internal Server Error\",\n"
+                                      "  \"message\": \"Database error occurred while updating user\"\n"
+                                      "}");
 
         http_response_set_status(response, HTTP_500_INTERNAL_ERROR);
-        printf("Database error while updating user %d\n", user_id);
+        LOG_ERROR("Database error while updating user %d\n", user_id);
     }
 
     http_response_set_content_type(response, "application/json");
-    http_response_set_body(response, body);
 }
 
 void route_partial_update_user(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
 {
-    char body[1024];
     char current_user_json[512];
     char name[256] = {0};
     char email[256] = {0};
 
     // Extract user ID from URL path "/api/users/123"
-    const char *user_id_str = get_url_param(request, "id");
-    int user_id = atoi(user_id_str);
+    int user_id = 0;
+    http_slice_to_int(get_url_param(request, "id"), &user_id);
 
     if (user_id <= 0)
     {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Bad Request\",\n"
-                 "  \"message\": \"Invalid user ID\"\n"
-                 "}");
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Bad Request\",\n"
+                                      "  \"message\": \"Invalid user ID\"\n"
+                                      "}");
 
         http_response_set_status(response, HTTP_400_BAD_REQUEST);
         http_response_set_content_type(response, "application/json");
-        http_response_set_body(response, body);
         return;
     }
 
     // Check if request body exists
     if (!request->body || request->content_length <= 0)
     {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Bad Request\",\n"
-                 "  \"message\": \"Request body is required for partial user update\"\n"
-                 "}");
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Bad Request\",\n"
+                                      "  \"message\": \"Request body is required for partial user update\"\n"
+                                      "}");
 
         http_response_set_status(response, HTTP_400_BAD_REQUEST);
         http_response_set_content_type(response, "application/json");
-        http_response_set_body(response, body);
         return;
     }
 
-    printf("Partially updating user %d with data: %s\n", user_id, request->body);
+    LOG_DEBUG("Partially updating user %d with data: %s\n", user_id, request->body);
 
     // Get current user data
-    pthread_mutex_lock(&db_mutex);
+    lock_db();
     int user_exists = db_get_user_by_id(&app_db, user_id, current_user_json, sizeof(current_user_json));
     pthread_mutex_unlock(&db_mutex);
 
     if (user_exists < 0)
     {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Internal Server Error\",\n"
-                 "  \"message\": \"Database error occurred\"\n"
-                 "}");
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Internal Server Error\",\n"
+                                      "  \"message\": \"Database error occurred\"\n"
+                                      "}");
 
         http_response_set_status(response, HTTP_500_INTERNAL_ERROR);
         http_response_set_content_type(response, "application/json");
-        http_response_set_body(response, body);
         return;
     }
 
     if (user_exists == 0)
     {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Not Found\",\n"
-                 "  \"message\": \"User with ID %d not found\"\n"
-                 "}",
-                 user_id);
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Not Found\",\n"
+                                      "  \"message\": \"User with ID %d not found\"\n"
+                                      "}",
+                                      user_id);
 
         http_response_set_status(response, HTTP_404_NOT_FOUND);
         http_response_set_content_type(response, "application/json");
-        http_response_set_body(response, body);
         return;
     }
 
@@ -597,180 +743,187 @@ void route_partial_update_user(const HTTP_REQUEST *request, HTTP_RESPONSE *respo
     // Validate the final values
     if (!is_valid_name(name) || !is_valid_email(email))
     {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Bad Request\",\n"
-                 "  \"message\": \"Name and email must be valid (3-50 characters, alphanumeric and underscores only for name)\"\n"
-                 "}");
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Bad Request\",\n"
+                                      "  \"message\": \"Name and email must be valid (3-50 characters, alphanumeric and underscores only for name)\"\n"
+                                      "}");
 
         http_response_set_status(response, HTTP_400_BAD_REQUEST);
         http_response_set_content_type(response, "application/json");
-        http_response_set_body(response, body);
         return;
     }
 
     // Update user in database
-    pthread_mutex_lock(&db_mutex);
+    lock_db();
     int result = db_update_user(&app_db, user_id, name, email);
     pthread_mutex_unlock(&db_mutex);
 
     if (result > 0)
     {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"message\": \"User partially updated successfully\",\n"
-                 "  \"id\": %d,\n"
-                 "  \"name\": \"%s\",\n"
-                 "  \"email\": \"%s\"\n"
-                 "}",
-                 user_id, name, email);
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"message\": \"User partially updated successfully\",\n"
+                                      "  \"id\": %d,\n"
+                                      "  \"name\": \"%s\",\n"
+                                      "  \"email\": \"%s\"\n"
+                                      "}",
+                                      user_id, name, email);
 
         http_response_set_status(response, HTTP_200_OK);
-        printf("User %d partially updated successfully\n", user_id);
+        LOG_INFO("User %d partially updated successfully\n", user_id);
     }
     else if (result == 0)
     {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Not Found\",\n"
-                 "  \"message\": \"User with ID %d not found\"\n"
-                 "}",
-                 user_id);
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Not Found\",\n"
+                                      "  \"message\": \"User with ID %d not found\"\n"
+                                      "}",
+                                      user_id);
 
         http_response_set_status(response, HTTP_404_NOT_FOUND);
     }
     else
     {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Internal Server Error\",\n"
-                 "  \"message\": \"Database error occurred while updating user\"\n"
-                 "}");
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Internal Server Error\",\n"
+                                      "  \"message\": \"Database error occurred while updating user\"\n"
+                                      "}");
 
         http_response_set_status(response, HTTP_500_INTERNAL_ERROR);
     }
 
     http_response_set_content_type(response, "application/json");
-    http_response_set_body(response, body);
 }
 
 void route_delete_user(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
 {
-    char body[512];
-    const char *user_id_str = get_url_param(request, "id");
-    int user_id = atoi(user_id_str);
+    int user_id = 0;
+    http_slice_to_int(get_url_param(request, "id"), &user_id);
 
     if (user_id <= 0)
     {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Bad Request\",\n"
-                 "  \"message\": \"Invalid user ID\"\n"
-                 "}");
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Bad Request\",\n"
+                                      "  \"message\": \"Invalid user ID\"\n"
+                                      "}");
 
         http_response_set_status(response, HTTP_400_BAD_REQUEST);
         http_response_set_content_type(response, "application/json");
-        http_response_set_body(response, body);
         return;
     }
 
-    printf("Deleting user %d\n", user_id);
+    LOG_DEBUG("Deleting user %d\n", user_id);
 
     // Delete user from database
-    pthread_mutex_lock(&db_mutex);
+    lock_db();
     int result = db_delete_user(&app_db, user_id);
     pthread_mutex_unlock(&db_mutex);
 
     if (result > 0)
     {
         // Success - user deleted
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"message\": \"User deleted successfully\",\n"
-                 "  \"deleted_user_id\": %d\n"
-                 "}",
-                 user_id);
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"message\": \"User deleted successfully\",\n"
+                                      "  \"deleted_user_id\": %d\n"
+                                      "}",
+                                      user_id);
 
         http_response_set_status(response, HTTP_200_OK);
-        printf("User %d deleted successfully\n", user_id);
+        LOG_INFO("User %d deleted successfully\n", user_id);
     }
     else if (result == 0)
     {
         // User not found
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Not Found\",\n"
-                 "  \"message\": \"User with ID %d not found\"\n"
-                 "}",
-                 user_id);
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Not Found\",\n"
+                                      "  \"message\": \"User with ID %d not found\"\n"
+                                      "}",
+                                      user_id);
 
         http_response_set_status(response, HTTP_404_NOT_FOUND);
-        printf("User %d not found for deletion\n", user_id);
+        LOG_INFO("User %d not found for deletion\n", user_id);
     }
     else
     {
         // Database error
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Internal Server Error\",\n"
-                 "  \"message\": \"Database error occurred while deleting user\"\n"
-                 "}");
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Internal Server Error\",\n"
+                                      "  \"message\": \"Database error occurred while deleting user\"\n"
+                                      "}");
 
         http_response_set_status(response, HTTP_500_INTERNAL_ERROR);
-        printf("Database error while deleting user %d\n", user_id);
+        LOG_ERROR("Database error while deleting user %d\n", user_id);
     }
 
     http_response_set_content_type(response, "application/json");
-    http_response_set_body(response, body);
 }
 
 void route_login(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
 {
-    char body[1024];
 
     if (request->body && request->content_length > 0)
     {
-        printf("Login attempt with data: %s\n", request->body);
+        LOG_DEBUG("Login attempt with data: %s\n", request->body);
 
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"message\": \"Login successful\",\n"
-                 "  \"token\": \"fake_jwt_token_123\",\n"
-                 "  \"user\": {\"id\": 1, \"username\": \"authenticated_user\"}\n"
-                 "}");
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"message\": \"Login successful\",\n"
+                                      "  \"token\": \"fake_jwt_token_123\",\n"
+                                      "  \"user\": {\"id\": 1, \"username\": \"authenticated_user\"}\n"
+                                      "}");
 
         http_response_set_status(response, HTTP_200_OK);
     }
     else
     {
-        snprintf(body, sizeof(body),
-                 "{\n"
-                 "  \"error\": \"Invalid credentials\",\n"
-                 "  \"message\": \"Username and password are required\"\n"
-                 "}");
+        http_response_set_body_printf(response,
+                                      "{\n"
+                                      "  \"error\": \"Invalid credentials\",\n"
+                                      "  \"message\": \"Username and password are required\"\n"
+                                      "}");
 
         http_response_set_status(response, HTTP_401_UNAUTHORIZED);
     }
 
     http_response_set_content_type(response, "application/json");
-    http_response_set_body(response, body);
 }
 
-void route_not_found(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
+// Prometheus scrape target: the counters of every thread, added up now
+void route_metrics(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
 {
     (void)request;
 
-    const char *body =
-        "<!DOCTYPE html>\n"
-        "<html>\n"
-        "<head><title>404 Not Found</title></head>\n"
-        "<body>\n"
-        "<h1>404 - Page Not Found</h1>\n"
-        "<p>The requested resource was not found on this server.</p>\n"
-        "<p><a href=\"/\">Go back to home</a></p>\n"
-        "</body>\n"
-        "</html>\n";
-
-    http_response_set_status(response, HTTP_404_NOT_FOUND);
-    http_response_set_body(response, body);
+    METRICS_GAUGES gauges = {0, 0, 0};
+    if (thread_pool)
+    {
+        threadpool_stats(thread_pool, &gauges.queue_depth, &gauges.busy_workers);
+        gauges.workers = thread_pool->thread_count;
+    }
+
+    BODY_STREAM stream = {response, "text/plain; version=0.0.4; charset=utf-8", false};
+    if (metrics_write(write_body_stream, &stream, &gauges) == 0)
+    {
+        http_response_end_chunked(response);
+    }
+    else if (stream.started)
+    {
+        http_response_abort_chunked(response);
+    }
+    else
+    {
+        canned_response_set(response, CANNED_FILE_ERROR);
+    }
+}
+
+void route_not_found(const HTTP_REQUEST *request, HTTP_RESPONSE *response)
+{
+    (void)request;
+    canned_response_set(response, CANNED_ROUTE_NOT_FOUND);
 }
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include <stddef.h>
+#include "../include/scan.h"
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+// RFC 9110 token characters (method, header names)
+static const unsigned char token_chars[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 1, 0, 1, 1, 1, 1, 1, 0, 0, 1, 1, 0, 1, 1, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 0, 1, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+static int is_line_char(unsigned char c)
+{
+    // Anything but control characters; tab and obs-text are allowed
+    return (c >= 0x20 && c != 0x7f) || c == '\t';
+}
+
+#ifdef __SSE4_2__
+// Offset of the first byte in the first (length & ~15) bytes of buf that
+// falls into one of the byte ranges, or that many bytes if none does
+static size_t scan_ranges(const char *buf, size_t length, const char *ranges, int ranges_size)
+{
+    __m128i ranges16 = _mm_loadu_si128((const __m128i *)ranges);
+    size_t offset = 0;
+
+    while (length - offset >= 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)(buf + offset));
+        int index = _mm_cmpestri(ranges16, ranges_size, block, 16,
+                                 _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if (index != 16)
+        {
+            return offset + index;
+        }
+        offset += 16;
+    }
+
+    return offset;
+}
+#endif
+
+// Offset of the first CR, LF or other control character, or length
+size_t scan_line(const char *buf, size_t length)
+{
+    size_t offset = 0;
+
+#ifdef __SSE4_2__
+    // Control characters except tab: 0x00-0x08, 0x0a-0x1f, 0x7f
+    static const char line_ranges[16] = "\x00\x08\x0a\x1f\x7f\x7f";
+    offset = scan_ranges(buf, length, line_ranges, 6);
+    if (offset < length && !is_line_char((unsigned char)buf[offset]))
+    {
+        return offset;
+    }
+#endif
+
+    while (offset < length && is_line_char((unsigned char)buf[offset]))
+    {
+        offset++;
+    }
+    return offset;
+}
+
+// Offset of the first byte that is not a token character, or length
+size_t scan_token(const char *buf, size_t length)
+{
+    size_t offset = 0;
+
+#ifdef __SSE4_2__
+    // Delimiters, controls and non-ASCII. Only eight ranges fit, so '|' and
+    // '~' (valid token characters) are matched too and skipped below.
+    static const char token_ranges[16] = "\x00 \"\"(),,//:@[]{\xff";
+    while (1)
+    {
+        offset += scan_ranges(buf + offset, length - offset, token_ranges, 16);
+        if (offset < length && !token_chars[(unsigned char)buf[offset]])
+        {
+            return offset;
+        }
+        if (length - offset < 16)
+        {
+            break;
+        }
+        offset++;
+    }
+#endif
+
+    while (offset < length && token_chars[(unsigned char)buf[offset]])
+    {
+        offset++;
+    }
+    return offset;
+}
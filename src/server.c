@@ -1,10 +1,14 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 #include "../include/config.h"
 #include "../include/server.h"
+#include "../include/log.h"
 
 int server_create(TCP_SERVER *server, int port)
 {
@@ -36,6 +40,19 @@ int server_create(TCP_SERVER *server, int port)
     return 0;
 }
 
+// Let several sockets bind the same port; the kernel spreads new
+// connections across them. Must be called before server_bind().
+int server_set_reuseport(TCP_SERVER *server)
+{
+    int opt = 1;
+    if (setsockopt(server->socket_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+    {
+        perror("setsockopt SO_REUSEPORT failed");
+        return -1;
+    }
+    return 0;
+}
+
 int server_bind(TCP_SERVER *server)
 {
     if (bind(server->socket_fd, (struct sockaddr *)&server->address, sizeof(server->address)) < 0)
@@ -56,13 +73,30 @@ int server_listen(TCP_SERVER *server, int backlog)
     return 0;
 }
 
+int server_set_nonblocking(int socket_fd)
+{
+    int flags = fcntl(socket_fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        perror("fcntl O_NONBLOCK failed");
+        return -1;
+    }
+    return 0;
+}
+
+// Accept a client as a non-blocking socket. Returns -1 with errno EAGAIN
+// once the accept queue is empty.
 int server_accept(TCP_SERVER *server, struct sockaddr_in *client_addr)
 {
     socklen_t client_len = sizeof(*client_addr);
-    int client_socket = accept(server->socket_fd, (struct sockaddr *)client_addr, &client_len);
+    int client_socket = accept4(server->socket_fd, (struct sockaddr *)client_addr, &client_len,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
     if (client_socket < 0)
     {
-        perror("Accept failed");
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            LOG_ERROR("Accept failed: %s\n", strerror(errno));
+        }
         return -1;
     }
     return client_socket;
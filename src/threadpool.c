@@ -152,6 +152,7 @@ void *threadpool_worker(void *arg)
 {
     ThreadPool *pool = (ThreadPool *)arg;
     ThreadPoolTask task;
+    bool busy = false;
 
     while (1)
     {
@@ -161,6 +162,13 @@ void *threadpool_worker(void *arg)
 
         pthread_mutex_lock(&pool->queue_mutex);
 
+        // The previous task is done
+        if (busy)
+        {
+            pool->busy_count--;
+            busy = false;
+        }
+
         // Wait for tasks or shutdown signal
         while (pool->queue_size == 0 && !pool->shutdown)
         {
@@ -184,6 +192,8 @@ void *threadpool_worker(void *arg)
 
             pool->queue_front = (pool->queue_front + 1) % pool->queue_capacity;
             pool->queue_size--;
+            pool->busy_count++;
+            busy = true;
 
             // Signal that queue is not full
             pthread_cond_signal(&pool->queue_not_full);
@@ -200,6 +210,15 @@ void *threadpool_worker(void *arg)
     return NULL;
 }
 
+// Tasks waiting in the queue and workers running one, at this moment
+void threadpool_stats(ThreadPool *pool, int *queued, int *busy)
+{
+    pthread_mutex_lock(&pool->queue_mutex);
+    *queued = pool->queue_size;
+    *busy = pool->busy_count;
+    pthread_mutex_unlock(&pool->queue_mutex);
+}
+
 int threadpool_destroy(ThreadPool *pool)
 {
     if (!pool)
@@ -0,0 +1,136 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#include "../include/config.h"
+#include "../include/timing.h"
+#include "../include/request.h"
+#include "../include/log.h"
+
+__thread REQUEST_TIMING *timing_current = NULL;
+int timing_use_tsc = 0;
+
+static double ns_per_tick = 1.0;
+static uint64_t slow_threshold = 0; // In ticks, 0: no slow log
+
+static const char *stage_names[TIMING_STAGE_COUNT] = {
+    "recv", "queue", "parse", "route", "handler", "db_lock", "db", "build", "send"};
+
+// Monotonic nanoseconds
+uint64_t timing_clock_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// The counter only measures time if it runs at a constant rate through
+// frequency changes and sleep states
+static int has_invariant_tsc(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+    {
+        return 0;
+    }
+    return (edx >> 8) & 1;
+}
+#endif
+
+// Call once before any timestamps are taken
+void timing_init(unsigned int slow_threshold_ms)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (has_invariant_tsc())
+    {
+        struct timespec pause = {0, TIMING_CALIBRATION_MS * 1000000L};
+        uint64_t clock_start = timing_clock_ns();
+        uint64_t tsc_start = __rdtsc();
+        nanosleep(&pause, NULL);
+        uint64_t tsc_elapsed = __rdtsc() - tsc_start;
+        uint64_t clock_elapsed = timing_clock_ns() - clock_start;
+
+        if (tsc_elapsed > 0 && clock_elapsed > 0)
+        {
+            ns_per_tick = (double)clock_elapsed / tsc_elapsed;
+            timing_use_tsc = 1;
+        }
+    }
+#endif
+
+    slow_threshold = (uint64_t)(slow_threshold_ms * 1000000.0 / ns_per_tick);
+}
+
+uint64_t timing_to_ns(uint64_t ticks)
+{
+    return (uint64_t)(ticks * ns_per_tick);
+}
+
+static double ticks_to_ms(uint64_t ticks)
+{
+    return ticks * ns_per_tick / 1000000.0;
+}
+
+// One slow-log line: when, who, what, and the stages in milliseconds. The
+// handler is reported without the database and send time inside it, time
+// outside every stage (between pipelined requests) as "other"
+static void report_slow(const REQUEST_TIMING *timing, uint64_t total, const struct sockaddr_in *client_addr)
+{
+    char line[LOG_LINE_MAX];
+    size_t length = 0;
+
+    time_t now = time(NULL);
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    length += strftime(line, sizeof(line), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    char address[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &client_addr->sin_addr, address, sizeof(address));
+    length += snprintf(line + length, sizeof(line) - length, " %s:%d %s %.*s %d (%d request%s) %.3f ms:",
+                       address, ntohs(client_addr->sin_port), http_method_name((HTTP_METHOD)timing->method),
+                       (int)timing->path_length, timing->path, timing->status, timing->requests,
+                       timing->requests == 1 ? "" : "s", ticks_to_ms(total));
+
+    uint64_t counted = 0;
+    for (int i = 0; i < TIMING_STAGE_COUNT && length < sizeof(line); i++)
+    {
+        uint64_t ticks = timing->ticks[i];
+        if (i == TIMING_HANDLER)
+        {
+            ticks = (ticks > timing->nested) ? ticks - timing->nested : 0;
+        }
+        counted += ticks;
+        length += snprintf(line + length, sizeof(line) - length, " %s %.3f", stage_names[i], ticks_to_ms(ticks));
+    }
+
+    if (length < sizeof(line))
+    {
+        snprintf(line + length, sizeof(line) - length, " other %.3f",
+                 ticks_to_ms((total > counted) ? total - counted : 0));
+    }
+
+    LOG_SLOW("%s\n", line);
+}
+
+// The batch's last byte was sent: report it if it was slow and start over
+void timing_finish(REQUEST_TIMING *timing, const struct sockaddr_in *client_addr)
+{
+    timing_mark(timing, TIMING_SEND);
+
+    uint64_t total = timing->mark - timing->start;
+    if (slow_threshold && total >= slow_threshold && timing->requests > 0)
+    {
+        report_slow(timing, total, client_addr);
+    }
+
+    timing->start = 0;
+    timing->sending = 0;
+    timing->requests = 0;
+    timing->nested = 0;
+    memset(timing->ticks, 0, sizeof(timing->ticks));
+}
@@ -0,0 +1,951 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/uring.h"
+
+#ifdef USE_IO_URING
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+#include "../include/config.h"
+#include "../include/handler.h"
+#include "../include/request.h"
+#include "../include/file.h"
+#include "../include/log.h"
+
+// Operation tags kept in the low bits of user_data (connections are malloc'd and aligned)
+#define URING_OP_ACCEPT 1
+#define URING_OP_RECV 2
+#define URING_OP_SEND 3
+#define URING_OP_CLOSE 4
+#define URING_OP_TIMEOUT 5
+#define URING_OP_TICK 6
+#define URING_OP_WRITABLE 7
+#define URING_OP_MASK 7
+
+// Minimal ring wrapper over the raw io_uring syscalls
+typedef struct
+{
+    int ring_fd;
+    unsigned entries;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_local_tail;
+    struct io_uring_sqe *sqes;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *ring_ptr;
+    size_t ring_size;
+    size_t sqes_size;
+} URING;
+
+typedef struct
+{
+    dev_t dev; // The file registered, a replaced one has a new inode
+    ino_t ino;
+    int fd;
+} URING_FILE;
+
+typedef struct URING_BACKEND
+{
+    URING io;    // Network operations
+    URING files; // Synchronous static file reads
+
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    char *buffers;
+    unsigned short buf_tail;
+
+    URING_FILE registered[URING_MAX_FILES];
+    int registered_count;
+} URING_BACKEND;
+
+static struct __kernel_timespec client_timeout = {CLIENT_TIMEOUT_SECONDS, 0};
+static struct __kernel_timespec keepalive_timeout = {KEEPALIVE_TIMEOUT_SECONDS, 0};
+static struct __kernel_timespec loop_tick = {EVENT_LOOP_TICK_MS / 1000, (EVENT_LOOP_TICK_MS % 1000) * 1000000L};
+
+// Backend of the loop running on this thread, used by the static file reader
+static __thread URING_BACKEND *thread_backend = NULL;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int ring_fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+static int uring_setup(URING *ring, unsigned entries)
+{
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(URING));
+    memset(&params, 0, sizeof(params));
+
+    ring->ring_fd = sys_io_uring_setup(entries, &params);
+    if (ring->ring_fd < 0)
+    {
+        perror("io_uring_setup failed");
+        return -1;
+    }
+
+    // Skipped send completions and the single ring mapping need a 5.17+ kernel
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_CQE_SKIP))
+    {
+        fprintf(stderr, "io_uring: kernel lacks required features\n");
+        close(ring->ring_fd);
+        ring->ring_fd = -1;
+        return -1;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ring_size = (sq_size > cq_size) ? sq_size : cq_size;
+
+    ring->ring_ptr = mmap(NULL, ring->ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->ring_ptr == MAP_FAILED)
+    {
+        perror("io_uring ring mmap failed");
+        close(ring->ring_fd);
+        ring->ring_fd = -1;
+        return -1;
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        perror("io_uring sqe mmap failed");
+        munmap(ring->ring_ptr, ring->ring_size);
+        close(ring->ring_fd);
+        ring->ring_fd = -1;
+        return -1;
+    }
+
+    char *base = ring->ring_ptr;
+    ring->entries = params.sq_entries;
+    ring->sq_head = (unsigned *)(base + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(base + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(base + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(base + params.sq_off.array);
+    ring->cq_head = (unsigned *)(base + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(base + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(base + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(base + params.cq_off.cqes);
+    ring->sq_local_tail = *ring->sq_tail;
+
+    return 0;
+}
+
+static void uring_teardown(URING *ring)
+{
+    if (ring->ring_fd < 0)
+    {
+        return;
+    }
+
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->ring_ptr, ring->ring_size);
+    close(ring->ring_fd);
+    ring->ring_fd = -1;
+}
+
+// Publish queued SQEs and optionally wait for wait_nr completions
+static int uring_submit(URING *ring, unsigned wait_nr)
+{
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    unsigned pending = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    return sys_io_uring_enter(ring->ring_fd, pending, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+}
+
+// Make room for count SQEs so linked chains are never split across submissions
+static int uring_reserve(URING *ring, unsigned count)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local_tail - head + count <= ring->entries)
+    {
+        return 0;
+    }
+
+    uring_submit(ring, 0);
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    return (ring->sq_local_tail - head + count <= ring->entries) ? 0 : -1;
+}
+
+static struct io_uring_sqe *uring_get_sqe(URING *ring)
+{
+    if (uring_reserve(ring, 1) < 0)
+    {
+        return NULL;
+    }
+
+    unsigned index = ring->sq_local_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+    return sqe;
+}
+
+// Hand a receive buffer back to the kernel
+static void uring_recycle_buffer(URING_BACKEND *backend, unsigned short bid)
+{
+    struct io_uring_buf *buf = &backend->buf_ring->bufs[backend->buf_tail & (URING_BUFFER_COUNT - 1)];
+
+    buf->addr = (unsigned long)(backend->buffers + (size_t)bid * URING_BUFFER_SIZE);
+    buf->len = URING_BUFFER_SIZE;
+    buf->bid = bid;
+    backend->buf_tail++;
+
+    __atomic_store_n(&backend->buf_ring->tail, backend->buf_tail, __ATOMIC_RELEASE);
+}
+
+static int uring_setup_buffers(URING_BACKEND *backend)
+{
+    backend->buf_ring_size = URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    backend->buf_ring = mmap(NULL, backend->buf_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (backend->buf_ring == MAP_FAILED)
+    {
+        backend->buf_ring = NULL;
+        perror("io_uring buffer ring mmap failed");
+        return -1;
+    }
+
+    backend->buffers = malloc((size_t)URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+    if (!backend->buffers)
+    {
+        fprintf(stderr, "Failed to allocate io_uring receive buffers\n");
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)backend->buf_ring;
+    reg.ring_entries = URING_BUFFER_COUNT;
+    reg.bgid = URING_BUFFER_GROUP;
+
+    if (sys_io_uring_register(backend->io.ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        perror("io_uring buffer ring registration failed");
+        return -1;
+    }
+
+    backend->buf_tail = 0;
+    for (int i = 0; i < URING_BUFFER_COUNT; i++)
+    {
+        uring_recycle_buffer(backend, (unsigned short)i);
+    }
+
+    return 0;
+}
+
+// Open every regular file under dir so reads skip open/fstat/close
+static void uring_collect_files(URING_BACKEND *backend, const char *dir)
+{
+    DIR *handle = opendir(dir);
+    if (!handle)
+    {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(handle)) != NULL && backend->registered_count < URING_MAX_FILES)
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+
+        char path[MAX_PATH_LENGTH];
+        if (snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name) >= (int)sizeof(path))
+        {
+            continue;
+        }
+
+        struct stat file_stat;
+        if (stat(path, &file_stat) != 0)
+        {
+            continue;
+        }
+
+        if (S_ISDIR(file_stat.st_mode))
+        {
+            uring_collect_files(backend, path);
+        }
+        else if (S_ISREG(file_stat.st_mode))
+        {
+            int fd = open(path, O_RDONLY | O_CLOEXEC);
+            if (fd >= 0 && fstat(fd, &file_stat) == 0)
+            {
+                URING_FILE *file = &backend->registered[backend->registered_count++];
+                file->dev = file_stat.st_dev;
+                file->ino = file_stat.st_ino;
+                file->fd = fd;
+            }
+            else if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+    }
+
+    closedir(handle);
+}
+
+static int uring_register_files(URING_BACKEND *backend)
+{
+    uring_collect_files(backend, STATIC_FILES_DIR);
+    if (backend->registered_count == 0)
+    {
+        return 0;
+    }
+
+    int fds[URING_MAX_FILES];
+    for (int i = 0; i < backend->registered_count; i++)
+    {
+        fds[i] = backend->registered[i].fd;
+    }
+
+    if (sys_io_uring_register(backend->files.ring_fd, IORING_REGISTER_FILES, fds, backend->registered_count) < 0)
+    {
+        perror("io_uring file registration failed");
+        return -1;
+    }
+
+    printf("io_uring: registered %d static files\n", backend->registered_count);
+    return 0;
+}
+
+// FILE_READ_FUNC: ring reads of the file the file cache opened and stat'ed,
+// so the bytes always belong to the validators sent with them. A file still
+// registered from startup is read through its fixed slot; one replaced since
+// has a new inode and is read through the cache's descriptor
+static long uring_read_file(int fd, const struct stat *file_stat, char **buffer)
+{
+    URING_BACKEND *backend = thread_backend;
+    int index = -1;
+
+    for (int i = 0; backend && i < backend->registered_count; i++)
+    {
+        if (backend->registered[i].ino == file_stat->st_ino && backend->registered[i].dev == file_stat->st_dev)
+        {
+            index = i;
+            break;
+        }
+    }
+
+    if (!backend || file_stat->st_size > MAX_FILE_SIZE)
+    {
+        return -1;
+    }
+
+    long file_size = file_stat->st_size;
+    *buffer = malloc(file_size + 1);
+    if (!*buffer)
+    {
+        return -1;
+    }
+
+    URING *ring = &backend->files;
+    long done = 0;
+
+    while (done < file_size)
+    {
+        struct io_uring_sqe *sqe = uring_get_sqe(ring);
+        if (!sqe)
+        {
+            break;
+        }
+
+        sqe->opcode = IORING_OP_READ;
+        sqe->flags = (index >= 0) ? IOSQE_FIXED_FILE : 0;
+        sqe->fd = (index >= 0) ? index : fd;
+        sqe->addr = (unsigned long)(*buffer + done);
+        sqe->len = file_size - done;
+        sqe->off = done;
+
+        int ret;
+        do
+        {
+            ret = uring_submit(ring, 1);
+        } while (ret < 0 && errno == EINTR);
+
+        unsigned head = *ring->cq_head;
+        if (ret < 0 || head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            break;
+        }
+
+        int res = ring->cqes[head & *ring->cq_mask].res;
+        __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+        if (res <= 0)
+        {
+            break;
+        }
+        done += res;
+    }
+
+    if (done != file_size)
+    {
+        free(*buffer);
+        *buffer = NULL;
+        return -1;
+    }
+
+    (*buffer)[file_size] = '\0';
+    return file_size;
+}
+
+static void uring_arm_accept(EVENT_LOOP *loop)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->uring->io);
+    if (!sqe)
+    {
+        return;
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = loop->server->socket_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = URING_OP_ACCEPT;
+}
+
+static void uring_arm_tick(EVENT_LOOP *loop)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->uring->io);
+    if (!sqe)
+    {
+        return;
+    }
+
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (unsigned long)&loop_tick;
+    sqe->len = 1;
+    sqe->user_data = URING_OP_TICK;
+}
+
+// Receive into a provided buffer, cancelled if the client stays silent too long
+static int uring_arm_recv(EVENT_LOOP *loop, CONNECTION *conn)
+{
+    URING *ring = &loop->uring->io;
+
+    if (uring_reserve(ring, 2) < 0)
+    {
+        return -1;
+    }
+
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->socket_fd;
+    sqe->flags = IOSQE_BUFFER_SELECT | IOSQE_IO_LINK;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = (uintptr_t)conn | URING_OP_RECV;
+
+    // Idle keep-alive connections get longer than clients stuck mid-request
+    int idle = conn->read_length == 0 && conn->requests_served > 0;
+
+    sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    sqe->addr = (unsigned long)(idle ? &keepalive_timeout : &client_timeout);
+    sqe->len = 1;
+    sqe->user_data = URING_OP_TIMEOUT;
+
+    return 0;
+}
+
+static void uring_close_connection(EVENT_LOOP *loop, CONNECTION *conn)
+{
+    event_loop_remove_connection(loop, conn);
+    connection_destroy(conn);
+}
+
+static void uring_open_connection(EVENT_LOOP *loop, int client_socket)
+{
+    struct sockaddr_in client_addr;
+    socklen_t client_len = sizeof(client_addr);
+
+    if (getpeername(client_socket, (struct sockaddr *)&client_addr, &client_len) != 0)
+    {
+        memset(&client_addr, 0, sizeof(client_addr));
+    }
+
+    if (loop->connection_count >= MAX_CLIENT_CONNECTIONS)
+    {
+        LOG_WARN("Connection limit reached, rejecting client\n");
+        close(client_socket);
+        loop->stats.rejected++;
+        return;
+    }
+
+    CONNECTION *conn = connection_create(client_socket, &client_addr);
+    if (!conn)
+    {
+        LOG_ERROR("Failed to allocate memory for connection\n");
+        close(client_socket);
+        return;
+    }
+
+    event_loop_add_connection(loop, conn);
+
+    LOG_DEBUG("New connection from %s:%d\n",
+              inet_ntoa(client_addr.sin_addr),
+              ntohs(client_addr.sin_port));
+
+    if (uring_arm_recv(loop, conn) < 0)
+    {
+        uring_close_connection(loop, conn);
+    }
+}
+
+// Wait until the socket takes more, or the client stops reading for too long
+static int uring_arm_writable(EVENT_LOOP *loop, CONNECTION *conn)
+{
+    URING *ring = &loop->uring->io;
+
+    if (uring_reserve(ring, 2) < 0)
+    {
+        return -1;
+    }
+
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = conn->socket_fd;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = (uintptr_t)conn | URING_OP_WRITABLE;
+
+    sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    sqe->addr = (unsigned long)&client_timeout;
+    sqe->len = 1;
+    sqe->user_data = URING_OP_TIMEOUT;
+
+    return 0;
+}
+
+// Queue a sendmsg for the unsent responses. Keep-alive responses are a plain
+// send; otherwise, if the rest fits in one call, the send is linked to the
+// close so both go out in one submission. The ring has no sendfile, so a
+// file segment (large static files, ranges of them) is sent with the
+// connection's own non-blocking sendfile, then the socket is polled for the
+// rest.
+static int uring_send_responses(EVENT_LOOP *loop, CONNECTION *conn)
+{
+    URING *ring = &loop->uring->io;
+
+    conn->state = CONN_WRITING;
+    if (conn->segments[conn->segment_index].fd >= 0)
+    {
+        return (connection_write(conn) < 0) ? -1 : uring_arm_writable(loop, conn);
+    }
+
+    if (uring_reserve(ring, 2) < 0)
+    {
+        return -1;
+    }
+
+    // The sendmsg stops in front of a file segment
+    int count = connection_prepare_write(conn);
+    int last_send = conn->segment_index + count == conn->segment_count;
+
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn->socket_fd;
+    sqe->addr = (unsigned long)&conn->write_message;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+
+    if (conn->keep_alive || conn->suspended || !last_send)
+    {
+        sqe->user_data = (uintptr_t)conn | URING_OP_SEND;
+        return 0;
+    }
+
+    conn->state = CONN_CLOSING;
+    sqe->flags = IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = URING_OP_SEND;
+
+    sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = conn->socket_fd;
+    sqe->user_data = (uintptr_t)conn | URING_OP_CLOSE;
+    return 0;
+}
+
+// Run the handlers inline and queue the batched responses
+static void uring_process_request(EVENT_LOOP *loop, CONNECTION *conn)
+{
+    conn->state = CONN_PROCESSING;
+
+    LOG_DEBUG("[Thread %lu] Handling client request from %s:%d\n",
+              pthread_self(),
+              inet_ntoa(conn->client_addr.sin_addr),
+              ntohs(conn->client_addr.sin_port));
+
+    if (handle_http_requests(conn) < 0)
+    {
+        uring_close_connection(loop, conn);
+        return;
+    }
+
+    // A handler waiting for more of its body: send what is queued first,
+    // then receive the rest
+    if (conn->suspended && conn->write_pending == 0)
+    {
+        conn->state = CONN_READING;
+        if (uring_arm_recv(loop, conn) < 0)
+        {
+            uring_close_connection(loop, conn);
+        }
+        return;
+    }
+
+    if (uring_send_responses(loop, conn) < 0)
+    {
+        uring_close_connection(loop, conn);
+        return;
+    }
+
+    LOG_DEBUG("[Thread %lu] Request handling completed\n", pthread_self());
+}
+
+static void uring_continue_reading(EVENT_LOOP *loop, CONNECTION *conn);
+
+static void uring_handle_recv(EVENT_LOOP *loop, CONNECTION *conn, int res, unsigned flags)
+{
+    URING_BACKEND *backend = loop->uring;
+
+    if (res == -ENOBUFS)
+    {
+        // All provided buffers in use, try again
+        if (uring_arm_recv(loop, conn) < 0)
+        {
+            uring_close_connection(loop, conn);
+        }
+        return;
+    }
+
+    // EOF, error, or cancelled by the idle timeout
+    if (res <= 0 || !(flags & IORING_CQE_F_BUFFER))
+    {
+        uring_close_connection(loop, conn);
+        return;
+    }
+
+    unsigned short bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    int appended = connection_append(conn, backend->buffers + (size_t)bid * URING_BUFFER_SIZE, res);
+    uring_recycle_buffer(backend, bid);
+
+    if (appended < 0 && !conn->parser.too_large)
+    {
+        uring_close_connection(loop, conn);
+        return;
+    }
+
+    uring_continue_reading(loop, conn);
+}
+
+// Process the complete buffered requests, or wait for more bytes
+static void uring_continue_reading(EVENT_LOOP *loop, CONNECTION *conn)
+{
+    // A body over its limit is still answered, with 413
+    int length = connection_next_request(conn);
+    if (length < 0 && !conn->parser.too_large)
+    {
+        LOG_INFO("Invalid request framing, closing connection\n");
+        uring_close_connection(loop, conn);
+        return;
+    }
+
+    if (length == 0)
+    {
+        if (uring_arm_recv(loop, conn) < 0)
+        {
+            uring_close_connection(loop, conn);
+        }
+        return;
+    }
+
+    uring_process_request(loop, conn);
+}
+
+// Send what is still queued; once everything went out, read the rest of a
+// suspended request's body, the next request or close
+static void uring_continue_sending(EVENT_LOOP *loop, CONNECTION *conn)
+{
+    // A short send, more segments than one sendmsg takes or a file: send the rest
+    if (conn->write_pending > 0)
+    {
+        if (uring_send_responses(loop, conn) < 0)
+        {
+            uring_close_connection(loop, conn);
+        }
+        return;
+    }
+
+    if (conn->suspended)
+    {
+        // Sent what was queued ahead of a handler waiting for its body
+        conn->state = CONN_READING;
+        if (uring_arm_recv(loop, conn) < 0)
+        {
+            uring_close_connection(loop, conn);
+        }
+        return;
+    }
+
+    LOG_DEBUG("Response sent\n\n");
+    if (!conn->keep_alive)
+    {
+        uring_close_connection(loop, conn);
+        return;
+    }
+
+    connection_reset_request(conn);
+    uring_continue_reading(loop, conn);
+}
+
+// Completion of a send that is not linked to a close
+static void uring_handle_send(EVENT_LOOP *loop, CONNECTION *conn, int res)
+{
+    if (res <= 0)
+    {
+        uring_close_connection(loop, conn);
+        return;
+    }
+
+    connection_advance_write(conn, res);
+    uring_continue_sending(loop, conn);
+}
+
+// The socket takes more after a file segment filled it, or the poll failed
+static void uring_handle_writable(EVENT_LOOP *loop, CONNECTION *conn, int res)
+{
+    if (res < 0 || (res & (POLLERR | POLLHUP)))
+    {
+        uring_close_connection(loop, conn);
+        return;
+    }
+
+    uring_continue_sending(loop, conn);
+}
+
+static void uring_handle_close(EVENT_LOOP *loop, CONNECTION *conn, int res)
+{
+    if (res == -ECANCELED)
+    {
+        // The linked send failed, so the close never ran
+        close(conn->socket_fd);
+    }
+    else
+    {
+        connection_advance_write(conn, conn->write_pending);
+        LOG_DEBUG("Response sent\n\n");
+    }
+
+    conn->socket_fd = -1;
+    uring_close_connection(loop, conn);
+}
+
+static void uring_process_completions(EVENT_LOOP *loop)
+{
+    URING *ring = &loop->uring->io;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail)
+    {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        uint64_t user_data = cqe->user_data;
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+
+        // Free the slot before handling, handlers may queue more work
+        head++;
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+        CONNECTION *conn = (CONNECTION *)(uintptr_t)(user_data & ~(uint64_t)URING_OP_MASK);
+
+        switch (user_data & URING_OP_MASK)
+        {
+        case URING_OP_ACCEPT:
+            if (res >= 0)
+            {
+                uring_open_connection(loop, res);
+            }
+            else if (res != -EINTR && res != -ECANCELED)
+            {
+                LOG_ERROR("Accept failed: %s\n", strerror(-res));
+            }
+
+            if (!(flags & IORING_CQE_F_MORE) && loop->running)
+            {
+                uring_arm_accept(loop);
+            }
+            break;
+        case URING_OP_RECV:
+            uring_handle_recv(loop, conn, res, flags);
+            break;
+        case URING_OP_SEND:
+            // Sends linked to a close only complete here on failure, and the
+            // close reports it; keep-alive sends carry their connection
+            if (conn)
+            {
+                uring_handle_send(loop, conn, res);
+            }
+            break;
+        case URING_OP_CLOSE:
+            uring_handle_close(loop, conn, res);
+            break;
+        case URING_OP_WRITABLE:
+            uring_handle_writable(loop, conn, res);
+            break;
+        case URING_OP_TIMEOUT:
+            break;
+        case URING_OP_TICK:
+            if (loop->running)
+            {
+                uring_arm_tick(loop);
+            }
+            break;
+        }
+
+        tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    }
+}
+
+int uring_loop_init(EVENT_LOOP *loop)
+{
+    URING_BACKEND *backend = malloc(sizeof(URING_BACKEND));
+    if (!backend)
+    {
+        return -1;
+    }
+
+    memset(backend, 0, sizeof(URING_BACKEND));
+    backend->io.ring_fd = -1;
+    backend->files.ring_fd = -1;
+    loop->uring = backend;
+
+    if (uring_setup(&backend->io, URING_ENTRIES) < 0 ||
+        uring_setup(&backend->files, 8) < 0 ||
+        uring_setup_buffers(backend) < 0 ||
+        uring_register_files(backend) < 0)
+    {
+        uring_loop_cleanup(loop);
+        return -1;
+    }
+
+    return 0;
+}
+
+void uring_loop_run(EVENT_LOOP *loop)
+{
+    thread_backend = loop->uring;
+    file_set_thread_reader(uring_read_file);
+
+    uring_arm_accept(loop);
+    uring_arm_tick(loop);
+
+    while (loop->running)
+    {
+        if (uring_submit(&loop->uring->io, 1) < 0 && errno != EINTR)
+        {
+            LOG_ERROR("io_uring_enter failed: %s\n", strerror(errno));
+            break;
+        }
+
+        uring_process_completions(loop);
+    }
+
+    file_set_thread_reader(NULL);
+    thread_backend = NULL;
+}
+
+void uring_loop_cleanup(EVENT_LOOP *loop)
+{
+    URING_BACKEND *backend = loop->uring;
+    if (!backend)
+    {
+        return;
+    }
+
+    // Wake any in-flight receive or send before the rings go away
+    for (CONNECTION *conn = loop->connections; conn; conn = conn->next)
+    {
+        if (conn->socket_fd >= 0)
+        {
+            shutdown(conn->socket_fd, SHUT_RDWR);
+        }
+    }
+
+    uring_teardown(&backend->io);
+    uring_teardown(&backend->files);
+
+    for (int i = 0; i < backend->registered_count; i++)
+    {
+        close(backend->registered[i].fd);
+    }
+
+    if (backend->buf_ring)
+    {
+        munmap(backend->buf_ring, backend->buf_ring_size);
+    }
+    free(backend->buffers);
+    free(backend);
+
+    loop->uring = NULL;
+    loop->backend = EVENT_BACKEND_EPOLL;
+}
+
+#else
+
+int uring_loop_init(EVENT_LOOP *loop)
+{
+    (void)loop;
+    fprintf(stderr, "io_uring support not compiled in (build with make IO_URING=1)\n");
+    return -1;
+}
+
+void uring_loop_run(EVENT_LOOP *loop)
+{
+    (void)loop;
+}
+
+void uring_loop_cleanup(EVENT_LOOP *loop)
+{
+    (void)loop;
+}
+
+#endif // USE_IO_URING
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include "../include/utils.h"
 
 // Simple JSON parser for user data
 int parse_user_json(const char *json, char *name, int name_len, char *email, int email_len,
@@ -190,4 +191,89 @@ int is_valid_password(const char *password)
     }
 
     return 1;
-}
\ No newline at end of file
+}
+
+void json_splitter_init(JSON_SPLITTER *splitter)
+{
+    splitter->length = 0;
+    splitter->depth = 0;
+    splitter->in_string = false;
+    splitter->escaped = false;
+}
+
+// Feed the next piece of the document. Anything outside of objects (array
+// brackets, commas, whitespace) is skipped. Returns -1 if on_object stopped
+int json_splitter_feed(JSON_SPLITTER *splitter, const char *data, size_t length,
+                       JSON_OBJECT_FUNC on_object, void *context)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        char c = data[i];
+
+        if (splitter->depth == 0)
+        {
+            if (c == '{')
+            {
+                splitter->depth = 1;
+                splitter->length = 0;
+                splitter->in_string = false;
+                splitter->escaped = false;
+                splitter->object[splitter->length++] = c;
+            }
+            continue;
+        }
+
+        // Keep collecting past the buffer to find the end, the object is lost
+        if (splitter->length < IMPORT_MAX_OBJECT_SIZE)
+        {
+            splitter->object[splitter->length] = c;
+        }
+        splitter->length++;
+
+        if (splitter->in_string)
+        {
+            if (splitter->escaped)
+            {
+                splitter->escaped = false;
+            }
+            else if (c == '\\')
+            {
+                splitter->escaped = true;
+            }
+            else if (c == '"')
+            {
+                splitter->in_string = false;
+            }
+            continue;
+        }
+
+        if (c == '"')
+        {
+            splitter->in_string = true;
+        }
+        else if (c == '{')
+        {
+            splitter->depth++;
+        }
+        else if (c == '}' && --splitter->depth == 0)
+        {
+            int result;
+            if (splitter->length <= IMPORT_MAX_OBJECT_SIZE)
+            {
+                splitter->object[splitter->length] = '\0';
+                result = on_object(context, splitter->object, splitter->length);
+            }
+            else
+            {
+                result = on_object(context, NULL, 0);
+            }
+
+            if (result < 0)
+            {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_client.h"
+#include "test_suites.h"
+
+#define TEST_DEFAULT_PORT 18080
+
+typedef struct
+{
+    const char *name;
+    const char *args[8]; // After the port, NULL-terminated
+} TEST_MODE;
+
+// The thread pool behind one event loop, and handlers run inline by several
+static const TEST_MODE modes[] = {
+    {"pool", {"5", "100", "1", NULL}},
+    {"per-core", {"5", "100", "2", NULL}},
+};
+
+static const TEST_MODE io_uring_mode = {"io_uring", {"5", "100", "1", "io_uring", NULL}};
+
+typedef void (*TEST_SUITE)(const TEST_SERVER *server);
+
+static const TEST_SUITE suites[] = {
+    test_parser,
+    test_router,
+    test_pipelining,
+    test_bodies,
+    test_streaming,
+    test_static,
+};
+
+static void run_mode(const char *binary, int port, const TEST_MODE *mode)
+{
+    TEST_SERVER server = {mode->name, port};
+
+    pid_t pid = test_server_start(binary, port, mode->args);
+    if (pid < 0)
+    {
+        fprintf(stderr, "FAIL [%s] server did not start\n", mode->name);
+        test_failures++;
+        return;
+    }
+
+    int failures = test_failures;
+    for (size_t i = 0; i < sizeof(suites) / sizeof(suites[0]); i++)
+    {
+        suites[i](&server);
+    }
+
+    test_server_stop(pid);
+    printf("%-8s %s\n", mode->name, (test_failures == failures) ? "ok" : "FAILED");
+}
+
+// Usage: http_test <server binary> [port] [io_uring]. Run from the directory
+// the server serves public/ and keeps its database in
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <server binary> [port] [io_uring]\n", argv[0]);
+        return 2;
+    }
+
+    int port = (argc > 2) ? atoi(argv[2]) : TEST_DEFAULT_PORT;
+    int with_io_uring = argc > 3 && strcmp(argv[3], "io_uring") == 0;
+
+    if (test_fixtures_create() < 0)
+    {
+        fprintf(stderr, "Cannot create the test files under public/\n");
+        return 2;
+    }
+
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+    {
+        run_mode(argv[1], port, &modes[i]);
+    }
+
+    if (with_io_uring)
+    {
+        run_mode(argv[1], port, &io_uring_mode);
+    }
+
+    test_fixtures_remove();
+
+    if (test_failures)
+    {
+        printf("%d check(s) failed\n", test_failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "test_suites.h"
+
+#define IMPORTED_USERS 200
+#define SEND_PIECE 7 // Small enough to cut chunk-size lines and CRLFs apart
+
+// Names unique to one run and server mode, the database outlives the tests
+static void make_name(char *name, size_t size)
+{
+    static int runs = 0;
+    snprintf(name, size, "b%d_%d", (int)getpid(), runs++);
+}
+
+// A buffered body sent in chunks, with a chunk extension and a trailer
+static void chunked_buffered(const TEST_SERVER *server)
+{
+    char name[32];
+    make_name(name, sizeof(name));
+
+    char body[256];
+    int length = snprintf(body, sizeof(body), "{\"name\":\"%s\",\"email\":\"%s@test.io\",\"password\":\"secret1\"}",
+                          name, name);
+    int half = length / 2;
+
+    char request[1024];
+    snprintf(request, sizeof(request),
+             "POST /api/users HTTP/1.1\r\nHost: test\r\nContent-Type: application/json\r\n"
+             "Transfer-Encoding: chunked\r\n\r\n"
+             "%x;part=1\r\n%.*s\r\n%X\r\n%s\r\n0\r\nX-Trailer: ignored\r\n\r\n",
+             half, half, body, length - half, body + half);
+
+    TEST_RESPONSE response;
+    CHECK(server, test_request(server, request, &response) == 201);
+    CHECK(server, response.body && strstr(response.body, name) != NULL);
+    test_response_free(&response);
+}
+
+// A streamed import in many chunks, trickled in pieces that split the framing
+static void chunked_streamed(const TEST_SERVER *server)
+{
+    char name[32];
+    make_name(name, sizeof(name));
+
+    size_t capacity = (size_t)IMPORTED_USERS * 160 + 256;
+    char *request = malloc(capacity);
+    CHECK(server, request != NULL);
+    if (!request)
+    {
+        return;
+    }
+
+    size_t length = snprintf(request, capacity,
+                             "POST /api/users/import HTTP/1.1\r\nHost: test\r\nContent-Type: application/json\r\n"
+                             "Transfer-Encoding: chunked\r\n\r\n1\r\n[\r\n");
+    for (int i = 0; i < IMPORTED_USERS; i++)
+    {
+        char user[128];
+        int user_length = snprintf(user, sizeof(user),
+                                   "%s{\"name\":\"%s_%d\",\"email\":\"%s_%d@test.io\",\"password\":\"secret1\"}",
+                                   i ? "," : "", name, i, name, i);
+        length += snprintf(request + length, capacity - length, "%x\r\n%s\r\n", user_length, user);
+    }
+    length += snprintf(request + length, capacity - length, "1\r\n]\r\n0\r\n\r\n");
+
+    TEST_CONNECTION conn;
+    CHECK(server, test_connect(server, &conn) == 0);
+    for (size_t sent = 0; sent < length; sent += SEND_PIECE)
+    {
+        size_t piece = (length - sent < SEND_PIECE) ? length - sent : SEND_PIECE;
+        if (test_send(&conn, request + sent, piece) != 0)
+        {
+            CHECK(server, 0);
+            break;
+        }
+    }
+    free(request);
+
+    char expected[64];
+    snprintf(expected, sizeof(expected), "\"imported\": %d", IMPORTED_USERS);
+
+    TEST_RESPONSE response;
+    CHECK(server, test_read_response(&conn, &response, 0) == 0 && response.status == 200);
+    CHECK(server, response.body && strstr(response.body, expected) != NULL);
+    test_response_free(&response);
+    test_disconnect(&conn);
+}
+
+// A streamed body held back until the server asks for it
+static void expect_continue(const TEST_SERVER *server)
+{
+    char name[32];
+    make_name(name, sizeof(name));
+
+    char body[256];
+    snprintf(body, sizeof(body), "[{\"name\":\"%s\",\"email\":\"%s@test.io\",\"password\":\"secret1\"}]", name, name);
+
+    char headers[512];
+    snprintf(headers, sizeof(headers),
+             "POST /api/users/import HTTP/1.1\r\nHost: test\r\nContent-Type: application/json\r\n"
+             "Content-Length: %zu\r\nExpect: 100-continue\r\n\r\n",
+             strlen(body));
+
+    TEST_CONNECTION conn;
+    CHECK(server, test_connect(server, &conn) == 0);
+    CHECK(server, test_send_string(&conn, headers) == 0);
+
+    // Only the interim response comes before the body is sent
+    static const char continue_response[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    char interim[sizeof(continue_response)] = "";
+    CHECK(server, recv(conn.fd, interim, sizeof(continue_response) - 1, MSG_WAITALL) ==
+                      (ssize_t)sizeof(continue_response) - 1);
+    CHECK(server, strcmp(interim, continue_response) == 0);
+
+    TEST_RESPONSE response;
+    CHECK(server, test_send_string(&conn, body) == 0);
+    CHECK(server, test_read_response(&conn, &response, 0) == 0 && response.status == 200);
+    CHECK(server, response.body && strstr(response.body, "\"imported\": 1") != NULL);
+    test_response_free(&response);
+    test_disconnect(&conn);
+}
+
+// A body over the route's limit is answered with 413 and ends the
+// connection, whether its length is declared or found while decoding
+static void too_large(const TEST_SERVER *server)
+{
+    TEST_CONNECTION conn;
+    TEST_RESPONSE response;
+
+    CHECK(server, test_connect(server, &conn) == 0);
+    CHECK(server, test_send_string(&conn, "POST /api/users HTTP/1.1\r\nHost: test\r\n"
+                                          "Content-Length: 100000\r\n\r\n") == 0);
+    CHECK(server, test_read_response(&conn, &response, 0) == 0 && response.status == 413);
+    test_response_free(&response);
+    CHECK(server, test_closed(&conn));
+    test_disconnect(&conn);
+
+    char chunk[4096];
+    memset(chunk, 'a', sizeof(chunk));
+    CHECK(server, test_connect(server, &conn) == 0);
+    CHECK(server, test_send_string(&conn, "POST /api/users HTTP/1.1\r\nHost: test\r\n"
+                                          "Transfer-Encoding: chunked\r\n\r\n") == 0);
+
+    // The server answers once the limit is crossed, the rest may not be taken
+    for (int i = 0; i < 3; i++)
+    {
+        if (test_send_string(&conn, "1000\r\n") != 0 || test_send(&conn, chunk, sizeof(chunk)) != 0 ||
+            test_send_string(&conn, "\r\n") != 0)
+        {
+            break;
+        }
+    }
+    CHECK(server, test_read_response(&conn, &response, 0) == 0 && response.status == 413);
+    test_response_free(&response);
+    test_disconnect(&conn);
+}
+
+// Chunk framing that cannot be decoded closes the connection unanswered
+static void malformed_chunks(const TEST_SERVER *server)
+{
+    static const char *const bodies[] = {
+        "zz\r\nabc\r\n0\r\n\r\n",
+        "3\r\nabcd\r\n0\r\n\r\n",
+        "3\rabc\r\n0\r\n\r\n",
+        "fffffffffffffffff\r\n",
+    };
+
+    for (size_t i = 0; i < sizeof(bodies) / sizeof(bodies[0]); i++)
+    {
+        TEST_CONNECTION conn;
+        CHECK(server, test_connect(server, &conn) == 0);
+        CHECK(server, test_send_string(&conn, "POST /api/users HTTP/1.1\r\nHost: test\r\n"
+                                              "Transfer-Encoding: chunked\r\n\r\n") == 0);
+        CHECK(server, test_send_string(&conn, bodies[i]) == 0);
+        if (!test_closed(&conn))
+        {
+            fprintf(stderr, "  answered: %s\n", bodies[i]);
+            CHECK(server, 0);
+        }
+        test_disconnect(&conn);
+    }
+}
+
+void test_bodies(const TEST_SERVER *server)
+{
+    chunked_buffered(server);
+    chunked_streamed(server);
+    expect_continue(server);
+    too_large(server);
+    malformed_chunks(server);
+}
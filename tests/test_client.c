@@ -0,0 +1,433 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "test_client.h"
+
+#define TEST_START_ATTEMPTS 100 // Tries 50ms apart to reach a starting server
+
+int test_failures = 0;
+
+void test_check(const TEST_SERVER *server, int condition, const char *text, const char *file, int line)
+{
+    if (!condition)
+    {
+        fprintf(stderr, "FAIL [%s] %s:%d: %s\n", server->name, file, line, text);
+        test_failures++;
+    }
+}
+
+static int open_socket(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    struct timeval timeout = {TEST_RECV_TIMEOUT_SECONDS, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+pid_t test_server_start(const char *binary, int port, const char *const *args)
+{
+    char port_text[16];
+    snprintf(port_text, sizeof(port_text), "%d", port);
+
+    const char *argv[16] = {binary, port_text};
+    int argc = 2;
+    for (int i = 0; args && args[i] && argc < 15; i++)
+    {
+        argv[argc++] = args[i];
+    }
+    argv[argc] = NULL;
+
+    // The child would flush pending output a second time
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        // The server's own output would drown the test results
+        if (!freopen("/dev/null", "w", stdout))
+        {
+            _exit(127);
+        }
+        execv(binary, (char *const *)argv);
+        _exit(127);
+    }
+
+    struct timespec pause = {0, 50 * 1000000L};
+    for (int i = 0; i < TEST_START_ATTEMPTS; i++)
+    {
+        nanosleep(&pause, NULL);
+
+        int fd = open_socket(port);
+        if (fd >= 0)
+        {
+            close(fd);
+            return pid;
+        }
+
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+        {
+            return -1;
+        }
+    }
+
+    test_server_stop(pid);
+    return -1;
+}
+
+void test_server_stop(pid_t pid)
+{
+    kill(pid, SIGINT);
+    waitpid(pid, NULL, 0);
+}
+
+int test_connect(const TEST_SERVER *server, TEST_CONNECTION *conn)
+{
+    memset(conn, 0, sizeof(TEST_CONNECTION));
+    conn->fd = open_socket(server->port);
+    return (conn->fd < 0) ? -1 : 0;
+}
+
+void test_disconnect(TEST_CONNECTION *conn)
+{
+    if (conn->fd >= 0)
+    {
+        close(conn->fd);
+    }
+    free(conn->buffer);
+    memset(conn, 0, sizeof(TEST_CONNECTION));
+    conn->fd = -1;
+}
+
+int test_send(TEST_CONNECTION *conn, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t sent = send(conn->fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return -1;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return 0;
+}
+
+int test_send_string(TEST_CONNECTION *conn, const char *data)
+{
+    return test_send(conn, data, strlen(data));
+}
+
+// Receive more bytes behind the buffered ones. Returns the count, 0 on EOF,
+// -1 on error or timeout
+static ssize_t receive_more(TEST_CONNECTION *conn)
+{
+    if (conn->capacity - conn->length < 4096)
+    {
+        size_t capacity = conn->capacity ? conn->capacity * 2 : 16384;
+        char *buffer = realloc(conn->buffer, capacity + 1);
+        if (!buffer)
+        {
+            return -1;
+        }
+        conn->buffer = buffer;
+        conn->capacity = capacity;
+    }
+
+    ssize_t bytes;
+    do
+    {
+        bytes = recv(conn->fd, conn->buffer + conn->length, conn->capacity - conn->length, 0);
+    } while (bytes < 0 && errno == EINTR);
+
+    if (bytes > 0)
+    {
+        conn->length += bytes;
+        conn->buffer[conn->length] = '\0';
+    }
+    return bytes;
+}
+
+// Wait until at least length bytes are buffered. Returns 0, -1 if they never come
+static int receive_at_least(TEST_CONNECTION *conn, size_t length)
+{
+    while (conn->length < length)
+    {
+        if (receive_more(conn) <= 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Drop the first length buffered bytes
+static void consume(TEST_CONNECTION *conn, size_t length)
+{
+    memmove(conn->buffer, conn->buffer + length, conn->length - length);
+    conn->length -= length;
+    conn->buffer[conn->length] = '\0';
+}
+
+// Offset just past the blank line ending the head, -1 until it arrived
+static long find_head_end(const TEST_CONNECTION *conn)
+{
+    const char *end = conn->length ? memmem(conn->buffer, conn->length, "\r\n\r\n", 4) : NULL;
+    return end ? (long)(end - conn->buffer) + 4 : -1;
+}
+
+static int append_body(TEST_RESPONSE *response, const char *data, size_t length)
+{
+    char *body = realloc(response->body, response->body_length + length + 1);
+    if (!body)
+    {
+        return -1;
+    }
+
+    memcpy(body + response->body_length, data, length);
+    response->body = body;
+    response->body_length += length;
+    response->body[response->body_length] = '\0';
+    return 0;
+}
+
+static int read_chunked_body(TEST_CONNECTION *conn, TEST_RESPONSE *response)
+{
+    while (1)
+    {
+        char *line_end;
+        while (!(line_end = conn->length ? memmem(conn->buffer, conn->length, "\r\n", 2) : NULL))
+        {
+            if (receive_more(conn) <= 0)
+            {
+                return -1;
+            }
+        }
+
+        size_t size = strtoul(conn->buffer, NULL, 16);
+        size_t line_length = line_end - conn->buffer + 2;
+
+        if (size == 0)
+        {
+            // No trailers are sent, only the final blank line
+            if (receive_at_least(conn, line_length + 2) < 0)
+            {
+                return -1;
+            }
+            consume(conn, line_length + 2);
+            return 0;
+        }
+
+        if (receive_at_least(conn, line_length + size + 2) < 0 ||
+            append_body(response, conn->buffer + line_length, size) < 0)
+        {
+            return -1;
+        }
+        consume(conn, line_length + size + 2);
+    }
+}
+
+int test_read_response(TEST_CONNECTION *conn, TEST_RESPONSE *response, int head_only)
+{
+    memset(response, 0, sizeof(TEST_RESPONSE));
+    if (append_body(response, "", 0) < 0)
+    {
+        return -1;
+    }
+
+    long head_length;
+    while (1)
+    {
+        while ((head_length = find_head_end(conn)) < 0)
+        {
+            if (receive_more(conn) <= 0)
+            {
+                return -1;
+            }
+        }
+
+        int status = 0;
+        if (sscanf(conn->buffer, "HTTP/1.%*d %d", &status) != 1)
+        {
+            return -1;
+        }
+
+        if (status >= 200)
+        {
+            response->status = status;
+            break;
+        }
+
+        response->interim++;
+        consume(conn, head_length);
+    }
+
+    size_t copied = (size_t)head_length < sizeof(response->headers) ? (size_t)head_length : sizeof(response->headers) - 1;
+    memcpy(response->headers, conn->buffer, copied);
+    response->headers[copied] = '\0';
+    consume(conn, head_length);
+
+    char value[64];
+    if (head_only || response->status == 204 || response->status == 304)
+    {
+        return 0;
+    }
+
+    if (test_header(response, "Transfer-Encoding", value, sizeof(value)) && strcasecmp(value, "chunked") == 0)
+    {
+        return read_chunked_body(conn, response);
+    }
+
+    if (test_header(response, "Content-Length", value, sizeof(value)))
+    {
+        size_t length = strtoul(value, NULL, 10);
+        if (receive_at_least(conn, length) < 0 || append_body(response, conn->buffer, length) < 0)
+        {
+            return -1;
+        }
+        consume(conn, length);
+        return 0;
+    }
+
+    // Delimited by the close
+    ssize_t bytes;
+    while ((bytes = receive_more(conn)) > 0)
+    {
+    }
+    if (bytes < 0 || append_body(response, conn->buffer, conn->length) < 0)
+    {
+        return -1;
+    }
+    consume(conn, conn->length);
+    return 0;
+}
+
+void test_response_free(TEST_RESPONSE *response)
+{
+    free(response->body);
+    response->body = NULL;
+    response->body_length = 0;
+}
+
+const char *test_header(const TEST_RESPONSE *response, const char *name, char *value, size_t size)
+{
+    size_t name_length = strlen(name);
+    const char *line = strstr(response->headers, "\r\n");
+
+    while (line && line[2] != '\r' && line[2] != '\0')
+    {
+        line += 2;
+        const char *end = strstr(line, "\r\n");
+        if (!end)
+        {
+            return NULL;
+        }
+
+        if (strncasecmp(line, name, name_length) == 0 && line[name_length] == ':')
+        {
+            const char *start = line + name_length + 1;
+            while (*start == ' ')
+            {
+                start++;
+            }
+
+            size_t length = end - start;
+            if (length >= size)
+            {
+                length = size - 1;
+            }
+            memcpy(value, start, length);
+            value[length] = '\0';
+            return value;
+        }
+        line = end;
+    }
+
+    return NULL;
+}
+
+int test_request(const TEST_SERVER *server, const char *request, TEST_RESPONSE *response)
+{
+    memset(response, 0, sizeof(TEST_RESPONSE));
+
+    TEST_CONNECTION conn;
+    if (test_connect(server, &conn) < 0)
+    {
+        return 0;
+    }
+
+    int head_only = strncmp(request, "HEAD ", 5) == 0;
+    if (test_send_string(&conn, request) < 0 || test_read_response(&conn, response, head_only) < 0)
+    {
+        response->status = 0;
+    }
+
+    test_disconnect(&conn);
+    return response->status;
+}
+
+int test_write_file(const char *path, const char *data, size_t length)
+{
+    char temporary[512];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+
+    FILE *file = fopen(temporary, "wb");
+    if (!file)
+    {
+        return -1;
+    }
+
+    size_t written = fwrite(data, 1, length, file);
+    if (fclose(file) != 0 || written != length || rename(temporary, path) != 0)
+    {
+        unlink(temporary);
+        return -1;
+    }
+    return 0;
+}
+
+int test_closed(TEST_CONNECTION *conn)
+{
+    // Closing with request bytes still unread makes the close a reset
+    ssize_t bytes = receive_more(conn);
+    return bytes == 0 || (bytes < 0 && errno == ECONNRESET);
+}
@@ -0,0 +1,78 @@
+#ifndef TEST_CLIENT_H
+#define TEST_CLIENT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Request-level tests: raw bytes go to a server started from bin/http_server
+// and the responses are checked as a client sees them.
+
+#define TEST_HEADERS_SIZE 8192
+#define TEST_RECV_TIMEOUT_SECONDS 3
+
+typedef struct
+{
+    const char *name; // Printed with failures
+    int port;
+} TEST_SERVER;
+
+// Client socket and the bytes received past the last response read
+typedef struct
+{
+    int fd;
+    char *buffer;
+    size_t length;
+    size_t capacity;
+} TEST_CONNECTION;
+
+typedef struct
+{
+    int status; // Final status, interim 1xx responses are skipped
+    int interim; // 1xx responses seen before it
+    char headers[TEST_HEADERS_SIZE]; // Status line and header lines, NUL-terminated
+    char *body;  // De-chunked, NUL-terminated, free with test_response_free
+    size_t body_length;
+} TEST_RESPONSE;
+
+// Failed checks so far, the exit status of the test run
+extern int test_failures;
+
+#define CHECK(server, condition) \
+    test_check((server), (condition), #condition, __FILE__, __LINE__)
+
+void test_check(const TEST_SERVER *server, int condition, const char *text, const char *file, int line);
+
+// Start the server with args (NULL-terminated, after the port) and wait
+// until it accepts connections. Returns the child pid, -1 on failure
+pid_t test_server_start(const char *binary, int port, const char *const *args);
+void test_server_stop(pid_t pid);
+
+// Connect with a receive timeout. Returns 0, -1 on failure
+int test_connect(const TEST_SERVER *server, TEST_CONNECTION *conn);
+void test_disconnect(TEST_CONNECTION *conn);
+int test_send(TEST_CONNECTION *conn, const char *data, size_t length);
+int test_send_string(TEST_CONNECTION *conn, const char *data);
+
+// Read the next response. head_only: the request was HEAD, no body follows.
+// Returns 0, or -1 if the connection closed or timed out first
+int test_read_response(TEST_CONNECTION *conn, TEST_RESPONSE *response, int head_only);
+void test_response_free(TEST_RESPONSE *response);
+
+// Value of a response header (case-insensitive name) copied into value,
+// NULL if it is missing
+const char *test_header(const TEST_RESPONSE *response, const char *name, char *value, size_t size);
+
+// One request on a new connection, closed afterwards. Returns the status,
+// 0 if no complete response arrived
+int test_request(const TEST_SERVER *server, const char *request, TEST_RESPONSE *response);
+
+// Replace path with a file holding data the way a deploy would: written
+// next to it, then renamed over it. Returns 0, -1 on failure
+int test_write_file(const char *path, const char *data, size_t length);
+
+// 1 once the server closed (or reset) the connection without sending
+// anything more, 0 if it is still open after the receive timeout or sent
+// more bytes
+int test_closed(TEST_CONNECTION *conn);
+
+#endif // TEST_CLIENT_H
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_suites.h"
+
+static const char valid_request[] = "GET /about HTTP/1.1\r\nHost: test\r\n\r\n";
+
+// Requests the parser must refuse. The connection is closed without a
+// response, nothing after them is read
+static const char *const malformed_requests[] = {
+    "GET\r\n\r\n",
+    "GET  /about HTTP/1.1\r\nHost: test\r\n\r\n",
+    "GET /about HTTP/1.1\r\nHost test\r\n\r\n",
+    "GET /about HTTP/1.1\r\nHost : test\r\n\r\n",
+    "GET /about HTTP/1.1\r\nHost: test\r\n folded\r\n\r\n",
+    "GET /about HTTP/1.1\rHost: test\r\n\r\n",
+    "POST /api/users HTTP/1.1\r\nHost: test\r\ncontent-LENGTH: 5\r\nContent-Length: 6\r\n\r\nabcdef",
+    "POST /api/users HTTP/1.1\r\nHost: test\r\nContent-Length: -1\r\n\r\n",
+    "POST /api/users HTTP/1.1\r\nHost: test\r\nContent-Length: 99999999999999999999999\r\n\r\n",
+    "POST /api/users HTTP/1.1\r\nHost: test\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n",
+    "POST /api/users HTTP/1.1\r\nHost: test\r\nTransfer-Encoding: gzip\r\n\r\n",
+};
+
+static void malformed(const TEST_SERVER *server)
+{
+    for (size_t i = 0; i < sizeof(malformed_requests) / sizeof(malformed_requests[0]); i++)
+    {
+        TEST_CONNECTION conn;
+        CHECK(server, test_connect(server, &conn) == 0);
+        CHECK(server, test_send_string(&conn, malformed_requests[i]) == 0);
+        CHECK(server, test_send_string(&conn, valid_request) == 0);
+        if (!test_closed(&conn))
+        {
+            fprintf(stderr, "  answered: %s\n", malformed_requests[i]);
+            CHECK(server, 0);
+        }
+        test_disconnect(&conn);
+    }
+}
+
+// More header lines than MAX_HEADERS, or a head longer than MAX_REQUEST_SIZE
+static void oversized(const TEST_SERVER *server)
+{
+    char request[16384];
+    size_t length = snprintf(request, sizeof(request), "GET /about HTTP/1.1\r\nHost: test\r\n");
+    for (int i = 0; i < 40; i++)
+    {
+        length += snprintf(request + length, sizeof(request) - length, "X-Header-%d: %d\r\n", i, i);
+    }
+    snprintf(request + length, sizeof(request) - length, "\r\n");
+
+    TEST_CONNECTION conn;
+    CHECK(server, test_connect(server, &conn) == 0);
+    CHECK(server, test_send_string(&conn, request) == 0);
+    CHECK(server, test_closed(&conn));
+    test_disconnect(&conn);
+
+    length = snprintf(request, sizeof(request), "GET /about HTTP/1.1\r\nHost: test\r\nX-Long: ");
+    memset(request + length, 'a', 9000);
+    length += 9000;
+    snprintf(request + length, sizeof(request) - length, "\r\n\r\n");
+
+    CHECK(server, test_connect(server, &conn) == 0);
+    CHECK(server, test_send_string(&conn, request) == 0);
+    CHECK(server, test_closed(&conn));
+    test_disconnect(&conn);
+}
+
+// Header names are matched without regard to case, and only in full: a name
+// as long as a known one, or sharing its first letter, is just another header
+static void header_names(const TEST_SERVER *server)
+{
+    TEST_CONNECTION conn;
+    TEST_RESPONSE response;
+
+    CHECK(server, test_connect(server, &conn) == 0);
+    CHECK(server, test_send_string(&conn, "GET /about HTTP/1.1\r\nhOsT: test\r\nCONNECTION: close\r\n\r\n") == 0);
+    CHECK(server, test_read_response(&conn, &response, 0) == 0 && response.status == 200);
+    test_response_free(&response);
+    CHECK(server, test_closed(&conn));
+    test_disconnect(&conn);
+
+    CHECK(server, test_connect(server, &conn) == 0);
+    CHECK(server, test_send_string(&conn, "GET /about HTTP/1.1\r\nHost: test\r\nXonnection: close\r\n"
+                                          "Connectiox: close\r\nTransfer-Encodinh: chunked\r\n"
+                                          "Content-Length: 0\r\n\r\n") == 0);
+    CHECK(server, test_read_response(&conn, &response, 0) == 0 && response.status == 200);
+    test_response_free(&response);
+    CHECK(server, test_send_string(&conn, valid_request) == 0);
+    CHECK(server, test_read_response(&conn, &response, 0) == 0 && response.status == 200);
+    test_response_free(&response);
+    test_disconnect(&conn);
+}
+
+// Bare LF line endings, and empty lines before the request line
+static void lenient_framing(const TEST_SERVER *server)
+{
+    TEST_RESPONSE response;
+    CHECK(server, test_request(server, "GET /about HTTP/1.1\nHost: test\nConnection: close\n\n", &response) == 200);
+    test_response_free(&response);
+    CHECK(server, test_request(server, "\r\n\r\nGET /about HTTP/1.1\r\nHost: test\r\nConnection: close\r\n\r\n",
+                               &response) == 200);
+    test_response_free(&response);
+}
+
+void test_parser(const TEST_SERVER *server)
+{
+    malformed(server);
+    oversized(server);
+    header_names(server);
+    lenient_framing(server);
+}
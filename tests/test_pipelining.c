@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <string.h>
+#include "test_suites.h"
+
+// More than PIPELINE_MAX_REQUESTS, so the server has to come back for the
+// requests left in its buffer after the first batch
+#define PIPELINED_REQUESTS 60
+#define NOT_FOUND_POSITION 40
+
+static const char found_request[] = "GET /about HTTP/1.1\r\nHost: test\r\n\r\n";
+static const char missing_request[] = "GET /missing.html HTTP/1.1\r\nHost: test\r\n\r\n";
+
+// All requests in one send, answered in order on the same connection
+static void pipeline_beyond_batch(const TEST_SERVER *server)
+{
+    char requests[PIPELINED_REQUESTS * sizeof(missing_request)];
+    size_t length = 0;
+    for (int i = 0; i < PIPELINED_REQUESTS; i++)
+    {
+        const char *request = (i == NOT_FOUND_POSITION) ? missing_request : found_request;
+        memcpy(requests + length, request, strlen(request));
+        length += strlen(request);
+    }
+
+    TEST_CONNECTION conn;
+    CHECK(server, test_connect(server, &conn) == 0);
+    CHECK(server, test_send(&conn, requests, length) == 0);
+
+    int answered = 0;
+    int in_order = 1;
+    for (int i = 0; i < PIPELINED_REQUESTS; i++)
+    {
+        TEST_RESPONSE response;
+        int result = test_read_response(&conn, &response, 0);
+        int expected = (i == NOT_FOUND_POSITION) ? 404 : 200;
+        in_order = in_order && response.status == expected;
+        test_response_free(&response);
+        if (result < 0)
+        {
+            break;
+        }
+        answered++;
+    }
+    CHECK(server, answered == PIPELINED_REQUESTS);
+    CHECK(server, in_order);
+
+    // The connection is still usable afterwards
+    TEST_RESPONSE response;
+    CHECK(server, test_send_string(&conn, found_request) == 0);
+    CHECK(server, test_read_response(&conn, &response, 0) == 0 && response.status == 200);
+    test_response_free(&response);
+
+    test_disconnect(&conn);
+}
+
+// A request cut off at the end of one send is completed by the next
+static void pipeline_split_request(const TEST_SERVER *server)
+{
+    char requests[4 * sizeof(found_request)];
+    snprintf(requests, sizeof(requests), "%s%s%.10s", found_request, found_request, found_request);
+
+    TEST_CONNECTION conn;
+    CHECK(server, test_connect(server, &conn) == 0);
+    CHECK(server, test_send_string(&conn, requests) == 0);
+
+    TEST_RESPONSE response;
+    for (int i = 0; i < 2; i++)
+    {
+        CHECK(server, test_read_response(&conn, &response, 0) == 0 && response.status == 200);
+        test_response_free(&response);
+    }
+
+    CHECK(server, test_send_string(&conn, found_request + 10) == 0);
+    CHECK(server, test_read_response(&conn, &response, 0) == 0 && response.status == 200);
+    test_response_free(&response);
+
+    test_disconnect(&conn);
+}
+
+// Nothing sent after "Connection: close" is answered
+static void pipeline_stops_at_close(const TEST_SERVER *server)
+{
+    TEST_CONNECTION conn;
+    CHECK(server, test_connect(server, &conn) == 0);
+    CHECK(server, test_send_string(&conn, "GET /about HTTP/1.1\r\nHost: test\r\n\r\n"
+                                          "GET /about HTTP/1.1\r\nHost: test\r\nConnection: close\r\n\r\n"
+                                          "GET /about HTTP/1.1\r\nHost: test\r\n\r\n") == 0);
+
+    TEST_RESPONSE response;
+    for (int i = 0; i < 2; i++)
+    {
+        CHECK(server, test_read_response(&conn, &response, 0) == 0 && response.status == 200);
+        test_response_free(&response);
+    }
+    CHECK(server, test_closed(&conn));
+
+    test_disconnect(&conn);
+}
+
+void test_pipelining(const TEST_SERVER *server)
+{
+    pipeline_beyond_batch(server);
+    pipeline_split_request(server);
+    pipeline_stops_at_close(server);
+}
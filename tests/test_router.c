@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "test_suites.h"
+
+// Status of "METHOD path" sent alone on a new connection
+static int status_of(const TEST_SERVER *server, const char *method, const char *path)
+{
+    char request[512];
+    snprintf(request, sizeof(request), "%s %s HTTP/1.1\r\nHost: test\r\nConnection: close\r\n\r\n", method, path);
+
+    TEST_RESPONSE response;
+    int status = test_request(server, request, &response);
+    test_response_free(&response);
+    return status;
+}
+
+// Unknown paths are 404, known ones with another method 405
+static void unmatched(const TEST_SERVER *server)
+{
+    CHECK(server, status_of(server, "GET", "/nope") == 404);
+    CHECK(server, status_of(server, "GET", "/api/users/1/extra") == 404);
+    CHECK(server, status_of(server, "DELETE", "/about") == 405);
+    CHECK(server, status_of(server, "DELETE", "/api/users") == 405);
+    CHECK(server, status_of(server, "PUT", "/api/users/import") == 405);
+}
+
+// Empty segments and the query string do not change the route, nor the
+// file it serves
+static void path_spellings(const TEST_SERVER *server)
+{
+    static const char *const spellings[] = {"/about/", "//about", "/about?x=1", "/about.html"};
+
+    TEST_RESPONSE response;
+    CHECK(server, test_request(server, "GET /about HTTP/1.1\r\nHost: test\r\n\r\n", &response) == 200);
+    size_t length = response.body_length;
+    CHECK(server, length > 0);
+    test_response_free(&response);
+
+    for (size_t i = 0; i < sizeof(spellings) / sizeof(spellings[0]); i++)
+    {
+        char request[256];
+        snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: test\r\n\r\n", spellings[i]);
+        CHECK(server, test_request(server, request, &response) == 200);
+        if (response.body_length != length)
+        {
+            fprintf(stderr, "  %s: %zu bytes, /about has %zu\n", spellings[i], response.body_length, length);
+            CHECK(server, 0);
+        }
+        test_response_free(&response);
+    }
+}
+
+// {id} captures the segment and hands it to the handler
+static void path_params(const TEST_SERVER *server)
+{
+    static int runs = 0;
+    char name[64];
+    snprintf(name, sizeof(name), "r%d_%d", (int)getpid(), runs++);
+
+    char body[256];
+    char request[512];
+    snprintf(body, sizeof(body), "{\"name\":\"%s\",\"email\":\"%s@test.io\",\"password\":\"secret1\"}", name, name);
+    snprintf(request, sizeof(request),
+             "POST /api/users HTTP/1.1\r\nHost: test\r\nContent-Type: application/json\r\n"
+             "Content-Length: %zu\r\n\r\n%s",
+             strlen(body), body);
+
+    TEST_RESPONSE response;
+    CHECK(server, test_request(server, request, &response) == 201);
+    const char *id = response.body ? strstr(response.body, "\"id\": ") : NULL;
+    int user_id = id ? atoi(id + 6) : 0;
+    CHECK(server, user_id > 0);
+    test_response_free(&response);
+
+    char path[64];
+    snprintf(path, sizeof(path), "/api/users/%d", user_id);
+    snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: test\r\n\r\n", path);
+    CHECK(server, test_request(server, request, &response) == 200);
+    CHECK(server, response.body && strstr(response.body, name) != NULL);
+    test_response_free(&response);
+
+    CHECK(server, status_of(server, "GET", "/api/users/abc") == 400);
+    CHECK(server, status_of(server, "GET", "/api/users/999999999") == 404);
+    CHECK(server, status_of(server, "DELETE", path) == 200);
+    CHECK(server, status_of(server, "GET", path) == 404);
+}
+
+void test_router(const TEST_SERVER *server)
+{
+    unmatched(server);
+    path_spellings(server);
+    path_params(server);
+}
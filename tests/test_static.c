@@ -0,0 +1,270 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "test_suites.h"
+
+// Served from the open-file cache: created before the server starts, and
+// larger than ASSET_CACHE_MAX_FILE_SIZE so the asset cache leaves it alone
+#define FIXTURE_DIR "public/media"
+#define FIXTURE_PATH FIXTURE_DIR "/test_fixture.bin"
+#define FIXTURE_URL "/media/test_fixture.bin"
+#define FIXTURE_SIZE (2 * 1024 * 1024)
+
+// Sparse, past what an int can count: sent from the file, never read whole
+#define LARGE_PATH FIXTURE_DIR "/test_large.bin"
+#define LARGE_URL "/media/test_large.bin"
+#define LARGE_SIZE 2147483649LL
+
+// Time for the inotify watcher to drop a changed file
+#define INVALIDATION_WAIT_US 300000
+
+static char *fixture = NULL;
+static size_t fixture_length = 0;
+static int created_dir = 0;
+
+// Deterministic contents, different for every seed
+static void fill_fixture(unsigned int seed, size_t length)
+{
+    unsigned int state = seed * 2654435761u + 1;
+    for (size_t i = 0; i < length; i++)
+    {
+        state = state * 1103515245u + 12345u;
+        fixture[i] = (char)(state >> 16);
+    }
+    fixture_length = length;
+}
+
+static int write_fixture(unsigned int seed, size_t length)
+{
+    fill_fixture(seed, length);
+    return test_write_file(FIXTURE_PATH, fixture, fixture_length);
+}
+
+int test_fixtures_create(void)
+{
+    fixture = malloc(FIXTURE_SIZE);
+    if (!fixture)
+    {
+        return -1;
+    }
+
+    created_dir = mkdir(FIXTURE_DIR, 0755) == 0;
+    if (test_write_file(LARGE_PATH, "", 0) < 0 || truncate(LARGE_PATH, LARGE_SIZE) < 0)
+    {
+        return -1;
+    }
+    return write_fixture(0, FIXTURE_SIZE);
+}
+
+void test_fixtures_remove(void)
+{
+    unlink(FIXTURE_PATH);
+    unlink(LARGE_PATH);
+    if (created_dir)
+    {
+        rmdir(FIXTURE_DIR);
+    }
+    free(fixture);
+    fixture = NULL;
+}
+
+static int body_matches(const TEST_RESPONSE *response, const char *data, size_t length)
+{
+    return response->body_length == length && memcmp(response->body, data, length) == 0;
+}
+
+// ETag and Last-Modified on the full response, 304 when the client's copy
+// matches either, the full file again when it does not
+static void conditional_requests(const TEST_SERVER *server)
+{
+    CHECK(server, write_fixture(1, FIXTURE_SIZE) == 0);
+    usleep(INVALIDATION_WAIT_US);
+
+    TEST_RESPONSE response;
+    char etag[128] = "";
+    char last_modified[64] = "";
+    char value[128];
+    char request[512];
+
+    CHECK(server, test_request(server, "GET " FIXTURE_URL " HTTP/1.1\r\nHost: test\r\n\r\n", &response) == 200);
+    CHECK(server, body_matches(&response, fixture, fixture_length));
+    CHECK(server, test_header(&response, "ETag", etag, sizeof(etag)) != NULL);
+    CHECK(server, test_header(&response, "Last-Modified", last_modified, sizeof(last_modified)) != NULL);
+    test_response_free(&response);
+
+    // The validators of a cached file do not change between requests
+    CHECK(server, test_request(server, "GET " FIXTURE_URL " HTTP/1.1\r\nHost: test\r\n\r\n", &response) == 200);
+    CHECK(server, test_header(&response, "ETag", value, sizeof(value)) && strcmp(value, etag) == 0);
+    CHECK(server, test_header(&response, "Content-Length", value, sizeof(value)) &&
+                      strtoul(value, NULL, 10) == fixture_length);
+    test_response_free(&response);
+
+    snprintf(request, sizeof(request), "GET " FIXTURE_URL " HTTP/1.1\r\nHost: test\r\nIf-None-Match: \"x\", %s\r\n\r\n", etag);
+    CHECK(server, test_request(server, request, &response) == 304);
+    CHECK(server, response.body_length == 0);
+    CHECK(server, test_header(&response, "ETag", value, sizeof(value)) && strcmp(value, etag) == 0);
+    test_response_free(&response);
+
+    snprintf(request, sizeof(request), "GET " FIXTURE_URL " HTTP/1.1\r\nHost: test\r\nIf-Modified-Since: %s\r\n\r\n", last_modified);
+    CHECK(server, test_request(server, request, &response) == 304);
+    test_response_free(&response);
+
+    // If-None-Match wins over If-Modified-Since
+    snprintf(request, sizeof(request), "GET " FIXTURE_URL " HTTP/1.1\r\nHost: test\r\nIf-None-Match: \"x\"\r\n"
+                                       "If-Modified-Since: %s\r\n\r\n", last_modified);
+    CHECK(server, test_request(server, request, &response) == 200);
+    CHECK(server, body_matches(&response, fixture, fixture_length));
+    test_response_free(&response);
+}
+
+// A redeployed file is served with its new validators and contents
+static void changed_file(const TEST_SERVER *server)
+{
+    TEST_RESPONSE response;
+    char old_etag[128] = "";
+    char etag[128] = "";
+
+    CHECK(server, write_fixture(2, FIXTURE_SIZE) == 0);
+    usleep(INVALIDATION_WAIT_US);
+    CHECK(server, test_request(server, "GET " FIXTURE_URL " HTTP/1.1\r\nHost: test\r\n\r\n", &response) == 200);
+    CHECK(server, test_header(&response, "ETag", old_etag, sizeof(old_etag)) != NULL);
+    test_response_free(&response);
+
+    CHECK(server, write_fixture(3, FIXTURE_SIZE) == 0);
+    usleep(INVALIDATION_WAIT_US);
+    CHECK(server, test_request(server, "GET " FIXTURE_URL " HTTP/1.1\r\nHost: test\r\n\r\n", &response) == 200);
+    CHECK(server, test_header(&response, "ETag", etag, sizeof(etag)) && strcmp(etag, old_etag) != 0);
+    CHECK(server, body_matches(&response, fixture, fixture_length));
+    test_response_free(&response);
+
+    // Replaced by a much smaller file: the length and bytes follow it too
+    char value[64];
+    CHECK(server, write_fixture(4, 16) == 0);
+    usleep(INVALIDATION_WAIT_US);
+    CHECK(server, test_request(server, "GET " FIXTURE_URL " HTTP/1.1\r\nHost: test\r\n\r\n", &response) == 200);
+    CHECK(server, test_header(&response, "Content-Length", value, sizeof(value)) && strcmp(value, "16") == 0);
+    CHECK(server, body_matches(&response, fixture, fixture_length));
+    test_response_free(&response);
+}
+
+// Another spelling of the same path is invalidated with it
+static void changed_file_other_spelling(const TEST_SERVER *server)
+{
+    static const char request[] = "GET /media//test_fixture.bin HTTP/1.1\r\nHost: test\r\n\r\n";
+    TEST_RESPONSE response;
+
+    CHECK(server, write_fixture(5, FIXTURE_SIZE) == 0);
+    usleep(INVALIDATION_WAIT_US);
+    CHECK(server, test_request(server, request, &response) == 200);
+    CHECK(server, body_matches(&response, fixture, fixture_length));
+    test_response_free(&response);
+
+    CHECK(server, write_fixture(6, FIXTURE_SIZE) == 0);
+    usleep(INVALIDATION_WAIT_US);
+    CHECK(server, test_request(server, request, &response) == 200);
+    CHECK(server, body_matches(&response, fixture, fixture_length));
+    test_response_free(&response);
+}
+
+// Part of a multipart/byteranges body: its headers, then the bytes
+static int part_matches(const TEST_RESPONSE *response, off_t start, off_t length, off_t total)
+{
+    char headers[128];
+    snprintf(headers, sizeof(headers), "Content-Range: bytes %lld-%lld/%lld\r\n\r\n",
+             (long long)start, (long long)(start + length - 1), (long long)total);
+
+    const char *part = memmem(response->body, response->body_length, headers, strlen(headers));
+    if (!part)
+    {
+        return 0;
+    }
+    part += strlen(headers);
+    return (size_t)(part - response->body) + length <= response->body_length &&
+           memcmp(part, fixture + start, length) == 0;
+}
+
+// Single, suffix and multiple ranges, none satisfiable, and an If-Range
+// that no longer matches
+static void byte_ranges(const TEST_SERVER *server)
+{
+    CHECK(server, write_fixture(7, FIXTURE_SIZE) == 0);
+    usleep(INVALIDATION_WAIT_US);
+
+    TEST_RESPONSE response;
+    char value[128];
+    char expected[128];
+
+    CHECK(server, test_request(server, "GET " FIXTURE_URL " HTTP/1.1\r\nHost: test\r\nRange: bytes=100-199\r\n\r\n",
+                               &response) == 206);
+    snprintf(expected, sizeof(expected), "bytes 100-199/%d", FIXTURE_SIZE);
+    CHECK(server, test_header(&response, "Content-Range", value, sizeof(value)) && strcmp(value, expected) == 0);
+    CHECK(server, body_matches(&response, fixture + 100, 100));
+    test_response_free(&response);
+
+    CHECK(server, test_request(server, "GET " FIXTURE_URL " HTTP/1.1\r\nHost: test\r\nRange: bytes=-50\r\n\r\n",
+                               &response) == 206);
+    CHECK(server, body_matches(&response, fixture + FIXTURE_SIZE - 50, 50));
+    test_response_free(&response);
+
+    CHECK(server, test_request(server, "GET " FIXTURE_URL " HTTP/1.1\r\nHost: test\r\n"
+                                       "Range: bytes=0-9, 1000-1999\r\n\r\n", &response) == 206);
+    CHECK(server, test_header(&response, "Content-Type", value, sizeof(value)) &&
+                      strncmp(value, "multipart/byteranges; boundary=", 31) == 0);
+    CHECK(server, part_matches(&response, 0, 10, FIXTURE_SIZE));
+    CHECK(server, part_matches(&response, 1000, 1000, FIXTURE_SIZE));
+    test_response_free(&response);
+
+    CHECK(server, test_request(server, "GET " FIXTURE_URL " HTTP/1.1\r\nHost: test\r\nRange: bytes=3000000-\r\n\r\n",
+                               &response) == 416);
+    snprintf(expected, sizeof(expected), "bytes */%d", FIXTURE_SIZE);
+    CHECK(server, test_header(&response, "Content-Range", value, sizeof(value)) && strcmp(value, expected) == 0);
+    test_response_free(&response);
+
+    CHECK(server, test_request(server, "GET " FIXTURE_URL " HTTP/1.1\r\nHost: test\r\nRange: bytes=0-9\r\n"
+                                       "If-Range: \"stale\"\r\n\r\n", &response) == 200);
+    CHECK(server, body_matches(&response, fixture, fixture_length));
+    test_response_free(&response);
+}
+
+// A file larger than INT_MAX: the whole of it is announced, and ranges
+// reach past the 2GB mark
+static void large_file(const TEST_SERVER *server)
+{
+    TEST_CONNECTION conn;
+    TEST_RESPONSE response;
+    char value[128];
+    char expected[128];
+
+    CHECK(server, test_connect(server, &conn) == 0);
+    CHECK(server, test_send_string(&conn, "GET " LARGE_URL " HTTP/1.1\r\nHost: test\r\n\r\n") == 0);
+    CHECK(server, test_read_response(&conn, &response, 1) == 0 && response.status == 200);
+    snprintf(expected, sizeof(expected), "%lld", LARGE_SIZE);
+    CHECK(server, test_header(&response, "Content-Length", value, sizeof(value)) && strcmp(value, expected) == 0);
+    test_response_free(&response);
+    test_disconnect(&conn);
+
+    CHECK(server, test_request(server, "GET " LARGE_URL " HTTP/1.1\r\nHost: test\r\n"
+                                       "Range: bytes=2147483640-\r\n\r\n", &response) == 206);
+    snprintf(expected, sizeof(expected), "bytes 2147483640-%lld/%lld", LARGE_SIZE - 1, LARGE_SIZE);
+    CHECK(server, test_header(&response, "Content-Range", value, sizeof(value)) && strcmp(value, expected) == 0);
+    CHECK(server, response.body_length == LARGE_SIZE - 2147483640);
+    test_response_free(&response);
+
+    CHECK(server, test_request(server, "GET " LARGE_URL " HTTP/1.1\r\nHost: test\r\n"
+                                       "Range: bytes=0-0,-1\r\n\r\n", &response) == 206);
+    snprintf(expected, sizeof(expected), "Content-Range: bytes %lld-%lld/%lld", LARGE_SIZE - 1, LARGE_SIZE - 1, LARGE_SIZE);
+    CHECK(server, memmem(response.body, response.body_length, expected, strlen(expected)) != NULL);
+    test_response_free(&response);
+}
+
+void test_static(const TEST_SERVER *server)
+{
+    conditional_requests(server);
+    changed_file(server);
+    changed_file_other_spelling(server);
+    byte_ranges(server);
+    large_file(server);
+}
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "test_suites.h"
+
+#define IMPORTED_USERS 150
+#define LISTED_USERS 100
+
+// Names unique to one run and server mode, the database outlives the tests
+static void make_tag(char *tag, size_t size)
+{
+    static int runs = 0;
+    snprintf(tag, size, "t%d_%d", (int)getpid(), runs++);
+}
+
+// Import count users named <tag>_<i> with one streamed upload. Returns the status
+static int import_users(const TEST_SERVER *server, const char *tag, int count, TEST_RESPONSE *response)
+{
+    size_t capacity = (size_t)count * 128 + 256;
+    char *request = malloc(capacity);
+    char *body = malloc(capacity);
+    if (!request || !body)
+    {
+        free(request);
+        free(body);
+        memset(response, 0, sizeof(TEST_RESPONSE));
+        return 0;
+    }
+
+    size_t length = snprintf(body, capacity, "[");
+    for (int i = 0; i < count; i++)
+    {
+        length += snprintf(body + length, capacity - length,
+                           "%s{\"name\":\"%s_%d\",\"email\":\"%s_%d@test.io\",\"password\":\"secret1\"}",
+                           i ? "," : "", tag, i, tag, i);
+    }
+    snprintf(body + length, capacity - length, "]");
+
+    snprintf(request, capacity,
+             "POST /api/users/import HTTP/1.1\r\nHost: test\r\nContent-Type: application/json\r\n"
+             "Content-Length: %zu\r\nConnection: close\r\n\r\n%s",
+             strlen(body), body);
+
+    int status = test_request(server, request, response);
+    free(request);
+    free(body);
+    return status;
+}
+
+// The list goes out as the cursor produces it: chunked for HTTP/1.1,
+// delimited by the close for HTTP/1.0
+static void stream_user_list(const TEST_SERVER *server)
+{
+    char tag[32];
+    make_tag(tag, sizeof(tag));
+
+    TEST_RESPONSE response;
+    CHECK(server, import_users(server, tag, IMPORTED_USERS, &response) == 200);
+    CHECK(server, strstr(response.body, "\"imported\": 150") != NULL);
+    test_response_free(&response);
+
+    char request[256];
+    char expected[64];
+    char value[64];
+    snprintf(expected, sizeof(expected), "\"count\":%d,\"total\":%d", LISTED_USERS, IMPORTED_USERS);
+
+    snprintf(request, sizeof(request), "GET /api/users?limit=%d&search=%s HTTP/1.1\r\nHost: test\r\n\r\n",
+             LISTED_USERS, tag);
+    CHECK(server, test_request(server, request, &response) == 200);
+    CHECK(server, test_header(&response, "Transfer-Encoding", value, sizeof(value)) &&
+                      strcmp(value, "chunked") == 0);
+    CHECK(server, strstr(response.body, expected) != NULL);
+    size_t chunked_length = response.body_length;
+    test_response_free(&response);
+
+    snprintf(request, sizeof(request), "GET /api/users?limit=%d&search=%s HTTP/1.0\r\n\r\n", LISTED_USERS, tag);
+    CHECK(server, test_request(server, request, &response) == 200);
+    CHECK(server, !test_header(&response, "Transfer-Encoding", value, sizeof(value)));
+    CHECK(server, response.body_length == chunked_length);
+    CHECK(server, strstr(response.body, expected) != NULL);
+    test_response_free(&response);
+}
+
+void test_streaming(const TEST_SERVER *server)
+{
+    stream_user_list(server);
+}
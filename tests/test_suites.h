@@ -0,0 +1,18 @@
+#ifndef TEST_SUITES_H
+#define TEST_SUITES_H
+
+#include "test_client.h"
+
+// Each suite runs against every server mode http_test starts
+void test_parser(const TEST_SERVER *server);
+void test_router(const TEST_SERVER *server);
+void test_pipelining(const TEST_SERVER *server);
+void test_bodies(const TEST_SERVER *server);
+void test_streaming(const TEST_SERVER *server);
+void test_static(const TEST_SERVER *server);
+
+// Files under public/ the suites serve, made before the first server starts
+int test_fixtures_create(void);
+void test_fixtures_remove(void);
+
+#endif // TEST_SUITES_H
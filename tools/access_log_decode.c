@@ -0,0 +1,226 @@
+// Prints the binary access log written by the server as text, one request
+// per line, or as JSON lines with --json.
+//
+//   bin/access_log_decode [--json] [file...]
+//
+// Without files it reads standard input. Pass rotated logs oldest first:
+// bin/access_log_decode access.log.2 access.log.1 access.log
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "../include/access_log.h"
+#include "../include/request.h"
+
+static const char *method_names[HTTP_METHOD_COUNT] = {
+    [HTTP_METHOD_GET] = "GET",
+    [HTTP_METHOD_HEAD] = "HEAD",
+    [HTTP_METHOD_POST] = "POST",
+    [HTTP_METHOD_PUT] = "PUT",
+    [HTTP_METHOD_PATCH] = "PATCH",
+    [HTTP_METHOD_DELETE] = "DELETE",
+    [HTTP_METHOD_OPTIONS] = "OPTIONS",
+    [HTTP_METHOD_UNKNOWN] = "UNKNOWN"};
+
+static const char *stage_names[ACCESS_STAGE_COUNT] = {"parse", "handle", "build"};
+
+static const char *method_name(uint8_t method)
+{
+    return (method < HTTP_METHOD_COUNT && method_names[method]) ? method_names[method] : "UNKNOWN";
+}
+
+// ISO 8601 in UTC with microseconds
+static void format_time(char *buffer, size_t size, uint64_t timestamp_us)
+{
+    time_t seconds = (time_t)(timestamp_us / 1000000);
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+
+    size_t length = strftime(buffer, size, "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(buffer + length, size - length, ".%06uZ", (unsigned)(timestamp_us % 1000000));
+}
+
+static void print_json_string(const char *text, size_t length)
+{
+    putchar('"');
+    for (size_t i = 0; i < length; i++)
+    {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '"' || c == '\\')
+        {
+            printf("\\%c", c);
+        }
+        else if (c < 0x20 || c == 0x7f)
+        {
+            printf("\\u%04x", c);
+        }
+        else
+        {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+static void print_text(const ACCESS_RECORD *record, const char *path, const char *time, const char *client)
+{
+    printf("%s %s:%u \"%s %.*s\" %u %llu %u",
+           time, client, record->client_port, method_name(record->method),
+           (int)record->path_length, path, record->status,
+           (unsigned long long)record->response_bytes, record->request_bytes);
+
+    for (int i = 0; i < ACCESS_STAGE_COUNT; i++)
+    {
+        printf(" %s=%uns", stage_names[i], record->stage_ns[i]);
+    }
+
+    if (record->flags & ACCESS_FLAG_KEEP_ALIVE)
+    {
+        printf(" keep-alive");
+    }
+    if (record->flags & ACCESS_FLAG_COMPRESSED)
+    {
+        printf(" compressed");
+    }
+    if (record->flags & ACCESS_FLAG_STREAMED)
+    {
+        printf(" streamed");
+    }
+    putchar('\n');
+}
+
+static void print_json(const ACCESS_RECORD *record, const char *path, const char *time, const char *client)
+{
+    printf("{\"time\":\"%s\",\"client\":\"%s\",\"port\":%u,\"method\":\"%s\",\"path\":",
+           time, client, record->client_port, method_name(record->method));
+    print_json_string(path, record->path_length);
+    printf(",\"status\":%u,\"request_bytes\":%u,\"response_bytes\":%llu",
+           record->status, record->request_bytes, (unsigned long long)record->response_bytes);
+
+    for (int i = 0; i < ACCESS_STAGE_COUNT; i++)
+    {
+        printf(",\"%s_ns\":%u", stage_names[i], record->stage_ns[i]);
+    }
+
+    printf(",\"keep_alive\":%s,\"compressed\":%s,\"streamed\":%s}\n",
+           (record->flags & ACCESS_FLAG_KEEP_ALIVE) ? "true" : "false",
+           (record->flags & ACCESS_FLAG_COMPRESSED) ? "true" : "false",
+           (record->flags & ACCESS_FLAG_STREAMED) ? "true" : "false");
+}
+
+static bool read_exactly(FILE *input, void *data, size_t length)
+{
+    return fread(data, 1, length, input) == length;
+}
+
+// Works on pipes too, unlike fseek
+static bool skip_bytes(FILE *input, size_t length)
+{
+    char scratch[256];
+    while (length > 0)
+    {
+        size_t chunk = (length < sizeof(scratch)) ? length : sizeof(scratch);
+        if (!read_exactly(input, scratch, chunk))
+        {
+            return false;
+        }
+        length -= chunk;
+    }
+    return true;
+}
+
+// Decode one log file. Returns 0, or -1 if it is not an access log or ends
+// inside a record
+static int decode(FILE *input, const char *name, bool json)
+{
+    ACCESS_LOG_HEADER header;
+    if (!read_exactly(input, &header, sizeof(header)) ||
+        memcmp(header.magic, ACCESS_LOG_MAGIC, sizeof(header.magic)) != 0)
+    {
+        fprintf(stderr, "%s: not an access log\n", name);
+        return -1;
+    }
+    if (header.version != ACCESS_LOG_VERSION || header.record_size < offsetof(ACCESS_RECORD, stage_ns))
+    {
+        fprintf(stderr, "%s: unsupported access log version %u\n", name, header.version);
+        return -1;
+    }
+
+    // Fields the writer did not have stay zero, ones it added are skipped
+    size_t known = (header.record_size < sizeof(ACCESS_RECORD)) ? header.record_size : sizeof(ACCESS_RECORD);
+    size_t extra = header.record_size - known;
+
+    for (;;)
+    {
+        ACCESS_RECORD record;
+        char path[UINT16_MAX];
+        memset(&record, 0, sizeof(record));
+
+        int c = fgetc(input);
+        if (c == EOF)
+        {
+            return 0;
+        }
+        ungetc(c, input);
+
+        if (!read_exactly(input, &record, known) || !skip_bytes(input, extra) ||
+            !read_exactly(input, path, record.path_length))
+        {
+            fprintf(stderr, "%s: truncated record\n", name);
+            return -1;
+        }
+
+        char time[48];
+        char client[INET_ADDRSTRLEN];
+        format_time(time, sizeof(time), record.timestamp_us);
+        inet_ntop(AF_INET, &record.client_addr, client, sizeof(client));
+
+        if (json)
+        {
+            print_json(&record, path, time, client);
+        }
+        else
+        {
+            print_text(&record, path, time, client);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bool json = false;
+    int first = 1;
+    if (argc > 1 && strcmp(argv[1], "--json") == 0)
+    {
+        json = true;
+        first = 2;
+    }
+
+    if (first >= argc)
+    {
+        return decode(stdin, "stdin", json) == 0 ? 0 : 1;
+    }
+
+    int status = 0;
+    for (int i = first; i < argc; i++)
+    {
+        FILE *input = fopen(argv[i], "rb");
+        if (!input)
+        {
+            perror(argv[i]);
+            status = 1;
+            continue;
+        }
+        if (decode(input, argv[i], json) < 0)
+        {
+            status = 1;
+        }
+        fclose(input);
+    }
+    return status;
+}